@@ -65,6 +65,9 @@ class ANALYSIS_EXPORT DualEdgeTriangulation: public Triangulation
     virtual bool getTriangle( double x, double y, Point3D* p1, Point3D* p2, Point3D* p3 ) override;
     /**Returns a pointer to a value list with the information of the triangles surrounding (counterclockwise) a point. Four integer values describe a triangle, the first three are the number of the half edges of the triangle and the fourth is -10, if the third (and most counterclockwise) edge is a breakline, and -20 otherwise. The value list has to be deleted by the code which called the method*/
     QList<int>* getSurroundingTriangles( int pointno ) override;
+    /**Appends the point numbers of all the triangles inside the convex hull to 'triangles' (three numbers per triangle)*/
+    //! @note not available in python bindings
+    void getTriangles( QVector<int>& triangles ) const;
     /**Returns the largest x-coordinate value of the bounding box*/
     virtual double getXMax() const override { return xMax; }
     /**Returns the smallest x-coordinate value of the bounding box*/
@@ -122,8 +125,8 @@ class ANALYSIS_EXPORT DualEdgeTriangulation: public Triangulation
     QVector<Point3D*> mPointVector;
     /**Default value for the number of storable HalfEdges at the beginning*/
     const static unsigned int mDefaultStorageForHalfEdges = 300006;
-    /**Stores pointers to the HalfEdges*/
-    QVector<HalfEdge*> mHalfEdge;
+    /**Stores the HalfEdges by value, the dual, next and point members refer to indices in this vector*/
+    QVector<HalfEdge> mHalfEdge;
     /**Association to an interpolator object*/
     TriangleInterpolator* mTriangleInterpolator;
     /**Member to store the behaviour in case of crossing forced segments*/
@@ -235,14 +238,14 @@ inline Point3D* DualEdgeTriangulation::getPoint( unsigned int i ) const
 inline bool DualEdgeTriangulation::halfEdgeBBoxTest( int edge, double xlowleft, double ylowleft, double xupright, double yupright ) const
 {
   return (
-           ( getPoint( mHalfEdge[edge]->getPoint() )->getX() >= xlowleft &&
-             getPoint( mHalfEdge[edge]->getPoint() )->getX() <= xupright &&
-             getPoint( mHalfEdge[edge]->getPoint() )->getY() >= ylowleft &&
-             getPoint( mHalfEdge[edge]->getPoint() )->getY() <= yupright ) ||
-           ( getPoint( mHalfEdge[mHalfEdge[edge]->getDual()]->getPoint() )->getX() >= xlowleft &&
-             getPoint( mHalfEdge[mHalfEdge[edge]->getDual()]->getPoint() )->getX() <= xupright &&
-             getPoint( mHalfEdge[mHalfEdge[edge]->getDual()]->getPoint() )->getY() >= ylowleft &&
-             getPoint( mHalfEdge[mHalfEdge[edge]->getDual()]->getPoint() )->getY() <= yupright )
+           ( getPoint( mHalfEdge[edge].getPoint() )->getX() >= xlowleft &&
+             getPoint( mHalfEdge[edge].getPoint() )->getX() <= xupright &&
+             getPoint( mHalfEdge[edge].getPoint() )->getY() >= ylowleft &&
+             getPoint( mHalfEdge[edge].getPoint() )->getY() <= yupright ) ||
+           ( getPoint( mHalfEdge[mHalfEdge[edge].getDual()].getPoint() )->getX() >= xlowleft &&
+             getPoint( mHalfEdge[mHalfEdge[edge].getDual()].getPoint() )->getX() <= xupright &&
+             getPoint( mHalfEdge[mHalfEdge[edge].getDual()].getPoint() )->getY() >= ylowleft &&
+             getPoint( mHalfEdge[mHalfEdge[edge].getDual()].getPoint() )->getY() <= yupright )
          );
 }
 
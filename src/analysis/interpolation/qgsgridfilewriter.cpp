@@ -22,6 +22,15 @@
 #include <QFileInfo>
 #include <QProgressDialog>
 
+#include <gdal.h>
+#include <cpl_string.h>
+
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1800
+#define TO8F(x) (x).toUtf8().constData()
+#else
+#define TO8F(x) QFile::encodeName( x ).constData()
+#endif
+
 QgsGridFileWriter::QgsGridFileWriter( QgsInterpolator* i, QString outputPath, QgsRectangle extent, int nCols, int nRows, double cellSizeX, double cellSizeY )
     : mInterpolator( i )
     , mOutputFilePath( outputPath )
@@ -51,26 +60,53 @@ QgsGridFileWriter::~QgsGridFileWriter()
 
 int QgsGridFileWriter::writeFile( bool showProgressDialog )
 {
-  QFile outputFile( mOutputFilePath );
+  if ( !mInterpolator )
+  {
+    return 2;
+  }
+
+  GDALAllRegister();
 
-  if ( !outputFile.open( QFile::WriteOnly ) )
+  QString format = mOutputFormat;
+  if ( format.isEmpty() )
+  {
+    format = QFileInfo( mOutputFilePath ).suffix().compare( "asc", Qt::CaseInsensitive ) == 0 ? "AAIGrid" : "GTiff";
+  }
+  GDALDriverH outputDriver = GDALGetDriverByName( format.toLocal8Bit().data() );
+  if ( !outputDriver )
   {
     return 1;
   }
 
-  if ( !mInterpolator )
+  //drivers which can only copy datasets (e.g. the ascii grid) get a copy of an in-memory dataset
+  bool canCreate = CSLFetchBoolean( GDALGetMetadata( outputDriver, NULL ), GDAL_DCAP_CREATE, false );
+  GDALDriverH createDriver = canCreate ? outputDriver : GDALGetDriverByName( "MEM" );
+  if ( !createDriver )
   {
-    outputFile.remove();
-    return 2;
+    return 1;
   }
 
-  QTextStream outStream( &outputFile );
-  outStream.setRealNumberPrecision( 8 );
-  writeHeader( outStream );
+  char **papszOptions = NULL;
+  if ( format == "GTiff" )
+  {
+    papszOptions = CSLSetNameValue( papszOptions, "COMPRESS", "LZW" );
+  }
+  GDALDatasetH outputDataset = GDALCreate( createDriver, canCreate ? TO8F( mOutputFilePath ) : "", mNumColumns, mNumRows, 1, GDT_Float64, papszOptions );
+  CSLDestroy( papszOptions );
+  if ( !outputDataset )
+  {
+    return 1;
+  }
 
-  double currentYValue = mInterpolationExtent.yMaximum() - mCellSizeY / 2.0; //calculate value in the center of the cell
-  double currentXValue;
-  double interpolatedValue;
+  double geotransform[6] = { mInterpolationExtent.xMinimum(), mCellSizeX, 0, mInterpolationExtent.yMaximum(), 0, -mCellSizeY };
+  GDALSetGeoTransform( outputDataset, geotransform );
+  QgsVectorLayer* vl = mInterpolator->layerData().isEmpty() ? 0 : mInterpolator->layerData().first().vectorLayer;
+  if ( vl )
+  {
+    GDALSetProjection( outputDataset, vl->crs().toWkt().toLocal8Bit().data() );
+  }
+  GDALRasterBandH outputBand = GDALGetRasterBand( outputDataset, 1 );
+  GDALSetRasterNoDataValue( outputBand, -9999 );
 
   QProgressDialog* progressDialog = 0;
   if ( showProgressDialog )
@@ -79,72 +115,76 @@ int QgsGridFileWriter::writeFile( bool showProgressDialog )
     progressDialog->setWindowModality( Qt::WindowModal );
   }
 
-  for ( int i = 0; i < mNumRows; ++i )
+  //interpolate blocks of rows, the rows of a block in parallel if the interpolator allows concurrent calls
+  bool concurrent = mInterpolator->prepareConcurrentInterpolation();
+  int blockRows = qBound( 1, ( 1 << 18 ) / qMax( mNumColumns, 1 ), qMax( mNumRows, 1 ) );
+  QVector<double> block( blockRows * mNumColumns );
+  bool canceled = false;
+  bool writeError = false;
+
+  for ( int blockStart = 0; blockStart < mNumRows; blockStart += blockRows )
   {
-    currentXValue = mInterpolationExtent.xMinimum() + mCellSizeX / 2.0; //calculate value in the center of the cell
-    for ( int j = 0; j < mNumColumns; ++j )
+    int nRows = qMin( blockRows, mNumRows - blockStart );
+    double* blockData = block.data();
+
+    //interpolators which can fill whole rows (e.g. the linear TIN, triangle by triangle) do so, the others are asked for each cell
+    if ( !mInterpolator->interpolateGridRows( mInterpolationExtent.xMinimum(), mInterpolationExtent.yMaximum() - blockStart * mCellSizeY,
+         mCellSizeX, mCellSizeY, mNumColumns, nRows, blockData, -9999 ) )
     {
-      if ( mInterpolator->interpolatePoint( currentXValue, currentYValue, interpolatedValue ) == 0 )
-      {
-        outStream << interpolatedValue << " ";
-      }
-      else
+#pragma omp parallel for schedule(dynamic) if ( concurrent )
+      for ( int i = 0; i < nRows; ++i )
       {
-        outStream << "-9999 ";
+        double currentYValue = mInterpolationExtent.yMaximum() - ( blockStart + i + 0.5 ) * mCellSizeY; //calculate value in the center of the cell
+        double* line = blockData + i * mNumColumns;
+        for ( int j = 0; j < mNumColumns; ++j )
+        {
+          double currentXValue = mInterpolationExtent.xMinimum() + ( j + 0.5 ) * mCellSizeX;
+          double interpolatedValue;
+          line[j] = mInterpolator->interpolatePoint( currentXValue, currentYValue, interpolatedValue ) == 0 ? interpolatedValue : -9999;
+        }
       }
-      currentXValue += mCellSizeX;
     }
-    outStream << endl;
-    currentYValue -= mCellSizeY;
+
+    CPLErr err = GDALRasterIO( outputBand, GF_Write, 0, blockStart, mNumColumns, nRows, blockData, mNumColumns, nRows, GDT_Float64, 0, 0 );
+    if ( err != CE_None )
+    {
+      writeError = true;
+      break;
+    }
 
     if ( showProgressDialog )
     {
       if ( progressDialog->wasCanceled() )
       {
-        outputFile.remove();
-        return 3;
+        canceled = true;
+        break;
       }
-      progressDialog->setValue( i );
+      progressDialog->setValue( blockStart + nRows );
     }
   }
-
-  // create prj file
-  QgsInterpolator::LayerData ld;
-  ld = mInterpolator->layerData().first();
-  QgsVectorLayer* vl = ld.vectorLayer;
-  QString crs = vl->crs().toWkt();
-  QFileInfo fi( mOutputFilePath );
-  QString fileName = fi.absolutePath() + "/" + fi.completeBaseName() + ".prj";
-  QFile prjFile( fileName );
-  if ( !prjFile.open( QFile::WriteOnly ) )
-  {
-    return 1;
-  }
-  QTextStream prjStream( &prjFile );
-  prjStream << crs;
-  prjStream << endl;
-  prjFile.close();
-
   delete progressDialog;
-  return 0;
-}
 
-int QgsGridFileWriter::writeHeader( QTextStream& outStream )
-{
-  outStream << "NCOLS " << mNumColumns << endl;
-  outStream << "NROWS " << mNumRows << endl;
-  outStream << "XLLCORNER " << mInterpolationExtent.xMinimum() << endl;
-  outStream << "YLLCORNER " <<  mInterpolationExtent.yMinimum() << endl;
-  if ( mCellSizeX == mCellSizeY ) //standard way
+  if ( canceled || writeError )
   {
-    outStream << "CELLSIZE " << mCellSizeX << endl;
+    GDALClose( outputDataset );
+    if ( canCreate )
+    {
+      GDALDeleteDataset( outputDriver, TO8F( mOutputFilePath ) );
+    }
+    return canceled ? 3 : 1;
   }
-  else //this is supported by GDAL but probably not by other products
+
+  if ( !canCreate )
   {
-    outStream << "DX " << mCellSizeX << endl;
-    outStream << "DY " << mCellSizeY << endl;
+    GDALDatasetH copyDataset = GDALCreateCopy( outputDriver, TO8F( mOutputFilePath ), outputDataset, FALSE, NULL, NULL, NULL );
+    GDALClose( outputDataset );
+    if ( !copyDataset )
+    {
+      return 1;
+    }
+    outputDataset = copyDataset;
   }
-  outStream << "NODATA_VALUE -9999" << endl;
+  GDALClose( outputDataset );
 
   return 0;
 }
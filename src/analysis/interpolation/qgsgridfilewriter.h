@@ -20,12 +20,11 @@
 
 #include "qgsrectangle.h"
 #include <QString>
-#include <QTextStream>
 
 class QgsInterpolator;
 
-/**A class that does interpolation to a grid and writes the results to an ascii grid*/
-//todo: extend such that writing to other file types is possible
+/**A class that does interpolation to a grid and writes the results to a raster file through GDAL.
+   The rows are interpolated in parallel if the interpolator supports it*/
 class ANALYSIS_EXPORT QgsGridFileWriter
 {
   public:
@@ -34,17 +33,22 @@ class ANALYSIS_EXPORT QgsGridFileWriter
 
     /**Writes the grid file.
      @param showProgressDialog shows a dialog with the possibility to cancel
-    @return 0 in case of success*/
+    @return 0 in case of success, 1 if the file could not be created or written, 2 without interpolator, 3 if canceled*/
 
     int writeFile( bool showProgressDialog = false );
 
+    /**GDAL driver used for the output. If empty (the default), files with the .asc suffix
+       are written as ascii grid and all the others as GeoTIFF*/
+    const QString& outputFormat() const { return mOutputFormat; }
+    void setOutputFormat( const QString& format ) { mOutputFormat = format; }
+
   private:
 
     QgsGridFileWriter(); //forbidden
-    int writeHeader( QTextStream& outStream );
 
     QgsInterpolator* mInterpolator;
     QString mOutputFilePath;
+    QString mOutputFormat;
     QgsRectangle mInterpolationExtent;
     int mNumColumns;
     int mNumRows;
@@ -16,15 +16,52 @@
  ***************************************************************************/
 
 #include "qgsidwinterpolator.h"
+#include <QVarLengthArray>
+#include <algorithm>
 #include <cmath>
 #include <limits>
 
-QgsIDWInterpolator::QgsIDWInterpolator( const QList<LayerData>& layerData ): QgsInterpolator( layerData ), mDistanceCoefficient( 2.0 )
+namespace
+{
+  struct Neighbour
+  {
+    double squaredDistance;
+    int index;
+  };
+
+  // Order by distance, equally distant points by their position in the base data
+  bool operator<( const Neighbour& a, const Neighbour& b )
+  {
+    return a.squaredDistance < b.squaredDistance || ( a.squaredDistance == b.squaredDistance && a.index < b.index );
+  }
+}
+
+QgsIDWInterpolator::QgsIDWInterpolator( const QList<LayerData>& layerData )
+    : QgsInterpolator( layerData )
+    , mDistanceCoefficient( 2.0 )
+    , mMaxNeighbours( 0 )
+    , mSearchRadius( 0 )
+    , mIndexBuilt( false )
+    , mGridXMin( 0 )
+    , mGridYMin( 0 )
+    , mBucketSize( 1 )
+    , mGridCols( 0 )
+    , mGridRows( 0 )
 {
 
 }
 
-QgsIDWInterpolator::QgsIDWInterpolator(): QgsInterpolator( QList<LayerData>() ), mDistanceCoefficient( 2.0 )
+QgsIDWInterpolator::QgsIDWInterpolator()
+    : QgsInterpolator( QList<LayerData>() )
+    , mDistanceCoefficient( 2.0 )
+    , mMaxNeighbours( 0 )
+    , mSearchRadius( 0 )
+    , mIndexBuilt( false )
+    , mGridXMin( 0 )
+    , mGridYMin( 0 )
+    , mBucketSize( 1 )
+    , mGridCols( 0 )
+    , mGridRows( 0 )
 {
 
 }
@@ -41,23 +78,55 @@ int QgsIDWInterpolator::interpolatePoint( double x, double y, double& result )
     cacheBaseData();
   }
 
-  double currentWeight;
-  double distance;
+  if ( mMaxNeighbours <= 0 && mSearchRadius <= 0 )
+  {
+    return interpolateAllPoints( x, y, result );
+  }
 
+  if ( !mIndexBuilt )
+  {
+    buildIndex();
+  }
+  return interpolateNeighbours( x, y, result );
+}
+
+bool QgsIDWInterpolator::prepareConcurrentInterpolation()
+{
+  if ( !mDataIsCached )
+  {
+    cacheBaseData();
+  }
+  if ( !mIndexBuilt )
+  {
+    buildIndex();
+  }
+  return true;
+}
+
+double QgsIDWInterpolator::weight( double squaredDistance ) const
+{
+  if ( mDistanceCoefficient == 2.0 )
+  {
+    return 1.0 / squaredDistance;
+  }
+  return 1.0 / pow( squaredDistance, 0.5 * mDistanceCoefficient );
+}
+
+int QgsIDWInterpolator::interpolateAllPoints( double x, double y, double& result ) const
+{
   double sumCounter = 0;
   double sumDenominator = 0;
 
-  QVector<vertexData>::iterator vertex_it = mCachedBaseData.begin();
-
-  for ( ; vertex_it != mCachedBaseData.end(); ++vertex_it )
+  QVector<vertexData>::const_iterator vertex_it = mCachedBaseData.constBegin();
+  for ( ; vertex_it != mCachedBaseData.constEnd(); ++vertex_it )
   {
-    distance = sqrt(( vertex_it->x - x ) * ( vertex_it->x - x ) + ( vertex_it->y - y ) * ( vertex_it->y - y ) );
-    if (( distance - 0 ) < std::numeric_limits<double>::min() )
+    double squaredDistance = ( vertex_it->x - x ) * ( vertex_it->x - x ) + ( vertex_it->y - y ) * ( vertex_it->y - y );
+    if ( squaredDistance == 0 )
     {
       result = vertex_it->z;
       return 0;
     }
-    currentWeight = 1 / ( pow( distance, mDistanceCoefficient ) );
+    double currentWeight = weight( squaredDistance );
     sumCounter += ( currentWeight * vertex_it->z );
     sumDenominator += currentWeight;
   }
@@ -70,3 +139,217 @@ int QgsIDWInterpolator::interpolatePoint( double x, double y, double& result )
   result = sumCounter / sumDenominator;
   return 0;
 }
+
+int QgsIDWInterpolator::interpolateNeighbours( double x, double y, double& result ) const
+{
+  if ( mGridCols == 0 || mGridRows == 0 )
+  {
+    return 1;
+  }
+
+  const double maxSquaredDistance = mSearchRadius > 0 ? mSearchRadius * mSearchRadius : std::numeric_limits<double>::infinity();
+  const bool limitCount = mMaxNeighbours > 0;
+
+  //bucket of the position, may be outside of the grid
+  const double cellLimit = 1 << 30;
+  int col = ( int ) qBound( -cellLimit, std::floor(( x - mGridXMin ) / mBucketSize ), cellLimit );
+  int row = ( int ) qBound( -cellLimit, std::floor(( y - mGridYMin ) / mBucketSize ), cellLimit );
+
+  //the buckets at chebyshev distance r from the position bucket form ring r
+  int firstRing = qMax( qMax( 0, qMax( -col, col - ( mGridCols - 1 ) ) ), qMax( -row, row - ( mGridRows - 1 ) ) );
+  int lastRing = qMax( qMax( col, mGridCols - 1 - col ), qMax( row, mGridRows - 1 - row ) );
+
+  //nearest points found so far (max heap, only used if the number of points is limited)
+  QVarLengthArray<Neighbour, 64> nearest;
+  //sums over the points in the radius (only used if the number of points is not limited)
+  double sumCounter = 0;
+  double sumDenominator = 0;
+  int exactIndex = -1;
+
+  for ( int ring = firstRing; ring <= lastRing; ++ring )
+  {
+    //all the points in this ring and beyond are further away than minDistance
+    double minDistance = ( ring - 1 ) * mBucketSize;
+    if ( minDistance > 0 )
+    {
+      double minSquaredDistance = minDistance * minDistance;
+      if ( minSquaredDistance > maxSquaredDistance )
+      {
+        break;
+      }
+      if ( limitCount && nearest.size() == mMaxNeighbours && nearest[0].squaredDistance <= minSquaredDistance )
+      {
+        break;
+      }
+    }
+
+    int rowStart = qMax( row - ring, 0 );
+    int rowEnd = qMin( row + ring, mGridRows - 1 );
+    for ( int r = rowStart; r <= rowEnd; ++r )
+    {
+      //the first and last row of the ring are complete, the other rows only have their first and last bucket
+      int cols[2];
+      int nCols = 0;
+      int colStart, colEnd;
+      if ( r == row - ring || r == row + ring )
+      {
+        colStart = qMax( col - ring, 0 );
+        colEnd = qMin( col + ring, mGridCols - 1 );
+      }
+      else
+      {
+        if ( col - ring >= 0 && col - ring < mGridCols )
+        {
+          cols[nCols++] = col - ring;
+        }
+        if ( col + ring >= 0 && col + ring < mGridCols )
+        {
+          cols[nCols++] = col + ring;
+        }
+        colStart = 0;
+        colEnd = nCols - 1;
+      }
+
+      for ( int c = colStart; c <= colEnd; ++c )
+      {
+        int bucket = r * mGridCols + ( nCols > 0 ? cols[c] : c );
+        for ( int i = mBucketStart[bucket], end = mBucketStart[bucket + 1]; i < end; ++i )
+        {
+          const vertexData& v = mCachedBaseData[mBucketPoints[i]];
+          Neighbour n;
+          n.squaredDistance = ( v.x - x ) * ( v.x - x ) + ( v.y - y ) * ( v.y - y );
+          n.index = mBucketPoints[i];
+          if ( n.squaredDistance > maxSquaredDistance )
+          {
+            continue;
+          }
+          if ( !limitCount )
+          {
+            if ( n.squaredDistance == 0 )
+            {
+              exactIndex = exactIndex < 0 ? n.index : qMin( exactIndex, n.index );
+            }
+            else
+            {
+              double currentWeight = weight( n.squaredDistance );
+              sumCounter += currentWeight * v.z;
+              sumDenominator += currentWeight;
+            }
+          }
+          else if ( nearest.size() < mMaxNeighbours )
+          {
+            nearest.append( n );
+            std::push_heap( nearest.begin(), nearest.end() );
+          }
+          else if ( n < nearest[0] )
+          {
+            std::pop_heap( nearest.begin(), nearest.end() );
+            nearest[nearest.size() - 1] = n;
+            std::push_heap( nearest.begin(), nearest.end() );
+          }
+        }
+      }
+    }
+  }
+
+  if ( limitCount )
+  {
+    for ( int i = 0; i < nearest.size(); ++i )
+    {
+      const Neighbour& n = nearest[i];
+      if ( n.squaredDistance == 0 )
+      {
+        exactIndex = exactIndex < 0 ? n.index : qMin( exactIndex, n.index );
+      }
+      else
+      {
+        double currentWeight = weight( n.squaredDistance );
+        sumCounter += currentWeight * mCachedBaseData[n.index].z;
+        sumDenominator += currentWeight;
+      }
+    }
+  }
+
+  if ( exactIndex >= 0 )
+  {
+    result = mCachedBaseData[exactIndex].z;
+    return 0;
+  }
+
+  if ( sumDenominator == 0.0 )
+  {
+    return 1;
+  }
+
+  result = sumCounter / sumDenominator;
+  return 0;
+}
+
+void QgsIDWInterpolator::buildIndex()
+{
+  mIndexBuilt = true;
+  mBucketStart.clear();
+  mBucketPoints.clear();
+  mGridCols = 0;
+  mGridRows = 0;
+
+  int nPoints = mCachedBaseData.size();
+  if ( nPoints == 0 )
+  {
+    return;
+  }
+
+  double xMin = mCachedBaseData[0].x, xMax = xMin;
+  double yMin = mCachedBaseData[0].y, yMax = yMin;
+  for ( int i = 1; i < nPoints; ++i )
+  {
+    xMin = qMin( xMin, mCachedBaseData[i].x );
+    xMax = qMax( xMax, mCachedBaseData[i].x );
+    yMin = qMin( yMin, mCachedBaseData[i].y );
+    yMax = qMax( yMax, mCachedBaseData[i].y );
+  }
+
+  //square buckets holding two points on average
+  int nBuckets = qMax( 1, nPoints / 2 );
+  double width = xMax - xMin;
+  double height = yMax - yMin;
+  if ( width > 0 && height > 0 )
+  {
+    mBucketSize = std::sqrt( width * height / nBuckets );
+  }
+  else
+  {
+    mBucketSize = qMax( width, height ) / nBuckets;
+  }
+  //no more buckets in a row or column than points, also for very elongated data
+  mBucketSize = qMax( mBucketSize, qMax( width, height ) / nPoints );
+  if ( !( mBucketSize > 0 ) )
+  {
+    mBucketSize = 1;
+  }
+  mGridXMin = xMin;
+  mGridYMin = yMin;
+  mGridCols = ( int )( width / mBucketSize ) + 1;
+  mGridRows = ( int )( height / mBucketSize ) + 1;
+
+  //counting sort of the point indices by bucket, the indices stay in ascending order within a bucket
+  QVector<int> pointBucket( nPoints );
+  mBucketStart.fill( 0, mGridCols * mGridRows + 1 );
+  for ( int i = 0; i < nPoints; ++i )
+  {
+    int c = qBound( 0, ( int )(( mCachedBaseData[i].x - mGridXMin ) / mBucketSize ), mGridCols - 1 );
+    int r = qBound( 0, ( int )(( mCachedBaseData[i].y - mGridYMin ) / mBucketSize ), mGridRows - 1 );
+    pointBucket[i] = r * mGridCols + c;
+    ++mBucketStart[pointBucket[i] + 1];
+  }
+  for ( int b = 0; b < mGridCols * mGridRows; ++b )
+  {
+    mBucketStart[b + 1] += mBucketStart[b];
+  }
+  mBucketPoints.resize( nPoints );
+  QVector<int> fill = mBucketStart;
+  for ( int i = 0; i < nPoints; ++i )
+  {
+    mBucketPoints[fill[pointBucket[i]]++] = i;
+  }
+}
@@ -20,6 +20,9 @@
 
 #include "qgsinterpolator.h"
 
+/**Inverse distance weighting interpolator. The base data is kept in a bucket grid, such that
+   the interpolation can be restricted to the nearest points and / or the points within a search radius
+   without looking at all the points for every interpolated position*/
 class ANALYSIS_EXPORT QgsIDWInterpolator: public QgsInterpolator
 {
   public:
@@ -33,8 +36,19 @@ class ANALYSIS_EXPORT QgsIDWInterpolator: public QgsInterpolator
        @return 0 in case of success*/
     int interpolatePoint( double x, double y, double& result ) override;
 
+    bool prepareConcurrentInterpolation() override;
+
     void setDistanceCoefficient( double p ) {mDistanceCoefficient = p;}
 
+    /**Maximum number of (nearest) points used for the interpolation of a position. 0 uses all the points*/
+    int maxNeighbours() const { return mMaxNeighbours; }
+    void setMaxNeighbours( int n ) { mMaxNeighbours = n; }
+
+    /**Only the points within this distance (in map units) are used for the interpolation of a position.
+       Positions without points in the radius have no value. 0 means no limit*/
+    double searchRadius() const { return mSearchRadius; }
+    void setSearchRadius( double radius ) { mSearchRadius = radius; }
+
   private:
 
     QgsIDWInterpolator(); //forbidden
@@ -43,6 +57,25 @@ class ANALYSIS_EXPORT QgsIDWInterpolator: public QgsInterpolator
        Smaller values mean sharper peaks at the data points. The default is a
        value of 2*/
     double mDistanceCoefficient;
+    int mMaxNeighbours;
+    double mSearchRadius;
+
+    /**Bucket grid over mCachedBaseData. The indices of the points in bucket i are
+       mBucketPoints[mBucketStart[i]] to mBucketPoints[mBucketStart[i+1] - 1]*/
+    bool mIndexBuilt;
+    double mGridXMin;
+    double mGridYMin;
+    double mBucketSize;
+    int mGridCols;
+    int mGridRows;
+    QVector<int> mBucketStart;
+    QVector<int> mBucketPoints;
+
+    void buildIndex();
+    /**Inverse distance weight for a squared distance*/
+    double weight( double squaredDistance ) const;
+    int interpolateAllPoints( double x, double y, double& result ) const;
+    int interpolateNeighbours( double x, double y, double& result ) const;
 };
 
 #endif
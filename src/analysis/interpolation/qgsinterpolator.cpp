@@ -101,6 +101,7 @@ int QgsInterpolator::cacheBaseData()
     }
   }
 
+  mDataIsCached = true;
   return 0;
 }
 
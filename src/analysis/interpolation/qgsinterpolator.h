@@ -64,6 +64,25 @@ class ANALYSIS_EXPORT QgsInterpolator
        @return 0 in case of success*/
     virtual int interpolatePoint( double x, double y, double& result ) = 0;
 
+    /**Prepares the interpolator for calls of interpolatePoint from several threads at once
+       (e.g. caches the base data and builds the search structures).
+       @return true if interpolatePoint may be called concurrently afterwards. The default implementation returns false*/
+    virtual bool prepareConcurrentInterpolation() { return false; }
+
+    /**Interpolates the cell centers of consecutive rows of a grid at once.
+       @param xMin x-coordinate of the left border of the grid
+       @param yMax y-coordinate of the upper border of the first row
+       @param cellSizeX cell width
+       @param cellSizeY cell height
+       @param nCols number of columns
+       @param nRows number of rows
+       @param data receives nCols * nRows values, row by row
+       @param noDataValue value for the cells which cannot be interpolated
+       @return false if the interpolator does not support it. interpolatePoint has to be used for each cell then
+       @note not available in python bindings*/
+    virtual bool interpolateGridRows( double xMin, double yMax, double cellSizeX, double cellSizeY, int nCols, int nRows, double* data, double noDataValue )
+    { Q_UNUSED( xMin ); Q_UNUSED( yMax ); Q_UNUSED( cellSizeX ); Q_UNUSED( cellSizeY ); Q_UNUSED( nCols ); Q_UNUSED( nRows ); Q_UNUSED( data ); Q_UNUSED( noDataValue ); return false; }
+
     // @note not available in python bindings
     const QList<LayerData>& layerData() const { return mLayerData; }
 
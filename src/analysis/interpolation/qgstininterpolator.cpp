@@ -25,7 +25,10 @@
 #include "qgsfeature.h"
 #include "qgsgeometry.h"
 #include "qgsvectorlayer.h"
+#include "qgslogger.h"
 #include <QProgressDialog>
+#include <algorithm>
+#include <cmath>
 
 QgsTINInterpolator::QgsTINInterpolator( const QList<LayerData>& inputData, TIN_INTERPOLATION interpolation, bool showProgressDialog )
     : QgsInterpolator( inputData )
@@ -35,11 +38,14 @@ QgsTINInterpolator::QgsTINInterpolator( const QList<LayerData>& inputData, TIN_I
     , mShowProgressDialog( showProgressDialog )
     , mExportTriangulationToFile( false )
     , mInterpolation( interpolation )
+    , mGridTrianglesMaxHeight( 0 )
+    , mGridTrianglesBuilt( false )
 {
 }
 
 QgsTINInterpolator::~QgsTINInterpolator()
 {
+  qDeleteAll( mPointBuffer );
   delete mTriangulation;
   delete mTriangleInterpolator;
 }
@@ -102,12 +108,18 @@ void QgsTINInterpolator::initialize()
   }
 
 
+  //the point layers are inserted first, all their points at once. Then the structure and break lines
   QgsFeature f;
-  QList<LayerData>::iterator layerDataIt = mLayerData.begin();
-  for ( ; layerDataIt != mLayerData.end(); ++layerDataIt )
+  for ( int pass = 0; pass < 2; ++pass )
   {
-    if ( layerDataIt->vectorLayer )
+    QList<LayerData>::iterator layerDataIt = mLayerData.begin();
+    for ( ; layerDataIt != mLayerData.end(); ++layerDataIt )
     {
+      if ( !layerDataIt->vectorLayer || ( layerDataIt->mInputType == POINTS ) != ( pass == 0 ) )
+      {
+        continue;
+      }
+
       QgsAttributeList attList;
       if ( !layerDataIt->zCoordInterpolation )
       {
@@ -130,6 +142,10 @@ void QgsTINInterpolator::initialize()
         ++nProcessedFeatures;
       }
     }
+    if ( insertBufferedPoints() != 0 )
+    {
+      QgsDebugMsg( "Not all the points could be inserted into the triangulation" );
+    }
   }
 
   delete theProgressDialog;
@@ -222,11 +238,7 @@ int QgsTINInterpolator::insertData( QgsFeature* f, bool zCoord, int attr, InputT
       {
         z = attributeValue;
       }
-      Point3D* thePoint = new Point3D( x, y, z );
-      if ( mTriangulation->addPoint( thePoint ) == -100 )
-      {
-        return -1;
-      }
+      mPointBuffer.append( new Point3D( x, y, z ) );
       break;
     }
     case QGis::WKBMultiPoint25D:
@@ -248,6 +260,7 @@ int QgsTINInterpolator::insertData( QgsFeature* f, bool zCoord, int attr, InputT
         {
           z = attributeValue;
         }
+        mPointBuffer.append( new Point3D( x, y, z ) );
       }
       break;
     }
@@ -276,8 +289,7 @@ int QgsTINInterpolator::insertData( QgsFeature* f, bool zCoord, int attr, InputT
 
         if ( type == POINTS )
         {
-          //todo: handle error code -100
-          mTriangulation->addPoint( new Point3D( x, y, z ) );
+          mPointBuffer.append( new Point3D( x, y, z ) );
         }
         else
         {
@@ -320,8 +332,7 @@ int QgsTINInterpolator::insertData( QgsFeature* f, bool zCoord, int attr, InputT
 
           if ( type == POINTS )
           {
-            //todo: handle error code -100
-            mTriangulation->addPoint( new Point3D( x, y, z ) );
+            mPointBuffer.append( new Point3D( x, y, z ) );
           }
           else
           {
@@ -364,8 +375,7 @@ int QgsTINInterpolator::insertData( QgsFeature* f, bool zCoord, int attr, InputT
           }
           if ( type == POINTS )
           {
-            //todo: handle error code -100
-            mTriangulation->addPoint( new Point3D( x, y, z ) );
+            mPointBuffer.append( new Point3D( x, y, z ) );
           }
           else
           {
@@ -414,8 +424,7 @@ int QgsTINInterpolator::insertData( QgsFeature* f, bool zCoord, int attr, InputT
             }
             if ( type == POINTS )
             {
-              //todo: handle error code -100
-              mTriangulation->addPoint( new Point3D( x, y, z ) );
+              mPointBuffer.append( new Point3D( x, y, z ) );
             }
             else
             {
@@ -438,3 +447,220 @@ int QgsTINInterpolator::insertData( QgsFeature* f, bool zCoord, int attr, InputT
   return 0;
 }
 
+
+namespace
+{
+  // Position of the cell (x, y) of a 2^16 x 2^16 grid along the hilbert curve
+  quint32 hilbertIndex( quint32 x, quint32 y )
+  {
+    quint32 d = 0;
+    for ( quint32 s = 1 << 15; s > 0; s >>= 1 )
+    {
+      quint32 rx = ( x & s ) > 0;
+      quint32 ry = ( y & s ) > 0;
+      d += s * s * (( 3 * rx ) ^ ry );
+      if ( ry == 0 )
+      {
+        if ( rx == 1 )
+        {
+          x = s - 1 - x;
+          y = s - 1 - y;
+        }
+        qSwap( x, y );
+      }
+    }
+    return d;
+  }
+
+  struct SortedPoint
+  {
+    quint32 key;
+    Point3D* point;
+    bool operator<( const SortedPoint& other ) const { return key < other.key; }
+  };
+}
+
+int QgsTINInterpolator::insertBufferedPoints()
+{
+  int nPoints = mPointBuffer.size();
+  if ( nPoints == 0 )
+  {
+    return 0;
+  }
+
+  double xMin = mPointBuffer[0]->getX(), xMax = xMin;
+  double yMin = mPointBuffer[0]->getY(), yMax = yMin;
+  for ( int i = 1; i < nPoints; ++i )
+  {
+    xMin = qMin( xMin, mPointBuffer[i]->getX() );
+    xMax = qMax( xMax, mPointBuffer[i]->getX() );
+    yMin = qMin( yMin, mPointBuffer[i]->getY() );
+    yMax = qMax( yMax, mPointBuffer[i]->getY() );
+  }
+  double scaleX = xMax > xMin ? 65535. / ( xMax - xMin ) : 0;
+  double scaleY = yMax > yMin ? 65535. / ( yMax - yMin ) : 0;
+
+  QVector<SortedPoint> sorted( nPoints );
+  for ( int i = 0; i < nPoints; ++i )
+  {
+    sorted[i].key = hilbertIndex(( quint32 )(( mPointBuffer[i]->getX() - xMin ) * scaleX ), ( quint32 )(( mPointBuffer[i]->getY() - yMin ) * scaleY ) );
+    sorted[i].point = mPointBuffer[i];
+  }
+  mPointBuffer.clear();
+  std::stable_sort( sorted.begin(), sorted.end() );
+
+  //an empty triangulation needs three points which are not on a line to start with, otherwise the third point is dropped.
+  //Move a suitable second and third point to the front
+  if ( mTriangulation->getNumberOfPoints() == 0 )
+  {
+    Point3D* first = sorted[0].point;
+    int second = 1;
+    while ( second < nPoints && sorted[second].point->getX() == first->getX() && sorted[second].point->getY() == first->getY() )
+    {
+      ++second;
+    }
+    if ( second < nPoints )
+    {
+      qSwap( sorted[1], sorted[second] );
+      int third = 2;
+      while ( third < nPoints && qAbs( MathUtils::leftOf( sorted[third].point, first, sorted[1].point ) ) <= 0.00000001 )
+      {
+        ++third;
+      }
+      if ( third < nPoints )
+      {
+        qSwap( sorted[2], sorted[third] );
+      }
+    }
+  }
+
+  int result = 0;
+  for ( int i = 0; i < nPoints; ++i )
+  {
+    if ( mTriangulation->addPoint( sorted[i].point ) == -100 )
+    {
+      result = -1;
+    }
+  }
+  return result;
+}
+
+void QgsTINInterpolator::buildGridTriangles()
+{
+  mGridTrianglesBuilt = true;
+  DualEdgeTriangulation* tin = dynamic_cast<DualEdgeTriangulation*>( mTriangulation );
+  if ( !tin )
+  {
+    return;
+  }
+
+  QVector<int> triangles;
+  tin->getTriangles( triangles );
+  int nTriangles = triangles.size() / 3;
+
+  QVector< QPair<double, int> > order( nTriangles );
+  for ( int i = 0; i < nTriangles; ++i )
+  {
+    double minY = tin->getPoint( triangles[3 * i] )->getY();
+    double maxY = minY;
+    for ( int j = 1; j < 3; ++j )
+    {
+      double y = tin->getPoint( triangles[3 * i + j] )->getY();
+      minY = qMin( minY, y );
+      maxY = qMax( maxY, y );
+    }
+    mGridTrianglesMaxHeight = qMax( mGridTrianglesMaxHeight, maxY - minY );
+    order[i] = qMakePair( minY, i );
+  }
+  std::sort( order.begin(), order.end() );
+
+  mGridTriangles.resize( 3 * nTriangles );
+  mGridTrianglesMinY.resize( nTriangles );
+  for ( int i = 0; i < nTriangles; ++i )
+  {
+    for ( int j = 0; j < 3; ++j )
+    {
+      mGridTriangles[3 * i + j] = triangles[3 * order[i].second + j];
+    }
+    mGridTrianglesMinY[i] = order[i].first;
+  }
+}
+
+bool QgsTINInterpolator::interpolateGridRows( double xMin, double yMax, double cellSizeX, double cellSizeY, int nCols, int nRows, double* data, double noDataValue )
+{
+  if ( !mIsInitialized )
+  {
+    initialize();
+  }
+
+  if ( mInterpolation != Linear || !dynamic_cast<DualEdgeTriangulation*>( mTriangulation ) )
+  {
+    return false;
+  }
+  if ( !mGridTrianglesBuilt )
+  {
+    buildGridTriangles();
+  }
+
+  std::fill( data, data + nCols * nRows, noDataValue );
+
+  //only the triangles overlapping the cell centers of the rows have to be considered
+  double topY = yMax - 0.5 * cellSizeY;
+  double bottomY = yMax - ( nRows - 0.5 ) * cellSizeY;
+  int start = std::lower_bound( mGridTrianglesMinY.constBegin(), mGridTrianglesMinY.constEnd(), bottomY - mGridTrianglesMaxHeight ) - mGridTrianglesMinY.constBegin();
+  int end = std::upper_bound( mGridTrianglesMinY.constBegin(), mGridTrianglesMinY.constEnd(), topY ) - mGridTrianglesMinY.constBegin();
+
+  for ( int t = start; t < end; ++t )
+  {
+    Point3D* pt1 = mTriangulation->getPoint( mGridTriangles[3 * t] );
+    Point3D* pt2 = mTriangulation->getPoint( mGridTriangles[3 * t + 1] );
+    Point3D* pt3 = mTriangulation->getPoint( mGridTriangles[3 * t + 2] );
+    double x1 = pt1->getX(), y1 = pt1->getY();
+    double x2 = pt2->getX(), y2 = pt2->getY();
+    double x3 = pt3->getX(), y3 = pt3->getY();
+
+    double area = ( x2 - x1 ) * ( y3 - y1 ) - ( x3 - x1 ) * ( y2 - y1 );
+    if ( area == 0 )
+    {
+      continue;
+    }
+
+    //rows and columns whose cell centers are within the bounding box of the triangle
+    double txMin = qMin( x1, qMin( x2, x3 ) ), txMax = qMax( x1, qMax( x2, x3 ) );
+    double tyMin = qMin( y1, qMin( y2, y3 ) ), tyMax = qMax( y1, qMax( y2, y3 ) );
+    int rowStart = qMax( 0, ( int ) std::ceil( qBound( -1., ( yMax - tyMax ) / cellSizeY - 0.5, ( double ) nRows ) ) );
+    int rowEnd = qMin( nRows - 1, ( int ) std::floor( qBound( -1., ( yMax - tyMin ) / cellSizeY - 0.5, ( double ) nRows ) ) );
+    int colStart = qMax( 0, ( int ) std::ceil( qBound( -1., ( txMin - xMin ) / cellSizeX - 0.5, ( double ) nCols ) ) );
+    int colEnd = qMin( nCols - 1, ( int ) std::floor( qBound( -1., ( txMax - xMin ) / cellSizeX - 0.5, ( double ) nCols ) ) );
+    if ( rowStart > rowEnd || colStart > colEnd )
+    {
+      continue;
+    }
+
+    //plane through the triangle, as in LinTriangleInterpolator
+    double a = ( pt1->getZ() * ( y2 - y3 ) + pt2->getZ() * ( y3 - y1 ) + pt3->getZ() * ( y1 - y2 ) ) / (( x1 - x2 ) * ( y2 - y3 ) - ( x2 - x3 ) * ( y1 - y2 ) );
+    double b = ( pt1->getZ() * ( x2 - x3 ) + pt2->getZ() * ( x3 - x1 ) + pt3->getZ() * ( x1 - x2 ) ) / (( y1 - y2 ) * ( x2 - x3 ) - ( y2 - y3 ) * ( x1 - x2 ) );
+    double c = pt1->getZ() - a * x1 - b * y1;
+
+    //cell centers on the edges belong to both triangles, the tolerance avoids gaps because of rounding
+    double sign = area > 0 ? 1. : -1.;
+    double tolerance = -1E-9 * qAbs( area );
+    for ( int row = rowStart; row <= rowEnd; ++row )
+    {
+      double y = yMax - ( row + 0.5 ) * cellSizeY;
+      double* line = data + row * nCols;
+      for ( int col = colStart; col <= colEnd; ++col )
+      {
+        double x = xMin + ( col + 0.5 ) * cellSizeX;
+        double w1 = sign * (( x2 - x1 ) * ( y - y1 ) - ( y2 - y1 ) * ( x - x1 ) );
+        double w2 = sign * (( x3 - x2 ) * ( y - y2 ) - ( y3 - y2 ) * ( x - x2 ) );
+        double w3 = sign * (( x1 - x3 ) * ( y - y3 ) - ( y1 - y3 ) * ( x - x3 ) );
+        if ( w1 >= tolerance && w2 >= tolerance && w3 >= tolerance )
+        {
+          line[col] = a * x + b * y + c;
+        }
+      }
+    }
+  }
+  return true;
+}
@@ -21,6 +21,7 @@
 #include "qgsinterpolator.h"
 #include <QString>
 
+class Point3D;
 class Triangulation;
 class TriangleInterpolator;
 class QgsFeature;
@@ -45,6 +46,10 @@ class ANALYSIS_EXPORT QgsTINInterpolator: public QgsInterpolator
        @return 0 in case of success*/
     int interpolatePoint( double x, double y, double& result ) override;
 
+    /**Fills the grid rows triangle by triangle instead of locating the triangle of each cell. Only supported for linear interpolation
+       @note not available in python bindings*/
+    bool interpolateGridRows( double xMin, double yMax, double cellSizeX, double cellSizeY, int nCols, int nRows, double* data, double noDataValue ) override;
+
     void setExportTriangulationToFile( bool e ) {mExportTriangulationToFile = e;}
     void setTriangulationFilePath( const QString& filepath ) {mTriangulationFilePath = filepath;}
 
@@ -59,6 +64,13 @@ class ANALYSIS_EXPORT QgsTINInterpolator: public QgsInterpolator
     QString mTriangulationFilePath;
     /**Type of interpolation*/
     TIN_INTERPOLATION mInterpolation;
+    /**Points of the point layers, which are inserted at once in spatially sorted order*/
+    QVector<Point3D*> mPointBuffer;
+    /**Point numbers of the triangles (three per triangle) sorted by their minimum y-coordinate, for interpolateGridRows*/
+    QVector<int> mGridTriangles;
+    QVector<double> mGridTrianglesMinY;
+    double mGridTrianglesMaxHeight;
+    bool mGridTrianglesBuilt;
 
     /**Create dual edge triangulation*/
     void initialize();
@@ -67,8 +79,14 @@ class ANALYSIS_EXPORT QgsTINInterpolator: public QgsInterpolator
       @param zCoord true if the z coordinate is the interpolation attribute
       @param attr interpolation attribute index (if zCoord is false)
       @param type point/structure line, break line
-      @return 0 in case of success, -1 if the feature could not be inserted because of numerical problems*/
+      @return 0 in case of success. The points of point features are only buffered, see insertBufferedPoints*/
     int insertData( QgsFeature* f, bool zCoord, int attr, InputType type );
+    /**Inserts the points of mPointBuffer into the triangulation. They are sorted along a hilbert curve first,
+       such that each point is close to the previous one and the triangle containing it is found in a few steps
+      @return 0 in case of success, -1 if a point could not be inserted*/
+    int insertBufferedPoints();
+    /**Collects the triangles of the triangulation for interpolateGridRows*/
+    void buildGridTriangles();
 };
 
 #endif
@@ -16,6 +16,13 @@
 
 #include "qgsgraph.h"
 
+// QT includes
+#include <QDataStream>
+#include <QFile>
+
+static const quint32 sGraphFileMagic = 0x51475247; // "QGRG"
+static const qint32 sGraphFileVersion = 1;
+
 QgsGraph::QgsGraph()
 {
 }
@@ -82,6 +89,78 @@ int QgsGraph::findVertex( const QgsPoint& pt ) const
   return -1;
 }
 
+bool QgsGraph::writeToFile( const QString& fileName ) const
+{
+  QFile file( fileName );
+  if ( !file.open( QIODevice::WriteOnly ) )
+  {
+    return false;
+  }
+  QDataStream out( &file );
+  out.setVersion( QDataStream::Qt_4_8 );
+  out << sGraphFileMagic << sGraphFileVersion;
+
+  out << ( qint32 ) mGraphVertexes.size();
+  for ( int i = 0; i < mGraphVertexes.size(); ++i )
+  {
+    out << mGraphVertexes[ i ].mCoordinate.x() << mGraphVertexes[ i ].mCoordinate.y();
+  }
+  out << ( qint32 ) mGraphArc.size();
+  for ( int i = 0; i < mGraphArc.size(); ++i )
+  {
+    out << ( qint32 ) mGraphArc[ i ].mOut << ( qint32 ) mGraphArc[ i ].mIn << mGraphArc[ i ].mProperties;
+  }
+  return out.status() == QDataStream::Ok;
+}
+
+QgsGraph* QgsGraph::readFromFile( const QString& fileName )
+{
+  QFile file( fileName );
+  if ( !file.open( QIODevice::ReadOnly ) )
+  {
+    return NULL;
+  }
+  QDataStream in( &file );
+  in.setVersion( QDataStream::Qt_4_8 );
+  quint32 magic;
+  qint32 version;
+  in >> magic >> version;
+  if ( magic != sGraphFileMagic || version != sGraphFileVersion )
+  {
+    return NULL;
+  }
+
+  QgsGraph* graph = new QgsGraph();
+  qint32 vertexCount;
+  in >> vertexCount;
+  for ( qint32 i = 0; i < vertexCount && in.status() == QDataStream::Ok; ++i )
+  {
+    double x, y;
+    in >> x >> y;
+    graph->addVertex( QgsPoint( x, y ) );
+  }
+  qint32 arcCount;
+  in >> arcCount;
+  for ( qint32 i = 0; i < arcCount && in.status() == QDataStream::Ok; ++i )
+  {
+    qint32 outVertex, inVertex;
+    QVector< QVariant > properties;
+    in >> outVertex >> inVertex >> properties;
+    if ( outVertex < 0 || outVertex >= vertexCount || inVertex < 0 || inVertex >= vertexCount )
+    {
+      break;
+    }
+    graph->addArc( outVertex, inVertex, properties );
+  }
+
+  if ( in.status() != QDataStream::Ok || graph->arcCount() != arcCount )
+  {
+    delete graph;
+    return NULL;
+  }
+  return graph;
+}
+
 QgsGraphArc::QgsGraphArc()
     : mOut( 0 )
     , mIn( 0 )
@@ -172,6 +172,18 @@ class ANALYSIS_EXPORT QgsGraph
      */
     int findVertex( const QgsPoint& pt ) const;
 
+    /**
+     * write the graph to a binary file, such that it can be loaded instead of being built again
+     * \return false if the file could not be written
+     */
+    bool writeToFile( const QString& fileName ) const;
+
+    /**
+     * read a graph written by writeToFile
+     * \return the graph or NULL if the file could not be read. The caller takes ownership
+     */
+    static QgsGraph* readFromFile( const QString& fileName );
+
   private:
     QVector<QgsGraphVertex> mGraphVertexes;
 
@@ -14,77 +14,18 @@
  *   (at your option) any later version.                                   *
  *                                                                         *
  ***************************************************************************/
-// C++ standard includes
-#include <limits>
-
 // QT includes
-#include <QMap>
 #include <QVector>
-#include <QPair>
 
 //QGIS-uncludes
 #include "qgsgraph.h"
 #include "qgsgraphanalyzer.h"
+#include "qgsgraphrouter.h"
 
 void QgsGraphAnalyzer::dijkstra( const QgsGraph* source, int startPointIdx, int criterionNum, QVector<int>* resultTree, QVector<double>* resultCost )
 {
-  QVector< double > * result = NULL;
-  if ( resultCost != NULL )
-  {
-    result = resultCost;
-  }
-  else
-  {
-    result = new QVector<double>();
-  }
-
-  result->clear();
-  result->insert( result->begin(), source->vertexCount(), std::numeric_limits<double>::infinity() );
-  ( *result )[ startPointIdx ] = 0.0;
-
-  if ( resultTree != NULL )
-  {
-    resultTree->clear();
-    resultTree->insert( resultTree->begin(), source->vertexCount(), -1 );
-  }
-
-  // QMultiMap< cost, vertexIdx > not_begin
-  // I use it and not create any struct or class.
-  QMultiMap< double, int > not_begin;
-  QMultiMap< double, int >::iterator it;
-
-  not_begin.insert( 0.0, startPointIdx );
-
-  while ( !not_begin.empty() )
-  {
-    it = not_begin.begin();
-    double curCost = it.key();
-    int curVertex = it.value();
-    not_begin.erase( it );
-
-    // edge index list
-    QgsGraphArcIdList l = source->vertex( curVertex ).outArc();
-    QgsGraphArcIdList::iterator arcIt;
-    for ( arcIt = l.begin(); arcIt != l.end(); ++arcIt )
-    {
-      const QgsGraphArc arc = source->arc( *arcIt );
-      double cost = arc.property( criterionNum ).toDouble() + curCost;
-
-      if ( cost < ( *result )[ arc.inVertex()] )
-      {
-        ( *result )[ arc.inVertex()] = cost;
-        if ( resultTree != NULL )
-        {
-          ( *resultTree )[ arc.inVertex()] = *arcIt;
-        }
-        not_begin.insert( cost, arc.inVertex() );
-      }
-    }
-  }
-  if ( resultCost == NULL )
-  {
-    delete result;
-  }
+  QgsGraphRouter router( source, criterionNum );
+  router.dijkstra( startPointIdx, resultTree, resultCost );
 }
 
 QgsGraph* QgsGraphAnalyzer::shortestTree( const QgsGraph* source, int startVertexIdx, int criterionNum )
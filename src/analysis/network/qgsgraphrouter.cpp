@@ -0,0 +1,657 @@
+/***************************************************************************
+  qgsgraphrouter.cpp
+  --------------------------------------
+  Date                 : 2016-03-21
+  Copyright            : (C) 2016 by Sourcepole AG
+****************************************************************************
+*                                                                          *
+*   This program is free software; you can redistribute it and/or modify   *
+*   it under the terms of the GNU General Public License as published by   *
+*   the Free Software Foundation; either version 2 of the License, or      *
+*   (at your option) any later version.                                    *
+*                                                                          *
+***************************************************************************/
+
+/**
+ * \file qgsgraphrouter.cpp
+ * \brief implementation of QgsGraphRouter
+ */
+
+// C++ standard includes
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//QGIS-uncludes
+#include "qgsgraph.h"
+#include "qgsgraphrouter.h"
+
+/** Indexed 4-ary min heap of vertices. The key of a vertex which is in the heap can only decrease */
+class QgsGraphRouter::Heap
+{
+  public:
+    explicit Heap( int vertexCount )
+        : mPos( vertexCount, -1 )
+    {}
+
+    bool isEmpty() const { return mItems.isEmpty(); }
+
+    double minKey() const { return mItems[0].key; }
+
+    /** Inserts the vertex, or lowers its key if it is already in the heap */
+    void push( int vertex, double key )
+    {
+      int pos = mPos[vertex];
+      if ( pos < 0 )
+      {
+        Item item = { key, vertex };
+        mItems.append( item );
+        pos = mItems.size() - 1;
+      }
+      else if ( key < mItems[pos].key )
+      {
+        mItems[pos].key = key;
+      }
+      else
+      {
+        return;
+      }
+      siftUp( pos );
+    }
+
+    int pop()
+    {
+      int top = mItems[0].vertex;
+      mPos[top] = -1;
+      Item last = mItems.last();
+      mItems.pop_back();
+      if ( !mItems.isEmpty() )
+      {
+        mItems[0] = last;
+        siftDown( 0 );
+      }
+      return top;
+    }
+
+    void clear()
+    {
+      for ( int i = 0; i < mItems.size(); ++i )
+      {
+        mPos[mItems[i].vertex] = -1;
+      }
+      mItems.resize( 0 );
+    }
+
+  private:
+    struct Item
+    {
+      double key;
+      int vertex;
+    };
+    static const int sArity = 4;
+
+    QVector<Item> mItems;
+    /** Position of each vertex in mItems, -1 if it is not in the heap */
+    QVector<int> mPos;
+
+    void siftUp( int pos )
+    {
+      Item item = mItems[pos];
+      while ( pos > 0 )
+      {
+        int parent = ( pos - 1 ) / sArity;
+        if ( mItems[parent].key <= item.key )
+        {
+          break;
+        }
+        mItems[pos] = mItems[parent];
+        mPos[mItems[pos].vertex] = pos;
+        pos = parent;
+      }
+      mItems[pos] = item;
+      mPos[item.vertex] = pos;
+    }
+
+    void siftDown( int pos )
+    {
+      Item item = mItems[pos];
+      int n = mItems.size();
+      while ( true )
+      {
+        int first = sArity * pos + 1;
+        if ( first >= n )
+        {
+          break;
+        }
+        int best = first;
+        for ( int child = first + 1, end = qMin( first + sArity, n ); child < end; ++child )
+        {
+          if ( mItems[child].key < mItems[best].key )
+          {
+            best = child;
+          }
+        }
+        if ( mItems[best].key >= item.key )
+        {
+          break;
+        }
+        mItems[pos] = mItems[best];
+        mPos[mItems[pos].vertex] = pos;
+        pos = best;
+      }
+      mItems[pos] = item;
+      mPos[item.vertex] = pos;
+    }
+};
+
+/** Contracts the vertices of the graph one by one and adds the shortcuts which preserve the shortest paths between the remaining vertices */
+class QgsGraphRouter::Contractor
+{
+  public:
+    Contractor( QVector<HierarchyEdge>& edges, int vertexCount )
+        : mOutEdges( vertexCount )
+        , mInEdges( vertexCount )
+        , mDeletedNeighbours( vertexCount, 0 )
+        , mEdges( edges )
+        , mWitnessCost( vertexCount, 0 )
+        , mWitnessStamp( vertexCount, 0 )
+        , mWitnessId( 0 )
+        , mWitnessHeap( vertexCount )
+    {}
+
+    /** Adds an edge, or lowers the cost of an existing edge between the same vertices */
+    void addEdge( int source, int target, double cost, int arc, int child1, int child2 )
+    {
+      const QVector<int>& out = mOutEdges[source];
+      for ( int i = 0; i < out.size(); ++i )
+      {
+        if ( mEdges[out[i]].target != target )
+        {
+          continue;
+        }
+        if ( mEdges[out[i]].cost <= cost )
+        {
+          return;
+        }
+        //the existing edge may be the child of a shortcut, so it is replaced and not modified
+        int oldEdge = out[i];
+        mOutEdges[source][i] = appendEdge( source, target, cost, arc, child1, child2 );
+        mInEdges[target][mInEdges[target].indexOf( oldEdge )] = mOutEdges[source][i];
+        return;
+      }
+      int edge = appendEdge( source, target, cost, arc, child1, child2 );
+      mOutEdges[source].append( edge );
+      mInEdges[target].append( edge );
+    }
+
+    /** Importance of a vertex, the vertices with lower values are contracted first */
+    int priority( int vertex )
+    {
+      return contract( vertex, true ) - mInEdges[vertex].size() - mOutEdges[vertex].size() + mDeletedNeighbours[vertex];
+    }
+
+    /**
+     * Adds the shortcuts needed to remove the vertex (or only counts them if simulate is true)
+     * @return the number of shortcuts
+     */
+    int contract( int vertex, bool simulate )
+    {
+      double maxOutCost = 0;
+      const QVector<int>& out = mOutEdges[vertex];
+      for ( int i = 0; i < out.size(); ++i )
+      {
+        maxOutCost = qMax( maxOutCost, mEdges[out[i]].cost );
+      }
+
+      int shortcuts = 0;
+      for ( int i = 0; i < mInEdges[vertex].size(); ++i )
+      {
+        int inEdge = mInEdges[vertex][i];
+        int source = mEdges[inEdge].source;
+        double inCost = mEdges[inEdge].cost;
+        witnessSearch( source, vertex, inCost + maxOutCost );
+
+        for ( int j = 0; j < mOutEdges[vertex].size(); ++j )
+        {
+          int outEdge = mOutEdges[vertex][j];
+          int target = mEdges[outEdge].target;
+          double cost = inCost + mEdges[outEdge].cost;
+          if ( target == source || ( mWitnessStamp[target] == mWitnessId && mWitnessCost[target] <= cost ) )
+          {
+            continue;
+          }
+          ++shortcuts;
+          if ( !simulate )
+          {
+            addEdge( source, target, cost, -1, inEdge, outEdge );
+          }
+        }
+      }
+      return shortcuts;
+    }
+
+    /** Removes the vertex from the remaining graph */
+    void remove( int vertex )
+    {
+      for ( int i = 0; i < mOutEdges[vertex].size(); ++i )
+      {
+        int edge = mOutEdges[vertex][i];
+        int target = mEdges[edge].target;
+        mInEdges[target].remove( mInEdges[target].indexOf( edge ) );
+        ++mDeletedNeighbours[target];
+      }
+      for ( int i = 0; i < mInEdges[vertex].size(); ++i )
+      {
+        int edge = mInEdges[vertex][i];
+        int source = mEdges[edge].source;
+        mOutEdges[source].remove( mOutEdges[source].indexOf( edge ) );
+        ++mDeletedNeighbours[source];
+      }
+      mOutEdges[vertex].clear();
+      mInEdges[vertex].clear();
+    }
+
+    /** Edges between the remaining vertices */
+    QVector< QVector<int> > mOutEdges;
+    QVector< QVector<int> > mInEdges;
+
+  private:
+    /** Maximum number of vertices settled by a witness search. A failed search only costs an unnecessary shortcut */
+    static const int sWitnessSettleLimit = 500;
+
+    QVector<int> mDeletedNeighbours;
+    QVector<HierarchyEdge>& mEdges;
+    QVector<double> mWitnessCost;
+    QVector<int> mWitnessStamp;
+    int mWitnessId;
+    Heap mWitnessHeap;
+
+    int appendEdge( int source, int target, double cost, int arc, int child1, int child2 )
+    {
+      HierarchyEdge edge = { source, target, cost, arc, child1, child2 };
+      mEdges.append( edge );
+      return mEdges.size() - 1;
+    }
+
+    /** Dijkstra search from source in the remaining graph without the excluded vertex, up to maxCost */
+    void witnessSearch( int source, int excluded, double maxCost )
+    {
+      ++mWitnessId;
+      mWitnessCost[source] = 0;
+      mWitnessStamp[source] = mWitnessId;
+      mWitnessHeap.push( source, 0 );
+      int settled = 0;
+      while ( !mWitnessHeap.isEmpty() && mWitnessHeap.minKey() <= maxCost && settled < sWitnessSettleLimit )
+      {
+        int vertex = mWitnessHeap.pop();
+        ++settled;
+        double cost = mWitnessCost[vertex];
+        const QVector<int>& out = mOutEdges[vertex];
+        for ( int i = 0; i < out.size(); ++i )
+        {
+          const HierarchyEdge& edge = mEdges[out[i]];
+          if ( edge.target == excluded )
+          {
+            continue;
+          }
+          double newCost = cost + edge.cost;
+          if ( mWitnessStamp[edge.target] != mWitnessId || newCost < mWitnessCost[edge.target] )
+          {
+            mWitnessStamp[edge.target] = mWitnessId;
+            mWitnessCost[edge.target] = newCost;
+            mWitnessHeap.push( edge.target, newCost );
+          }
+        }
+      }
+      mWitnessHeap.clear();
+    }
+};
+
+QgsGraphRouter::QgsGraphRouter( const QgsGraph* graph, int criterionNum )
+    : mVertexCount( graph->vertexCount() )
+    , mCostPerDistance( std::numeric_limits<double>::infinity() )
+    , mSearchId( 0 )
+{
+  mVertexX.resize( mVertexCount );
+  mVertexY.resize( mVertexCount );
+  for ( int i = 0; i < mVertexCount; ++i )
+  {
+    QgsPoint pt = graph->vertex( i ).point();
+    mVertexX[i] = pt.x();
+    mVertexY[i] = pt.y();
+  }
+
+  //sort the arcs by outgoing vertex (counting sort, the arcs of a vertex stay in their order)
+  int arcCount = graph->arcCount();
+  mOutStart.fill( 0, mVertexCount + 1 );
+  for ( int i = 0; i < arcCount; ++i )
+  {
+    ++mOutStart[graph->arc( i ).outVertex() + 1];
+  }
+  for ( int i = 0; i < mVertexCount; ++i )
+  {
+    mOutStart[i + 1] += mOutStart[i];
+  }
+  mOutTarget.resize( arcCount );
+  mOutCost.resize( arcCount );
+  mOutArc.resize( arcCount );
+  QVector<int> fill = mOutStart;
+  for ( int i = 0; i < arcCount; ++i )
+  {
+    const QgsGraphArc& arc = graph->arc( i );
+    int pos = fill[arc.outVertex()]++;
+    mOutTarget[pos] = arc.inVertex();
+    mOutCost[pos] = arc.property( criterionNum ).toDouble();
+    mOutArc[pos] = i;
+
+    double dx = mVertexX[arc.inVertex()] - mVertexX[arc.outVertex()];
+    double dy = mVertexY[arc.inVertex()] - mVertexY[arc.outVertex()];
+    double distance = std::sqrt( dx * dx + dy * dy );
+    if ( distance > 0 )
+    {
+      mCostPerDistance = qMin( mCostPerDistance, mOutCost[pos] / distance );
+    }
+  }
+  //keep a margin against rounding, an overestimating bound would make A* miss the shortest path
+  mCostPerDistance = mCostPerDistance == std::numeric_limits<double>::infinity() ? 0 : qMax( 0., mCostPerDistance * ( 1 - 1E-9 ) );
+
+  mHeap[0] = new Heap( mVertexCount );
+  mHeap[1] = new Heap( mVertexCount );
+}
+
+QgsGraphRouter::~QgsGraphRouter()
+{
+  delete mHeap[0];
+  delete mHeap[1];
+}
+
+void QgsGraphRouter::dijkstra( int startVertexIdx, QVector<int>* resultTree, QVector<double>* resultCost )
+{
+  QVector<double> cost;
+  QVector<double>& result = resultCost ? *resultCost : cost;
+  result.fill( std::numeric_limits<double>::infinity(), mVertexCount );
+  result[startVertexIdx] = 0.0;
+  if ( resultTree )
+  {
+    resultTree->fill( -1, mVertexCount );
+  }
+
+  Heap& heap = *mHeap[0];
+  heap.clear();
+  heap.push( startVertexIdx, 0.0 );
+  while ( !heap.isEmpty() )
+  {
+    int vertex = heap.pop();
+    double curCost = result[vertex];
+    for ( int i = mOutStart[vertex], end = mOutStart[vertex + 1]; i < end; ++i )
+    {
+      double newCost = curCost + mOutCost[i];
+      int target = mOutTarget[i];
+      if ( newCost < result[target] )
+      {
+        result[target] = newCost;
+        if ( resultTree )
+        {
+          ( *resultTree )[target] = mOutArc[i];
+        }
+        heap.push( target, newCost );
+      }
+    }
+  }
+}
+
+double QgsGraphRouter::shortestPath( int startVertexIdx, int stopVertexIdx, QVector<int>* arcs )
+{
+  if ( arcs )
+  {
+    arcs->clear();
+  }
+  if ( startVertexIdx == stopVertexIdx )
+  {
+    return 0.0;
+  }
+  return hasHierarchy() ? shortestPathHierarchy( startVertexIdx, stopVertexIdx, arcs ) : shortestPathAStar( startVertexIdx, stopVertexIdx, arcs );
+}
+
+void QgsGraphRouter::startSearch()
+{
+  if ( mSearchStamp[0].size() != mVertexCount )
+  {
+    for ( int dir = 0; dir < 2; ++dir )
+    {
+      mSearchCost[dir].resize( mVertexCount );
+      mSearchPred[dir].resize( mVertexCount );
+      mSearchEdge[dir].resize( mVertexCount );
+      mSearchStamp[dir].fill( 0, mVertexCount );
+    }
+    mSearchId = 0;
+  }
+  if ( mSearchId == std::numeric_limits<int>::max() )
+  {
+    mSearchStamp[0].fill( 0 );
+    mSearchStamp[1].fill( 0 );
+    mSearchId = 0;
+  }
+  ++mSearchId;
+  mHeap[0]->clear();
+  mHeap[1]->clear();
+}
+
+double QgsGraphRouter::shortestPathAStar( int startVertexIdx, int stopVertexIdx, QVector<int>* arcs )
+{
+  startSearch();
+  QVector<double>& cost = mSearchCost[0];
+  QVector<int>& pred = mSearchPred[0];
+  QVector<int>& arc = mSearchEdge[0];
+  QVector<int>& stamp = mSearchStamp[0];
+  Heap& heap = *mHeap[0];
+
+  double stopX = mVertexX[stopVertexIdx];
+  double stopY = mVertexY[stopVertexIdx];
+
+  cost[startVertexIdx] = 0;
+  pred[startVertexIdx] = -1;
+  stamp[startVertexIdx] = mSearchId;
+  heap.push( startVertexIdx, 0 );
+  while ( !heap.isEmpty() )
+  {
+    int vertex = heap.pop();
+    if ( vertex == stopVertexIdx )
+    {
+      break;
+    }
+    double curCost = cost[vertex];
+    for ( int i = mOutStart[vertex], end = mOutStart[vertex + 1]; i < end; ++i )
+    {
+      int target = mOutTarget[i];
+      double newCost = curCost + mOutCost[i];
+      if ( stamp[target] != mSearchId || newCost < cost[target] )
+      {
+        stamp[target] = mSearchId;
+        cost[target] = newCost;
+        pred[target] = vertex;
+        arc[target] = mOutArc[i];
+        double estimate = 0;
+        if ( mCostPerDistance > 0 )
+        {
+          double dx = stopX - mVertexX[target];
+          double dy = stopY - mVertexY[target];
+          estimate = mCostPerDistance * std::sqrt( dx * dx + dy * dy );
+        }
+        heap.push( target, newCost + estimate );
+      }
+    }
+  }
+
+  if ( stamp[stopVertexIdx] != mSearchId )
+  {
+    return std::numeric_limits<double>::infinity();
+  }
+  if ( arcs )
+  {
+    for ( int vertex = stopVertexIdx; vertex != startVertexIdx; vertex = pred[vertex] )
+    {
+      arcs->append( arc[vertex] );
+    }
+    std::reverse( arcs->begin(), arcs->end() );
+  }
+  return cost[stopVertexIdx];
+}
+
+double QgsGraphRouter::shortestPathHierarchy( int startVertexIdx, int stopVertexIdx, QVector<int>* arcs )
+{
+  startSearch();
+
+  //forward search from the start and backward search from the stop vertex, both only towards higher vertices
+  int startVertex[2] = { startVertexIdx, stopVertexIdx };
+  for ( int dir = 0; dir < 2; ++dir )
+  {
+    mSearchCost[dir][startVertex[dir]] = 0;
+    mSearchPred[dir][startVertex[dir]] = -1;
+    mSearchStamp[dir][startVertex[dir]] = mSearchId;
+    mHeap[dir]->push( startVertex[dir], 0 );
+  }
+
+  double best = std::numeric_limits<double>::infinity();
+  int meet = -1;
+  while ( true )
+  {
+    double minKey[2];
+    for ( int dir = 0; dir < 2; ++dir )
+    {
+      minKey[dir] = mHeap[dir]->isEmpty() ? std::numeric_limits<double>::infinity() : mHeap[dir]->minKey();
+    }
+    //no path through a vertex which is still to be settled can be shorter
+    if ( qMin( minKey[0], minKey[1] ) >= best )
+    {
+      break;
+    }
+
+    int dir = minKey[0] <= minKey[1] ? 0 : 1;
+    int vertex = mHeap[dir]->pop();
+    double curCost = mSearchCost[dir][vertex];
+    if ( mSearchStamp[1 - dir][vertex] == mSearchId && curCost + mSearchCost[1 - dir][vertex] < best )
+    {
+      best = curCost + mSearchCost[1 - dir][vertex];
+      meet = vertex;
+    }
+
+    const QVector<int>& edgeStart = dir == 0 ? mUpStart : mDownStart;
+    const QVector<int>& edges = dir == 0 ? mUpEdges : mDownEdges;
+    for ( int i = edgeStart[vertex], end = edgeStart[vertex + 1]; i < end; ++i )
+    {
+      const HierarchyEdge& edge = mHierarchyEdges[edges[i]];
+      int next = dir == 0 ? edge.target : edge.source;
+      double newCost = curCost + edge.cost;
+      if ( mSearchStamp[dir][next] != mSearchId || newCost < mSearchCost[dir][next] )
+      {
+        mSearchStamp[dir][next] = mSearchId;
+        mSearchCost[dir][next] = newCost;
+        mSearchPred[dir][next] = vertex;
+        mSearchEdge[dir][next] = edges[i];
+        mHeap[dir]->push( next, newCost );
+      }
+    }
+  }
+
+  if ( meet < 0 )
+  {
+    return std::numeric_limits<double>::infinity();
+  }
+  if ( arcs )
+  {
+    QVector<int> pathEdges;
+    for ( int vertex = meet; vertex != startVertexIdx; vertex = mSearchPred[0][vertex] )
+    {
+      pathEdges.append( mSearchEdge[0][vertex] );
+    }
+    std::reverse( pathEdges.begin(), pathEdges.end() );
+    for ( int vertex = meet; vertex != stopVertexIdx; vertex = mSearchPred[1][vertex] )
+    {
+      pathEdges.append( mSearchEdge[1][vertex] );
+    }
+    for ( int i = 0; i < pathEdges.size(); ++i )
+    {
+      unpackEdge( pathEdges[i], arcs );
+    }
+  }
+  return best;
+}
+
+void QgsGraphRouter::unpackEdge( int edge, QVector<int>* arcs ) const
+{
+  QVector<int> stack;
+  stack.append( edge );
+  while ( !stack.isEmpty() )
+  {
+    const HierarchyEdge& e = mHierarchyEdges[stack.last()];
+    stack.pop_back();
+    if ( e.child1 < 0 )
+    {
+      arcs->append( e.arc );
+    }
+    else
+    {
+      stack.append( e.child2 );
+      stack.append( e.child1 );
+    }
+  }
+}
+
+void QgsGraphRouter::buildHierarchy()
+{
+  mHierarchyEdges.clear();
+  Contractor contractor( mHierarchyEdges, mVertexCount );
+  for ( int vertex = 0; vertex < mVertexCount; ++vertex )
+  {
+    for ( int i = mOutStart[vertex], end = mOutStart[vertex + 1]; i < end; ++i )
+    {
+      if ( mOutTarget[i] != vertex )
+      {
+        contractor.addEdge( vertex, mOutTarget[i], mOutCost[i], mOutArc[i], -1, -1 );
+      }
+    }
+  }
+
+  //contract the least important vertex first. Priorities change when neighbours are contracted,
+  //so they are recomputed when a vertex comes up (lazy update)
+  Heap order( mVertexCount );
+  for ( int vertex = 0; vertex < mVertexCount; ++vertex )
+  {
+    order.push( vertex, contractor.priority( vertex ) );
+  }
+
+  mRank.fill( -1, mVertexCount );
+  QVector< QVector<int> > upEdges( mVertexCount );
+  QVector< QVector<int> > downEdges( mVertexCount );
+  int rank = 0;
+  while ( !order.isEmpty() )
+  {
+    int vertex = order.pop();
+    int priority = contractor.priority( vertex );
+    if ( !order.isEmpty() && priority > order.minKey() )
+    {
+      order.push( vertex, priority );
+      continue;
+    }
+
+    contractor.contract( vertex, false );
+    //the remaining neighbours are all contracted later, i.e. higher in the hierarchy
+    upEdges[vertex] = contractor.mOutEdges[vertex];
+    downEdges[vertex] = contractor.mInEdges[vertex];
+    contractor.remove( vertex );
+    mRank[vertex] = rank++;
+  }
+
+  mUpStart.fill( 0, mVertexCount + 1 );
+  mDownStart.fill( 0, mVertexCount + 1 );
+  mUpEdges.clear();
+  mDownEdges.clear();
+  for ( int vertex = 0; vertex < mVertexCount; ++vertex )
+  {
+    mUpEdges += upEdges[vertex];
+    mDownEdges += downEdges[vertex];
+    mUpStart[vertex + 1] = mUpEdges.size();
+    mDownStart[vertex + 1] = mDownEdges.size();
+  }
+}
@@ -0,0 +1,133 @@
+/***************************************************************************
+  qgsgraphrouter.h
+  --------------------------------------
+  Date                 : 2016-03-21
+  Copyright            : (C) 2016 by Sourcepole AG
+****************************************************************************
+*                                                                          *
+*   This program is free software; you can redistribute it and/or modify   *
+*   it under the terms of the GNU General Public License as published by   *
+*   the Free Software Foundation; either version 2 of the License, or      *
+*   (at your option) any later version.                                    *
+*                                                                          *
+***************************************************************************/
+
+#ifndef QGSGRAPHROUTERH
+#define QGSGRAPHROUTERH
+
+//QT4 includes
+#include <QVector>
+
+//forward declarations
+class QgsGraph;
+
+/**
+ * \ingroup networkanalysis
+ * \class QgsGraphRouter
+ * \brief Answers shortest path queries on a QgsGraph for one optimization criterion.
+ *
+ * The arcs of the graph are copied into compressed sparse row arrays with numeric costs, such that
+ * the searches neither copy arc lists nor convert properties. Point to point queries use A* with the
+ * euclidean distance to the target as lower bound. After buildHierarchy() they use the much faster
+ * bidirectional search in the contraction hierarchy of the graph, which pays off when many queries
+ * are run on the same graph.
+ * The router keeps its search buffers between the queries, so it must not be used from several threads at once.
+ */
+class ANALYSIS_EXPORT QgsGraphRouter
+{
+  public:
+    /**
+     * @param graph the graph, which is not referenced after the construction
+     * @param criterionNum index of arc property used as cost. The costs must not be negative
+     */
+    QgsGraphRouter( const QgsGraph* graph, int criterionNum );
+    ~QgsGraphRouter();
+
+    /**
+     * return vertex count
+     */
+    int vertexCount() const { return mVertexCount; }
+
+    /**
+     * solve the shortest path problem from one vertex to all the other ones
+     * @param startVertexIdx index of start vertex
+     * @param resultTree resultTree[ vertexIndex ] == inboundingArcIndex if vertex reacheble and resultTree[ vertexIndex ] == -1 others.
+     * @param resultCost array of cost paths
+     */
+    void dijkstra( int startVertexIdx, QVector<int>* resultTree = NULL, QVector<double>* resultCost = NULL );
+
+    /**
+     * find the shortest path between two vertices
+     * @param startVertexIdx index of start vertex
+     * @param stopVertexIdx index of stop vertex
+     * @param arcs receives the indices of the arcs of the path, from start to stop
+     * @return cost of the path, infinity if the stop vertex is not reachable
+     */
+    double shortestPath( int startVertexIdx, int stopVertexIdx, QVector<int>* arcs = NULL );
+
+    /**
+     * build the contraction hierarchy used by subsequent shortestPath calls.
+     * The preprocessing takes a while, but each query only visits a few hundred vertices afterwards
+     */
+    void buildHierarchy();
+
+    /**
+     * return true if buildHierarchy() has been called
+     */
+    bool hasHierarchy() const { return !mRank.isEmpty(); }
+
+  private:
+    class Heap;
+    class Contractor;
+
+    /** Edge of the contraction hierarchy. Shortcuts stand for the two edges child1 and child2, other edges for the arc of the graph */
+    struct HierarchyEdge
+    {
+      int source;
+      int target;
+      double cost;
+      int arc;
+      int child1;
+      int child2;
+    };
+
+    int mVertexCount;
+    QVector<double> mVertexX;
+    QVector<double> mVertexY;
+
+    /** The outgoing arcs of vertex i are at the positions mOutStart[i] to mOutStart[i + 1] - 1 */
+    QVector<int> mOutStart;
+    QVector<int> mOutTarget;
+    QVector<double> mOutCost;
+    QVector<int> mOutArc;
+    /** Lower bound of the cost per unit of euclidean distance, used by A* */
+    double mCostPerDistance;
+
+    /** Contraction order of the vertices, empty if there is no hierarchy */
+    QVector<int> mRank;
+    QVector<HierarchyEdge> mHierarchyEdges;
+    /** Edges of the hierarchy leaving vertex i to higher vertices, at the positions mUpStart[i] to mUpStart[i + 1] - 1 */
+    QVector<int> mUpStart;
+    QVector<int> mUpEdges;
+    /** Edges of the hierarchy arriving at vertex i from higher vertices, at the positions mDownStart[i] to mDownStart[i + 1] - 1 */
+    QVector<int> mDownStart;
+    QVector<int> mDownEdges;
+
+    /** Search buffers of the forward and backward searches. The values of vertex i are valid if mSearchStamp[dir][i] == mSearchId */
+    QVector<double> mSearchCost[2];
+    QVector<int> mSearchPred[2];
+    QVector<int> mSearchEdge[2];
+    QVector<int> mSearchStamp[2];
+    int mSearchId;
+    Heap* mHeap[2];
+
+    void startSearch();
+    double shortestPathAStar( int startVertexIdx, int stopVertexIdx, QVector<int>* arcs );
+    double shortestPathHierarchy( int startVertexIdx, int stopVertexIdx, QVector<int>* arcs );
+    void unpackEdge( int edge, QVector<int>* arcs ) const;
+
+    QgsGraphRouter( const QgsGraphRouter& );
+    QgsGraphRouter& operator=( const QgsGraphRouter& );
+};
+
+#endif //QGSGRAPHROUTERH
@@ -23,65 +23,90 @@
 #include <qgspoint.h>
 #include <qgsgeometry.h>
 #include <qgsdistancearea.h>
+#include <qgsspatialindex.h>
 
 // QT includes
+#include <QHash>
 #include <QString>
 #include <QtAlgorithms>
 
 //standard includes
+#include <cmath>
+#include <cstring>
 #include <limits>
 #include <algorithm>
 
-class QgsPointCompare
+/** Cell of the vertex grid, the coordinates are the cell numbers (or the exact coordinates for zero tolerance) */
+struct QgsVertexGridCell
+{
+  double x;
+  double y;
+
+  bool operator==( const QgsVertexGridCell& other ) const
+  {
+    return x == other.x && y == other.y;
+  }
+};
+
+inline uint qHash( const QgsVertexGridCell& cell )
+{
+  quint64 x, y;
+  memcpy( &x, &cell.x, sizeof( x ) );
+  memcpy( &y, &cell.y, sizeof( y ) );
+  return qHash( x ) ^ 31 * qHash( y );
+}
+
+/** Merges the points which lie in the same cell of a grid with the topology tolerance as cell size */
+class QgsVertexGrid
 {
   public:
-    QgsPointCompare( double tolerance ) :
+    QgsVertexGrid( double tolerance ) :
         mTolerance( tolerance )
     {  }
 
-    bool operator()( const QgsPoint& p1, const QgsPoint& p2 ) const
+    /** Returns the index of the vertex of the cell containing pt, the point becomes a new vertex if the cell is empty */
+    int addPoint( const QgsPoint& pt )
     {
-      if ( mTolerance <= 0 )
-        return p1.x() == p2.x() ? p1.y() < p2.y() : p1.x() < p2.x();
+      QgsVertexGridCell c = cell( pt );
+      QHash< QgsVertexGridCell, int >::const_iterator it = mCells.constFind( c );
+      if ( it != mCells.constEnd() )
+        return it.value();
+
+      mPoints.append( pt );
+      mCells.insert( c, mPoints.size() - 1 );
+      return mPoints.size() - 1;
+    }
 
-      double tx1 = ceil( p1.x() / mTolerance );
-      double tx2 = ceil( p2.x() / mTolerance );
-      if ( tx1 == tx2 )
-        return ceil( p1.y() / mTolerance ) < ceil( p2.y() / mTolerance );
-      return tx1 < tx2;
+    /** Returns the index of the vertex of the cell containing pt, -1 if there is none */
+    int findPoint( const QgsPoint& pt ) const
+    {
+      return mCells.value( cell( pt ), -1 );
     }
 
+    const QVector< QgsPoint >& points() const { return mPoints; }
+
   private:
     double mTolerance;
-};
-
-template <typename RandIter, typename Type, typename CompareOp > RandIter my_binary_search( RandIter begin, RandIter end, Type val, CompareOp comp )
-{
-  // result if not found
-  RandIter not_found = end;
+    QHash< QgsVertexGridCell, int > mCells;
+    QVector< QgsPoint > mPoints;
 
-  while ( true )
-  {
-    RandIter avg = begin + ( end - begin ) / 2;
-    if ( begin == avg || end == avg )
+    QgsVertexGridCell cell( const QgsPoint& pt ) const
     {
-      if ( !comp( *begin, val ) && !comp( val, *begin ) )
-        return begin;
-      if ( !comp( *end, val ) && !comp( val, *end ) )
-        return end;
-
-      return not_found;
+      QgsVertexGridCell c;
+      if ( mTolerance <= 0 )
+      {
+        // adding 0 turns -0 into 0, which is equal but has another bit pattern
+        c.x = pt.x() + 0.0;
+        c.y = pt.y() + 0.0;
+      }
+      else
+      {
+        c.x = ceil( pt.x() / mTolerance ) + 0.0;
+        c.y = ceil( pt.y() / mTolerance ) + 0.0;
+      }
+      return c;
     }
-    if ( comp( val, *avg ) )
-      end = avg;
-    else if ( comp( *avg, val ) )
-      begin = avg;
-    else
-      return avg;
-  }
-
-  return not_found;
-}
+};
 
 struct TiePointInfo
 {
@@ -99,6 +124,115 @@ bool TiePointInfoCompare( const TiePointInfo& a, const TiePointInfo& b )
   return a.mFirstPoint.x() == b.mFirstPoint.x() ? a.mFirstPoint.y() < b.mFirstPoint.y() : a.mFirstPoint.x() < b.mFirstPoint.x();
 }
 
+/** Number of additional points from which the closest segments are looked up in a spatial index instead of checking all segments */
+static const int sTiePointIndexThreshold = 8;
+
+/**
+ * Checks the segments of the line in the range [first, last) in their order, only a strictly closer segment
+ * replaces the current tie point. Like this the first of all segments with the minimal distance is tied to.
+ */
+static void tieToSegments( const QVector< QgsPoint >& lines, int first, int last, const QgsPoint& pt, TiePointInfo& best, QgsPoint& tied )
+{
+  for ( int j = first + 1; j < last; ++j )
+  {
+    const QgsPoint& pt1 = lines[ j - 1 ];
+    const QgsPoint& pt2 = lines[ j ];
+    TiePointInfo info;
+    if ( pt1 == pt2 )
+    {
+      info.mLength = pt.sqrDist( pt1 );
+      info.mTiedPoint = pt1;
+    }
+    else
+    {
+      info.mLength = pt.sqrDistToSegment( pt1.x(), pt1.y(), pt2.x(), pt2.y(), info.mTiedPoint );
+    }
+
+    if ( best.mLength > info.mLength )
+    {
+      info.mFirstPoint = pt1;
+      info.mLastPoint = pt2;
+      best = info;
+      tied = info.mTiedPoint;
+    }
+  }
+}
+
+/**
+ * Finds the closest segment of the lines to each point.
+ * @param lines the vertices of all lines, line i is the range lineStart[i] to lineStart[i + 1] - 1 and has at least two vertices
+ * @param lineStart start of each line, with an additional entry for the end
+ * @param lineFeature index of the feature of each line, in the order of the features
+ */
+static void tiePoints( const QVector< QgsPoint >& lines, const QVector< int >& lineStart, const QVector< int >& lineFeature,
+                       const QVector< QgsPoint >& additionalPoints, QVector< TiePointInfo >& pointLengthMap, QVector< QgsPoint >& tiedPoint )
+{
+  int lineCount = lineStart.size() - 1;
+
+  if ( additionalPoints.size() < sTiePointIndexThreshold )
+  {
+    for ( int i = 0; i < additionalPoints.size(); ++i )
+    {
+      for ( int line = 0; line < lineCount; ++line )
+      {
+        tieToSegments( lines, lineStart[ line ], lineStart[ line + 1 ], additionalPoints[ i ], pointLengthMap[ i ], tiedPoint[ i ] );
+      }
+    }
+    return;
+  }
+
+  // index the bounding boxes of the features
+  QgsSpatialIndex index;
+  QVector< int > featureFirstLine;
+  for ( int line = 0; line < lineCount; )
+  {
+    int feature = lineFeature[ line ];
+    featureFirstLine.append( line );
+    QgsRectangle rect;
+    rect.setMinimal();
+    for ( ; line < lineCount && lineFeature[ line ] == feature; ++line )
+    {
+      for ( int j = lineStart[ line ]; j < lineStart[ line + 1 ]; ++j )
+      {
+        rect.combineExtentWith( lines[ j ].x(), lines[ j ].y() );
+      }
+    }
+    QgsFeature f( featureFirstLine.size() - 1 );
+    f.setGeometry( QgsGeometry::fromRect( rect ) );
+    index.insertFeature( f );
+  }
+  featureFirstLine.append( lineCount );
+
+  for ( int i = 0; i < additionalPoints.size(); ++i )
+  {
+    const QgsPoint& pt = additionalPoints[ i ];
+    // the distance to the feature with the closest bounding box bounds the distance of the tie point
+    QList< QgsFeatureId > nearest = index.nearestNeighbor( pt, 1 );
+    if ( nearest.isEmpty() )
+      continue;
+
+    TiePointInfo bound = pointLengthMap[ i ];
+    QgsPoint boundTied;
+    int feature = nearest.first();
+    for ( int line = featureFirstLine[ feature ]; line < featureFirstLine[ feature + 1 ]; ++line )
+    {
+      tieToSegments( lines, lineStart[ line ], lineStart[ line + 1 ], pt, bound, boundTied );
+    }
+    // sqrDistToSegment reports distances below its epsilon as 0
+    double radius = sqrt( bound.mLength + DEFAULT_SEGMENT_EPSILON ) * ( 1 + 1E-9 );
+
+    QList< QgsFeatureId > candidates = index.intersects( QgsRectangle( pt.x() - radius, pt.y() - radius, pt.x() + radius, pt.y() + radius ) );
+    qSort( candidates );
+    foreach ( QgsFeatureId candidate, candidates )
+    {
+      for ( int line = featureFirstLine[ candidate ]; line < featureFirstLine[ candidate + 1 ]; ++line )
+      {
+        tieToSegments( lines, lineStart[ line ], lineStart[ line + 1 ], pt, pointLengthMap[ i ], tiedPoint[ i ] );
+      }
+    }
+  }
+}
+
 QgsLineVectorLayerDirector::QgsLineVectorLayerDirector( QgsVectorLayer *myLayer,
     int directionFieldId,
     const QString& directDirectionValue,
@@ -155,66 +289,55 @@ void QgsLineVectorLayerDirector::makeGraph( QgsGraphBuilderInterface *builder, c
   QVector< TiePointInfo > pointLengthMap( additionalPoints.size(), tmpInfo );
   QVector< TiePointInfo >::iterator pointLengthIt;
 
-  //Graph's points;
-  QVector< QgsPoint > points;
+  //Graph's points, points closer than the topology tolerance are merged
+  QgsVertexGrid vertexGrid( builder->topologyTolerance() );
 
   QgsFeatureIterator fit = vl->getFeatures( QgsFeatureRequest().setSubsetOfAttributes( QgsAttributeList() ) );
 
   // begin: tie points to the graph
   QgsAttributeList la;
   QgsFeature feature;
-  while ( fit.nextFeature( feature ) )
   {
-    QgsMultiPolyline mpl;
-    if ( feature.geometry()->wkbType() == QGis::WKBMultiLineString )
-      mpl = feature.geometry()->asMultiPolyline();
-    else if ( feature.geometry()->wkbType() == QGis::WKBLineString )
-      mpl.push_back( feature.geometry()->asPolyline() );
-
-    QgsMultiPolyline::iterator mplIt;
-    for ( mplIt = mpl.begin(); mplIt != mpl.end(); ++mplIt )
+    // transformed lines with at least two vertices, kept for tying the additional points
+    QVector< QgsPoint > lines;
+    QVector< int > lineStart;
+    QVector< int > lineFeature;
+    bool keepLines = !additionalPoints.isEmpty();
+
+    int featureIdx = 0;
+    while ( fit.nextFeature( feature ) )
     {
-      QgsPoint pt1, pt2;
-      bool isFirstPoint = true;
-      QgsPolyline::iterator pointIt;
-      for ( pointIt = mplIt->begin(); pointIt != mplIt->end(); ++pointIt )
+      QgsMultiPolyline mpl;
+      if ( feature.geometry()->wkbType() == QGis::WKBMultiLineString )
+        mpl = feature.geometry()->asMultiPolyline();
+      else if ( feature.geometry()->wkbType() == QGis::WKBLineString )
+        mpl.push_back( feature.geometry()->asPolyline() );
+
+      QgsMultiPolyline::iterator mplIt;
+      for ( mplIt = mpl.begin(); mplIt != mpl.end(); ++mplIt )
       {
-        pt2 = ct.transform( *pointIt );
-        points.push_back( pt2 );
-
-        if ( !isFirstPoint )
+        bool keepLine = keepLines && mplIt->size() > 1;
+        if ( keepLine )
         {
-          int i = 0;
-          for ( i = 0; i != additionalPoints.size(); ++i )
-          {
-            TiePointInfo info;
-            if ( pt1 == pt2 )
-            {
-              info.mLength = additionalPoints[ i ].sqrDist( pt1 );
-              info.mTiedPoint = pt1;
-            }
-            else
-            {
-              info.mLength = additionalPoints[ i ].sqrDistToSegment( pt1.x(), pt1.y(),
-                             pt2.x(), pt2.y(), info.mTiedPoint );
-            }
-
-            if ( pointLengthMap[ i ].mLength > info.mLength )
-            {
-              Q_UNUSED( info.mTiedPoint );
-              info.mFirstPoint = pt1;
-              info.mLastPoint = pt2;
+          lineStart.push_back( lines.size() );
+          lineFeature.push_back( featureIdx );
+        }
 
-              pointLengthMap[ i ] = info;
-              tiedPoint[ i ] = info.mTiedPoint;
-            }
-          }
+        QgsPolyline::iterator pointIt;
+        for ( pointIt = mplIt->begin(); pointIt != mplIt->end(); ++pointIt )
+        {
+          QgsPoint pt = ct.transform( *pointIt );
+          vertexGrid.addPoint( pt );
+          if ( keepLine )
+            lines.push_back( pt );
         }
-        pt1 = pt2;
-        isFirstPoint = false;
       }
+      ++featureIdx;
+      emit buildProgress( ++step, featureCount );
     }
-    emit buildProgress( ++step, featureCount );
+    lineStart.push_back( lines.size() );
+
+    tiePoints( lines, lineStart, lineFeature, additionalPoints, pointLengthMap, tiedPoint );
   }
   // end: tie points to graph
 
@@ -224,22 +347,14 @@ void QgsLineVectorLayerDirector::makeGraph( QgsGraphBuilderInterface *builder, c
   {
     if ( tiedPoint[ i ] != QgsPoint( 0.0, 0.0 ) )
     {
-      points.push_back( tiedPoint [ i ] );
+      tiedPoint[ i ] = vertexGrid.points()[ vertexGrid.addPoint( tiedPoint[ i ] )];
     }
   }
 
-  QgsPointCompare pointCompare( builder->topologyTolerance() );
-
-  qSort( points.begin(), points.end(), pointCompare );
-  QVector< QgsPoint >::iterator tmp = std::unique( points.begin(), points.end() );
-  points.resize( tmp - points.begin() );
-
+  const QVector< QgsPoint >& points = vertexGrid.points();
   for ( i = 0;i < points.size();++i )
     builder->addVertex( i, points[ i ] );
 
-  for ( i = 0; i < tiedPoint.size() ; ++i )
-    tiedPoint[ i ] = *( my_binary_search( points.begin(), points.end(), tiedPoint[ i ], pointCompare ) );
-
   qSort( pointLengthMap.begin(), pointLengthMap.end(), TiePointInfoCompare );
 
   {
@@ -325,25 +440,10 @@ void QgsLineVectorLayerDirector::makeGraph( QgsGraphBuilderInterface *builder, c
           TiePointInfo t;
           t.mFirstPoint = pt1;
           t.mLastPoint  = pt2;
-          pointLengthIt = my_binary_search( pointLengthMap.begin(), pointLengthMap.end(), t, TiePointInfoCompare );
-
-          if ( pointLengthIt != pointLengthMap.end() )
+          pointLengthIt = std::lower_bound( pointLengthMap.begin(), pointLengthMap.end(), t, TiePointInfoCompare );
+          for ( ; pointLengthIt != pointLengthMap.end() && pointLengthIt->mFirstPoint == pt1 && pointLengthIt->mLastPoint == pt2; ++pointLengthIt )
           {
-            QVector< TiePointInfo >::iterator it;
-            for ( it = pointLengthIt; it - pointLengthMap.begin() >= 0; --it )
-            {
-              if ( it->mFirstPoint == pt1 && it->mLastPoint == pt2 )
-              {
-                pointsOnArc[ pt1.sqrDist( it->mTiedPoint )] = it->mTiedPoint;
-              }
-            }
-            for ( it = pointLengthIt + 1; it != pointLengthMap.end(); ++it )
-            {
-              if ( it->mFirstPoint == pt1 && it->mLastPoint == pt2 )
-              {
-                pointsOnArc[ pt1.sqrDist( it->mTiedPoint )] = it->mTiedPoint;
-              }
-            }
+            pointsOnArc[ pt1.sqrDist( pointLengthIt->mTiedPoint )] = pointLengthIt->mTiedPoint;
           }
 
           std::map< double, QgsPoint >::iterator pointsIt;
@@ -354,9 +454,8 @@ void QgsLineVectorLayerDirector::makeGraph( QgsGraphBuilderInterface *builder, c
           for ( pointsIt = pointsOnArc.begin(); pointsIt != pointsOnArc.end(); ++pointsIt )
           {
             pt2 = pointsIt->second;
-            tmp = my_binary_search( points.begin(), points.end(), pt2, pointCompare );
-            pt2 = *tmp;
-            pt2idx = tmp - points.begin();
+            pt2idx = vertexGrid.findPoint( pt2 );
+            pt2 = points[ pt2idx ];
 
             if ( !isFirstPoint && pt1 != pt2 )
             {
@@ -18,6 +18,8 @@
 #include "qgsgeometry.h"
 #include "qgslogger.h"
 
+#include <cstring>
+
 
 QgsOSMDatabase::QgsOSMDatabase( const QString& dbFileName )
     : mDbFileName( dbFileName )
@@ -28,6 +30,7 @@ QgsOSMDatabase::QgsOSMDatabase( const QString& dbFileName )
     , mStmtWayNode( 0 )
     , mStmtWayNodePoints( 0 )
     , mStmtWayTags( 0 )
+    , mStmtWayCoords( 0 )
 {
 }
 
@@ -82,6 +85,7 @@ bool QgsOSMDatabase::close()
   deleteStatement( mStmtWayNode );
   deleteStatement( mStmtWayNodePoints );
   deleteStatement( mStmtWayTags );
+  deleteStatement( mStmtWayCoords );
 
   Q_ASSERT( mStmtNode == 0 );
 
@@ -235,6 +239,28 @@ QgsPolyline QgsOSMDatabase::wayPoints( QgsOSMId id ) const
 {
   QgsPolyline points;
 
+  // the import stores the points of ways whose nodes are all known, which avoids the join
+  if ( mStmtWayCoords )
+  {
+    sqlite3_bind_int64( mStmtWayCoords, 1, id );
+    if ( sqlite3_step( mStmtWayCoords ) == SQLITE_ROW && sqlite3_column_type( mStmtWayCoords, 0 ) == SQLITE_BLOB )
+    {
+      // the blob is not necessarily aligned
+      const char* coords = static_cast<const char*>( sqlite3_column_blob( mStmtWayCoords, 0 ) );
+      int count = sqlite3_column_bytes( mStmtWayCoords, 0 ) / ( 2 * sizeof( double ) );
+      points.reserve( count );
+      for ( int i = 0; i < count; ++i )
+      {
+        double lonLat[2];
+        memcpy( lonLat, coords + i * sizeof( lonLat ), sizeof( lonLat ) );
+        points.append( QgsPoint( lonLat[0], lonLat[1] ) );
+      }
+    }
+    sqlite3_reset( mStmtWayCoords );
+    if ( !points.isEmpty() )
+      return points;
+  }
+
   // bind the way identifier
   sqlite3_bind_int64( mStmtWayNodePoints, 1, id );
 
@@ -287,6 +313,10 @@ bool QgsOSMDatabase::prepareStatements()
     }
   }
 
+  // optional, missing in databases imported by older versions
+  if ( sqlite3_prepare_v2( mDatabase, "SELECT coords FROM ways WHERE id=?", -1, &mStmtWayCoords, 0 ) != SQLITE_OK )
+    deleteStatement( mStmtWayCoords );
+
   return true;
 }
 
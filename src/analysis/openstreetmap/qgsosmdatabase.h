@@ -109,6 +109,8 @@ class ANALYSIS_EXPORT QgsOSMDatabase
     sqlite3_stmt* mStmtWayNode;
     sqlite3_stmt* mStmtWayNodePoints;
     sqlite3_stmt* mStmtWayTags;
+    //! point list stored by the import, not available in databases of older versions
+    sqlite3_stmt* mStmtWayCoords;
 };
 
 
@@ -14,10 +14,116 @@
  ***************************************************************************/
 
 #include "qgsosmimport.h"
+#include "qgsosmpbfreader.h"
 #include "qgsslconnect.h"
 
 #include <QStringList>
+#include <QTemporaryFile>
+#include <QThread>
 #include <QXmlStreamReader>
+#include <QtConcurrentMap>
+
+#include <algorithm>
+#include <limits>
+
+/**
+ * Coordinates of the nodes in a temporary file, which is memory mapped once all nodes are added.
+ * Files are usually sorted by id, otherwise the nodes get sorted when the file is mapped.
+ */
+class QgsOSMNodeStore
+{
+  public:
+    QgsOSMNodeStore()
+        : mCount( 0 )
+        , mSorted( true )
+        , mLastId( std::numeric_limits<QgsOSMId>::min() )
+        , mNodes( 0 )
+        , mFinished( false )
+    {}
+
+    bool open() { return mFile.open(); }
+
+    bool isFinished() const { return mFinished; }
+
+    bool add( QgsOSMId id, double lat, double lon )
+    {
+      if ( mFinished )
+        return true; // nodes after the first way are only stored in the database
+
+      Node node = { id, lat, lon };
+      mBuffer.append( node );
+      mSorted = mSorted && id > mLastId;
+      mLastId = id;
+      return mBuffer.size() < sBufferSize || flush();
+    }
+
+    /** Maps the file, no nodes can be added afterwards */
+    bool finish()
+    {
+      mFinished = true;
+      if ( !flush() )
+        return false;
+      if ( mCount == 0 )
+        return true;
+
+      // the last nodes may still be in the write buffer of QFile
+      if ( !mFile.flush() )
+        return false;
+
+      mNodes = reinterpret_cast<Node*>( mFile.map( 0, mCount * sizeof( Node ) ) );
+      if ( !mNodes )
+        return false;
+      if ( !mSorted )
+        std::sort( mNodes, mNodes + mCount, NodeCompare() );
+      return true;
+    }
+
+    bool lookup( QgsOSMId id, double& lat, double& lon ) const
+    {
+      if ( !mNodes )
+        return false;
+      const Node* it = std::lower_bound( mNodes, mNodes + mCount, id, NodeCompare() );
+      if ( it == mNodes + mCount || it->id != id )
+        return false;
+      lat = it->lat;
+      lon = it->lon;
+      return true;
+    }
+
+  private:
+    struct Node
+    {
+      QgsOSMId id;
+      double lat;
+      double lon;
+    };
+
+    struct NodeCompare
+    {
+      bool operator()( const Node& a, const Node& b ) const { return a.id < b.id; }
+      bool operator()( const Node& a, QgsOSMId id ) const { return a.id < id; }
+    };
+
+    static const int sBufferSize = 64 * 1024;
+
+    QTemporaryFile mFile;
+    QVector<Node> mBuffer;
+    qint64 mCount;
+    bool mSorted;
+    QgsOSMId mLastId;
+    Node* mNodes;
+    bool mFinished;
+
+    bool flush()
+    {
+      qint64 size = mBuffer.size() * sizeof( Node );
+      if ( size > 0 && mFile.write( reinterpret_cast<const char*>( mBuffer.constData() ), size ) != size )
+        return false;
+      mCount += mBuffer.size();
+      mBuffer.resize( 0 );
+      return true;
+    }
+};
 
 
 QgsOSMXmlImport::QgsOSMXmlImport( const QString& xmlFilename, const QString& dbFilename )
@@ -29,10 +135,16 @@ QgsOSMXmlImport::QgsOSMXmlImport( const QString& xmlFilename, const QString& dbF
     , mStmtInsertWay( 0 )
     , mStmtInsertWayNode( 0 )
     , mStmtInsertWayTag( 0 )
+    , mNodeStore( 0 )
 {
 
 }
 
+QgsOSMXmlImport::~QgsOSMXmlImport()
+{
+  delete mNodeStore;
+}
+
 bool QgsOSMXmlImport::import()
 {
   mError.clear();
@@ -62,14 +174,41 @@ bool QgsOSMXmlImport::import()
     return false;
   }
 
+  mNodeStore = new QgsOSMNodeStore();
+  if ( !mNodeStore->open() )
+  {
+    mError = "Cannot create temporary file for node coordinates";
+    delete mNodeStore;
+    mNodeStore = 0;
+    closeDatabase();
+    return false;
+  }
+
   qDebug( "starting import" );
 
   int retX = sqlite3_exec( mDatabase, "BEGIN", NULL, NULL, 0 );
   Q_ASSERT( retX == SQLITE_OK );
   Q_UNUSED( retX );
 
-  // start parsing
+  bool res = QgsOSMPbfReader::isPbf( &mInputFile ) ? importPbf() : importXml();
 
+  int retY = sqlite3_exec( mDatabase, "COMMIT", NULL, NULL, 0 );
+  Q_ASSERT( retY == SQLITE_OK );
+  Q_UNUSED( retY );
+
+  delete mNodeStore;
+  mNodeStore = 0;
+  mInputFile.close();
+
+  createIndexes();
+
+  closeDatabase();
+
+  return res;
+}
+
+bool QgsOSMXmlImport::importXml()
+{
   QXmlStreamReader xml( &mInputFile );
 
   while ( !xml.atEnd() )
@@ -88,19 +227,79 @@ bool QgsOSMXmlImport::import()
     }
   }
 
-  int retY = sqlite3_exec( mDatabase, "COMMIT", NULL, NULL, 0 );
-  Q_ASSERT( retY == SQLITE_OK );
-  Q_UNUSED( retY );
-
-  createIndexes();
-
   if ( xml.hasError() )
   {
     mError = QString( "XML error: %1" ).arg( xml.errorString() );
     return false;
   }
 
-  closeDatabase();
+  return true;
+}
+
+bool QgsOSMXmlImport::importPbf()
+{
+  QgsOSMPbfReader reader( &mInputFile );
+  int batchSize = 2 * qMax( 1, QThread::idealThreadCount() );
+  int percent = -1;
+
+  // the next batch of blocks is decoded in parallel while the current one is stored
+  QVector<QgsOSMPbfBlock> batches[2];
+  int current = 0;
+  if ( !reader.readBlocks( batches[current], batchSize ) )
+  {
+    mError = reader.errorString();
+    return false;
+  }
+  QFuture<void> decoding = QtConcurrent::map( batches[current], QgsOSMPbfReader::decodeBlock );
+
+  while ( !batches[current].isEmpty() )
+  {
+    decoding.waitForFinished();
+
+    int next = 1 - current;
+    if ( !reader.readBlocks( batches[next], batchSize ) )
+    {
+      mError = reader.errorString();
+      return false;
+    }
+    decoding = QtConcurrent::map( batches[next], QgsOSMPbfReader::decodeBlock );
+
+    foreach ( const QgsOSMPbfBlock& block, batches[current] )
+    {
+      bool ok = block.error.isEmpty();
+      if ( !ok )
+        mError = block.error;
+
+      for ( int i = 0; ok && i < block.nodeIds.size(); ++i )
+      {
+        ok = insertNode( block.nodeIds[i], block.nodeLat[i], block.nodeLon[i] );
+        for ( int j = block.nodeTagStart[i]; ok && j < block.nodeTagStart[i + 1]; ++j )
+          ok = insertTag( false, block.nodeIds[i], block.strings[block.nodeTags[2 * j]], block.strings[block.nodeTags[2 * j + 1]] );
+      }
+
+      for ( int i = 0; ok && i < block.wayIds.size(); ++i )
+      {
+        ok = insertWay( block.wayIds[i], block.wayRefs.constData() + block.wayRefStart[i], block.wayRefStart[i + 1] - block.wayRefStart[i] );
+        for ( int j = block.wayTagStart[i]; ok && j < block.wayTagStart[i + 1]; ++j )
+          ok = insertTag( true, block.wayIds[i], block.strings[block.wayTags[2 * j]], block.strings[block.wayTags[2 * j + 1]] );
+      }
+
+      if ( !ok )
+      {
+        decoding.waitForFinished();
+        return false;
+      }
+    }
+
+    int newPercent = 100 * mInputFile.pos() / mInputFile.size();
+    if ( newPercent > percent )
+    {
+      emit progress( newPercent );
+      percent = newPercent;
+    }
+
+    current = next;
+  }
 
   return true;
 }
@@ -157,7 +356,7 @@ bool QgsOSMXmlImport::createDatabase()
     above41 ? "SELECT InitSpatialMetadata(1)" : "SELECT InitSpatialMetadata()",
     "CREATE TABLE nodes ( id INTEGER PRIMARY KEY, lat REAL, lon REAL )",
     "CREATE TABLE nodes_tags ( id INTEGER, k TEXT, v TEXT )",
-    "CREATE TABLE ways ( id INTEGER PRIMARY KEY )",
+    "CREATE TABLE ways ( id INTEGER PRIMARY KEY, coords BLOB )",
     "CREATE TABLE ways_nodes ( way_id INTEGER, node_id INTEGER, way_pos INTEGER )",
     "CREATE TABLE ways_tags ( id INTEGER, k TEXT, v TEXT )",
   };
@@ -180,7 +379,7 @@ bool QgsOSMXmlImport::createDatabase()
   {
     "INSERT INTO nodes ( id, lat, lon ) VALUES (?,?,?)",
     "INSERT INTO nodes_tags ( id, k, v ) VALUES (?,?,?)",
-    "INSERT INTO ways ( id ) VALUES (?)",
+    "INSERT INTO ways ( id, coords ) VALUES (?,?)",
     "INSERT INTO ways_nodes ( way_id, node_id, way_pos ) VALUES (?,?,?)",
     "INSERT INTO ways_tags ( id, k, v ) VALUES (?,?,?)"
   };
@@ -285,17 +484,11 @@ void QgsOSMXmlImport::readNode( QXmlStreamReader& xml )
   double lon = attrs.value( "lon" ).toString().toDouble();
 
   // insert to DB
-  sqlite3_bind_int64( mStmtInsertNode, 1, id );
-  sqlite3_bind_double( mStmtInsertNode, 2, lat );
-  sqlite3_bind_double( mStmtInsertNode, 3, lon );
-
-  if ( sqlite3_step( mStmtInsertNode ) != SQLITE_DONE )
+  if ( !insertNode( id, lat, lon ) )
   {
-    xml.raiseError( QString( "Storing node %1 failed." ).arg( id ) );
+    xml.raiseError( mError );
   }
 
-  sqlite3_reset( mStmtInsertNode );
-
   while ( !xml.atEnd() )
   {
     xml.readNext();
@@ -320,19 +513,10 @@ void QgsOSMXmlImport::readTag( bool way, QgsOSMId id, QXmlStreamReader& xml )
   QByteArray v = attrs.value( "v" ).toString().toUtf8();
   xml.skipCurrentElement();
 
-  sqlite3_stmt* stmtInsertTag = way ? mStmtInsertWayTag : mStmtInsertNodeTag;
-
-  sqlite3_bind_int64( stmtInsertTag, 1, id );
-  sqlite3_bind_text( stmtInsertTag, 2, k.constData(), -1, SQLITE_STATIC );
-  sqlite3_bind_text( stmtInsertTag, 3, v.constData(), -1, SQLITE_STATIC );
-
-  int res = sqlite3_step( stmtInsertTag );
-  if ( res != SQLITE_DONE )
+  if ( !insertTag( way, id, k, v ) )
   {
-    xml.raiseError( QString( "Storing tag failed [%1]" ).arg( res ) );
+    xml.raiseError( mError );
   }
-
-  sqlite3_reset( stmtInsertTag );
 }
 
 void QgsOSMXmlImport::readWay( QXmlStreamReader& xml )
@@ -352,17 +536,7 @@ void QgsOSMXmlImport::readWay( QXmlStreamReader& xml )
   QXmlStreamAttributes attrs = xml.attributes();
   QgsOSMId id = attrs.value( "id" ).toString().toLongLong();
 
-  // insert to DB
-  sqlite3_bind_int64( mStmtInsertWay, 1, id );
-
-  if ( sqlite3_step( mStmtInsertWay ) != SQLITE_DONE )
-  {
-    xml.raiseError( QString( "Storing way %1 failed." ).arg( id ) );
-  }
-
-  sqlite3_reset( mStmtInsertWay );
-
-  int way_pos = 0;
+  QVector<QgsOSMId> nodes;
 
   while ( !xml.atEnd() )
   {
@@ -375,21 +549,7 @@ void QgsOSMXmlImport::readWay( QXmlStreamReader& xml )
     {
       if ( xml.name() == "nd" )
       {
-        QgsOSMId node_id = xml.attributes().value( "ref" ).toString().toLongLong();
-
-        sqlite3_bind_int64( mStmtInsertWayNode, 1, id );
-        sqlite3_bind_int64( mStmtInsertWayNode, 2, node_id );
-        sqlite3_bind_int( mStmtInsertWayNode, 3, way_pos );
-
-        if ( sqlite3_step( mStmtInsertWayNode ) != SQLITE_DONE )
-        {
-          xml.raiseError( QString( "Storing ways_nodes %1 - %2 failed." ).arg( id ).arg( node_id ) );
-        }
-
-        sqlite3_reset( mStmtInsertWayNode );
-
-        way_pos++;
-
+        nodes.append( xml.attributes().value( "ref" ).toString().toLongLong() );
         xml.skipCurrentElement();
       }
       else if ( xml.name() == "tag" )
@@ -398,4 +558,101 @@ void QgsOSMXmlImport::readWay( QXmlStreamReader& xml )
         xml.skipCurrentElement();
     }
   }
+
+  // insert to DB once all nodes are known
+  if ( !xml.hasError() && !insertWay( id, nodes.constData(), nodes.size() ) )
+  {
+    xml.raiseError( mError );
+  }
+}
+
+bool QgsOSMXmlImport::insertNode( QgsOSMId id, double lat, double lon )
+{
+  sqlite3_bind_int64( mStmtInsertNode, 1, id );
+  sqlite3_bind_double( mStmtInsertNode, 2, lat );
+  sqlite3_bind_double( mStmtInsertNode, 3, lon );
+
+  bool res = sqlite3_step( mStmtInsertNode ) == SQLITE_DONE;
+  sqlite3_reset( mStmtInsertNode );
+  if ( !res )
+  {
+    mError = QString( "Storing node %1 failed." ).arg( id );
+    return false;
+  }
+
+  if ( !mNodeStore->add( id, lat, lon ) )
+  {
+    mError = "Writing node coordinates failed.";
+    return false;
+  }
+  return true;
+}
+
+bool QgsOSMXmlImport::insertTag( bool way, QgsOSMId id, const QByteArray& k, const QByteArray& v )
+{
+  sqlite3_stmt* stmtInsertTag = way ? mStmtInsertWayTag : mStmtInsertNodeTag;
+
+  sqlite3_bind_int64( stmtInsertTag, 1, id );
+  sqlite3_bind_text( stmtInsertTag, 2, k.constData(), k.size(), SQLITE_STATIC );
+  sqlite3_bind_text( stmtInsertTag, 3, v.constData(), v.size(), SQLITE_STATIC );
+
+  int res = sqlite3_step( stmtInsertTag );
+  sqlite3_reset( stmtInsertTag );
+  if ( res != SQLITE_DONE )
+  {
+    mError = QString( "Storing tag failed [%1]" ).arg( res );
+    return false;
+  }
+  return true;
+}
+
+bool QgsOSMXmlImport::insertWay( QgsOSMId id, const QgsOSMId* nodes, int nodeCount )
+{
+  // ways follow the nodes in OSM files, so the coordinates of all nodes are known now
+  if ( !mNodeStore->isFinished() && !mNodeStore->finish() )
+  {
+    mError = "Mapping node coordinates failed.";
+    return false;
+  }
+
+  // the points of the way (lon, lat), left NULL if some nodes are missing
+  QVector<double> coords( 2 * nodeCount );
+  for ( int i = 0; i < nodeCount; ++i )
+  {
+    if ( !mNodeStore->lookup( nodes[i], coords[2 * i + 1], coords[2 * i] ) )
+    {
+      coords.clear();
+      break;
+    }
+  }
+
+  sqlite3_bind_int64( mStmtInsertWay, 1, id );
+  if ( !coords.isEmpty() )
+    sqlite3_bind_blob( mStmtInsertWay, 2, coords.constData(), ( int )( coords.size() * sizeof( double ) ), SQLITE_STATIC );
+  else
+    sqlite3_bind_null( mStmtInsertWay, 2 );
+
+  bool res = sqlite3_step( mStmtInsertWay ) == SQLITE_DONE;
+  sqlite3_reset( mStmtInsertWay );
+  if ( !res )
+  {
+    mError = QString( "Storing way %1 failed." ).arg( id );
+    return false;
+  }
+
+  for ( int i = 0; i < nodeCount; ++i )
+  {
+    sqlite3_bind_int64( mStmtInsertWayNode, 1, id );
+    sqlite3_bind_int64( mStmtInsertWayNode, 2, nodes[i] );
+    sqlite3_bind_int( mStmtInsertWayNode, 3, i );
+
+    res = sqlite3_step( mStmtInsertWayNode ) == SQLITE_DONE;
+    sqlite3_reset( mStmtInsertWayNode );
+    if ( !res )
+    {
+      mError = QString( "Storing ways_nodes %1 - %2 failed." ).arg( id ).arg( nodes[i] );
+      return false;
+    }
+  }
+  return true;
 }
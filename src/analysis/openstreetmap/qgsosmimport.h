@@ -22,11 +22,16 @@
 #include "qgsosmbase.h"
 
 class QXmlStreamReader;
+class QgsOSMNodeStore;
 
 /**
- * @brief The QgsOSMXmlImport class imports OpenStreetMap XML format to our topological representation
+ * @brief The QgsOSMXmlImport class imports OpenStreetMap XML or PBF format to our topological representation
  * in a SQLite database (see QgsOSMDatabase for details).
  *
+ * The format is detected from the content of the input file. The blocks of PBF files are decoded
+ * in parallel threads. The coordinates of the nodes are collected in a temporary memory mapped file,
+ * from which the point lists of the ways are stored along with the ways.
+ *
  * How to use the classs:
  * 1. set input XML file name and output DB file name (in constructor or with respective functions)
  * 2. run import()
@@ -37,6 +42,7 @@ class ANALYSIS_EXPORT QgsOSMXmlImport : public QObject
     Q_OBJECT
   public:
     explicit QgsOSMXmlImport( const QString& xmlFileName = QString(), const QString& dbFileName = QString() );
+    ~QgsOSMXmlImport();
 
     void setInputXmlFileName( const QString& xmlFileName ) { mXmlFileName = xmlFileName; }
     QString inputXmlFileName() const { return mXmlFileName; }
@@ -45,7 +51,7 @@ class ANALYSIS_EXPORT QgsOSMXmlImport : public QObject
     QString outputDbFileName() const { return mDbFileName; }
 
     /**
-     * Run import. This will parse the XML file and store the data in a SQLite database.
+     * Run import. This will parse the XML or PBF file and store the data in a SQLite database.
      * @return true on success, false when import failed (see errorString() for the error)
      */
     bool import();
@@ -69,6 +75,13 @@ class ANALYSIS_EXPORT QgsOSMXmlImport : public QObject
     void readWay( QXmlStreamReader& xml );
     void readTag( bool way, QgsOSMId id, QXmlStreamReader& xml );
 
+    bool importXml();
+    bool importPbf();
+
+    bool insertNode( QgsOSMId id, double lat, double lon );
+    bool insertTag( bool way, QgsOSMId id, const QByteArray& k, const QByteArray& v );
+    bool insertWay( QgsOSMId id, const QgsOSMId* nodes, int nodeCount );
+
   private:
     QString mXmlFileName;
     QString mDbFileName;
@@ -83,6 +96,9 @@ class ANALYSIS_EXPORT QgsOSMXmlImport : public QObject
     sqlite3_stmt* mStmtInsertWay;
     sqlite3_stmt* mStmtInsertWayNode;
     sqlite3_stmt* mStmtInsertWayTag;
+
+    //! coordinates of the imported nodes
+    QgsOSMNodeStore* mNodeStore;
 };
 
 
@@ -0,0 +1,541 @@
+/***************************************************************************
+  qgsosmpbfreader.cpp
+  --------------------------------------
+  Date                 : March 2016
+  Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgsosmpbfreader.h"
+
+#include <QIODevice>
+#include <QStringList>
+
+//! maximum sizes allowed by the format
+static const int sMaxBlobHeaderSize = 64 * 1024;
+static const int sMaxBlobSize = 32 * 1024 * 1024;
+
+/**
+ * Minimal reader of the protocol buffer wire format, sufficient for the messages of the OSM PBF format.
+ * Reading past the end of the message sets an error flag instead of failing.
+ */
+class QgsPbfMessage
+{
+  public:
+    enum WireType { Varint = 0, Fixed64 = 1, LengthDelimited = 2, Fixed32 = 5 };
+
+    QgsPbfMessage( const char* data, int size )
+        : mPos( reinterpret_cast<const uchar*>( data ) )
+        , mEnd( reinterpret_cast<const uchar*>( data ) + size )
+        , mOk( true )
+    {}
+
+    explicit QgsPbfMessage( const QByteArray& data )
+        : mPos( reinterpret_cast<const uchar*>( data.constData() ) )
+        , mEnd( reinterpret_cast<const uchar*>( data.constData() ) + data.size() )
+        , mOk( true )
+    {}
+
+    bool ok() const { return mOk; }
+    bool atEnd() const { return mPos >= mEnd; }
+
+    /** Reads the key of the next field, returns false at the end of the message */
+    bool next( int& field, int& wireType )
+    {
+      if ( !mOk || atEnd() )
+        return false;
+      quint64 key = varint();
+      field = ( int )( key >> 3 );
+      wireType = ( int )( key & 7 );
+      return mOk;
+    }
+
+    quint64 varint()
+    {
+      quint64 value = 0;
+      for ( int shift = 0; shift < 64 && mPos < mEnd; shift += 7 )
+      {
+        uchar byte = *mPos++;
+        value |= ( quint64 )( byte & 0x7f ) << shift;
+        if ( !( byte & 0x80 ) )
+          return value;
+      }
+      mOk = false;
+      return 0;
+    }
+
+    qint64 svarint()
+    {
+      quint64 value = varint();
+      return ( qint64 )( value >> 1 ) ^ -( qint64 )( value & 1 );
+    }
+
+    /** Returns the content of a length delimited field */
+    QgsPbfMessage message()
+    {
+      quint64 size = varint();
+      if ( !mOk || size > ( quint64 )( mEnd - mPos ) )
+      {
+        mOk = false;
+        return QgsPbfMessage( 0, 0 );
+      }
+      QgsPbfMessage sub( reinterpret_cast<const char*>( mPos ), ( int ) size );
+      mPos += size;
+      return sub;
+    }
+
+    QByteArray bytes()
+    {
+      QgsPbfMessage sub = message();
+      return QByteArray( reinterpret_cast<const char*>( sub.mPos ), ( int )( sub.mEnd - sub.mPos ) );
+    }
+
+    void skip( int wireType )
+    {
+      switch ( wireType )
+      {
+        case Varint:
+          varint();
+          break;
+        case Fixed64:
+          advance( 8 );
+          break;
+        case LengthDelimited:
+          message();
+          break;
+        case Fixed32:
+          advance( 4 );
+          break;
+        default:
+          mOk = false;
+      }
+    }
+
+    /** Reads the values of a repeated integer field, which may be packed or not */
+    template<typename T> void readRepeated( int wireType, bool zigzag, QVector<T>& values )
+    {
+      if ( wireType == LengthDelimited )
+      {
+        QgsPbfMessage packed = message();
+        while ( !packed.atEnd() && packed.ok() )
+          values.append(( T )( zigzag ? packed.svarint() : ( qint64 ) packed.varint() ) );
+        mOk = mOk && packed.ok();
+      }
+      else
+      {
+        values.append(( T )( zigzag ? svarint() : ( qint64 ) varint() ) );
+      }
+    }
+
+  private:
+    const uchar* mPos;
+    const uchar* mEnd;
+    bool mOk;
+
+    void advance( int n )
+    {
+      if ( mEnd - mPos < n )
+        mOk = false;
+      else
+        mPos += n;
+    }
+};
+
+
+QgsOSMPbfReader::QgsOSMPbfReader( QIODevice* device )
+    : mDevice( device )
+    , mAtEnd( false )
+{
+}
+
+bool QgsOSMPbfReader::isPbf( QIODevice* device )
+{
+  // a PBF file starts with the size of the first blob header (big endian) followed by the header with type "OSMHeader"
+  QByteArray start = device->peek( 15 );
+  return start.size() == 15 && start.startsWith( QByteArray( "\0\0", 2 ) ) && start.mid( 4 ) == QByteArray( "\x0a\x09OSMHeader" );
+}
+
+bool QgsOSMPbfReader::readExactly( char* data, qint64 size )
+{
+  while ( size > 0 )
+  {
+    qint64 n = mDevice->read( data, size );
+    if ( n <= 0 )
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool QgsOSMPbfReader::readBlocks( QVector<QgsOSMPbfBlock>& blocks, int maxBlocks )
+{
+  blocks.clear();
+  while ( blocks.size() < maxBlocks && !mAtEnd )
+  {
+    uchar sizeBytes[4];
+    qint64 n = mDevice->read( reinterpret_cast<char*>( sizeBytes ), 4 );
+    if ( n == 0 )
+    {
+      mAtEnd = true;
+      break;
+    }
+    if ( n != 4 && !readExactly( reinterpret_cast<char*>( sizeBytes ) + n, 4 - n ) )
+    {
+      mError = "Unexpected end of PBF file";
+      return false;
+    }
+    int headerSize = ( sizeBytes[0] << 24 ) | ( sizeBytes[1] << 16 ) | ( sizeBytes[2] << 8 ) | sizeBytes[3];
+    if ( headerSize <= 0 || headerSize > sMaxBlobHeaderSize )
+    {
+      mError = QString( "Invalid PBF blob header size %1" ).arg( headerSize );
+      return false;
+    }
+
+    QByteArray header( headerSize, 0 );
+    if ( !readExactly( header.data(), headerSize ) )
+    {
+      mError = "Unexpected end of PBF file";
+      return false;
+    }
+
+    // BlobHeader: 1 type, 2 indexdata, 3 datasize
+    QByteArray type;
+    qint64 dataSize = -1;
+    QgsPbfMessage msg( header );
+    int field, wireType;
+    while ( msg.next( field, wireType ) )
+    {
+      if ( field == 1 && wireType == QgsPbfMessage::LengthDelimited )
+        type = msg.bytes();
+      else if ( field == 3 && wireType == QgsPbfMessage::Varint )
+        dataSize = ( qint64 ) msg.varint();
+      else
+        msg.skip( wireType );
+    }
+    if ( !msg.ok() || dataSize < 0 || dataSize > sMaxBlobSize )
+    {
+      mError = "Invalid PBF blob header";
+      return false;
+    }
+
+    QByteArray blob( ( int ) dataSize, 0 );
+    if ( !readExactly( blob.data(), dataSize ) )
+    {
+      mError = "Unexpected end of PBF file";
+      return false;
+    }
+
+    if ( type == "OSMHeader" )
+    {
+      if ( !checkHeaderBlock( blob ) )
+        return false;
+    }
+    else if ( type == "OSMData" )
+    {
+      QgsOSMPbfBlock block;
+      block.blob = blob;
+      blocks.append( block );
+    }
+    // unknown blob types are skipped as required by the format
+  }
+  return true;
+}
+
+bool QgsOSMPbfReader::uncompressBlob( const QByteArray& blob, QByteArray& data, QString& error )
+{
+  // Blob: 1 raw, 2 raw_size, 3 zlib_data, 4 lzma_data, 5 bzip2_data (obsolete), 6 lz4_data, 7 zstd_data
+  QByteArray zlibData;
+  int rawSize = -1;
+  QgsPbfMessage msg( blob );
+  int field, wireType;
+  while ( msg.next( field, wireType ) )
+  {
+    if ( field == 1 && wireType == QgsPbfMessage::LengthDelimited )
+    {
+      data = msg.bytes();
+      return msg.ok();
+    }
+    else if ( field == 2 && wireType == QgsPbfMessage::Varint )
+    {
+      rawSize = ( int ) msg.varint();
+    }
+    else if ( field == 3 && wireType == QgsPbfMessage::LengthDelimited )
+    {
+      zlibData = msg.bytes();
+    }
+    else if ( field >= 4 && field <= 7 )
+    {
+      error = "Unsupported PBF compression (only zlib is supported)";
+      return false;
+    }
+    else
+    {
+      msg.skip( wireType );
+    }
+  }
+  if ( !msg.ok() || zlibData.isEmpty() || rawSize < 0 || rawSize > sMaxBlobSize )
+  {
+    error = "Invalid PBF blob";
+    return false;
+  }
+
+  // qUncompress expects the uncompressed size as big endian prefix of the zlib stream
+  QByteArray prefixed;
+  prefixed.reserve( zlibData.size() + 4 );
+  prefixed.append(( char )(( rawSize >> 24 ) & 0xff ) );
+  prefixed.append(( char )(( rawSize >> 16 ) & 0xff ) );
+  prefixed.append(( char )(( rawSize >> 8 ) & 0xff ) );
+  prefixed.append(( char )( rawSize & 0xff ) );
+  prefixed.append( zlibData );
+  data = qUncompress( prefixed );
+  if ( data.size() != rawSize )
+  {
+    error = "Decompressing PBF blob failed";
+    return false;
+  }
+  return true;
+}
+
+bool QgsOSMPbfReader::checkHeaderBlock( const QByteArray& blob )
+{
+  QByteArray data;
+  if ( !uncompressBlob( blob, data, mError ) )
+    return false;
+
+  // HeaderBlock: 4 required_features
+  QStringList unsupported;
+  QgsPbfMessage msg( data );
+  int field, wireType;
+  while ( msg.next( field, wireType ) )
+  {
+    if ( field == 4 && wireType == QgsPbfMessage::LengthDelimited )
+    {
+      QByteArray feature = msg.bytes();
+      if ( feature != "OsmSchema-V0.6" && feature != "DenseNodes" )
+        unsupported << QString::fromUtf8( feature );
+    }
+    else
+    {
+      msg.skip( wireType );
+    }
+  }
+  if ( !msg.ok() )
+  {
+    mError = "Invalid PBF header block";
+    return false;
+  }
+  if ( !unsupported.isEmpty() )
+  {
+    mError = QString( "Unsupported PBF features: %1" ).arg( unsupported.join( ", " ) );
+    return false;
+  }
+  return true;
+}
+
+/** Appends the tags of a node or way given as separate key and value index lists */
+static bool appendTags( const QVector<quint32>& keys, const QVector<quint32>& vals, int stringCount, QVector<int>& tags )
+{
+  if ( keys.size() != vals.size() )
+    return false;
+  for ( int i = 0; i < keys.size(); ++i )
+  {
+    if (( int ) keys[i] >= stringCount || ( int ) vals[i] >= stringCount )
+      return false;
+    tags.append( keys[i] );
+    tags.append( vals[i] );
+  }
+  return true;
+}
+
+void QgsOSMPbfReader::decodeBlock( QgsOSMPbfBlock& block )
+{
+  QByteArray data;
+  bool ok = uncompressBlob( block.blob, data, block.error );
+  block.blob.clear();
+  if ( !ok )
+    return;
+
+  // PrimitiveBlock: 1 stringtable, 2 primitivegroup, 17 granularity, 19 lat_offset, 20 lon_offset.
+  // The coordinate parameters follow the groups, so they are read first
+  qint64 granularity = 100;
+  qint64 latOffset = 0;
+  qint64 lonOffset = 0;
+  QgsPbfMessage msg( data );
+  int field, wireType;
+  while ( msg.next( field, wireType ) )
+  {
+    if ( field == 1 && wireType == QgsPbfMessage::LengthDelimited )
+    {
+      QgsPbfMessage table = msg.message();
+      int tableField, tableWireType;
+      while ( table.next( tableField, tableWireType ) )
+      {
+        if ( tableField == 1 && tableWireType == QgsPbfMessage::LengthDelimited )
+          block.strings.append( table.bytes() );
+        else
+          table.skip( tableWireType );
+      }
+      ok = ok && table.ok();
+    }
+    else if ( field == 17 && wireType == QgsPbfMessage::Varint )
+      granularity = ( qint64 ) msg.varint();
+    else if ( field == 19 && wireType == QgsPbfMessage::Varint )
+      latOffset = ( qint64 ) msg.varint();
+    else if ( field == 20 && wireType == QgsPbfMessage::Varint )
+      lonOffset = ( qint64 ) msg.varint();
+    else
+      msg.skip( wireType );
+  }
+  if ( !ok || !msg.ok() )
+  {
+    block.error = "Invalid PBF data block";
+    return;
+  }
+
+  int stringCount = block.strings.size();
+  block.nodeTagStart.append( 0 );
+  block.wayRefStart.append( 0 );
+  block.wayTagStart.append( 0 );
+
+  QgsPbfMessage blockMsg( data );
+  while ( ok && blockMsg.next( field, wireType ) )
+  {
+    if ( field != 2 || wireType != QgsPbfMessage::LengthDelimited )
+    {
+      blockMsg.skip( wireType );
+      continue;
+    }
+
+    // PrimitiveGroup: 1 nodes, 2 dense, 3 ways, 4 relations, 5 changesets
+    QgsPbfMessage group = blockMsg.message();
+    int groupField, groupWireType;
+    while ( ok && group.next( groupField, groupWireType ) )
+    {
+      if ( groupField == 1 && groupWireType == QgsPbfMessage::LengthDelimited )
+      {
+        // Node: 1 id, 2 keys, 3 vals, 4 info, 8 lat, 9 lon
+        QgsPbfMessage node = group.message();
+        qint64 id = 0, lat = 0, lon = 0;
+        QVector<quint32> keys, vals;
+        int f, w;
+        while ( node.next( f, w ) )
+        {
+          if ( f == 1 )
+            id = node.svarint();
+          else if ( f == 2 )
+            node.readRepeated( w, false, keys );
+          else if ( f == 3 )
+            node.readRepeated( w, false, vals );
+          else if ( f == 8 )
+            lat = node.svarint();
+          else if ( f == 9 )
+            lon = node.svarint();
+          else
+            node.skip( w );
+        }
+        ok = node.ok() && appendTags( keys, vals, stringCount, block.nodeTags );
+        block.nodeIds.append( id );
+        block.nodeLat.append( 1E-9 * ( latOffset + granularity * lat ) );
+        block.nodeLon.append( 1E-9 * ( lonOffset + granularity * lon ) );
+        block.nodeTagStart.append( block.nodeTags.size() / 2 );
+      }
+      else if ( groupField == 2 && groupWireType == QgsPbfMessage::LengthDelimited )
+      {
+        // DenseNodes: 1 id, 5 denseinfo, 8 lat, 9 lon, 10 keys_vals. Ids and coordinates are delta coded
+        QgsPbfMessage dense = group.message();
+        QVector<qint64> ids, lats, lons;
+        QVector<quint32> keysVals;
+        int f, w;
+        while ( dense.next( f, w ) )
+        {
+          if ( f == 1 )
+            dense.readRepeated( w, true, ids );
+          else if ( f == 8 )
+            dense.readRepeated( w, true, lats );
+          else if ( f == 9 )
+            dense.readRepeated( w, true, lons );
+          else if ( f == 10 )
+            dense.readRepeated( w, false, keysVals );
+          else
+            dense.skip( w );
+        }
+        ok = dense.ok() && ids.size() == lats.size() && ids.size() == lons.size();
+
+        qint64 id = 0, lat = 0, lon = 0;
+        int kv = 0;
+        for ( int i = 0; ok && i < ids.size(); ++i )
+        {
+          id += ids[i];
+          lat += lats[i];
+          lon += lons[i];
+          block.nodeIds.append( id );
+          block.nodeLat.append( 1E-9 * ( latOffset + granularity * lat ) );
+          block.nodeLon.append( 1E-9 * ( lonOffset + granularity * lon ) );
+
+          // the tags of each node are terminated by a 0, the list is empty if no node has tags
+          while ( kv < keysVals.size() && keysVals[kv] != 0 )
+          {
+            if ( kv + 1 >= keysVals.size() || ( int ) keysVals[kv] >= stringCount || ( int ) keysVals[kv + 1] >= stringCount )
+            {
+              ok = false;
+              break;
+            }
+            block.nodeTags.append( keysVals[kv] );
+            block.nodeTags.append( keysVals[kv + 1] );
+            kv += 2;
+          }
+          ++kv;
+          block.nodeTagStart.append( block.nodeTags.size() / 2 );
+        }
+      }
+      else if ( groupField == 3 && groupWireType == QgsPbfMessage::LengthDelimited )
+      {
+        // Way: 1 id, 2 keys, 3 vals, 4 info, 8 refs (delta coded)
+        QgsPbfMessage way = group.message();
+        qint64 id = 0;
+        QVector<quint32> keys, vals;
+        QVector<qint64> refs;
+        int f, w;
+        while ( way.next( f, w ) )
+        {
+          if ( f == 1 )
+            id = ( qint64 ) way.varint();
+          else if ( f == 2 )
+            way.readRepeated( w, false, keys );
+          else if ( f == 3 )
+            way.readRepeated( w, false, vals );
+          else if ( f == 8 )
+            way.readRepeated( w, true, refs );
+          else
+            way.skip( w );
+        }
+        ok = way.ok() && appendTags( keys, vals, stringCount, block.wayTags );
+
+        block.wayIds.append( id );
+        qint64 ref = 0;
+        for ( int i = 0; i < refs.size(); ++i )
+        {
+          ref += refs[i];
+          block.wayRefs.append( ref );
+        }
+        block.wayRefStart.append( block.wayRefs.size() );
+        block.wayTagStart.append( block.wayTags.size() / 2 );
+      }
+      else
+      {
+        group.skip( groupWireType );
+      }
+    }
+    ok = ok && group.ok();
+  }
+
+  if ( !ok || !blockMsg.ok() )
+    block.error = "Invalid PBF data block";
+}
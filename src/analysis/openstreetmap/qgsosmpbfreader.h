@@ -0,0 +1,94 @@
+/***************************************************************************
+  qgsosmpbfreader.h
+  --------------------------------------
+  Date                 : March 2016
+  Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef OSMPBFREADER_H
+#define OSMPBFREADER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include "qgsosmbase.h"
+
+class QIODevice;
+
+/**
+ * Nodes and ways of one OSMData block of an OpenStreetMap PBF file.
+ * Tags are stored as pairs of indices into the string table of the block.
+ */
+struct ANALYSIS_EXPORT QgsOSMPbfBlock
+{
+  //! blob as read from the file, cleared by decoding
+  QByteArray blob;
+  //! set if the block could not be decoded
+  QString error;
+
+  //! string table of the block (UTF-8)
+  QList<QByteArray> strings;
+
+  QVector<QgsOSMId> nodeIds;
+  QVector<double> nodeLat;
+  QVector<double> nodeLon;
+  //! tags of node i are the pairs nodeTagStart[i] to nodeTagStart[i + 1] - 1 of nodeTags
+  QVector<int> nodeTagStart;
+  QVector<int> nodeTags;
+
+  QVector<QgsOSMId> wayIds;
+  //! nodes of way i are wayRefs[wayRefStart[i]] to wayRefs[wayRefStart[i + 1] - 1]
+  QVector<int> wayRefStart;
+  QVector<QgsOSMId> wayRefs;
+  //! tags of way i are the pairs wayTagStart[i] to wayTagStart[i + 1] - 1 of wayTags
+  QVector<int> wayTagStart;
+  QVector<int> wayTags;
+};
+
+/**
+ * @brief The QgsOSMPbfReader class reads the OpenStreetMap PBF format.
+ *
+ * Reading the blocks from the file and decoding them are separate steps, so that
+ * the (expensive) decoding of several blocks can run in parallel threads.
+ * Relations are skipped, like in the XML import.
+ */
+class ANALYSIS_EXPORT QgsOSMPbfReader
+{
+  public:
+    explicit QgsOSMPbfReader( QIODevice* device );
+
+    /** Returns true if the device starts like a PBF file. Does not consume any data */
+    static bool isPbf( QIODevice* device );
+
+    /**
+     * Reads the blobs of up to maxBlocks data blocks (header blocks are checked on the way).
+     * @return false on error (see errorString())
+     */
+    bool readBlocks( QVector<QgsOSMPbfBlock>& blocks, int maxBlocks );
+
+    bool atEnd() const { return mAtEnd; }
+    QString errorString() const { return mError; }
+
+    /** Decompresses and decodes the blob of the block. Does not use any shared state, so it may run in any thread */
+    static void decodeBlock( QgsOSMPbfBlock& block );
+
+  private:
+    QIODevice* mDevice;
+    bool mAtEnd;
+    QString mError;
+
+    bool readExactly( char* data, qint64 size );
+    bool checkHeaderBlock( const QByteArray& blob );
+    static bool uncompressBlob( const QByteArray& blob, QByteArray& data, QString& error );
+};
+
+#endif // OSMPBFREADER_H
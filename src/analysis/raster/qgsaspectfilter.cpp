@@ -16,6 +16,21 @@
  ***************************************************************************/
 
 #include "qgsaspectfilter.h"
+#include <QVector>
+
+static inline float aspectFromDerivatives( float derX, float derY, float outputNodataValue )
+{
+  if ( derX == outputNodataValue ||
+       derY == outputNodataValue ||
+       ( derX == 0.0 && derY == 0.0 ) )
+  {
+    return outputNodataValue;
+  }
+  else
+  {
+    return 180.0 + atan2( derX, derY ) * 180.0 / M_PI;
+  }
+}
 
 QgsAspectFilter::QgsAspectFilter( const QString& inputFile, const QString& outputFile, const QString& outputFormat , const QgsRectangle &filterRegion, const QgsCoordinateReferenceSystem& filterRegionCrs ) :
     QgsDerivativeFilter( inputFile, outputFile, outputFormat, filterRegion, filterRegionCrs )
@@ -35,16 +50,16 @@ float QgsAspectFilter::processNineCellWindow(
 {
   float derX = calcFirstDerX( x11, x21, x31, x12, x22, x32, x13, x23, x33 );
   float derY = calcFirstDerY( x11, x21, x31, x12, x22, x32, x13, x23, x33 );
+  return aspectFromDerivatives( derX, derY, mOutputNodataValue );
+}
 
-  if ( derX == mOutputNodataValue ||
-       derY == mOutputNodataValue ||
-       ( derX == 0.0 && derY == 0.0 ) )
-  {
-    return mOutputNodataValue;
-  }
-  else
+void QgsAspectFilter::processNineCellRow( float* scanLine1, float* scanLine2, float* scanLine3, float* resultLine, int nCells )
+{
+  QVector<float> derX( nCells ), derY( nCells );
+  calcFirstDerRow( scanLine1, scanLine2, scanLine3, derX.data(), derY.data(), nCells );
+  for ( int j = 0; j < nCells; ++j )
   {
-    return 180.0 + atan2( derX, derY ) * 180.0 / M_PI;
+    resultLine[j] = aspectFromDerivatives( derX[j], derY[j], mOutputNodataValue );
   }
 }
 
@@ -33,6 +33,9 @@ class ANALYSIS_EXPORT QgsAspectFilter: public QgsDerivativeFilter
                                  float* x12, float* x22, float* x32,
                                  float* x13, float* x23, float* x33 ) override;
 
+    /**Calculates the output values of a whole row of cells*/
+    void processNineCellRow( float* scanLine1, float* scanLine2, float* scanLine3, float* resultLine, int nCells ) override;
+
 };
 
 #endif // QGSASPECTFILTER_H
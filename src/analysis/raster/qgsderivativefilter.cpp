@@ -16,6 +16,7 @@
  ***************************************************************************/
 
 #include "qgsderivativefilter.h"
+#include <QVector>
 
 QgsDerivativeFilter::QgsDerivativeFilter( const QString& inputFile, const QString& outputFile, const QString& outputFormat , const QgsRectangle &filterRegion, const QgsCoordinateReferenceSystem& filterRegionCrs )
     : QgsNineCellFilter( inputFile, outputFile, outputFormat, filterRegion, filterRegionCrs )
@@ -162,7 +163,40 @@ float QgsDerivativeFilter::calcFirstDerY( float* x11, float* x21, float* x31, fl
   return sum / ( weight * mCellSizeY * mZFactor );
 }
 
-
-
-
-
+void QgsDerivativeFilter::calcFirstDerRow( float* scanLine1, float* scanLine2, float* scanLine3, float* derX, float* derY, int nCells )
+{
+  //the basic formula for all cells, remembering which windows contain nodata values
+  double denomX = 8 * mCellSizeX * mZFactor;
+  double denomY = 8 * mCellSizeY * mZFactor;
+  float nodata = mInputNodataValue;
+  QVector<unsigned char> hasNodata( nCells );
+  unsigned char* hasNodataData = hasNodata.data();
+  for ( int j = 0; j < nCells; ++j )
+  {
+    float x11 = scanLine1[j-1], x21 = scanLine1[j], x31 = scanLine1[j+1];
+    float x12 = scanLine2[j-1], x32 = scanLine2[j+1];
+    float x13 = scanLine3[j-1], x23 = scanLine3[j], x33 = scanLine3[j+1];
+    double sumX = ( x31 - x11 );
+    sumX += 2 * ( x32 - x12 );
+    sumX += ( x33 - x13 );
+    double sumY = ( x11 - x13 );
+    sumY += 2 * ( x21 - x23 );
+    sumY += ( x31 - x33 );
+    derX[j] = sumX / denomX;
+    derY[j] = sumY / denomY;
+    hasNodataData[j] = ( x11 == nodata ) | ( x21 == nodata ) | ( x31 == nodata ) | ( x12 == nodata ) |
+                       ( x32 == nodata ) | ( x13 == nodata ) | ( x23 == nodata ) | ( x33 == nodata );
+  }
+
+  //windows with nodata values need the weighted formulas
+  for ( int j = 0; j < nCells; ++j )
+  {
+    if ( hasNodataData[j] )
+    {
+      derX[j] = calcFirstDerX( &scanLine1[j-1], &scanLine1[j], &scanLine1[j+1], &scanLine2[j-1], &scanLine2[j],
+                               &scanLine2[j+1], &scanLine3[j-1], &scanLine3[j], &scanLine3[j+1] );
+      derY[j] = calcFirstDerY( &scanLine1[j-1], &scanLine1[j], &scanLine1[j+1], &scanLine2[j-1], &scanLine2[j],
+                               &scanLine2[j+1], &scanLine3[j-1], &scanLine3[j], &scanLine3[j+1] );
+    }
+  }
+}
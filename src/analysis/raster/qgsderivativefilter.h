@@ -36,6 +36,10 @@ class ANALYSIS_EXPORT QgsDerivativeFilter : public QgsNineCellFilter
     float calcFirstDerX( float* x11, float* x21, float* x31, float* x12, float* x22, float* x32, float* x13, float* x23, float* x33 );
     /**Calculates the first order derivative in y-direction according to Horn (1981)*/
     float calcFirstDerY( float* x11, float* x21, float* x31, float* x12, float* x22, float* x32, float* x13, float* x23, float* x33 );
+    /**Calculates the first order derivatives of a row of cells (see processNineCellRow). The results are the same as
+      calcFirstDerX and calcFirstDerY would give for each cell, but windows without nodata values are computed in a
+      single pass over the row which the compiler can vectorize*/
+    void calcFirstDerRow( float* scanLine1, float* scanLine2, float* scanLine3, float* derX, float* derY, int nCells );
 };
 
 #endif // QGSDERIVATIVEFILTER_H
@@ -16,6 +16,29 @@
  ***************************************************************************/
 
 #include "qgshillshadefilter.h"
+#include <QVector>
+
+static inline float hillshadeFromDerivatives( float derX, float derY, float lightAzimuth, float lightAngle, float outputNodataValue )
+{
+  if ( derX == outputNodataValue || derY == outputNodataValue )
+  {
+    return outputNodataValue;
+  }
+
+  float zenith_rad = lightAngle * M_PI / 180.0;
+  float slope_rad = atan( sqrt( derX * derX + derY * derY ) );
+  float azimuth_rad = lightAzimuth * M_PI / 180.0;
+  float aspect_rad = 0;
+  if ( derX == 0 && derY == 0 ) //aspect undefined, take a neutral value. Better solutions?
+  {
+    aspect_rad = azimuth_rad / 2.0;
+  }
+  else
+  {
+    aspect_rad = M_PI + atan2( derX, derY );
+  }
+  return qMax( 0.0, 255.0 * (( cos( zenith_rad ) * cos( slope_rad ) ) + ( sin( zenith_rad ) * sin( slope_rad ) * cos( azimuth_rad - aspect_rad ) ) ) );
+}
 
 QgsHillshadeFilter::QgsHillshadeFilter( const QString& inputFile, const QString& outputFile, const QString& outputFormat, double lightAzimuth,
                                         double lightAngle , const QgsRectangle &filterRegion, const QgsCoordinateReferenceSystem& filterRegionCrs )
@@ -35,23 +58,15 @@ float QgsHillshadeFilter::processNineCellWindow( float* x11, float* x21, float*
 {
   float derX = calcFirstDerX( x11, x21, x31, x12, x22, x32, x13, x23, x33 );
   float derY = calcFirstDerY( x11, x21, x31, x12, x22, x32, x13, x23, x33 );
+  return hillshadeFromDerivatives( derX, derY, mLightAzimuth, mLightAngle, mOutputNodataValue );
+}
 
-  if ( derX == mOutputNodataValue || derY == mOutputNodataValue )
-  {
-    return mOutputNodataValue;
-  }
-
-  float zenith_rad = mLightAngle * M_PI / 180.0;
-  float slope_rad = atan( sqrt( derX * derX + derY * derY ) );
-  float azimuth_rad = mLightAzimuth * M_PI / 180.0;
-  float aspect_rad = 0;
-  if ( derX == 0 && derY == 0 ) //aspect undefined, take a neutral value. Better solutions?
-  {
-    aspect_rad = azimuth_rad / 2.0;
-  }
-  else
+void QgsHillshadeFilter::processNineCellRow( float* scanLine1, float* scanLine2, float* scanLine3, float* resultLine, int nCells )
+{
+  QVector<float> derX( nCells ), derY( nCells );
+  calcFirstDerRow( scanLine1, scanLine2, scanLine3, derX.data(), derY.data(), nCells );
+  for ( int j = 0; j < nCells; ++j )
   {
-    aspect_rad = M_PI + atan2( derX, derY );
+    resultLine[j] = hillshadeFromDerivatives( derX[j], derY[j], mLightAzimuth, mLightAngle, mOutputNodataValue );
   }
-  return qMax( 0.0, 255.0 * (( cos( zenith_rad ) * cos( slope_rad ) ) + ( sin( zenith_rad ) * sin( slope_rad ) * cos( azimuth_rad - aspect_rad ) ) ) );
 }
@@ -167,24 +167,23 @@ int QgsNineCellFilter::processRaster( QProgressDialog* p )
     return 6;
   }
 
-  //keep only three scanlines in memory at a time
-  float* scanLine1 = ( float * ) CPLMalloc( sizeof( float ) * xSize );
-  float* scanLine2 = ( float * ) CPLMalloc( sizeof( float ) * xSize );
-  float* scanLine3 = ( float * ) CPLMalloc( sizeof( float ) * xSize );
-
-  float* resultLine = ( float * ) CPLMalloc( sizeof( float ) * xSize );
+  //process the raster in blocks of rows. Each block is read with one row above and below and padded with one
+  //column on each side, values outside the window (if the 3x3 window is on the border) are (input) nodata values
+  int paddedXSize = xSize + 2;
+  int blockRows = qBound( 1, ( 1 << 22 ) / paddedXSize, ySize );
+  float* inputBlock = ( float * ) CPLMalloc( sizeof( float ) * paddedXSize * ( blockRows + 2 ) );
+  float* resultBlock = ( float * ) CPLMalloc( sizeof( float ) * xSize * blockRows );
 
   if ( p )
   {
     p->setMaximum( ySize );
   }
 
-  //values outside the layer extent (if the 3x3 window is on the border) are sent to the processing method as (input) nodata values
-  for ( int i = 0; i < ySize; ++i )
+  for ( int blockStart = 0; blockStart < ySize; blockStart += blockRows )
   {
     if ( p )
     {
-      p->setValue( i );
+      p->setValue( blockStart );
     }
 
     if ( p && p->wasCanceled() )
@@ -192,59 +191,36 @@ int QgsNineCellFilter::processRaster( QProgressDialog* p )
       break;
     }
 
-    if ( i == 0 )
-    {
-      //fill scanline 1 with (input) nodata for the values above the first row and feed scanline2 with the first row
-      for ( int a = 0; a < xSize; ++a )
-      {
-        scanLine1[a] = mInputNodataValue;
-      }
-      CPLErr err = GDALRasterIO( rasterBand, GF_Read, colStart, rowStart, xSize, 1, scanLine2, xSize, 1, GDT_Float32, 0, 0 );
-      Q_UNUSED( err );
-    }
-    else
-    {
-      //normally fetch only scanLine3 and release scanline 1 if we move forward one row
-      CPLFree( scanLine1 );
-      scanLine1 = scanLine2;
-      scanLine2 = scanLine3;
-      scanLine3 = ( float * ) CPLMalloc( sizeof( float ) * xSize );
-    }
-
-    if ( i == ySize - 1 ) //fill the row below the bottom with nodata values
+    int nRows = qMin( blockRows, ySize - blockStart );
+    int readStart = qMax( blockStart - 1, 0 );
+    int readEnd = qMin( blockStart + nRows + 1, ySize );
+    for ( int i = 0, n = nRows + 2; i < n; ++i )
     {
-      for ( int a = 0; a < xSize; ++a )
+      int row = blockStart - 1 + i;
+      float* line = inputBlock + i * paddedXSize;
+      line[0] = mInputNodataValue;
+      line[paddedXSize - 1] = mInputNodataValue;
+      if ( row < readStart || row >= readEnd )
       {
-        scanLine3[a] = mInputNodataValue;
+        for ( int a = 1; a <= xSize; ++a )
+        {
+          line[a] = mInputNodataValue;
+        }
       }
     }
-    else
-    {
-      CPLErr err = GDALRasterIO( rasterBand, GF_Read, colStart, rowStart + i + 1, xSize, 1, scanLine3, xSize, 1, GDT_Float32, 0, 0 );
-      Q_UNUSED( err );
-    }
+    //read all rows of the block at once, directly into the padded buffer
+    float* readTarget = inputBlock + ( readStart - blockStart + 1 ) * paddedXSize + 1;
+    CPLErr err = GDALRasterIO( rasterBand, GF_Read, colStart, rowStart + readStart, xSize, readEnd - readStart, readTarget, xSize, readEnd - readStart, GDT_Float32, 0, sizeof( float ) * paddedXSize );
+    Q_UNUSED( err );
 
-#pragma omp parallel for schedule(static)
-    for ( int j = 0; j < xSize; ++j )
+#pragma omp parallel for schedule(dynamic, 4)
+    for ( int i = 0; i < nRows; ++i )
     {
-      if ( j == 0 )
-      {
-        resultLine[j] = processNineCellWindow( &mInputNodataValue, &scanLine1[j], &scanLine1[j+1], &mInputNodataValue, &scanLine2[j],
-                                               &scanLine2[j+1], &mInputNodataValue, &scanLine3[j], &scanLine3[j+1] );
-      }
-      else if ( j == xSize - 1 )
-      {
-        resultLine[j] = processNineCellWindow( &scanLine1[j-1], &scanLine1[j], &mInputNodataValue, &scanLine2[j-1], &scanLine2[j],
-                                               &mInputNodataValue, &scanLine3[j-1], &scanLine3[j], &mInputNodataValue );
-      }
-      else
-      {
-        resultLine[j] = processNineCellWindow( &scanLine1[j-1], &scanLine1[j], &scanLine1[j+1], &scanLine2[j-1], &scanLine2[j],
-                                               &scanLine2[j+1], &scanLine3[j-1], &scanLine3[j], &scanLine3[j+1] );
-      }
+      processNineCellRow( inputBlock + i * paddedXSize + 1, inputBlock + ( i + 1 ) * paddedXSize + 1, inputBlock + ( i + 2 ) * paddedXSize + 1,
+                          resultBlock + i * xSize, xSize );
     }
 
-    CPLErr err = GDALRasterIO( outputRasterBand, GF_Write, 0, i, xSize, 1, resultLine, xSize, 1, GDT_Float32, 0, 0 );
+    err = GDALRasterIO( outputRasterBand, GF_Write, 0, blockStart, xSize, nRows, resultBlock, xSize, nRows, GDT_Float32, 0, 0 );
     Q_UNUSED( err );
   }
 
@@ -253,10 +229,8 @@ int QgsNineCellFilter::processRaster( QProgressDialog* p )
     p->setValue( ySize );
   }
 
-  CPLFree( resultLine );
-  CPLFree( scanLine1 );
-  CPLFree( scanLine2 );
-  CPLFree( scanLine3 );
+  CPLFree( inputBlock );
+  CPLFree( resultBlock );
 
   GDALClose( inputDataset );
 
@@ -271,6 +245,15 @@ int QgsNineCellFilter::processRaster( QProgressDialog* p )
   return 0;
 }
 
+void QgsNineCellFilter::processNineCellRow( float* scanLine1, float* scanLine2, float* scanLine3, float* resultLine, int nCells )
+{
+  for ( int j = 0; j < nCells; ++j )
+  {
+    resultLine[j] = processNineCellWindow( &scanLine1[j-1], &scanLine1[j], &scanLine1[j+1], &scanLine2[j-1], &scanLine2[j],
+                                           &scanLine2[j+1], &scanLine3[j-1], &scanLine3[j], &scanLine3[j+1] );
+  }
+}
+
 GDALDatasetH QgsNineCellFilter::openInputFile( int& nCellsX, int& nCellsY )
 {
   GDALDatasetH inputDataset = GDALOpen( TO8F( mInputFile ), GA_ReadOnly );
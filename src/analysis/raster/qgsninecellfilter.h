@@ -60,6 +60,12 @@ class ANALYSIS_EXPORT QgsNineCellFilter
                                          float* x12, float* x22, float* x32,
                                          float* x13, float* x23, float* x33 ) = 0;
 
+    /**Calculates the output values of a row of cells from the rows above, at and below it. The input rows are padded
+      with a nodata cell on either side, i.e. scanLine1[-1] and scanLine1[nCells] are valid. Rows are processed
+      concurrently. The default implementation calls processNineCellWindow for each cell, subclasses can override
+      it with a kernel which processes the whole row at once*/
+    virtual void processNineCellRow( float* scanLine1, float* scanLine2, float* scanLine3, float* resultLine, int nCells );
+
   private:
     //default constructor forbidden. We need input file, output file and format obligatory
     QgsNineCellFilter();
@@ -68,6 +68,11 @@ class ANALYSIS_EXPORT QgsRasterCalcNode
     ~QgsRasterCalcNode();
 
     Type type() const { return mType; }
+    Operator op() const { return mOperator; }
+    double number() const { return mNumber; }
+    const QString& rasterName() const { return mRasterName; }
+    const QgsRasterCalcNode* left() const { return mLeft; }
+    const QgsRasterCalcNode* right() const { return mRight; }
 
     //set left node
     void setLeft( QgsRasterCalcNode* left ) { delete mLeft; mLeft = left; }
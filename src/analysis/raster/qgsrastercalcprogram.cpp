@@ -0,0 +1,344 @@
+/***************************************************************************
+    qgsrastercalcprogram.cpp
+    ------------------------
+    begin                : March 2016
+    copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+#include "qgsrastercalcprogram.h"
+#include "qgsrastermatrix.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+// Float cells only compare equal to nodata values which are representable as float.
+// Other nodata values are replaced by NaN, which never compares equal.
+static float nodataCompareValue( double nodata )
+{
+  if ( nodata < -FLT_MAX || nodata > FLT_MAX )
+  {
+    return std::numeric_limits<float>::quiet_NaN();
+  }
+  float f = static_cast<float>( nodata );
+  return static_cast<double>( f ) == nodata ? f : std::numeric_limits<float>::quiet_NaN();
+}
+
+static bool powerValid( double base, double power )
+{
+  return !(( base == 0 && power < 0 ) || ( base < 0 && ( power - floor( power ) ) > 0 ) );
+}
+
+// Per cell operators, same arithmetic as QgsRasterMatrix
+
+struct OpPlus { static float apply( float x, float y, float ) { return x + y; } };
+struct OpMinus { static float apply( float x, float y, float ) { return x - y; } };
+struct OpMul { static float apply( float x, float y, float ) { return x * y; } };
+struct OpDiv { static float apply( float x, float y, float nodata ) { return y == 0 ? nodata : x / y; } };
+struct OpPow { static float apply( float x, float y, float nodata ) { return powerValid( x, y ) ? static_cast<float>( pow( static_cast<double>( x ), static_cast<double>( y ) ) ) : nodata; } };
+struct OpPowF { static float apply( float x, float y, float nodata ) { return powerValid( x, y ) ? std::pow( x, y ) : nodata; } };
+struct OpEQ { static float apply( float x, float y, float ) { return x == y ? 1.0f : 0.0f; } };
+struct OpNE { static float apply( float x, float y, float ) { return x == y ? 0.0f : 1.0f; } };
+struct OpGT { static float apply( float x, float y, float ) { return x > y ? 1.0f : 0.0f; } };
+struct OpLT { static float apply( float x, float y, float ) { return x < y ? 1.0f : 0.0f; } };
+struct OpGE { static float apply( float x, float y, float ) { return x >= y ? 1.0f : 0.0f; } };
+struct OpLE { static float apply( float x, float y, float ) { return x <= y ? 1.0f : 0.0f; } };
+struct OpAnd { static float apply( float x, float y, float ) { return x && y ? 1.0f : 0.0f; } };
+struct OpOr { static float apply( float x, float y, float ) { return x || y ? 1.0f : 0.0f; } };
+
+struct OpSqrt { static float apply( float x, float nodata ) { return x < 0 ? nodata : static_cast<float>( sqrt( static_cast<double>( x ) ) ); } };
+struct OpSin { static float apply( float x, float ) { return static_cast<float>( sin( static_cast<double>( x ) ) ); } };
+struct OpCos { static float apply( float x, float ) { return static_cast<float>( cos( static_cast<double>( x ) ) ); } };
+struct OpTan { static float apply( float x, float ) { return static_cast<float>( tan( static_cast<double>( x ) ) ); } };
+struct OpASin { static float apply( float x, float ) { return static_cast<float>( asin( static_cast<double>( x ) ) ); } };
+struct OpACos { static float apply( float x, float ) { return static_cast<float>( acos( static_cast<double>( x ) ) ); } };
+struct OpATan { static float apply( float x, float ) { return static_cast<float>( atan( static_cast<double>( x ) ) ); } };
+struct OpSign { static float apply( float x, float ) { return -x; } };
+
+// A null data pointer denotes a scalar operand. Nodata scalars never get here, they are resolved at compile time
+template<class Op>
+static void binaryOperation( const float* a, float aValue, float aNodata, const float* b, float bValue, float bNodata, float nodata, float* r, int n )
+{
+  if ( !a )
+  {
+    for ( int i = 0; i < n; ++i )
+    {
+      float y = b[i];
+      float v = Op::apply( aValue, y, nodata );
+      r[i] = y == bNodata ? nodata : v;
+    }
+  }
+  else if ( !b )
+  {
+    for ( int i = 0; i < n; ++i )
+    {
+      float x = a[i];
+      float v = Op::apply( x, bValue, nodata );
+      r[i] = x == aNodata ? nodata : v;
+    }
+  }
+  else
+  {
+    for ( int i = 0; i < n; ++i )
+    {
+      float x = a[i];
+      float y = b[i];
+      float v = Op::apply( x, y, nodata );
+      r[i] = ( x == aNodata || y == bNodata ) ? nodata : v;
+    }
+  }
+}
+
+template<class Op>
+static void unaryOperation( const float* a, float aNodata, float nodata, float* r, int n )
+{
+  for ( int i = 0; i < n; ++i )
+  {
+    float x = a[i];
+    float v = Op::apply( x, nodata );
+    r[i] = x == aNodata ? x : v;
+  }
+}
+
+QgsRasterCalcProgram::QgsRasterCalcProgram()
+    : mNumSlots( 0 )
+{
+  mResult.type = Scalar;
+  mResult.index = 0;
+  mResult.value = 0;
+  mResult.nodata = -FLT_MAX;
+}
+
+bool QgsRasterCalcProgram::compile( const QgsRasterCalcNode* node, const QMap<QString, int>& inputs, const QVector<double>& inputNodata )
+{
+  mInstructions.clear();
+  mNumSlots = 0;
+  return node && compileNode( node, 0, inputs, inputNodata, mResult );
+}
+
+bool QgsRasterCalcProgram::referencesRaster( const QgsRasterCalcNode* node )
+{
+  if ( !node )
+  {
+    return false;
+  }
+  return node->type() == QgsRasterCalcNode::tRasterRef || referencesRaster( node->left() ) || referencesRaster( node->right() );
+}
+
+bool QgsRasterCalcProgram::compileNode( const QgsRasterCalcNode* node, int slot, const QMap<QString, int>& inputs, const QVector<double>& inputNodata, Operand& result )
+{
+  result.index = 0;
+  result.value = 0;
+
+  if ( node->type() == QgsRasterCalcNode::tRasterRef )
+  {
+    QMap<QString, int>::const_iterator it = inputs.find( node->rasterName() );
+    if ( it == inputs.constEnd() )
+    {
+      return false;
+    }
+    result.type = Input;
+    result.index = it.value();
+    result.nodata = inputNodata[it.value()];
+    return true;
+  }
+
+  if ( !referencesRaster( node ) )
+  {
+    // Constant subexpression: fold it with the matrix arithmetic
+    QMap<QString, QgsRasterMatrix*> noRasterData;
+    QgsRasterMatrix number;
+    if ( !node->calculate( noRasterData, number ) )
+    {
+      return false;
+    }
+    result.type = Scalar;
+    result.value = static_cast<float>( number.number() );
+    result.nodata = number.nodataValue();
+    return true;
+  }
+
+  if ( node->type() != QgsRasterCalcNode::tOperator || !node->left() )
+  {
+    return false;
+  }
+
+  Instruction ins;
+  ins.op = node->op();
+  ins.dst = slot;
+  ins.b.type = Scalar;
+  ins.b.index = 0;
+  ins.b.value = 0;
+  ins.b.nodata = -FLT_MAX;
+  if ( !compileNode( node->left(), slot, inputs, inputNodata, ins.a ) )
+  {
+    return false;
+  }
+
+  switch ( ins.op )
+  {
+    case QgsRasterCalcNode::opSQRT:
+    case QgsRasterCalcNode::opSIN:
+    case QgsRasterCalcNode::opCOS:
+    case QgsRasterCalcNode::opTAN:
+    case QgsRasterCalcNode::opASIN:
+    case QgsRasterCalcNode::opACOS:
+    case QgsRasterCalcNode::opATAN:
+    case QgsRasterCalcNode::opSIGN:
+      result.nodata = ins.a.nodata;
+      break;
+    case QgsRasterCalcNode::opPLUS:
+    case QgsRasterCalcNode::opMINUS:
+    case QgsRasterCalcNode::opMUL:
+    case QgsRasterCalcNode::opDIV:
+    case QgsRasterCalcNode::opPOW:
+    case QgsRasterCalcNode::opEQ:
+    case QgsRasterCalcNode::opNE:
+    case QgsRasterCalcNode::opGT:
+    case QgsRasterCalcNode::opLT:
+    case QgsRasterCalcNode::opGE:
+    case QgsRasterCalcNode::opLE:
+    case QgsRasterCalcNode::opAND:
+    case QgsRasterCalcNode::opOR:
+      if ( !node->right() || !compileNode( node->right(), ins.a.type == Slot ? slot + 1 : slot, inputs, inputNodata, ins.b ) )
+      {
+        return false;
+      }
+      // A number combined with a matrix takes the nodata value of the matrix. If the number
+      // is nodata (compared as QgsRasterMatrix does), the whole result is nodata
+      if ( ins.a.type == Scalar )
+      {
+        result.nodata = ins.b.nodata;
+        if ( static_cast<double>( ins.a.value ) == ins.b.nodata )
+        {
+          ins.op = QgsRasterCalcNode::opNONE;
+          ins.a.nodata = result.nodata;
+        }
+      }
+      else
+      {
+        result.nodata = ins.a.nodata;
+        if ( ins.b.type == Scalar && static_cast<double>( ins.b.value ) == ins.b.nodata )
+        {
+          ins.op = QgsRasterCalcNode::opNONE;
+        }
+      }
+      break;
+    default:
+      return false;
+  }
+
+  mInstructions.append( ins );
+  mNumSlots = qMax( mNumSlots, slot + 1 );
+  result.type = Slot;
+  result.index = slot;
+  return true;
+}
+
+void QgsRasterCalcProgram::evaluate( const float* const* inputs, int n, float* scratch, float outputNodata, float* output ) const
+{
+  foreach ( const Instruction& ins, mInstructions )
+  {
+    float* r = scratch + ins.dst * sStripSize;
+    const float* a = ins.a.type == Input ? inputs[ins.a.index] : ins.a.type == Slot ? scratch + ins.a.index * sStripSize : 0;
+    const float* b = ins.b.type == Input ? inputs[ins.b.index] : ins.b.type == Slot ? scratch + ins.b.index * sStripSize : 0;
+    float aNodata = ins.a.type == Scalar ? std::numeric_limits<float>::quiet_NaN() : nodataCompareValue( ins.a.nodata );
+    float bNodata = ins.b.type == Scalar ? std::numeric_limits<float>::quiet_NaN() : nodataCompareValue( ins.b.nodata );
+    float nodata = static_cast<float>( ins.a.type == Scalar ? ins.b.nodata : ins.a.nodata );
+
+    switch ( ins.op )
+    {
+      case QgsRasterCalcNode::opNONE:
+        std::fill( r, r + n, static_cast<float>( ins.a.nodata ) );
+        break;
+      case QgsRasterCalcNode::opPLUS:
+        binaryOperation<OpPlus>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opMINUS:
+        binaryOperation<OpMinus>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opMUL:
+        binaryOperation<OpMul>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opDIV:
+        binaryOperation<OpDiv>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opPOW:
+        // QgsRasterMatrix uses the float power function if one of the operands is a number
+        if ( a && b )
+          binaryOperation<OpPow>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        else
+          binaryOperation<OpPowF>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opEQ:
+        binaryOperation<OpEQ>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opNE:
+        binaryOperation<OpNE>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opGT:
+        binaryOperation<OpGT>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opLT:
+        binaryOperation<OpLT>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opGE:
+        binaryOperation<OpGE>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opLE:
+        binaryOperation<OpLE>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opAND:
+        binaryOperation<OpAnd>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opOR:
+        binaryOperation<OpOr>( a, ins.a.value, aNodata, b, ins.b.value, bNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opSQRT:
+        unaryOperation<OpSqrt>( a, aNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opSIN:
+        unaryOperation<OpSin>( a, aNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opCOS:
+        unaryOperation<OpCos>( a, aNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opTAN:
+        unaryOperation<OpTan>( a, aNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opASIN:
+        unaryOperation<OpASin>( a, aNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opACOS:
+        unaryOperation<OpACos>( a, aNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opATAN:
+        unaryOperation<OpATan>( a, aNodata, nodata, r, n );
+        break;
+      case QgsRasterCalcNode::opSIGN:
+        unaryOperation<OpSign>( a, aNodata, nodata, r, n );
+        break;
+    }
+  }
+
+  //replace the nodata values of the result with the output nodata value
+  if ( mResult.type == Scalar )
+  {
+    std::fill( output, output + n, static_cast<double>( mResult.value ) == mResult.nodata ? outputNodata : mResult.value );
+    return;
+  }
+  const float* res = mResult.type == Input ? inputs[mResult.index] : scratch + mResult.index * sStripSize;
+  float resNodata = nodataCompareValue( mResult.nodata );
+  for ( int i = 0; i < n; ++i )
+  {
+    float v = res[i];
+    output[i] = v == resNodata ? outputNodata : v;
+  }
+}
@@ -0,0 +1,94 @@
+/***************************************************************************
+                          qgsrastercalcprogram.h
+            Compiled form of a raster calculator tree
+                          --------------------
+    begin                : March 2016
+    copyright            : (C) 2016 by Sourcepole AG
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSRASTERCALCPROGRAM_H
+#define QGSRASTERCALCPROGRAM_H
+
+#include "qgsrastercalcnode.h"
+#include <QMap>
+#include <QVector>
+
+/** Flattened form of a QgsRasterCalcNode tree, which evaluates the whole formula
+  * over a strip of cells in one pass. Intermediate results are kept in a small
+  * scratch buffer provided by the caller instead of a new matrix per operator,
+  * constant subexpressions are folded at compile time and each operator is a
+  * branch free loop which the compiler can vectorize.
+  * The results (including the nodata propagation) are the same as the ones of
+  * QgsRasterCalcNode::calculate. A compiled program can be evaluated from several
+  * threads at once, each with its own scratch buffer.
+  */
+class ANALYSIS_EXPORT QgsRasterCalcProgram
+{
+  public:
+    /** Maximum number of cells evaluated at once. Small enough for the scratch buffer to stay in the cache */
+    static const int sStripSize = 1024;
+
+    QgsRasterCalcProgram();
+
+    /** Compiles the tree.
+      @param node root of the formula tree
+      @param inputs maps the raster references to the index of the corresponding input
+      @param inputNodata nodata value of each input
+      @return false if the tree references an unknown raster or contains an unknown operator*/
+    bool compile( const QgsRasterCalcNode* node, const QMap<QString, int>& inputs, const QVector<double>& inputNodata );
+
+    /** Number of floats the scratch buffer passed to evaluate() must hold */
+    int scratchSize() const { return mNumSlots * sStripSize; }
+
+    /** Evaluates n (at most sStripSize) cells.
+      @param inputs pointers to the n cells of each input
+      @param n number of cells
+      @param scratch buffer of scratchSize() floats
+      @param outputNodata value written for cells which evaluate to nodata
+      @param output receives the n results*/
+    void evaluate( const float* const* inputs, int n, float* scratch, float outputNodata, float* output ) const;
+
+  private:
+    enum OperandType
+    {
+      Input,
+      Slot,
+      Scalar
+    };
+
+    struct Operand
+    {
+      OperandType type;
+      int index;
+      float value;
+      //! nodata value as tracked by QgsRasterMatrix
+      double nodata;
+    };
+
+    struct Instruction
+    {
+      //! opNONE fills the destination with the nodata value of a
+      QgsRasterCalcNode::Operator op;
+      Operand a;
+      Operand b;
+      int dst;
+    };
+
+    QVector<Instruction> mInstructions;
+    Operand mResult;
+    int mNumSlots;
+
+    bool compileNode( const QgsRasterCalcNode* node, int slot, const QMap<QString, int>& inputs, const QVector<double>& inputNodata, Operand& result );
+    static bool referencesRaster( const QgsRasterCalcNode* node );
+};
+
+#endif // QGSRASTERCALCPROGRAM_H
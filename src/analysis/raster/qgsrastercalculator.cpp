@@ -17,8 +17,8 @@
 
 #include "qgsrastercalculator.h"
 #include "qgsrastercalcnode.h"
+#include "qgsrastercalcprogram.h"
 #include "qgsrasterlayer.h"
-#include "qgsrastermatrix.h"
 
 #include <QProgressDialog>
 #include <QFile>
@@ -67,8 +67,9 @@ int QgsRasterCalculator::processCalculation( QProgressDialog* p )
   outputGeoTransform( targetGeoTransform );
 
   //open all input rasters for reading
-  QMap< QString, GDALRasterBandH > mInputRasterBands; //raster references and corresponding scanline data
-  QMap< QString, QgsRasterMatrix* > inputScanLineData; //stores raster references and corresponding scanline data
+  QMap< QString, int > inputIndices; //raster references and corresponding input index
+  QVector< GDALRasterBandH > inputRasterBands;
+  QVector< double > inputNodataValues;
   QVector< GDALDatasetH > mInputDatasets; //raster references and corresponding dataset
 
   QVector<QgsRasterCalculatorEntry>::const_iterator it = mRasterEntries.constBegin();
@@ -111,8 +112,22 @@ int QgsRasterCalculator::processCalculation( QProgressDialog* p )
     int nodataSuccess;
     double nodataValue = GDALGetRasterNoDataValue( inputRasterBand, &nodataSuccess );
 
-    mInputRasterBands.insert( it->ref, inputRasterBand );
-    inputScanLineData.insert( it->ref, new QgsRasterMatrix( mNumOutputColumns, 1, new float[mNumOutputColumns], nodataValue ) );
+    inputIndices.insert( it->ref, inputRasterBands.size() );
+    inputRasterBands.append( inputRasterBand );
+    inputNodataValues.append( nodataValue );
+  }
+
+  //flatten the formula tree, so that it can be evaluated in one pass per block of cells
+  QgsRasterCalcProgram program;
+  if ( !program.compile( calcNode, inputIndices, inputNodataValues ) )
+  {
+    delete calcNode;
+    QVector< GDALDatasetH >::iterator datasetIt = mInputDatasets.begin();
+    for ( ; datasetIt != mInputDatasets.end(); ++ datasetIt )
+    {
+      GDALClose( *datasetIt );
+    }
+    return 4;
   }
 
   //open output dataset for writing
@@ -151,21 +166,35 @@ int QgsRasterCalculator::processCalculation( QProgressDialog* p )
   float outputNodataValue = -std::numeric_limits<float>::max();
   GDALSetRasterNoDataValue( outputRasterBand, outputNodataValue );
 
-  float* resultScanLine = ( float * ) CPLMalloc( sizeof( float ) * mNumOutputColumns );
-
   if ( p )
   {
     p->setMaximum( mNumOutputRows );
   }
 
-  QgsRasterMatrix resultMatrix;
+  //read, calculate and write blocks of about one million cells
+  int nInputs = inputRasterBands.size();
+  int blockRows = qBound( 1, ( 1 << 20 ) / qMax( 1, mNumOutputColumns ), qMax( 1, mNumOutputRows ) );
+  int blockSize = blockRows * mNumOutputColumns;
+  QVector< QVector<float> > inputBlocks( nInputs );
+  QVector< float* > inputBlockData( nInputs );
+  QVector< QVector<double> > sourceTransformations( nInputs, QVector<double>( 6 ) );
+  for ( int k = 0; k < nInputs; ++k )
+  {
+    inputBlocks[k].resize( blockSize );
+    inputBlockData[k] = inputBlocks[k].data();
+    if ( GDALGetGeoTransform( GDALGetBandDataset( inputRasterBands[k] ), sourceTransformations[k].data() ) != CE_None )
+    {
+      qWarning( "GDALGetGeoTransform failed!" );
+    }
+  }
+  QVector<float> outputBlock( blockSize );
+  float* outputBlockData = outputBlock.data();
 
-  //read / write line by line
-  for ( int i = 0; i < mNumOutputRows; ++i )
+  for ( int row = 0; row < mNumOutputRows; row += blockRows )
   {
     if ( p )
     {
-      p->setValue( i );
+      p->setValue( row );
     }
 
     if ( p && p->wasCanceled() )
@@ -173,60 +202,40 @@ int QgsRasterCalculator::processCalculation( QProgressDialog* p )
       break;
     }
 
+    int nRows = qMin( blockRows, mNumOutputRows - row );
+    int nCells = nRows * mNumOutputColumns;
+
     //fill buffers
-    QMap< QString, QgsRasterMatrix* >::iterator bufferIt = inputScanLineData.begin();
-    for ( ; bufferIt != inputScanLineData.end(); ++bufferIt )
+    for ( int k = 0; k < nInputs; ++k )
     {
-      double sourceTransformation[6];
-      GDALRasterBandH sourceRasterBand = mInputRasterBands[bufferIt.key()];
-      if ( GDALGetGeoTransform( GDALGetBandDataset( sourceRasterBand ), sourceTransformation ) != CE_None )
-      {
-        qWarning( "GDALGetGeoTransform failed!" );
-      }
-
       //the function readRasterPart calls GDALRasterIO (and ev. does some conversion if raster transformations are not the same)
-      readRasterPart( targetGeoTransform, 0, i, mNumOutputColumns, 1, sourceTransformation, sourceRasterBand, bufferIt.value()->data() );
+      readRasterPart( targetGeoTransform, 0, row, mNumOutputColumns, nRows, sourceTransformations[k].data(), inputRasterBands[k], inputBlockData[k] );
     }
 
-    if ( calcNode->calculate( inputScanLineData, resultMatrix ) )
+    //evaluate the formula on strips of cells in parallel, each thread with its own scratch buffer
+    int nStrips = ( nCells + QgsRasterCalcProgram::sStripSize - 1 ) / QgsRasterCalcProgram::sStripSize;
+#pragma omp parallel
     {
-      bool resultIsNumber = resultMatrix.isNumber();
-      float* calcData;
-
-      if ( resultIsNumber ) //scalar result. Insert number for every pixel
+      QVector<float> scratch( program.scratchSize() );
+      QVector<const float*> stripInputs( nInputs );
+#pragma omp for schedule(static)
+      for ( int strip = 0; strip < nStrips; ++strip )
       {
-        calcData = new float[mNumOutputColumns];
-        for ( int j = 0; j < mNumOutputColumns; ++j )
+        int offset = strip * QgsRasterCalcProgram::sStripSize;
+        int n = qMin( QgsRasterCalcProgram::sStripSize, nCells - offset );
+        for ( int k = 0; k < nInputs; ++k )
         {
-          calcData[j] = resultMatrix.number();
+          stripInputs[k] = inputBlockData[k] + offset;
         }
-      }
-      else //result is real matrix
-      {
-        calcData = resultMatrix.data();
-      }
-
-      //replace all matrix nodata values with output nodatas
-      for ( int j = 0; j < mNumOutputColumns; ++j )
-      {
-        if ( calcData[j] == resultMatrix.nodataValue() )
-        {
-          calcData[j] = outputNodataValue;
-        }
-      }
-
-      //write scanline to the dataset
-      if ( GDALRasterIO( outputRasterBand, GF_Write, 0, i, mNumOutputColumns, 1, calcData, mNumOutputColumns, 1, GDT_Float32, 0, 0 ) != CE_None )
-      {
-        qWarning( "RasterIO error!" );
-      }
-
-      if ( resultIsNumber )
-      {
-        delete[] calcData;
+        program.evaluate( stripInputs.constData(), n, scratch.data(), outputNodataValue, outputBlockData + offset );
       }
     }
 
+    //write the block to the dataset
+    if ( GDALRasterIO( outputRasterBand, GF_Write, 0, row, mNumOutputColumns, nRows, outputBlockData, mNumOutputColumns, nRows, GDT_Float32, 0, 0 ) != CE_None )
+    {
+      qWarning( "RasterIO error!" );
+    }
   }
 
   if ( p )
@@ -236,12 +245,6 @@ int QgsRasterCalculator::processCalculation( QProgressDialog* p )
 
   //close datasets and release memory
   delete calcNode;
-  QMap< QString, QgsRasterMatrix* >::iterator bufferIt = inputScanLineData.begin();
-  for ( ; bufferIt != inputScanLineData.end(); ++bufferIt )
-  {
-    delete bufferIt.value();
-  }
-  inputScanLineData.clear();
 
   QVector< GDALDatasetH >::iterator datasetIt = mInputDatasets.begin();
   for ( ; datasetIt != mInputDatasets.end(); ++ datasetIt )
@@ -256,7 +259,6 @@ int QgsRasterCalculator::processCalculation( QProgressDialog* p )
     return 3;
   }
   GDALClose( outputDataset );
-  CPLFree( resultScanLine );
   return 0;
 }
 
@@ -388,11 +390,11 @@ void QgsRasterCalculator::readRasterPart( double* targetGeotransform, int xOffse
       if ( sourceIndexX >= 0 && sourceIndexX < nSourcePixelsX
            && sourceIndexY >= 0 && sourceIndexY < nSourcePixelsY )
       {
-        rasterBuffer[j + i*nRows] = sourceRaster[ sourceIndexX  + nSourcePixelsX * sourceIndexY ];
+        rasterBuffer[j + i*nCols] = sourceRaster[ sourceIndexX  + nSourcePixelsX * sourceIndexY ];
       }
       else
       {
-        rasterBuffer[j + i*j] = nodataValue;
+        rasterBuffer[j + i*nCols] = nodataValue;
       }
       targetPixelX += targetGeotransform[1];
     }
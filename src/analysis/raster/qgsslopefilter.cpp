@@ -16,6 +16,17 @@
  ***************************************************************************/
 
 #include "qgsslopefilter.h"
+#include <QVector>
+
+static inline float slopeFromDerivatives( float derX, float derY, float outputNodataValue )
+{
+  if ( derX == outputNodataValue || derY == outputNodataValue )
+  {
+    return outputNodataValue;
+  }
+
+  return atan( sqrt( derX * derX + derY * derY ) ) * 180.0 / M_PI;
+}
 
 QgsSlopeFilter::QgsSlopeFilter( const QString& inputFile, const QString& outputFile, const QString& outputFormat , const QgsRectangle &filterRegion, const QgsCoordinateReferenceSystem& filterRegionCrs )
     : QgsDerivativeFilter( inputFile, outputFile, outputFormat, filterRegion, filterRegionCrs )
@@ -33,12 +44,16 @@ float QgsSlopeFilter::processNineCellWindow( float* x11, float* x21, float* x31,
 {
   float derX = calcFirstDerX( x11, x21, x31, x12, x22, x32, x13, x23, x33 );
   float derY = calcFirstDerY( x11, x21, x31, x12, x22, x32, x13, x23, x33 );
+  return slopeFromDerivatives( derX, derY, mOutputNodataValue );
+}
 
-  if ( derX == mOutputNodataValue || derY == mOutputNodataValue )
+void QgsSlopeFilter::processNineCellRow( float* scanLine1, float* scanLine2, float* scanLine3, float* resultLine, int nCells )
+{
+  QVector<float> derX( nCells ), derY( nCells );
+  calcFirstDerRow( scanLine1, scanLine2, scanLine3, derX.data(), derY.data(), nCells );
+  for ( int j = 0; j < nCells; ++j )
   {
-    return mOutputNodataValue;
+    resultLine[j] = slopeFromDerivatives( derX[j], derY[j], mOutputNodataValue );
   }
-
-  return atan( sqrt( derX * derX + derY * derY ) ) * 180.0 / M_PI;
 }
 
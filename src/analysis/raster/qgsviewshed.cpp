@@ -20,36 +20,631 @@
 #include "qgscoordinatereferencesystem.h"
 #include "qgscoordinatetransform.h"
 #include "qgsdistancearea.h"
+#include "qgsfeedback.h"
 #include <qmath.h>
 #include <gdal.h>
 #include <cpl_string.h>
 #include <cstring>
 #include <limits>
+#include <QEventLoop>
+#include <QFutureWatcher>
+#include <QPolygon>
 #include <QProgressDialog>
+#include <QThreadPool>
+#include <QTimer>
 #include <QVector>
+#include <QtConcurrentMap>
 
 
-static inline double geoToPixelX( double gtrans[6], double x, double y )
+static inline double geoToPixelX( const double gtrans[6], double x, double y )
 {
   return ( -gtrans[0] * gtrans[5] + gtrans[2] * gtrans[3] - gtrans[2] * y + gtrans[5] * x ) / ( gtrans[1] * gtrans[5] - gtrans[2] * gtrans[4] );
 }
 
-static inline double geoToPixelY( double gtrans[6], double x, double y )
+static inline double geoToPixelY( const double gtrans[6], double x, double y )
 {
   return ( -gtrans[0] * gtrans[4] + gtrans[1] * gtrans[3] - gtrans[1] * y + gtrans[4] * x ) / ( gtrans[2] * gtrans[4] - gtrans[1] * gtrans[5] );
 }
 
-static inline double pixelToGeoX( double gtrans[6], double px, double py )
+static inline double pixelToGeoX( const double gtrans[6], double px, double py )
 {
   return gtrans[0] + px * gtrans[1] + py * gtrans[2];
 }
 
-static inline double pixelToGeoY( double gtrans[6], double px, double py )
+static inline double pixelToGeoY( const double gtrans[6], double px, double py )
 {
   return gtrans[3] + px * gtrans[4] + py * gtrans[5];
 }
 
-bool QgsViewshed::computeViewshed( const QString &inputFile, const QString &outputFile, const QString &outputFormat, QgsPoint observerPos, const QgsCoordinateReferenceSystem &observerPosCrs, double observerHeight, double targetHeight, bool heightRelToTerr, double radius, const QGis::UnitType distanceElevUnit, const QVector<QgsPoint> &filterRegion, bool displayVisible, int accuracyFactor, QProgressDialog *progress )
+///////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+  /**
+   * Heightmap window, stored as separately allocated strips of rows.
+   * Values are addressed by their linear index in the window, as if the
+   * window were one contiguous buffer.
+   */
+  class Heightmap
+  {
+    public:
+      Heightmap() : mWidth( 0 ), mHeight( 0 ), mStripRows( 0 ), mStripSize( 0 ) {}
+
+      bool allocate( int width, int height, float fillValue )
+      {
+        // Indices are ints
+        if ( qint64( width ) * qint64( height ) > qint64( std::numeric_limits<int>::max() ) )
+        {
+          return false;
+        }
+        mWidth = width;
+        mHeight = height;
+        // Roughly 16MB per strip
+        mStripRows = qBound( 1, ( 4 * 1024 * 1024 ) / qMax( 1, width ), height );
+        mStripSize = mStripRows * width;
+        int nStrips = ( height + mStripRows - 1 ) / mStripRows;
+        mStrips.resize( nStrips );
+        mStripData.resize( nStrips );
+        mRowData.resize( height );
+        for ( int i = 0; i < nStrips; ++i )
+        {
+          mStrips[i] = QVector<float>( stripRowCount( i ) * width, fillValue );
+          mStripData[i] = mStrips[i].data();
+          for ( int row = 0, nRows = stripRowCount( i ); row < nRows; ++row )
+          {
+            mRowData[stripFirstRow( i ) + row] = mStripData[i] + row * width;
+          }
+        }
+        return true;
+      }
+
+      int width() const { return mWidth; }
+      int height() const { return mHeight; }
+      int size() const { return mWidth * mHeight; }
+      int stripCount() const { return mStripData.size(); }
+      int stripRowCount( int strip ) const { return qMin( mStripRows, mHeight - strip * mStripRows ); }
+      int stripFirstRow( int strip ) const { return strip * mStripRows; }
+      float* stripData( int strip ) { return mStripData[strip]; }
+      const float* rowData( int row ) const { return mRowData.at( row ); }
+
+      float value( int idx ) const
+      {
+        return mStripData.at( idx / mStripSize )[idx % mStripSize];
+      }
+
+    private:
+      int mWidth;
+      int mHeight;
+      int mStripRows;
+      int mStripSize;
+      QVector< QVector<float> > mStrips;
+      QVector<float*> mStripData;
+      QVector<const float*> mRowData;
+  };
+
+  /**
+   * A pixel written by a ray which lies on an octant boundary. Such pixels
+   * can be hit by rays of different octant tasks and are applied in ray
+   * order once all tasks are done.
+   */
+  struct SharedPixelWrite
+  {
+    int idx;
+    unsigned char value;
+  };
+
+  /**
+   * Everything the octant tasks of one observer share. Read-only, except for
+   * the viewshed buffer and the counters. The viewshed buffer has the size of
+   * the heightmap, whose origin is at pixel (gridColStart, gridRowStart).
+   * Rays are traced within [colStart, colEnd] x [rowStart, rowEnd].
+   */
+  struct ViewshedContext
+  {
+    const Heightmap* heightmap;
+    unsigned char* viewshed;
+    double gtrans[6];
+    int gridColStart, gridRowStart;
+    QgsPoint observerPos;
+    int obs[2];
+    int colStart, colEnd, rowStart, rowEnd;
+    int roi;
+    double observerHeight;
+    double targetHeight;
+    bool heightRelToTerr;
+    float noDataValue;
+    double earthRadius;
+    const QPolygon* filterPoly;
+    /** filterPoly rasterized over the heightmap grid, empty if there is no filter */
+    const QVector<unsigned char>* filterMask;
+    /** Squared geo distances to the observer per column and row offset from the grid origin, empty for rotated rasters */
+    QVector<double> colDistSqr;
+    QVector<double> rowDistSqr;
+    QAtomicInt* raysDone;
+    QAtomicInt* canceled;
+    const QgsFeedback* feedback;
+  };
+
+  /** Traces the rays [rayBegin, rayEnd), which all lie in the same (closed) octant around the observer. */
+  struct OctantTask
+  {
+    const ViewshedContext* ctx;
+    int rayBegin;
+    int rayEnd;
+    QVector<SharedPixelWrite> sharedWrites;
+  };
+
+  /**
+   * Line of sight kernel. For each ray, the samples which are inside the
+   * region of interest, the filter region and the heightmap are first
+   * gathered with their curvature corrected elevation. The horizon slope
+   * scan then only runs over flat arrays.
+   */
+  void traceOctant( OctantTask& task )
+  {
+    const ViewshedContext& ctx = *task.ctx;
+    const int* obs = ctx.obs;
+    const int roi = ctx.roi;
+    const Heightmap& heightmap = *ctx.heightmap;
+    const int hmapWidth = heightmap.width();
+    const int hmapHeight = heightmap.height();
+    const double roiSqr = double( roi ) * double( roi );
+    const double observerHeight = ctx.observerHeight;
+    const double targetHeight = ctx.targetHeight;
+    const bool heightRelToTerr = ctx.heightRelToTerr;
+    const bool haveFilter = !ctx.filterPoly->isEmpty();
+    const unsigned char* filterMask = ctx.filterMask->constData();
+    const bool haveDistTables = !ctx.colDistSqr.isEmpty();
+    const double* colDistSqr = ctx.colDistSqr.constData();
+    const double* rowDistSqr = ctx.rowDistSqr.constData();
+
+    // Per ray sample buffers. A ray has at most roi samples.
+    QVector<int> rayIdxBuf( roi + 1 );
+    QVector<unsigned char> raySharedBuf( roi + 1 );
+    QVector<float> rayElevBuf( roi + 1 );
+    QVector<double> rayDistBuf( roi + 1 );
+    QVector<double> raySlopeBuf( roi + 1 );
+    int* rayIdx = rayIdxBuf.data();
+    unsigned char* rayShared = raySharedBuf.data();
+    float* rayElev = rayElevBuf.data();
+    double* rayDist = rayDistBuf.data();
+    double* raySlope = raySlopeBuf.data();
+
+    for ( int radiusNumber = task.rayBegin; radiusNumber < task.rayEnd; ++radiusNumber )
+    {
+      if ( ctx.canceled->fetchAndAddRelaxed( 0 ) || ( ctx.feedback && ctx.feedback->isCanceled() ) )
+      {
+        return;
+      }
+      ctx.raysDone->fetchAndAddRelaxed( 1 );
+
+      int target[2];
+      if ( radiusNumber <= roi )
+      {
+        target[0] = obs[0] + roi;
+        target[1] = obs[1] + radiusNumber;
+      }
+      else if ( radiusNumber <= 3 * roi )
+      {
+        target[0] = obs[0] + 2 * roi - radiusNumber;
+        target[1] = obs[1] + roi;
+      }
+      else if ( radiusNumber <= 5 * roi )
+      {
+        target[0] = obs[0] - roi;
+        target[1] = obs[1] + 4 * roi - radiusNumber;
+      }
+      else if ( radiusNumber <= 7 * roi )
+      {
+        target[0] = obs[0] + radiusNumber - 6 * roi;
+        target[1] = obs[1] - roi;
+      }
+      else
+      {
+        target[0] = obs[0] + roi;
+        target[1] = obs[1] + radiusNumber - 8 * roi;
+      }
+
+      // Line of sight from observer to target.
+      int delta[2] = {target[0] - obs[0], target[1] - obs[1]};
+      int inciny = qAbs( delta[0] ) < qAbs( delta[1] );
+
+      // Step along coord (X or Y) that varies most from observer to target.
+      // That coord is inciny. Slope is how fast the other coord varies.
+      double slope = ( double ) delta[1 - inciny] / ( double ) delta[inciny];
+      int step = delta[inciny] > 0 ? 1 : -1;
+
+      // Gather the samples along the ray.
+      // i = 0 would be the observer, which is always visible.
+      int n = 0;
+      for ( int i = step; true; i += step )
+      {
+        int p[2];
+        p[inciny] = obs[inciny] + i;
+
+        if ( i * slope > 0 )
+        {
+          p[1 - inciny] = obs[1 - inciny] + int( qCeil( i * slope - 0.5 ) );
+        }
+        else
+        {
+          p[1 - inciny] = obs[1 - inciny] + int( qFloor( i * slope + 0.5 ) );
+        }
+
+        if ( p[0] < ctx.colStart || p[0] > ctx.colEnd || p[1] < ctx.rowStart || p[1] > ctx.rowEnd )
+        {
+          break;
+        }
+
+        //Is the point in the outside of the viewshed area?
+        double dx = qAbs( p[0] - obs[0] ), dy = qAbs( p[1] - obs[1] );
+        if ( !( dx <= roi && dy <= roi && dx * dx + dy * dy <= roiSqr ) )
+        {
+          break;
+        }
+
+        // Skip pixels outside of the heightmap, the linear index would wrap them into a neighbouring row
+        int col = p[0] - ctx.gridColStart;
+        int row = p[1] - ctx.gridRowStart;
+        if ( col < 0 || col >= hmapWidth || row < 0 || row >= hmapHeight )
+        {
+          continue;
+        }
+        int idx = row * hmapWidth + col;
+        if ( haveFilter && !filterMask[idx] )
+        {
+          continue;
+        }
+        float pElev = heightmap.rowData( row )[col];
+        if ( pElev == ctx.noDataValue )
+        {
+          continue;
+        }
+
+        // Earth curvature correction
+        double geoDistSqr;
+        if ( haveDistTables )
+        {
+          geoDistSqr = colDistSqr[col] + rowDistSqr[row];
+        }
+        else
+        {
+          double pGeoX = pixelToGeoX( ctx.gtrans, p[0], p[1] );
+          double pGeoY = pixelToGeoY( ctx.gtrans, p[0], p[1] );
+          geoDistSqr = ( ctx.observerPos.x() - pGeoX ) * ( ctx.observerPos.x() - pGeoX ) + ( ctx.observerPos.y() - pGeoY ) * ( ctx.observerPos.y() - pGeoY );
+        }
+        // http://www.swisstopo.admin.ch/internet/swisstopo/de/home/topics/survey/faq/curvature.html
+        pElev -= 0.87 * geoDistSqr / ( 2 * ctx.earthRadius );
+
+        // Pixels strictly inside the octant are only ever reached by rays of this task.
+        // Pixels on the axes and diagonals may also be reached by other tasks and are
+        // resolved later in ray order.
+        int ox = p[0] - obs[0], oy = p[1] - obs[1];
+        rayShared[n] = ox == 0 || oy == 0 || ox == oy || ox == -oy;
+        rayIdx[n] = idx;
+        rayElev[n] = pElev;
+        rayDist[n] = qAbs( i );
+        ++n;
+      }
+
+      // Slope (in vertical plane) from the observer to each sample
+      for ( int k = 0; k < n; ++k )
+      {
+        raySlope[k] = ( rayElev[k] - observerHeight ) / rayDist[k];
+      }
+
+      // Horizon scan: a sample is visible if the target above it is not below the horizon so far
+      double horizon_slope = -99999;
+      for ( int k = 0; k < n; ++k )
+      {
+        horizon_slope = qMax( horizon_slope, raySlope[k] );
+        double horizon_alt = observerHeight + horizon_slope * rayDist[k];
+        double tHeight = heightRelToTerr ? targetHeight + rayElev[k] : targetHeight;
+        unsigned char value = tHeight >= horizon_alt ? 255 : 0;
+        if ( rayShared[k] )
+        {
+          SharedPixelWrite write = { rayIdx[k], value };
+          task.sharedWrites.append( write );
+        }
+        else
+        {
+          ctx.viewshed[rayIdx[k]] = value;
+        }
+      }
+    }
+  }
+
+  /** A block of rows of the filter mask */
+  struct FilterMaskBlock
+  {
+    const QPolygon* filterPoly;
+    unsigned char* mask;
+    int gridColStart, gridRowStart;
+    int width;
+    int rowBegin, rowEnd;
+  };
+
+  /** Evaluates the filter polygon for the pixels of the block within its bounding box */
+  void rasterizeFilterMaskBlock( FilterMaskBlock& block )
+  {
+    QRect bbox = block.filterPoly->boundingRect();
+    int colBegin = qMax( 0, bbox.left() - block.gridColStart );
+    int colEnd = qMin( block.width, bbox.right() + 1 - block.gridColStart );
+    for ( int row = block.rowBegin; row < block.rowEnd; ++row )
+    {
+      int y = block.gridRowStart + row;
+      if ( y < bbox.top() || y > bbox.bottom() )
+      {
+        continue;
+      }
+      unsigned char* maskRow = block.mask + row * block.width;
+      for ( int col = colBegin; col < colEnd; ++col )
+      {
+        maskRow[col] = block.filterPoly->containsPoint( QPoint( block.gridColStart + col, y ), Qt::OddEvenFill );
+      }
+    }
+  }
+
+  /** Rasterizes the filter polygon over the heightmap grid, so that the kernel only needs a lookup per sample */
+  QVector<unsigned char> rasterizeFilterMask( const QPolygon& filterPoly, int gridColStart, int gridRowStart, int width, int height )
+  {
+    QVector<unsigned char> mask;
+    if ( filterPoly.isEmpty() )
+    {
+      return mask;
+    }
+    mask.fill( 0, width * height );
+    QVector<FilterMaskBlock> blocks;
+    int blockRows = 64;
+    for ( int row = 0; row < height; row += blockRows )
+    {
+      FilterMaskBlock block = { &filterPoly, mask.data(), gridColStart, gridRowStart, width, row, qMin( row + blockRows, height ) };
+      blocks.append( block );
+    }
+    QtConcurrent::blockingMap( blocks, rasterizeFilterMaskBlock );
+    return mask;
+  }
+
+  /**
+   * For north-up rasters the squared geo distance of a pixel to the observer
+   * is the sum of a column and a row term, which are tabulated once.
+   */
+  void prepareDistanceTables( ViewshedContext& ctx )
+  {
+    ctx.colDistSqr.clear();
+    ctx.rowDistSqr.clear();
+    if ( ctx.gtrans[2] != 0. || ctx.gtrans[4] != 0. )
+    {
+      return;
+    }
+    int nCols = ctx.colEnd - ctx.gridColStart + 1;
+    int nRows = ctx.rowEnd - ctx.gridRowStart + 1;
+    ctx.colDistSqr.resize( nCols );
+    ctx.rowDistSqr.resize( nRows );
+    for ( int col = 0; col < nCols; ++col )
+    {
+      double d = ctx.observerPos.x() - pixelToGeoX( ctx.gtrans, ctx.gridColStart + col, 0 );
+      ctx.colDistSqr[col] = d * d;
+    }
+    for ( int row = 0; row < nRows; ++row )
+    {
+      double d = ctx.observerPos.y() - pixelToGeoY( ctx.gtrans, 0, ctx.gridRowStart + row );
+      ctx.rowDistSqr[row] = d * d;
+    }
+  }
+
+  /** Reads the window into the heightmap strip by strip, resampling by averaging if the window is scaled. */
+  bool readHeightmap( GDALRasterBandH band, int colStart, int rowStart, int srcWidth, int srcHeight, Heightmap& heightmap, QProgressDialog* progress, const QgsFeedback* feedback )
+  {
+    double rowRatio = double( srcHeight ) / heightmap.height();
+    int bandHeight = GDALGetRasterBandYSize( band );
+    for ( int strip = 0, nStrips = heightmap.stripCount(); strip < nStrips; ++strip )
+    {
+      if ( feedback && feedback->isCanceled() )
+      {
+        QgsDebugMsg( "Canceled" );
+        return false;
+      }
+      if ( progress )
+      {
+        if ( progress->wasCanceled() )
+        {
+          QgsDebugMsg( "Canceled" );
+          return false;
+        }
+        progress->setValue( heightmap.stripFirstRow( strip ) );
+      }
+      int stripRows = heightmap.stripRowCount( strip );
+      // Source rows covered by this strip, as a floating point window such
+      // that the averaging matches the one of a read of the whole window
+      double srcYOff = rowStart + heightmap.stripFirstRow( strip ) * rowRatio;
+      double srcYSize = stripRows * rowRatio;
+      int nYOff = qFloor( srcYOff );
+      int nYSize = qMin( qCeil( srcYOff + srcYSize ), bandHeight ) - nYOff;
+
+      GDALRasterIOExtraArg rioargs;
+      INIT_RASTERIO_EXTRA_ARG( rioargs );
+      rioargs.eResampleAlg = GRIORA_Average;
+      rioargs.bFloatingPointWindowValidity = TRUE;
+      rioargs.dfXOff = colStart;
+      rioargs.dfYOff = srcYOff;
+      rioargs.dfXSize = srcWidth;
+      rioargs.dfYSize = srcYSize;
+      CPLErr err = GDALRasterIOEx( band, GF_Read, colStart, nYOff, srcWidth, nYSize, heightmap.stripData( strip ), heightmap.width(), stripRows, GDT_Float32, 0, 0, &rioargs );
+      if ( err != CE_None )
+      {
+        QgsDebugMsg( "Failed to fetch raster pixels" );
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /** Waits for the tasks to complete, keeping the progress dialog responsive. Returns false if canceled. */
+  bool waitForTasks( QFuture<void>& future, QAtomicInt& raysDone, QAtomicInt& canceled, int progressOffset, QProgressDialog* progress )
+  {
+    if ( !progress )
+    {
+      future.waitForFinished();
+      return true;
+    }
+    QEventLoop loop;
+    QFutureWatcher<void> watcher;
+    QTimer timer;
+    QObject::connect( &watcher, SIGNAL( finished() ), &loop, SLOT( quit() ) );
+    QObject::connect( &timer, SIGNAL( timeout() ), &loop, SLOT( quit() ) );
+    watcher.setFuture( future );
+    timer.start( 100 );
+    while ( !future.isFinished() )
+    {
+      progress->setValue( progressOffset + raysDone.fetchAndAddRelaxed( 0 ) );
+      if ( progress->wasCanceled() )
+      {
+        canceled.fetchAndStoreOrdered( 1 );
+        future.waitForFinished();
+        break;
+      }
+      loop.exec();
+    }
+    return !canceled.fetchAndAddOrdered( 0 );
+  }
+
+  /**
+   * Traces the viewsheds of all contexts concurrently. The 8 * roi rays of each
+   * observer are split in the eight octants around it, each octant is one task.
+   */
+  bool traceViewsheds( QVector<ViewshedContext>& contexts, QAtomicInt& raysDone, int progressOffset, QProgressDialog* progress, const QgsFeedback* feedback )
+  {
+    QAtomicInt canceled( 0 );
+    QVector<OctantTask> tasks;
+    tasks.reserve( 8 * contexts.size() );
+    for ( int i = 0, n = contexts.size(); i < n; ++i )
+    {
+      contexts[i].raysDone = &raysDone;
+      contexts[i].canceled = &canceled;
+      contexts[i].feedback = feedback;
+      for ( int octant = 0; octant < 8; ++octant )
+      {
+        OctantTask task;
+        task.ctx = &contexts[i];
+        task.rayBegin = octant * contexts[i].roi;
+        task.rayEnd = ( octant + 1 ) * contexts[i].roi;
+        tasks.append( task );
+      }
+    }
+    QFuture<void> future = QtConcurrent::map( tasks, traceOctant );
+    if ( !waitForTasks( future, raysDone, canceled, progressOffset, progress ) || ( feedback && feedback->isCanceled() ) )
+    {
+      QgsDebugMsg( "Canceled" );
+      return false;
+    }
+
+    // Apply the pixels shared between octants in the order a sequential trace would have written them
+    foreach ( const OctantTask& task, tasks )
+    {
+      foreach ( const SharedPixelWrite& write, task.sharedWrites )
+      {
+        task.ctx->viewshed[write.idx] = write.value;
+      }
+    }
+    // The observer is always visible from itself
+    foreach ( const ViewshedContext& ctx, contexts )
+    {
+      ctx.viewshed[( ctx.obs[1] - ctx.gridRowStart ) * ctx.heightmap->width() + ( ctx.obs[0] - ctx.gridColStart )] = 255;
+    }
+    return true;
+  }
+
+  /** Computes the (unscaled) window of the raster covering the radius around the observer */
+  void computeWindow( const double gtrans[6], int terWidth, int terHeight, const QgsPoint& observerPos, double radius, int& colStart, int& colEnd, int& rowStart, int& rowEnd )
+  {
+    QList<QgsPoint> cornerPoints = QList<QgsPoint>()
+                                   << QgsPoint( observerPos.x() - radius, observerPos.y() - radius )
+                                   << QgsPoint( observerPos.x() + radius, observerPos.y() - radius )
+                                   << QgsPoint( observerPos.x() + radius, observerPos.y() + radius )
+                                   << QgsPoint( observerPos.x() - radius, observerPos.y() + radius );
+    colStart = std::numeric_limits<int>::max();
+    rowStart = std::numeric_limits<int>::max();
+    colEnd = -std::numeric_limits<int>::max();
+    rowEnd = -std::numeric_limits<int>::max();
+    foreach ( const QgsPoint& p, cornerPoints )
+    {
+      double x = geoToPixelX( gtrans, p.x(), p.y() );
+      double y = geoToPixelY( gtrans, p.x(), p.y() );
+      colStart = qMin( colStart, qFloor( x ) );
+      colEnd = qMax( colEnd, qCeil( x ) );
+      rowStart = qMin( rowStart, qFloor( y ) );
+      rowEnd = qMax( rowEnd, qCeil( y ) );
+    }
+    colStart = qMax( 0, colStart );
+    colEnd = qMin( terWidth - 1, colEnd );
+    rowStart = qMax( 0, rowStart );
+    rowEnd = qMin( terHeight - 1, rowEnd );
+  }
+
+  /** Creates the output dataset for the scaled window starting at (colStart, rowStart) */
+  GDALDatasetH createOutputDataset( GDALDatasetH inputDataset, const QString& outputFile, const QString& outputFormat, const double gtrans[6], int colStart, int rowStart, int width, int height, int nBands, GDALDataType dataType )
+  {
+    GDALDriverH outputDriver = GDALGetDriverByName( outputFormat.toLocal8Bit().data() );
+    if ( outputDriver == 0 )
+    {
+      QgsDebugMsg( "Failed to get driver for output" );
+      return 0;
+    }
+    if ( !CSLFetchBoolean( GDALGetMetadata( outputDriver, NULL ), GDAL_DCAP_CREATE, false ) )
+    {
+      QgsDebugMsg( "Driver for output does not support creation" );
+      return 0;
+    }
+    char **papszOptions = CSLSetNameValue( 0, "COMPRESS", "LZW" );
+    if ( nBands > 1 )
+    {
+      papszOptions = CSLSetNameValue( papszOptions, "INTERLEAVE", "BAND" );
+    }
+    GDALDatasetH outputDataset = GDALCreate( outputDriver, outputFile.toLocal8Bit().data(), width, height, nBands, dataType, papszOptions );
+    CSLDestroy( papszOptions );
+    if ( outputDataset == NULL )
+    {
+      QgsDebugMsg( "Failed to open output dataset" );
+      return 0;
+    }
+
+    double outgtrans[6];
+    std::memcpy( outgtrans, gtrans, sizeof( outgtrans ) );
+
+    // Shift for origin of window
+    outgtrans[0] += colStart * outgtrans[1] + rowStart * outgtrans[2];
+    outgtrans[3] += colStart * outgtrans[4] + rowStart * outgtrans[5];
+
+    GDALSetGeoTransform( outputDataset, outgtrans );
+    GDALSetProjection( outputDataset, GDALGetProjectionRef( inputDataset ) );
+    return outputDataset;
+  }
+
+  /** Writes a width x height buffer to the band, in strips */
+  bool writeBand( GDALRasterBandH band, void* data, GDALDataType dataType, int width, int height )
+  {
+    int pixelSize = GDALGetDataTypeSize( dataType ) / 8;
+    int writeRows = qBound( 1, ( 16 * 1024 * 1024 ) / qMax( 1, width * pixelSize ), qMax( 1, height ) );
+    for ( int row = 0; row < height; row += writeRows )
+    {
+      int nRows = qMin( writeRows, height - row );
+      char* rowData = static_cast<char*>( data ) + qint64( row ) * width * pixelSize;
+      if ( GDALRasterIO( band, GF_Write, 0, row, width, nRows, rowData, width, nRows, dataType, 0, 0 ) != CE_None )
+      {
+        QgsDebugMsg( "Failed to write to output dataset" );
+        return false;
+      }
+    }
+    return true;
+  }
+
+} // anonymous namespace
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool QgsViewshed::computeViewshed( const QString &inputFile, const QString &outputFile, const QString &outputFormat, QgsPoint observerPos, const QgsCoordinateReferenceSystem &observerPosCrs, double observerHeight, double targetHeight, bool heightRelToTerr, double radius, const QGis::UnitType distanceElevUnit, const QVector<QgsPoint> &filterRegion, bool displayVisible, int accuracyFactor, QProgressDialog *progress, QgsFeedback *feedback )
 {
   // Open input file
   GDALDatasetH inputDataset = GDALOpen( inputFile.toLocal8Bit().data(), GA_ReadOnly );
@@ -93,6 +688,7 @@ bool QgsViewshed::computeViewshed( const QString &inputFile, const QString &outp
   if ( GDALGetGeoTransform( inputDataset, &gtrans[0] ) != CE_None )
   {
     QgsDebugMsg( "Failed to query input dataset geotransform" );
+    GDALClose( inputDataset );
     return false;
   }
   int terWidth = GDALGetRasterXSize( inputDataset );
@@ -109,28 +705,8 @@ bool QgsViewshed::computeViewshed( const QString &inputFile, const QString &outp
     earthRadius *= QGis::fromUnitToUnitFactor( QGis::Meters, datasetCrs.mapUnits() );
   }
 
-  QList<QgsPoint> cornerPoints = QList<QgsPoint>()
-                                 << QgsPoint( observerPos.x() - radius, observerPos.y() - radius )
-                                 << QgsPoint( observerPos.x() + radius, observerPos.y() - radius )
-                                 << QgsPoint( observerPos.x() + radius, observerPos.y() + radius )
-                                 << QgsPoint( observerPos.x() - radius, observerPos.y() + radius );
-  int colStart = std::numeric_limits<int>::max();
-  int rowStart = std::numeric_limits<int>::max();
-  int colEnd = -std::numeric_limits<int>::max();
-  int rowEnd = -std::numeric_limits<int>::max();
-  foreach ( const QgsPoint& p, cornerPoints )
-  {
-    double x = geoToPixelX( gtrans, p.x(), p.y() );
-    double y = geoToPixelY( gtrans, p.x(), p.y() );
-    colStart = qMin( colStart, qFloor( x ) );
-    colEnd = qMax( colEnd, qCeil( x ) );
-    rowStart = qMin( rowStart, qFloor( y ) );
-    rowEnd = qMax( rowEnd, qCeil( y ) );
-  }
-  colStart = qMax( 0, colStart );
-  colEnd = qMin( terWidth - 1, colEnd );
-  rowStart = qMax( 0, rowStart );
-  rowEnd = qMin( terHeight - 1, rowEnd );
+  int colStart, colEnd, rowStart, rowEnd;
+  computeWindow( gtrans, terWidth, terHeight, observerPos, radius, colStart, colEnd, rowStart, rowEnd );
   int hmapWidth = colEnd - colStart + 1;
   int hmapHeight = rowEnd - rowStart + 1;
   QPolygon filterPoly;
@@ -149,24 +725,23 @@ bool QgsViewshed::computeViewshed( const QString &inputFile, const QString &outp
 
   int scaledHmapHeight = hmapHeight / accuracyFactor;
   int scaledHmapWidth = hmapWidth / accuracyFactor;
+  int roi = .5 * qMin( scaledHmapWidth, scaledHmapHeight );
+  if ( progress )
+  {
+    progress->setRange( 0, scaledHmapHeight + 8 * roi );
+  }
 
   // Read input heightmap
-  // Allow at most 1GB allocated
-  if ( scaledHmapWidth * scaledHmapHeight * sizeof( float ) > 1073741824 )
+  Heightmap heightmap;
+  if ( !heightmap.allocate( scaledHmapWidth, scaledHmapHeight, noDataValue ) )
   {
     GDALClose( inputDataset );
     QgsDebugMsg( "Too much memory required" );
     return false;
   }
-  QVector<float> heightmap( scaledHmapWidth * scaledHmapHeight, noDataValue );
-  GDALRasterIOExtraArg rioargs;
-  INIT_RASTERIO_EXTRA_ARG( rioargs );
-  rioargs.eResampleAlg = GRIORA_Average;
-  CPLErr err = GDALRasterIOEx( inputBand, GF_Read, colStart, rowStart, hmapWidth, hmapHeight, heightmap.data(), scaledHmapWidth, scaledHmapHeight, GDT_Float32, 0, 0, &rioargs );
-  if ( err != CE_None )
+  if ( !readHeightmap( inputBand, colStart, rowStart, hmapWidth, hmapHeight, heightmap, progress, feedback ) )
   {
     GDALClose( inputDataset );
-    QgsDebugMsg( "Failed to fetch raster pixels" );
     return false;
   }
 
@@ -189,42 +764,16 @@ bool QgsViewshed::computeViewshed( const QString &inputFile, const QString &outp
   }
 
   // Prepare output
-  GDALDriverH outputDriver = GDALGetDriverByName( outputFormat.toLocal8Bit().data() );
-  if ( outputDriver == 0 )
-  {
-    GDALClose( inputDataset );
-    QgsDebugMsg( "Failed to get driver for output" );
-    return false;
-  }
-  if ( !CSLFetchBoolean( GDALGetMetadata( outputDriver, NULL ), GDAL_DCAP_CREATE, false ) )
-  {
-    GDALClose( inputDataset );
-    QgsDebugMsg( "Driver for output does not support creation" );
-    return false;
-  }
-  char **papszOptions = CSLSetNameValue( 0, "COMPRESS", "LZW" );
-  GDALDatasetH outputDataset = GDALCreate( outputDriver, outputFile.toLocal8Bit().data(), hmapWidth, hmapHeight, 1, GDT_Byte, papszOptions );
+  GDALDatasetH outputDataset = createOutputDataset( inputDataset, outputFile, outputFormat, gtrans, colStart, rowStart, hmapWidth, hmapHeight, 1, GDT_Byte );
+  GDALClose( inputDataset );
   if ( outputDataset == NULL )
   {
-    GDALClose( inputDataset );
-    QgsDebugMsg( "Failed to open output dataset" );
     return false;
   }
 
-  double outgtrans[6];
-  std::memcpy( outgtrans, gtrans, sizeof( gtrans ) );
-
-  // Shift for origin of window
-  outgtrans[0] += colStart * outgtrans[1] + rowStart * outgtrans[2];
-  outgtrans[3] += colStart * outgtrans[4] + rowStart * outgtrans[5];
-
-  GDALSetGeoTransform( outputDataset, outgtrans );
-  GDALSetProjection( outputDataset, GDALGetProjectionRef( inputDataset ) );
-
   GDALRasterBandH outputBand = GDALGetRasterBand( outputDataset, 1 );
   if ( outputBand == 0 )
   {
-    GDALClose( inputDataset );
     GDALClose( outputDataset );
     QgsDebugMsg( "Failed to get output dataset band 1" );
     return false;
@@ -233,149 +782,275 @@ bool QgsViewshed::computeViewshed( const QString &inputFile, const QString &outp
 
   // Offset observer elevation by position at point
   if ( heightRelToTerr )
-    observerHeight += heightmap[( obs[1] - rowStart ) * hmapWidth + ( obs[0] - colStart )];
+  {
+    int obsIdx = ( obs[1] - rowStart ) * hmapWidth + ( obs[0] - colStart );
+    if ( obsIdx < heightmap.size() )
+      observerHeight += heightmap.value( obsIdx );
+  }
 
 
   // Compute viewshed
-  int roi = .5 * qMin( hmapWidth, hmapHeight );
-  if ( progress )
+  QVector<unsigned char> viewshed( hmapWidth * hmapHeight, 255 * !displayVisible );
+  QVector<ViewshedContext> contexts( 1 );
+  ViewshedContext& ctx = contexts[0];
+  ctx.heightmap = &heightmap;
+  ctx.viewshed = viewshed.data();
+  std::memcpy( ctx.gtrans, gtrans, sizeof( gtrans ) );
+  ctx.gridColStart = colStart;
+  ctx.gridRowStart = rowStart;
+  ctx.observerPos = observerPos;
+  ctx.obs[0] = obs[0];
+  ctx.obs[1] = obs[1];
+  ctx.colStart = colStart;
+  ctx.colEnd = colEnd;
+  ctx.rowStart = rowStart;
+  ctx.rowEnd = rowEnd;
+  ctx.roi = roi;
+  ctx.observerHeight = observerHeight;
+  ctx.targetHeight = targetHeight;
+  ctx.heightRelToTerr = heightRelToTerr;
+  ctx.noDataValue = noDataValue;
+  ctx.earthRadius = earthRadius;
+  ctx.filterPoly = &filterPoly;
+  QVector<unsigned char> filterMask = rasterizeFilterMask( filterPoly, colStart, rowStart, hmapWidth, hmapHeight );
+  ctx.filterMask = &filterMask;
+  prepareDistanceTables( ctx );
+
+  QAtomicInt raysDone( 0 );
+  if ( !traceViewsheds( contexts, raysDone, hmapHeight, progress, feedback ) )
   {
-    progress->setRange( 0, 8 * roi );
+    GDALClose( outputDataset );
+    return false;
   }
-  QVector<unsigned char> viewshed( hmapWidth * hmapHeight, 255 * !displayVisible );
-  for ( int radiusNumber = 0; radiusNumber < 8 * roi; ++radiusNumber )
+
+  // Write output
+  bool success = writeBand( outputBand, viewshed.data(), GDT_Byte, hmapWidth, hmapHeight );
+  GDALClose( outputDataset );
+  return success;
+}
+
+bool QgsViewshed::computeViewsheds( const QString &inputFile, const QString &outputFile, const QString &outputFormat, const QVector<QgsPoint> &observerPositions, const QgsCoordinateReferenceSystem &observerPosCrs, double observerHeight, double targetHeight, bool heightRelToTerr, double radius, const QGis::UnitType distanceElevUnit, BatchOutputMode outputMode, const QVector<QgsPoint> &filterRegion, int accuracyFactor, QProgressDialog *progress, QgsFeedback *feedback )
+{
+  if ( observerPositions.isEmpty() )
   {
-    if ( progress )
-    {
-      if ( progress->wasCanceled() )
-      {
-        QgsDebugMsg( "Canceled" );
-        GDALClose( inputDataset );
-        GDALClose( outputDataset );
-        return false;
-      }
-      progress->setValue( radiusNumber );
-    }
-    int target[2];
-    if ( radiusNumber <= roi )
-    {
-      target[0] = obs[0] + roi;
-      target[1] = obs[1] + radiusNumber;
-    }
-    else if ( radiusNumber <= 3 * roi )
-    {
-      target[0] = obs[0] + 2 * roi - radiusNumber;
-      target[1] = obs[1] + roi;
-    }
-    else if ( radiusNumber <= 5 * roi )
-    {
-      target[0] = obs[0] - roi;
-      target[1] = obs[1] + 4 * roi - radiusNumber;
-    }
-    else if ( radiusNumber <= 7 * roi )
-    {
-      target[0] = obs[0] + radiusNumber - 6 * roi;
-      target[1] = obs[1] - roi;
-    }
-    else if ( radiusNumber < 8 * roi )
-    {
-      target[0] = obs[0] + roi;
-      target[1] = obs[1] + radiusNumber - 8 * roi;
-    }
-    else
-    {
-      break; // All terrain points processed.
-    }
+    QgsDebugMsg( "No observers" );
+    return false;
+  }
 
-    // Line of sight from observer to target.
-    int delta[2] = {target[0] - obs[0], target[1] - obs[1]};
-    int inciny = qAbs( delta[0] ) < qAbs( delta[1] );
+  // Open input file
+  GDALDatasetH inputDataset = GDALOpen( inputFile.toLocal8Bit().data(), GA_ReadOnly );
+  if ( inputDataset == 0 )
+  {
+    QgsDebugMsg( "Failed to open input dataset" );
+    return false;
+  }
 
-    // Step along coord (X or Y) that varies most from observer to target.
-    // That coord is inciny. Slope is how fast the other coord varies.
-    double slope = ( double ) delta[1 - inciny] / ( double ) delta[inciny];
-    int step = delta[inciny] > 0 ? 1 : -1;
-    double horizon_slope = -99999; // Slope (in vertical plane) to horizon so far.
+  // Transform positions and measurements to dataset CRS
+  QgsCoordinateReferenceSystem datasetCrs( QString( GDALGetProjectionRef( inputDataset ) ) );
+  if ( !datasetCrs.isValid() )
+  {
+    QgsDebugMsg( "Could not determine input dataset CRS" );
+    GDALClose( inputDataset );
+    return false;
+  }
+  QgsCoordinateTransform ct( observerPosCrs, datasetCrs );
+  if ( datasetCrs.mapUnits() != distanceElevUnit )
+  {
+    observerHeight *= QGis::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
+    targetHeight *= QGis::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
+    radius *= QGis::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
+  }
 
-    // i = 0 would be the observer, which is always visible.
-    for ( int i = step; true; i += step )
+  // Open input band
+  GDALRasterBandH inputBand = GDALGetRasterBand( inputDataset, 1 );
+  if ( inputBand == NULL )
+  {
+    GDALClose( inputDataset );
+    QgsDebugMsg( "Failed to open input dataset band 1" );
+    return false;
+  }
+  float noDataValue = GDALGetRasterNoDataValue( inputBand, NULL );
+
+  double gtrans[6] = {};
+  if ( GDALGetGeoTransform( inputDataset, &gtrans[0] ) != CE_None )
+  {
+    QgsDebugMsg( "Failed to query input dataset geotransform" );
+    GDALClose( inputDataset );
+    return false;
+  }
+  int terWidth = GDALGetRasterXSize( inputDataset );
+  int terHeight = GDALGetRasterYSize( inputDataset );
+
+  double earthRadius = 6370000;
+  if ( datasetCrs.mapUnits() != QGis::Meters )
+  {
+    earthRadius *= QGis::fromUnitToUnitFactor( QGis::Meters, datasetCrs.mapUnits() );
+  }
+
+  // Compute the window of each observer, and the window covering all of them
+  int nObservers = observerPositions.size();
+  QVector<ViewshedContext> observers( nObservers );
+  int colStart = std::numeric_limits<int>::max();
+  int rowStart = std::numeric_limits<int>::max();
+  int colEnd = -std::numeric_limits<int>::max();
+  int rowEnd = -std::numeric_limits<int>::max();
+  for ( int i = 0; i < nObservers; ++i )
+  {
+    ViewshedContext& ctx = observers[i];
+    ctx.observerPos = ct.transform( observerPositions[i] );
+    ctx.obs[0] = qRound( geoToPixelX( gtrans, ctx.observerPos.x(), ctx.observerPos.y() ) );
+    ctx.obs[1] = qRound( geoToPixelY( gtrans, ctx.observerPos.x(), ctx.observerPos.y() ) );
+    computeWindow( gtrans, terWidth, terHeight, ctx.observerPos, radius, ctx.colStart, ctx.colEnd, ctx.rowStart, ctx.rowEnd );
+    if ( ctx.obs[0] < ctx.colStart || ctx.obs[0] > ctx.colEnd || ctx.obs[1] < ctx.rowStart || ctx.obs[1] > ctx.rowEnd )
     {
-      int p[2];
-      p[inciny] = obs[inciny] + i;
+      GDALClose( inputDataset );
+      QgsDebugMsg( QString( "Observer pos %1 is outside vieweshed area, reprojection distortion?" ).arg( i ) );
+      return false;
+    }
+    ctx.roi = .5 * qMin( ( ctx.colEnd - ctx.colStart + 1 ) / accuracyFactor, ( ctx.rowEnd - ctx.rowStart + 1 ) / accuracyFactor );
+    colStart = qMin( colStart, ctx.colStart );
+    colEnd = qMax( colEnd, ctx.colEnd );
+    rowStart = qMin( rowStart, ctx.rowStart );
+    rowEnd = qMax( rowEnd, ctx.rowEnd );
+  }
+  int hmapWidth = colEnd - colStart + 1;
+  int hmapHeight = rowEnd - rowStart + 1;
+  int scaledHmapWidth = hmapWidth / accuracyFactor;
+  int scaledHmapHeight = hmapHeight / accuracyFactor;
 
-      if ( i * slope > 0 )
-      {
-        p[1 - inciny] = obs[1 - inciny] + int( qCeil( i * slope - 0.5 ) );
-      }
-      else
-      {
-        p[1 - inciny] = obs[1 - inciny] + int( qFloor( i * slope + 0.5 ) );
-      }
+  QPolygon filterPoly;
+  for ( int i = 0, n = filterRegion.size(); i < n; ++i )
+  {
+    QgsPoint p = ct.transform( filterRegion[i] );
+    filterPoly.append( QPoint( qRound( geoToPixelX( gtrans, p.x(), p.y() ) ) / accuracyFactor, qRound( geoToPixelY( gtrans, p.x(), p.y() ) ) / accuracyFactor ) );
+  }
 
-      if ( p[0] < colStart || p[0] > colEnd || p[1] < rowStart || p[1] > rowEnd )
-      {
-        break;
-      }
+  int totalRays = 0;
+  foreach ( const ViewshedContext& ctx, observers )
+  {
+    totalRays += 8 * ctx.roi;
+  }
+  if ( progress )
+  {
+    progress->setRange( 0, scaledHmapHeight + totalRays );
+  }
 
-      //Is the point in the outside of the viewshed area?
-      double dx = qAbs( p[0] - obs[0] ), dy = qAbs( p[1] - obs[1] );
-      if ( !( dx <= roi && dy <= roi && dx * dx + dy * dy <= double( roi ) * double( roi ) ) )
-      {
-        break;
-      }
-      if ( !filterPoly.isEmpty() && !filterPoly.containsPoint( QPoint( p[0], p[1] ), Qt::OddEvenFill ) )
-      {
-        continue;
-      }
+  // Read the shared input heightmap once
+  Heightmap heightmap;
+  if ( !heightmap.allocate( scaledHmapWidth, scaledHmapHeight, noDataValue ) )
+  {
+    GDALClose( inputDataset );
+    QgsDebugMsg( "Too much memory required" );
+    return false;
+  }
+  if ( !readHeightmap( inputBand, colStart, rowStart, hmapWidth, hmapHeight, heightmap, progress, feedback ) )
+  {
+    GDALClose( inputDataset );
+    return false;
+  }
 
-      int idx = ( p[1] - rowStart ) * hmapWidth + ( p[0] - colStart );
-      if ( idx >= heightmap.size() )
-      {
-        continue;
-      }
-      float pElev = heightmap[idx];
-      if ( pElev == noDataValue )
-      {
-        continue;
-      }
+  // Adjust for reduced resolution
+  gtrans[1] *= accuracyFactor;
+  gtrans[2] *= accuracyFactor;
+  gtrans[4] *= accuracyFactor;
+  gtrans[5] *= accuracyFactor;
+  colStart /= accuracyFactor;
+  rowStart /= accuracyFactor;
+  colEnd = colStart + scaledHmapWidth - 1;
+  rowEnd = rowStart + scaledHmapHeight - 1;
+  QVector<unsigned char> filterMask = rasterizeFilterMask( filterPoly, colStart, rowStart, scaledHmapWidth, scaledHmapHeight );
+  for ( int i = 0; i < nObservers; ++i )
+  {
+    ViewshedContext& ctx = observers[i];
+    ctx.heightmap = &heightmap;
+    std::memcpy( ctx.gtrans, gtrans, sizeof( gtrans ) );
+    ctx.gridColStart = colStart;
+    ctx.gridRowStart = rowStart;
+    ctx.obs[0] /= accuracyFactor;
+    ctx.obs[1] /= accuracyFactor;
+    // Clamp to the shared grid, so that no ray leaves it
+    ctx.colStart = qBound( colStart, ctx.colStart / accuracyFactor, colEnd );
+    ctx.colEnd = qBound( colStart, ctx.colEnd / accuracyFactor, colEnd );
+    ctx.rowStart = qBound( rowStart, ctx.rowStart / accuracyFactor, rowEnd );
+    ctx.rowEnd = qBound( rowStart, ctx.rowEnd / accuracyFactor, rowEnd );
+    ctx.obs[0] = qBound( ctx.colStart, ctx.obs[0], ctx.colEnd );
+    ctx.obs[1] = qBound( ctx.rowStart, ctx.obs[1], ctx.rowEnd );
+    ctx.observerHeight = observerHeight;
+    if ( heightRelToTerr )
+      ctx.observerHeight += heightmap.value( ( ctx.obs[1] - rowStart ) * scaledHmapWidth + ( ctx.obs[0] - colStart ) );
+    ctx.targetHeight = targetHeight;
+    ctx.heightRelToTerr = heightRelToTerr;
+    ctx.noDataValue = noDataValue;
+    ctx.earthRadius = earthRadius;
+    ctx.filterPoly = &filterPoly;
+    ctx.filterMask = &filterMask;
+    prepareDistanceTables( ctx );
+  }
 
-      // Earth curvature correction
-      double pGeoX = pixelToGeoX( gtrans, p[0], p[1] );
-      double pGeoY = pixelToGeoY( gtrans, p[0], p[1] );
-      double geoDistSqr = ( observerPos.x() - pGeoX ) * ( observerPos.x() - pGeoX ) + ( observerPos.y() - pGeoY ) * ( observerPos.y() - pGeoY );
-      // http://www.swisstopo.admin.ch/internet/swisstopo/de/home/topics/survey/faq/curvature.html
-      pElev -= 0.87 * geoDistSqr / ( 2 * earthRadius );
-
-      // Update the slope if the current slope is greater than the old one
-      double s = double( pElev - observerHeight ) / double( qAbs( p[inciny] - obs[inciny] ) );
-      horizon_slope = qMax( horizon_slope, s );
-
-      double horizon_alt =  observerHeight + horizon_slope * qAbs( p[inciny] - obs[inciny] );
-      double tHeight = targetHeight;
-      if ( heightRelToTerr )
-        tHeight += pElev;
-      if ( tHeight >= horizon_alt )
+  // Prepare output
+  bool perObserverBands = outputMode == PerObserverBands;
+  GDALDatasetH outputDataset = createOutputDataset( inputDataset, outputFile, outputFormat, gtrans, colStart, rowStart, scaledHmapWidth, scaledHmapHeight, perObserverBands ? nObservers : 1, perObserverBands ? GDT_Byte : GDT_UInt16 );
+  GDALClose( inputDataset );
+  if ( outputDataset == NULL )
+  {
+    return false;
+  }
+  for ( int band = 1, nBands = GDALGetRasterCount( outputDataset ); band <= nBands; ++band )
+  {
+    GDALSetRasterNoDataValue( GDALGetRasterBand( outputDataset, band ), 0 );
+  }
+
+  // Compute the viewsheds, as many observers at a time as there are threads, to bound the memory used by the per observer buffers
+  int chunkSize = qMax( 1, QThreadPool::globalInstance()->maxThreadCount() );
+  QVector<quint16> seenByCount;
+  if ( !perObserverBands )
+  {
+    seenByCount.fill( 0, scaledHmapWidth * scaledHmapHeight );
+  }
+  QAtomicInt raysDone( 0 );
+  for ( int chunkStart = 0; chunkStart < nObservers; chunkStart += chunkSize )
+  {
+    QVector<ViewshedContext> chunk = observers.mid( chunkStart, chunkSize );
+    QVector< QVector<unsigned char> > viewsheds( chunk.size() );
+    for ( int i = 0, n = chunk.size(); i < n; ++i )
+    {
+      viewsheds[i].fill( 0, scaledHmapWidth * scaledHmapHeight );
+      chunk[i].viewshed = viewsheds[i].data();
+    }
+    if ( !traceViewsheds( chunk, raysDone, scaledHmapHeight, progress, feedback ) )
+    {
+      GDALClose( outputDataset );
+      return false;
+    }
+    for ( int i = 0, n = chunk.size(); i < n; ++i )
+    {
+      if ( perObserverBands )
       {
-        viewshed[( p[1] - rowStart ) * hmapWidth + ( p[0] - colStart )] = 255;
+        if ( !writeBand( GDALGetRasterBand( outputDataset, chunkStart + i + 1 ), viewsheds[i].data(), GDT_Byte, scaledHmapWidth, scaledHmapHeight ) )
+        {
+          GDALClose( outputDataset );
+          return false;
+        }
       }
       else
       {
-        viewshed[( p[1] - rowStart ) * hmapWidth + ( p[0] - colStart )] = 0;
+        const unsigned char* visible = viewsheds[i].constData();
+        quint16* count = seenByCount.data();
+        for ( int j = 0, m = seenByCount.size(); j < m; ++j )
+        {
+          if ( visible[j] == 255 && count[j] < 0xFFFF )
+            ++count[j];
+        }
       }
     }
   }
-  // The observer is always visible from itself
-  viewshed[( obs[1] - rowStart ) * hmapWidth + ( obs[0] - colStart )] = 255;
-
 
   // Write output
-  err = GDALRasterIO( outputBand, GF_Write, 0, 0, hmapWidth, hmapHeight, viewshed.data(), hmapWidth, hmapHeight, GDT_Byte, 0, 0 );
-  GDALClose( inputDataset );
-  GDALClose( outputDataset );
-  if ( err != CE_None )
+  bool success = true;
+  if ( !perObserverBands )
   {
-    QgsDebugMsg( "Failed to write to output dataset" );
-    return false;
+    success = writeBand( GDALGetRasterBand( outputDataset, 1 ), seenByCount.data(), GDT_UInt16, scaledHmapWidth, scaledHmapHeight );
   }
-  return true;
+  GDALClose( outputDataset );
+  return success;
 }
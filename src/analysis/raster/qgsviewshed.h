@@ -20,6 +20,7 @@
 
 class QgsPoint;
 class QgsCoordinateReferenceSystem;
+class QgsFeedback;
 class QProgressDialog;
 
 #include "qgis.h"
@@ -29,13 +30,37 @@ class QProgressDialog;
 class ANALYSIS_EXPORT QgsViewshed
 {
   public:
+    /** Output written by computeViewsheds */
+    enum BatchOutputMode
+    {
+      PerObserverBands, /**< One Byte band per observer, 255 where visible, 0 otherwise */
+      CumulativeCount   /**< One UInt16 band holding the number of observers each pixel is visible from */
+    };
+
+    /**
+     * Computes the viewshed of an observer and writes it to outputFile.
+     * To compute from a worker thread, pass no progress dialog and cancel through feedback instead.
+     */
     static bool computeViewshed( const QString& inputFile,
                                  const QString& outputFile, const QString& outputFormat,
                                  QgsPoint observerPos, const QgsCoordinateReferenceSystem& observerPosCrs,
                                  double observerHeight, double targetHeight, bool heightRelToTerr, double radius,
                                  const QGis::UnitType distanceElevUnit,
                                  const QVector<QgsPoint> &filterRegion = QVector<QgsPoint>(), bool displayVisible = true, int accuracyFactor = 1,
-                                 QProgressDialog* progress = 0 );
+                                 QProgressDialog* progress = 0, QgsFeedback* feedback = 0 );
+
+    /**
+     * Computes the viewsheds of several observers with the same heights and radius.
+     * The heightmap window covering all observers is read once and the observers
+     * are traced concurrently. The output covers that window.
+     */
+    static bool computeViewsheds( const QString& inputFile,
+                                  const QString& outputFile, const QString& outputFormat,
+                                  const QVector<QgsPoint>& observerPositions, const QgsCoordinateReferenceSystem& observerPosCrs,
+                                  double observerHeight, double targetHeight, bool heightRelToTerr, double radius,
+                                  const QGis::UnitType distanceElevUnit, BatchOutputMode outputMode = CumulativeCount,
+                                  const QVector<QgsPoint> &filterRegion = QVector<QgsPoint>(), int accuracyFactor = 1,
+                                  QProgressDialog* progress = 0, QgsFeedback* feedback = 0 );
 
 };
 
@@ -23,6 +23,9 @@
 #include "cpl_string.h"
 #include <QProgressDialog>
 #include <QFile>
+#include <QtConcurrentMap>
+
+#include <algorithm>
 
 #if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1800
 #define TO8F(x) (x).toUtf8().constData()
@@ -30,6 +33,313 @@
 #define TO8F(x) QFile::encodeName( x ).constData()
 #endif
 
+// Zones are computed in batches of polygons. The raster window of each polygon is split in
+// blocks of rows which are read with one RasterIO call each and then processed concurrently.
+static const int sZoneBatchSize = 256;
+static const int sMaxBlockCells = 1 << 20;
+static const int sMaxBatchCells = 1 << 24;
+
+/** Polygon ring in pixel coordinates of the raster (x to the right, y downwards) */
+struct PixelRing
+{
+  QgsPolyline points;
+  /** +1 or -1, such that the signed area computed by the coverage accumulation is positive for exteriors and negative for holes */
+  double weight;
+};
+
+struct Zone
+{
+  QgsFeatureId id;
+  QVector<PixelRing> rings;
+  int offsetX;
+  int offsetY;
+  int nCellsX;
+  int nCellsY;
+  double sum;
+  double count;
+};
+
+struct ZoneBlock
+{
+  Zone* zone;
+  int row; // first row of the block, relative to the zone window
+  int nRows;
+  float nodata;
+  float* data;
+  double sum;
+  double count;
+};
+
+static inline bool validPixel( float value, float nodata )
+{
+  return value != nodata && !qIsNaN( value );
+}
+
+static QVector<PixelRing> pixelRings( const QgsGeometry* geom, const QgsRectangle& rasterBBox, double cellSizeX, double cellSizeY )
+{
+  QgsMultiPolygon multiPolygon;
+  if ( geom->isMultipart() )
+  {
+    multiPolygon = geom->asMultiPolygon();
+  }
+  else
+  {
+    multiPolygon.append( geom->asPolygon() );
+  }
+
+  QVector<PixelRing> rings;
+  foreach ( const QgsPolygon& polygon, multiPolygon )
+  {
+    for ( int i = 0, n = polygon.size(); i < n; ++i )
+    {
+      PixelRing ring;
+      ring.points.reserve( polygon[i].size() );
+      double area = 0;
+      foreach ( const QgsPoint& p, polygon[i] )
+      {
+        QgsPoint pixel(( p.x() - rasterBBox.xMinimum() ) / cellSizeX, ( rasterBBox.yMaximum() - p.y() ) / cellSizeY );
+        if ( !ring.points.isEmpty() )
+        {
+          area += ring.points.last().x() * pixel.y() - pixel.x() * ring.points.last().y();
+        }
+        ring.points.append( pixel );
+      }
+      if ( ring.points.size() < 3 )
+      {
+        continue;
+      }
+      area += ring.points.last().x() * ring.points.first().y() - ring.points.first().x() * ring.points.last().y();
+      // the coverage accumulation computes -integral( y dx ), which is the area of counter clockwise rings
+      // (in the flipped pixel coordinates). Ring 0 is the exterior, the others are holes
+      double orientation = area > 0 ? 1. : -1.;
+      ring.weight = i == 0 ? -orientation : orientation;
+      rings.append( ring );
+    }
+  }
+  return rings;
+}
+
+/** Sums the valid pixels of the block whose center is within the polygon (even-odd scanline test) */
+static void statisticsFromMiddlePointTest( ZoneBlock& block )
+{
+  const Zone& zone = *block.zone;
+  int rowStart = zone.offsetY + block.row;
+  QVector< QVector<double> > crossings( block.nRows );
+
+  // Crossings of the edges with the horizontal lines through the cell centers. An edge covers the half-open
+  // range [ymin, ymax), so that vertices shared by two edges are counted once
+  foreach ( const PixelRing& ring, zone.rings )
+  {
+    const QgsPolyline& pts = ring.points;
+    for ( int i = 0, n = pts.size(); i < n; ++i )
+    {
+      const QgsPoint& p0 = pts[i];
+      const QgsPoint& p1 = pts[( i + 1 ) % n];
+      if ( p0.y() == p1.y() )
+      {
+        continue;
+      }
+      double yMin = qMin( p0.y(), p1.y() );
+      double yMax = qMax( p0.y(), p1.y() );
+      int r0 = qMax( rowStart, ( int ) ceil( yMin - 0.5 ) );
+      int r1 = qMin( rowStart + block.nRows, ( int ) ceil( yMax - 0.5 ) );
+      double dxdy = ( p1.x() - p0.x() ) / ( p1.y() - p0.y() );
+      for ( int row = r0; row < r1; ++row )
+      {
+        crossings[row - rowStart].append( p0.x() + ( row + 0.5 - p0.y() ) * dxdy );
+      }
+    }
+  }
+
+  double sum = 0;
+  double count = 0;
+  for ( int i = 0; i < block.nRows; ++i )
+  {
+    QVector<double>& xs = crossings[i];
+    qSort( xs );
+    const float* scanLine = block.data + i * zone.nCellsX;
+    for ( int j = 0; j + 1 < xs.size(); j += 2 )
+    {
+      // cells whose center lies strictly between the two crossings
+      int c0 = qMax( 0, ( int ) floor( xs[j] - 0.5 ) + 1 - zone.offsetX );
+      int c1 = qMin( zone.nCellsX, ( int ) ceil( xs[j + 1] - 0.5 ) - zone.offsetX );
+      for ( int c = c0; c < c1; ++c )
+      {
+        if ( validPixel( scanLine[c], block.nodata ) )
+        {
+          sum += scanLine[c];
+          ++count;
+        }
+      }
+    }
+  }
+  block.sum = sum;
+  block.count = count;
+}
+
+/**
+ * Sums the valid pixels of the block weighted by the fraction of the pixel covered by the polygon.
+ * The area of the polygon within a cell is -integral( clamp( y - row, 0, 1 ) dx ) along the boundary,
+ * restricted to the column of the cell. Each edge is split at the cell borders: the part within a cell
+ * contributes to that cell and its full dx to all cells above it in the same column, which are
+ * accumulated with one pass over the rows.
+ */
+static void statisticsFromPreciseIntersection( ZoneBlock& block )
+{
+  const Zone& zone = *block.zone;
+  int nCols = zone.nCellsX;
+  int nRows = block.nRows;
+  double offsetX = zone.offsetX;
+  double offsetY = zone.offsetY + block.row;
+  QVector<double> own( nCols * nRows, 0. );
+  QVector<double> above( nCols * nRows, 0. );
+  QVector<double> ts;
+
+  foreach ( const PixelRing& ring, zone.rings )
+  {
+    const QgsPolyline& pts = ring.points;
+    for ( int i = 0, n = pts.size(); i < n; ++i )
+    {
+      double x0 = pts[i].x() - offsetX, y0 = pts[i].y() - offsetY;
+      double x1 = pts[( i + 1 ) % n].x() - offsetX, y1 = pts[( i + 1 ) % n].y() - offsetY;
+      // vertical edges and edges outside of the columns and below the block rows do not contribute
+      if ( x0 == x1 || ( x0 <= 0 && x1 <= 0 ) || ( x0 >= nCols && x1 >= nCols ) || ( y0 <= 0 && y1 <= 0 ) )
+      {
+        continue;
+      }
+
+      // split the edge at the column and row borders it crosses
+      ts.resize( 0 );
+      ts.append( 0. );
+      ts.append( 1. );
+      int cMin = qMax( 0, ( int ) ceil( qMin( x0, x1 ) ) ), cMax = qMin( nCols, ( int ) floor( qMax( x0, x1 ) ) );
+      for ( int c = cMin; c <= cMax; ++c )
+      {
+        ts.append(( c - x0 ) / ( x1 - x0 ) );
+      }
+      if ( y0 != y1 )
+      {
+        int rMin = qMax( 0, ( int ) ceil( qMin( y0, y1 ) ) ), rMax = qMin( nRows, ( int ) floor( qMax( y0, y1 ) ) );
+        for ( int r = rMin; r <= rMax; ++r )
+        {
+          ts.append(( r - y0 ) / ( y1 - y0 ) );
+        }
+      }
+      qSort( ts );
+
+      for ( int k = 0; k + 1 < ts.size(); ++k )
+      {
+        double ta = qBound( 0., ts[k], 1. ), tb = qBound( 0., ts[k + 1], 1. );
+        double dx = ( tb - ta ) * ( x1 - x0 ) * ring.weight;
+        double xm = x0 + 0.5 * ( ta + tb ) * ( x1 - x0 );
+        double ym = y0 + 0.5 * ( ta + tb ) * ( y1 - y0 );
+        int col = ( int ) floor( xm );
+        if ( dx == 0 || col < 0 || col >= nCols || ym <= 0 )
+        {
+          continue;
+        }
+        if ( ym >= nRows )
+        {
+          above[( nRows - 1 ) * nCols + col] += dx;
+        }
+        else
+        {
+          int row = ( int ) floor( ym );
+          own[row * nCols + col] += dx * ( ym - row );
+          if ( row > 0 )
+          {
+            above[( row - 1 ) * nCols + col] += dx;
+          }
+        }
+      }
+    }
+  }
+
+  double sum = 0;
+  double count = 0;
+  QVector<double> columnAbove( nCols, 0. );
+  for ( int row = nRows - 1; row >= 0; --row )
+  {
+    const float* scanLine = block.data + row * nCols;
+    for ( int col = 0; col < nCols; ++col )
+    {
+      columnAbove[col] += above[row * nCols + col];
+      double weight = qBound( 0., own[row * nCols + col] + columnAbove[col], 1. );
+      if ( weight > 0 && validPixel( scanLine[col], block.nodata ) )
+      {
+        count += weight;
+        sum += scanLine[col] * weight;
+      }
+    }
+  }
+  block.sum = sum;
+  block.count = count;
+}
+
+static void processZoneBlocksBatch( GDALRasterBandH band, QVector<ZoneBlock>& blocks, QVector<float>& buffer, bool precise )
+{
+  float* data = buffer.data();
+  for ( int i = 0, n = blocks.size(); i < n; ++i )
+  {
+    ZoneBlock& block = blocks[i];
+    const Zone& zone = *block.zone;
+    block.data = data;
+    if ( GDALRasterIO( band, GF_Read, zone.offsetX, zone.offsetY + block.row, zone.nCellsX, block.nRows, block.data, zone.nCellsX, block.nRows, GDT_Float32, 0, 0 ) != CE_None )
+    {
+      std::fill( block.data, block.data + zone.nCellsX * block.nRows, block.nodata );
+    }
+    data += zone.nCellsX * block.nRows;
+  }
+  QtConcurrent::blockingMap( blocks, precise ? statisticsFromPreciseIntersection : statisticsFromMiddlePointTest );
+}
+
+static void accumulateZoneBlocks( const QVector<ZoneBlock>& blocks )
+{
+  foreach ( const ZoneBlock& block, blocks )
+  {
+    block.zone->sum += block.sum;
+    block.zone->count += block.count;
+  }
+}
+
+/** Computes the statistics of the zones, replacing their sum and count */
+static void processZoneBlocks( GDALRasterBandH band, float nodata, const QVector<Zone*>& zones, bool precise )
+{
+  QVector<ZoneBlock> blocks;
+  QVector<float> buffer;
+  int batchCells = 0;
+  foreach ( Zone* zone, zones )
+  {
+    zone->sum = 0;
+    zone->count = 0;
+    int blockRows = qBound( 1, sMaxBlockCells / zone->nCellsX, zone->nCellsY );
+    for ( int row = 0; row < zone->nCellsY; row += blockRows )
+    {
+      ZoneBlock block;
+      block.zone = zone;
+      block.row = row;
+      block.nRows = qMin( blockRows, zone->nCellsY - row );
+      block.nodata = nodata;
+      block.data = 0;
+      block.sum = 0;
+      block.count = 0;
+      if ( batchCells > 0 && batchCells + block.nRows * zone->nCellsX > sMaxBatchCells )
+      {
+        buffer.resize( batchCells );
+        processZoneBlocksBatch( band, blocks, buffer, precise );
+        accumulateZoneBlocks( blocks );
+        blocks.clear();
+        batchCells = 0;
+      }
+      blocks.append( block );
+      batchCells += block.nRows * zone->nCellsX;
+    }
+  }
+  buffer.resize( batchCells );
+  processZoneBlocksBatch( band, blocks, buffer, precise );
+  accumulateZoneBlocks( blocks );
+}
+
 QgsZonalStatistics::QgsZonalStatistics( QgsVectorLayer* polygonLayer, const QString& rasterFile, const QString& attributePrefix, int rasterBand )
     : mRasterFilePath( rasterFile )
     , mRasterBand( rasterBand )
@@ -141,17 +451,16 @@ int QgsZonalStatistics::calculateStatistics( QProgressDialog* p )
   }
 
 
-  //iterate over each polygon
+  //iterate over the polygons in batches. The zones of a batch are computed concurrently
   QgsFeatureRequest request;
   request.setSubsetOfAttributes( QgsAttributeList() );
   QgsFeatureIterator fi = vectorProvider->getFeatures( request );
   QgsFeature f;
-  double count = 0;
-  double sum = 0;
-  double mean = 0;
+  QgsChangedAttributesMap changeMap;
   int featureCounter = 0;
+  bool featuresLeft = true;
 
-  while ( fi.nextFeature( f ) )
+  while ( featuresLeft )
   {
     if ( p )
     {
@@ -163,69 +472,83 @@ int QgsZonalStatistics::calculateStatistics( QProgressDialog* p )
       break;
     }
 
-    QgsGeometry* featureGeometry = f.geometry();
-    if ( !featureGeometry )
+    QVector<Zone> zones;
+    zones.reserve( sZoneBatchSize );
+    while ( zones.size() < sZoneBatchSize && ( featuresLeft = fi.nextFeature( f ) ) )
     {
       ++featureCounter;
-      continue;
-    }
 
-    QgsRectangle featureRect = featureGeometry->boundingBox().intersect( &rasterBBox );
-    if ( featureRect.isEmpty() )
-    {
-      ++featureCounter;
-      continue;
-    }
+      QgsGeometry* featureGeometry = f.geometry();
+      if ( !featureGeometry )
+      {
+        continue;
+      }
 
-    int offsetX, offsetY, nCellsX, nCellsY;
-    if ( cellInfoForBBox( rasterBBox, featureRect, cellsizeX, cellsizeY, offsetX, offsetY, nCellsX, nCellsY ) != 0 )
-    {
-      ++featureCounter;
-      continue;
-    }
+      QgsRectangle featureRect = featureGeometry->boundingBox().intersect( &rasterBBox );
+      if ( featureRect.isEmpty() )
+      {
+        continue;
+      }
 
-    //avoid access to cells outside of the raster (may occur because of rounding)
-    if (( offsetX + nCellsX ) > nCellsXGDAL )
-    {
-      nCellsX = nCellsXGDAL - offsetX;
-    }
-    if (( offsetY + nCellsY ) > nCellsYGDAL )
-    {
-      nCellsY = nCellsYGDAL - offsetY;
-    }
+      Zone zone;
+      zone.id = f.id();
+      zone.sum = 0;
+      zone.count = 0;
+      if ( cellInfoForBBox( rasterBBox, featureRect, cellsizeX, cellsizeY, zone.offsetX, zone.offsetY, zone.nCellsX, zone.nCellsY ) != 0 )
+      {
+        continue;
+      }
 
-    statisticsFromMiddlePointTest( rasterBand, featureGeometry, offsetX, offsetY, nCellsX, nCellsY, cellsizeX, cellsizeY,
-                                   rasterBBox, sum, count );
+      //avoid access to cells outside of the raster (may occur because of rounding)
+      if (( zone.offsetX + zone.nCellsX ) > nCellsXGDAL )
+      {
+        zone.nCellsX = nCellsXGDAL - zone.offsetX;
+      }
+      if (( zone.offsetY + zone.nCellsY ) > nCellsYGDAL )
+      {
+        zone.nCellsY = nCellsYGDAL - zone.offsetY;
+      }
 
-    if ( count <= 1 )
-    {
-      //the cell resolution is probably larger than the polygon area. We switch to precise pixel - polygon intersection in this case
-      statisticsFromPreciseIntersection( rasterBand, featureGeometry, offsetX, offsetY, nCellsX, nCellsY, cellsizeX, cellsizeY,
-                                         rasterBBox, sum, count );
+      if ( zone.nCellsX > 0 && zone.nCellsY > 0 )
+      {
+        zone.rings = pixelRings( featureGeometry, rasterBBox, cellsizeX, cellsizeY );
+        zones.append( zone );
+      }
     }
 
-
-    if ( count == 0 )
+    QVector<Zone*> allZones;
+    for ( int i = 0, n = zones.size(); i < n; ++i )
     {
-      mean = 0;
+      allZones.append( &zones[i] );
     }
-    else
+    processZoneBlocks( rasterBand, mInputNodataValue, allZones, false );
+
+    //the cell resolution is probably larger than the polygon area. We switch to precise pixel - polygon intersection in this case
+    QVector<Zone*> smallZones;
+    foreach ( Zone* zone, allZones )
     {
-      mean = sum / count;
+      if ( zone->count <= 1 )
+      {
+        smallZones.append( zone );
+      }
     }
+    processZoneBlocks( rasterBand, mInputNodataValue, smallZones, true );
 
-    //write the statistics value to the vector data provider
-    QgsChangedAttributesMap changeMap;
-    QgsAttributeMap changeAttributeMap;
-    changeAttributeMap.insert( countIndex, QVariant( count ) );
-    changeAttributeMap.insert( sumIndex, QVariant( sum ) );
-    changeAttributeMap.insert( meanIndex, QVariant( mean ) );
-    changeMap.insert( f.id(), changeAttributeMap );
-    vectorProvider->changeAttributeValues( changeMap );
+    foreach ( const Zone& zone, zones )
+    {
+      double mean = zone.count == 0 ? 0 : zone.sum / zone.count;
 
-    ++featureCounter;
+      QgsAttributeMap changeAttributeMap;
+      changeAttributeMap.insert( countIndex, QVariant( zone.count ) );
+      changeAttributeMap.insert( sumIndex, QVariant( zone.sum ) );
+      changeAttributeMap.insert( meanIndex, QVariant( mean ) );
+      changeMap.insert( zone.id, changeAttributeMap );
+    }
   }
 
+  //write the statistics values to the vector data provider in one go
+  vectorProvider->changeAttributeValues( changeMap );
+
   if ( p )
   {
     p->setValue( featureCount );
@@ -266,123 +589,6 @@ int QgsZonalStatistics::cellInfoForBBox( const QgsRectangle& rasterBBox, const Q
   return 0;
 }
 
-void QgsZonalStatistics::statisticsFromMiddlePointTest( void* band, QgsGeometry* poly, int pixelOffsetX,
-    int pixelOffsetY, int nCellsX, int nCellsY, double cellSizeX, double cellSizeY, const QgsRectangle& rasterBBox, double& sum, double& count )
-{
-  double cellCenterX, cellCenterY;
-
-  float* scanLine = ( float * ) CPLMalloc( sizeof( float ) * nCellsX );
-  cellCenterY = rasterBBox.yMaximum() - pixelOffsetY * cellSizeY - cellSizeY / 2;
-  count = 0;
-  sum = 0;
-
-  const GEOSGeometry* polyGeos = poly->asGeos();
-  if ( !polyGeos )
-  {
-    return;
-  }
-
-  GEOSContextHandle_t geosctxt = QgsGeometry::getGEOSHandler();
-  const GEOSPreparedGeometry* polyGeosPrepared = GEOSPrepare_r( geosctxt, poly->asGeos() );
-  if ( !polyGeosPrepared )
-  {
-    return;
-  }
-
-  GEOSCoordSequence* cellCenterCoords = 0;
-  GEOSGeometry* currentCellCenter = 0;
-
-  for ( int i = 0; i < nCellsY; ++i )
-  {
-    if ( GDALRasterIO( band, GF_Read, pixelOffsetX, pixelOffsetY + i, nCellsX, 1, scanLine, nCellsX, 1, GDT_Float32, 0, 0 )
-         != CPLE_None )
-    {
-      continue;
-    }
-    cellCenterX = rasterBBox.xMinimum() + pixelOffsetX * cellSizeX + cellSizeX / 2;
-    for ( int j = 0; j < nCellsX; ++j )
-    {
-      if ( validPixel( scanLine[j] ) )
-      {
-        GEOSGeom_destroy_r( geosctxt, currentCellCenter );
-        cellCenterCoords = GEOSCoordSeq_create_r( geosctxt, 1, 2 );
-        GEOSCoordSeq_setX_r( geosctxt, cellCenterCoords, 0, cellCenterX );
-        GEOSCoordSeq_setY_r( geosctxt, cellCenterCoords, 0, cellCenterY );
-        currentCellCenter = GEOSGeom_createPoint_r( geosctxt, cellCenterCoords );
-        if ( GEOSPreparedContains_r( geosctxt, polyGeosPrepared, currentCellCenter ) )
-        {
-          sum += scanLine[j];
-          ++count;
-        }
-      }
-      cellCenterX += cellSizeX;
-    }
-    cellCenterY -= cellSizeY;
-  }
-  GEOSGeom_destroy_r( geosctxt, currentCellCenter );
-  CPLFree( scanLine );
-  GEOSPreparedGeom_destroy_r( geosctxt, polyGeosPrepared );
-}
-
-void QgsZonalStatistics::statisticsFromPreciseIntersection( void* band, QgsGeometry* poly, int pixelOffsetX,
-    int pixelOffsetY, int nCellsX, int nCellsY, double cellSizeX, double cellSizeY, const QgsRectangle& rasterBBox, double& sum, double& count )
-{
-  sum = 0;
-  count = 0;
-  double currentY = rasterBBox.yMaximum() - pixelOffsetY * cellSizeY - cellSizeY / 2;
-  float* pixelData = ( float * ) CPLMalloc( sizeof( float ) );
-  QgsGeometry* pixelRectGeometry = 0;
-
-  double hCellSizeX = cellSizeX / 2.0;
-  double hCellSizeY = cellSizeY / 2.0;
-  double pixelArea = cellSizeX * cellSizeY;
-  double weight = 0;
-
-  for ( int row = 0; row < nCellsY; ++row )
-  {
-    double currentX = rasterBBox.xMinimum() + cellSizeX / 2.0 + pixelOffsetX * cellSizeX;
-    for ( int col = 0; col < nCellsX; ++col )
-    {
-      CPLErr err = GDALRasterIO( band, GF_Read, pixelOffsetX + col, pixelOffsetY + row, nCellsX, 1, pixelData, 1, 1, GDT_Float32, 0, 0 );
-      Q_UNUSED( err );
-      if ( !validPixel( *pixelData ) )
-        continue;
-
-      pixelRectGeometry = QgsGeometry::fromRect( QgsRectangle( currentX - hCellSizeX, currentY - hCellSizeY, currentX + hCellSizeX, currentY + hCellSizeY ) );
-      if ( pixelRectGeometry )
-      {
-        //intersection
-        QgsGeometry *intersectGeometry = pixelRectGeometry->intersection( poly );
-        if ( intersectGeometry )
-        {
-          double intersectionArea = intersectGeometry->area();
-          if ( intersectionArea >= 0.0 )
-          {
-            weight = intersectionArea / pixelArea;
-            count += weight;
-            sum += *pixelData * weight;
-          }
-          delete intersectGeometry;
-        }
-        delete pixelRectGeometry;
-        pixelRectGeometry = 0;
-      }
-      currentX += cellSizeX;
-    }
-    currentY -= cellSizeY;
-  }
-  CPLFree( pixelData );
-}
-
-bool QgsZonalStatistics::validPixel( float value ) const
-{
-  if ( value == mInputNodataValue || qIsNaN( value ) )
-  {
-    return false;
-  }
-  return true;
-}
-
 QString QgsZonalStatistics::getUniqueFieldName( QString fieldName )
 {
   QgsVectorDataProvider* dp = mPolygonLayer->dataProvider();
@@ -18,23 +18,19 @@
 #include "qgisapp.h"
 #include "qgsmaptoolhillshade.h"
 #include "qgscolorrampshader.h"
+#include "qgscoordinatetransform.h"
 #include "qgisinterface.h"
 #include "qgsmapcanvas.h"
 #include "qgsmaplayer.h"
 #include "qgsmaplayerregistry.h"
 #include "qgsproject.h"
 #include "qgsrasterlayer.h"
-#include "qgstemporaryfile.h"
-#include "qgssinglebandpseudocolorrenderer.h"
-#include "qgshillshadefilter.h"
+#include "qgsterrainrenderer.h"
 
-#include <QApplication>
 #include <QDialogButtonBox>
-#include <QDir>
 #include <QDoubleSpinBox>
 #include <QGridLayout>
 #include <QLabel>
-#include <QProgressDialog>
 
 
 QgsMapToolHillshade::QgsMapToolHillshade( QgsMapCanvas* mapCanvas )
@@ -108,23 +104,17 @@ void QgsMapToolHillshade::compute( const QgsRectangle &extent, const QgsCoordina
     return;
   }
 
-  QString outputFileName = QString( "hillshade_%1-%2_%3-%4.tif" ).arg( extent.xMinimum() ).arg( extent.xMaximum() ).arg( extent.yMinimum() ).arg( extent.yMaximum() );
-  QString outputFile = QgsTemporaryFile::createNewFile( outputFileName );
-
-  QgsHillshadeFilter hillshade( layer->source(), outputFile, "GTiff", spinHorAngle->value(), spinVerAngle->value(), extent, crs );
-  QProgressDialog p( tr( "Calculating hillshade..." ), tr( "Abort" ), 0, 0 );
-  p.setWindowTitle( tr( "Hillshade" ) );
-  p.setWindowModality( Qt::ApplicationModal );
-  QApplication::setOverrideCursor( Qt::WaitCursor );
-  hillshade.processRaster( &p );
-  QApplication::restoreOverrideCursor();
-  if ( !p.wasCanceled() )
+  QgsRasterLayer* rlayer = new QgsRasterLayer( layer->source(), tr( "Hillshade [%1]" ).arg( extent.toString( true ) ), static_cast<QgsRasterLayer*>( layer )->providerType() );
+  if ( !rlayer->isValid() )
   {
-    QgsRasterLayer* layer = new QgsRasterLayer( outputFile, tr( "Hillshade [%1]" ).arg( extent.toString( true ) ) );
-    if ( layer->isValid() && layer->renderer() )
-    {
-      layer->renderer()->setOpacity( 0.6 );
-      QgsMapLayerRegistry::instance()->addMapLayer( layer );
-    }
+    delete rlayer;
+    return;
   }
+  QgsTerrainRenderer* renderer = new QgsTerrainRenderer( rlayer->dataProvider(), 1, QgsTerrainRenderer::Hillshade );
+  renderer->setLightAzimuth( spinHorAngle->value() );
+  renderer->setLightAngle( spinVerAngle->value() );
+  renderer->setClipExtent( QgsCoordinateTransform( crs, rlayer->crs() ).transformBoundingBox( extent ) );
+  renderer->setOpacity( 0.6 );
+  rlayer->setRenderer( renderer );
+  QgsMapLayerRegistry::instance()->addMapLayer( rlayer );
 }
@@ -18,18 +18,14 @@
 #include "qgisapp.h"
 #include "qgsmaptoolslope.h"
 #include "qgscolorrampshader.h"
+#include "qgscoordinatetransform.h"
 #include "qgsmapcanvas.h"
 #include "qgsmaplayer.h"
 #include "qgsmaplayerregistry.h"
 #include "qgsproject.h"
 #include "qgsrasterlayer.h"
-#include "qgstemporaryfile.h"
-#include "qgssinglebandpseudocolorrenderer.h"
-#include "qgsslopefilter.h"
-
-#include <QApplication>
-#include <QDir>
-#include <QProgressDialog>
+#include "qgsrastershader.h"
+#include "qgsterrainrenderer.h"
 
 
 QgsMapToolSlope::QgsMapToolSlope( QgsMapCanvas* mapCanvas )
@@ -73,36 +69,30 @@ void QgsMapToolSlope::compute( const QgsRectangle &extent, const QgsCoordinateRe
     return;
   }
 
-  QString outputFileName = QString( "slope_%1-%2_%3-%4.tif" ).arg( extent.xMinimum() ).arg( extent.xMaximum() ).arg( extent.yMinimum() ).arg( extent.yMaximum() );
-  QString outputFile = QgsTemporaryFile::createNewFile( outputFileName );
-
-  QgsSlopeFilter slope( layer->source(), outputFile, "GTiff", extent, crs );
-  QProgressDialog p( tr( "Calculating slope..." ), tr( "Abort" ), 0, 0 );
-  p.setWindowTitle( tr( "Slope" ) );
-  p.setWindowModality( Qt::ApplicationModal );
-  QApplication::setOverrideCursor( Qt::WaitCursor );
-  slope.processRaster( &p );
-  QApplication::restoreOverrideCursor();
-  if ( !p.wasCanceled() )
+  QgsRasterLayer* rlayer = new QgsRasterLayer( layer->source(), tr( "Slope [%1]" ).arg( extent.toString( true ) ), static_cast<QgsRasterLayer*>( layer )->providerType() );
+  if ( !rlayer->isValid() )
   {
-    QgsRasterLayer* layer = new QgsRasterLayer( outputFile, tr( "Slope [%1]" ).arg( extent.toString( true ) ) );
-    QgsColorRampShader* rampShader = new QgsColorRampShader();
-    QList<QgsColorRampShader::ColorRampItem> colorRampItems = QList<QgsColorRampShader::ColorRampItem>()
-        << QgsColorRampShader::ColorRampItem( 0, QColor( 43, 131, 186 ), QString::fromUtf8( "0°" ) )
-        << QgsColorRampShader::ColorRampItem( 5, QColor( 99, 171, 176 ), QString::fromUtf8( "5°" ) )
-        << QgsColorRampShader::ColorRampItem( 10, QColor( 156, 211, 166 ), QString::fromUtf8( "10°" ) )
-        << QgsColorRampShader::ColorRampItem( 15, QColor( 199, 232, 173 ), QString::fromUtf8( "15°" ) )
-        << QgsColorRampShader::ColorRampItem( 20, QColor( 236, 247, 185 ), QString::fromUtf8( "20°" ) )
-        << QgsColorRampShader::ColorRampItem( 25, QColor( 254, 237, 170 ), QString::fromUtf8( "25°" ) )
-        << QgsColorRampShader::ColorRampItem( 30, QColor( 253, 201, 128 ), QString::fromUtf8( "30°" ) )
-        << QgsColorRampShader::ColorRampItem( 35, QColor( 248, 157, 89 ), QString::fromUtf8( "35°" ) )
-        << QgsColorRampShader::ColorRampItem( 40, QColor( 231, 91, 58 ), QString::fromUtf8( "40°" ) )
-        << QgsColorRampShader::ColorRampItem( 45, QColor( 215, 25, 28 ), QString::fromUtf8( "45°" ) );
-    rampShader->setColorRampItemList( colorRampItems );
-    QgsRasterShader* shader = new QgsRasterShader();
-    shader->setRasterShaderFunction( rampShader );
-    QgsSingleBandPseudoColorRenderer* renderer = new QgsSingleBandPseudoColorRenderer( 0, 1, shader );
-    layer->setRenderer( renderer );
-    QgsMapLayerRegistry::instance()->addMapLayer( layer );
+    delete rlayer;
+    return;
   }
+  QgsColorRampShader* rampShader = new QgsColorRampShader();
+  QList<QgsColorRampShader::ColorRampItem> colorRampItems = QList<QgsColorRampShader::ColorRampItem>()
+      << QgsColorRampShader::ColorRampItem( 0, QColor( 43, 131, 186 ), QString::fromUtf8( "0°" ) )
+      << QgsColorRampShader::ColorRampItem( 5, QColor( 99, 171, 176 ), QString::fromUtf8( "5°" ) )
+      << QgsColorRampShader::ColorRampItem( 10, QColor( 156, 211, 166 ), QString::fromUtf8( "10°" ) )
+      << QgsColorRampShader::ColorRampItem( 15, QColor( 199, 232, 173 ), QString::fromUtf8( "15°" ) )
+      << QgsColorRampShader::ColorRampItem( 20, QColor( 236, 247, 185 ), QString::fromUtf8( "20°" ) )
+      << QgsColorRampShader::ColorRampItem( 25, QColor( 254, 237, 170 ), QString::fromUtf8( "25°" ) )
+      << QgsColorRampShader::ColorRampItem( 30, QColor( 253, 201, 128 ), QString::fromUtf8( "30°" ) )
+      << QgsColorRampShader::ColorRampItem( 35, QColor( 248, 157, 89 ), QString::fromUtf8( "35°" ) )
+      << QgsColorRampShader::ColorRampItem( 40, QColor( 231, 91, 58 ), QString::fromUtf8( "40°" ) )
+      << QgsColorRampShader::ColorRampItem( 45, QColor( 215, 25, 28 ), QString::fromUtf8( "45°" ) );
+  rampShader->setColorRampItemList( colorRampItems );
+  QgsRasterShader* shader = new QgsRasterShader();
+  shader->setRasterShaderFunction( rampShader );
+  QgsTerrainRenderer* renderer = new QgsTerrainRenderer( rlayer->dataProvider(), 1, QgsTerrainRenderer::Slope );
+  renderer->setShader( shader );
+  renderer->setClipExtent( QgsCoordinateTransform( crs, rlayer->crs() ).transformBoundingBox( extent ) );
+  rlayer->setRenderer( renderer );
+  QgsMapLayerRegistry::instance()->addMapLayer( rlayer );
 }
@@ -24,6 +24,7 @@
 #include "qgscurvepolygonv2.h"
 #include "qgscolorrampshader.h"
 #include "qgsdistancearea.h"
+#include "qgsfeedback.h"
 #include "qgsgeometry.h"
 #include "qgsmapcanvas.h"
 #include "qgsmaplayer.h"
@@ -37,6 +38,7 @@
 #include "qgspinannotationitem.h"
 
 #include <QApplication>
+#include <QCheckBox>
 #include <QComboBox>
 #include <QDialogButtonBox>
 #include <QDir>
@@ -46,6 +48,7 @@
 #include <QMessageBox>
 #include <QProgressDialog>
 #include <QSlider>
+#include <QtConcurrentRun>
 
 QgsViewshedDialog::QgsViewshedDialog( double radius, QWidget *parent )
     : QDialog( parent )
@@ -109,10 +112,14 @@ QgsViewshedDialog::QgsViewshedDialog( double radius, QWidget *parent )
   labelWidget->layout()->addWidget( new QLabel( QString( "<small>%1</small>" ).arg( tr( "Fast" ) ) ) );
   heightDialogLayout->addWidget( labelWidget, 6, 1, 1, 1 );
 
+  mProgressiveCheckBox = new QCheckBox( tr( "Show coarse result first, then refine" ) );
+  mProgressiveCheckBox->setChecked( QSettings().value( "/Qgis/viewshedProgressive", true ).toBool() );
+  heightDialogLayout->addWidget( mProgressiveCheckBox, 7, 0, 1, 2 );
+
   QDialogButtonBox* bbox = new QDialogButtonBox( QDialogButtonBox::Ok | QDialogButtonBox::Cancel, Qt::Horizontal );
   connect( bbox, SIGNAL( accepted() ), this, SLOT( accept() ) );
   connect( bbox, SIGNAL( rejected() ), this, SLOT( reject() ) );
-  heightDialogLayout->addWidget( bbox, 7, 0, 1, 2 );
+  heightDialogLayout->addWidget( bbox, 8, 0, 1, 2 );
 
   setLayout( heightDialogLayout );
   setFixedSize( sizeHint() );
@@ -143,13 +150,28 @@ int QgsViewshedDialog::getAccuracyFactor() const
   return mAccuracySlider->value();
 }
 
+bool QgsViewshedDialog::getProgressiveRefinement() const
+{
+  return mProgressiveCheckBox->isChecked();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
+//minimum radius in heightmap pixels of a coarse progressive refinement level
+static const int sMinProgressiveRadiusPixels = 16;
+
 QgsMapToolViewshed::QgsMapToolViewshed( QgsMapCanvas* mapCanvas )
     : QgsMapToolDrawCircularSector( mapCanvas )
+    , mRefineFeedback( 0 )
 {
   setCursor( Qt::ArrowCursor );
   connect( this, SIGNAL( finished() ), this, SLOT( drawFinished() ) );
+  connect( &mRefineWatcher, SIGNAL( finished() ), this, SLOT( refinementFinished() ) );
+}
+
+QgsMapToolViewshed::~QgsMapToolViewshed()
+{
+  cancelRefinement();
 }
 
 void QgsMapToolViewshed::activate()
@@ -211,41 +233,66 @@ void QgsMapToolViewshed::drawFinished()
 
   double heightConv = QGis::fromUnitToUnitFactor( QgsCoordinateFormat::instance()->getHeightDisplayUnit(), QGis::Meters );
 
+  // A new viewshed supersedes the refinement of the previous one
+  cancelRefinement();
+
+  ViewshedParams params;
+  params.inputFile = layer->source();
+  params.outputFile = outputFile;
+  params.center = center;
+  params.crs = canvasCrs;
+  params.observerHeight = viewshedDialog.getObserverHeight() * heightConv;
+  params.targetHeight = viewshedDialog.getTargetHeight() * heightConv;
+  params.heightRelToGround = viewshedDialog.getHeightRelativeToGround();
+  params.radius = curRadius;
+  params.filterRegion = filterRegion;
+  params.displayVisible = viewshedDialog.getDisplayMode() == QgsViewshedDialog::DisplayVisibleArea;
+  params.feedback = 0;
+
+  // In progressive mode, a coarse viewshed is computed first and refined in the background
+  int accuracyFactor = viewshedDialog.getAccuracyFactor();
+  QList<int> levels;
+  QSettings().setValue( "/Qgis/viewshedProgressive", viewshedDialog.getProgressiveRefinement() );
+  if ( viewshedDialog.getProgressiveRefinement() )
+  {
+    // Skip coarse levels where the radius would only span a few heightmap pixels (or none at all)
+    QgsRasterLayer* heightmapLayer = static_cast<QgsRasterLayer*>( layer );
+    double pixelSize = qMax( heightmapLayer->rasterUnitsPerPixelX(), heightmapLayer->rasterUnitsPerPixelY() );
+    if ( heightmapLayer->crs().mapUnits() != QGis::Meters )
+    {
+      pixelSize *= QGis::fromUnitToUnitFactor( heightmapLayer->crs().mapUnits(), QGis::Meters );
+    }
+    foreach ( int level, QList<int>() << 4 * accuracyFactor << 2 * accuracyFactor )
+    {
+      if ( pixelSize > 0 && curRadius / ( pixelSize * level ) >= sMinProgressiveRadiusPixels )
+      {
+        levels << level;
+      }
+    }
+  }
+  levels << accuracyFactor;
+  params.accuracyFactor = levels.takeFirst();
+
   QProgressDialog p( tr( "Calculating viewshed..." ), tr( "Abort" ), 0, 0 );
   p.setWindowTitle( tr( "Viewshed" ) );
   p.setWindowModality( Qt::ApplicationModal );
-  bool displayVisible = viewshedDialog.getDisplayMode() == QgsViewshedDialog::DisplayVisibleArea;
-  int accuracyFactor = viewshedDialog.getAccuracyFactor();
   QApplication::setOverrideCursor( Qt::WaitCursor );
-  bool success = QgsViewshed::computeViewshed( layer->source(), outputFile, "GTiff", center, canvasCrs, viewshedDialog.getObserverHeight() * heightConv, viewshedDialog.getTargetHeight() * heightConv, viewshedDialog.getHeightRelativeToGround(), curRadius, QGis::Meters, filterRegion, displayVisible, accuracyFactor, &p );
+  bool success = computeViewshed( params, &p );
   QApplication::restoreOverrideCursor();
   if ( success )
   {
     QgsRasterLayer* layer = new QgsRasterLayer( outputFile, tr( "Viewshed [%1]" ).arg( center.toString() ) );
-    QgsColorRampShader* rampShader = new QgsColorRampShader();
-    if ( displayVisible )
-    {
-      QList<QgsColorRampShader::ColorRampItem> colorRampItems = QList<QgsColorRampShader::ColorRampItem>()
-          << QgsColorRampShader::ColorRampItem( 0, QColor( 0, 0, 0, 0 ), "" )
-          << QgsColorRampShader::ColorRampItem( 255, QColor( 0, 255, 0 ), tr( "Visible" ) );
-      rampShader->setColorRampItemList( colorRampItems );
-    }
-    else
-    {
-      QList<QgsColorRampShader::ColorRampItem> colorRampItems = QList<QgsColorRampShader::ColorRampItem>()
-          << QgsColorRampShader::ColorRampItem( 0, QColor( 0, 0, 0, 0 ), "" )
-          << QgsColorRampShader::ColorRampItem( 0, QColor( 255, 0, 0 ), tr( "Invisible" ) );
-      rampShader->setColorRampItemList( colorRampItems );
-    }
-    QgsRasterShader* shader = new QgsRasterShader();
-    shader->setRasterShaderFunction( rampShader );
-    QgsSingleBandPseudoColorRenderer* renderer = new QgsSingleBandPseudoColorRenderer( 0, 1, shader );
-    layer->setRenderer( renderer );
+    layer->setRenderer( createRenderer( params.displayVisible ) );
     QgsMapLayerRegistry::instance()->addMapLayer( layer );
     QgsPinAnnotationItem* pin = new QgsPinAnnotationItem( canvas() );
     pin->setMapPosition( center, canvasCrs );
     pin->setItemFlags( pin->itemFlags() | QgsAnnotationItem::ItemMapPositionLocked );
     QgisApp::instance()->itemCouplingManager()->addCoupling( layer, pin );
+
+    mRefineParams = params;
+    mRefineLevels = levels;
+    mRefineLayer = layer;
+    startRefinement();
   }
   else
   {
@@ -254,6 +301,83 @@ void QgsMapToolViewshed::drawFinished()
   reset();
 }
 
+bool QgsMapToolViewshed::computeViewshed( ViewshedParams params, QProgressDialog* progress )
+{
+  return QgsViewshed::computeViewshed( params.inputFile, params.outputFile, "GTiff", params.center, params.crs, params.observerHeight, params.targetHeight, params.heightRelToGround, params.radius, QGis::Meters, params.filterRegion, params.displayVisible, params.accuracyFactor, progress, params.feedback );
+}
+
+QgsRasterRenderer* QgsMapToolViewshed::createRenderer( bool displayVisible )
+{
+  QgsColorRampShader* rampShader = new QgsColorRampShader();
+  if ( displayVisible )
+  {
+    QList<QgsColorRampShader::ColorRampItem> colorRampItems = QList<QgsColorRampShader::ColorRampItem>()
+        << QgsColorRampShader::ColorRampItem( 0, QColor( 0, 0, 0, 0 ), "" )
+        << QgsColorRampShader::ColorRampItem( 255, QColor( 0, 255, 0 ), tr( "Visible" ) );
+    rampShader->setColorRampItemList( colorRampItems );
+  }
+  else
+  {
+    QList<QgsColorRampShader::ColorRampItem> colorRampItems = QList<QgsColorRampShader::ColorRampItem>()
+        << QgsColorRampShader::ColorRampItem( 0, QColor( 0, 0, 0, 0 ), "" )
+        << QgsColorRampShader::ColorRampItem( 0, QColor( 255, 0, 0 ), tr( "Invisible" ) );
+    rampShader->setColorRampItemList( colorRampItems );
+  }
+  QgsRasterShader* shader = new QgsRasterShader();
+  shader->setRasterShaderFunction( rampShader );
+  return new QgsSingleBandPseudoColorRenderer( 0, 1, shader );
+}
+
+void QgsMapToolViewshed::startRefinement()
+{
+  if ( mRefineLevels.isEmpty() || !mRefineLayer )
+  {
+    mRefineLevels.clear();
+    return;
+  }
+  mRefineParams.accuracyFactor = mRefineLevels.takeFirst();
+  QString outputFileName = QString( "viewshed_%1,%2_%3.tif" ).arg( mRefineParams.center.x() ).arg( mRefineParams.center.y() ).arg( mRefineParams.accuracyFactor );
+  mRefineParams.outputFile = QgsTemporaryFile::createNewFile( outputFileName );
+  mRefineFeedback = new QgsFeedback();
+  mRefineParams.feedback = mRefineFeedback;
+  mRefineWatcher.setFuture( QtConcurrent::run( &QgsMapToolViewshed::computeViewshed, mRefineParams, static_cast<QProgressDialog*>( 0 ) ) );
+}
+
+void QgsMapToolViewshed::cancelRefinement()
+{
+  mRefineLevels.clear();
+  mRefineLayer = 0;
+  if ( mRefineFeedback )
+  {
+    mRefineFeedback->cancel();
+    mRefineWatcher.waitForFinished();
+    // Discards the pending finished notification
+    mRefineWatcher.setFuture( QFuture<bool>() );
+    delete mRefineFeedback;
+    mRefineFeedback = 0;
+  }
+}
+
+void QgsMapToolViewshed::refinementFinished()
+{
+  bool success = !mRefineFeedback->isCanceled() && mRefineWatcher.result();
+  delete mRefineFeedback;
+  mRefineFeedback = 0;
+  if ( !success || !mRefineLayer )
+  {
+    mRefineLevels.clear();
+    return;
+  }
+
+  // Swap the refined result into the displayed layer
+  mRefineLayer->setSource( mRefineParams.outputFile );
+  mRefineLayer->setDataProvider( "gdal" );
+  mRefineLayer->setRenderer( createRenderer( mRefineParams.displayVisible ) );
+  mRefineLayer->triggerRepaint();
+
+  startRefinement();
+}
+
 void QgsMapToolViewshed::adjustRadius( double newRadius )
 {
   QGis::UnitType measureUnit = QGis::Meters;
@@ -19,12 +19,21 @@
 #define QGSMAPTOOLVIEWSHED_H
 
 #include "qgsmaptooldrawshape.h"
+#include "qgscoordinatereferencesystem.h"
+#include "qgspoint.h"
 
 #include <QDialog>
+#include <QFutureWatcher>
+#include <QPointer>
 
+class QCheckBox;
 class QComboBox;
 class QDoubleSpinBox;
+class QProgressDialog;
 class QSlider;
+class QgsFeedback;
+class QgsRasterLayer;
+class QgsRasterRenderer;
 
 class APP_EXPORT QgsViewshedDialog : public QDialog
 {
@@ -38,6 +47,7 @@ class APP_EXPORT QgsViewshedDialog : public QDialog
     bool getHeightRelativeToGround() const;
     DisplayMode getDisplayMode() const;
     int getAccuracyFactor() const;
+    bool getProgressiveRefinement() const;
 
   signals:
     void radiusChanged( double radius );
@@ -49,6 +59,7 @@ class APP_EXPORT QgsViewshedDialog : public QDialog
     QComboBox* mComboHeightMode;
     QComboBox* mDisplayModeCombo;
     QSlider* mAccuracySlider;
+    QCheckBox* mProgressiveCheckBox;
 };
 
 class APP_EXPORT QgsMapToolViewshed : public QgsMapToolDrawCircularSector
@@ -56,11 +67,43 @@ class APP_EXPORT QgsMapToolViewshed : public QgsMapToolDrawCircularSector
     Q_OBJECT
   public:
     QgsMapToolViewshed( QgsMapCanvas* mapCanvas );
+    ~QgsMapToolViewshed();
     void activate();
 
   private slots:
     void drawFinished();
     void adjustRadius( double newRadius );
+    void refinementFinished();
+
+  private:
+    struct ViewshedParams
+    {
+      QString inputFile;
+      QString outputFile;
+      QgsPoint center;
+      QgsCoordinateReferenceSystem crs;
+      double observerHeight;
+      double targetHeight;
+      bool heightRelToGround;
+      double radius;
+      QVector<QgsPoint> filterRegion;
+      bool displayVisible;
+      int accuracyFactor;
+      QgsFeedback* feedback;
+    };
+
+    // Progressive refinement: after a coarse viewshed is displayed, the finer
+    // levels are computed in the background and swapped into the same layer.
+    ViewshedParams mRefineParams;
+    QList<int> mRefineLevels;
+    QPointer<QgsRasterLayer> mRefineLayer;
+    QFutureWatcher<bool> mRefineWatcher;
+    QgsFeedback* mRefineFeedback;
+
+    void startRefinement();
+    void cancelRefinement();
+    static bool computeViewshed( ViewshedParams params, QProgressDialog* progress = 0 );
+    static QgsRasterRenderer* createRenderer( bool displayVisible );
 };
 
 #endif // QGSMAPTOOLVIEWSHED_H
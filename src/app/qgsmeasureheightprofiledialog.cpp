@@ -26,7 +26,7 @@
 #include "qgslogger.h"
 #include "qgsrubberband.h"
 #include "qgsproject.h"
-#include <gdal.h>
+#include "qgsrastersampler.h"
 #include <QApplication>
 #include <QClipboard>
 #include <QComboBox>
@@ -47,20 +47,16 @@
 #include <qwt_plot_marker.h>
 #include <qwt_symbol.h>
 #include <qmath.h>
+#include <limits>
 
 
 class QgsMeasureHeightProfileDialog::ScaleDraw : public QwtScaleDraw
 {
   public:
-    ScaleDraw( double maxVal, int nSamples ) : mFactor( maxVal / nSamples )
-    {
-    }
     QwtText label( double value ) const override
     {
-      return QLocale::system().toString( value * mFactor );
+      return QLocale::system().toString( value );
     }
-  private:
-    double mFactor;
 };
 
 #if QWT_VERSION >= 0x060000
@@ -80,7 +76,7 @@ class PaddedPlotMarker : public QwtPlotMarker
 
 
 QgsMeasureHeightProfileDialog::QgsMeasureHeightProfileDialog( QgsMeasureHeightProfileTool *tool, QWidget *parent, Qt::WindowFlags f )
-    : QDialog( parent, f ), mTool( tool ), mLineOfSightMarker( 0 ), mNSamples( 1000 )
+    : QDialog( parent, f ), mTool( tool ), mLineOfSightMarker( 0 ), mNSamples( 1000 ), mSampler( 0 ), mNoHeightmapNotified( false )
 {
   setWindowTitle( tr( "Height profile" ) );
   setAttribute( Qt::WA_ShowWithoutActivating );
@@ -182,6 +178,11 @@ QgsMeasureHeightProfileDialog::QgsMeasureHeightProfileDialog( QgsMeasureHeightPr
   restoreGeometry( QSettings().value( "/Windows/MeasureHeightProfile/geometry" ).toByteArray() );
 }
 
+QgsMeasureHeightProfileDialog::~QgsMeasureHeightProfileDialog()
+{
+  delete mSampler;
+}
+
 void QgsMeasureHeightProfileDialog::setPoints( const QList<QgsPoint>& points, const QgsCoordinateReferenceSystem &crs )
 {
   mPoints = points;
@@ -203,12 +204,16 @@ void QgsMeasureHeightProfileDialog::setPoints( const QList<QgsPoint>& points, co
 
 void QgsMeasureHeightProfileDialog::setMarkerPos( int segment, const QgsPoint &p )
 {
+  if ( mSampleDistances.isEmpty() )
+  {
+    return;
+  }
   double x = qSqrt( p.sqrDist( mPoints[segment] ) );
   for ( int i = 0; i < segment; ++i )
   {
     x += mSegmentLengths[i];
   }
-  int idx = qMin( int( x / mTotLength * mNSamples ), mNSamples - 1 );
+  int idx = sampleIndex( x );
 #if QWT_VERSION < 0x060000
   mPlotMarker->setValue( mPlotCurve->x( idx ), mPlotCurve->y( idx ) );
   mPlotMarker->setLabel( QString::number( qRound( mPlotCurve->y( idx ) ) ) );
@@ -236,6 +241,9 @@ void QgsMeasureHeightProfileDialog::clear()
   mLineOfSightMarker = 0;
   qDeleteAll( mNodeMarkers );
   mNodeMarkers.clear();
+  mSegmentSamples.clear();
+  mSampleDistances.clear();
+  mNoHeightmapNotified = false;
   mPlot->replot();
   mLineOfSightGroupBoxgroupBox->setEnabled( false );
 }
@@ -254,7 +262,7 @@ void QgsMeasureHeightProfileDialog::replot()
   mObserverHeightSpinBox->setSuffix( vertDisplayUnit == QGis::Feet ? " ft" : " m" );
   mTargetHeightSpinBox->setSuffix( vertDisplayUnit == QGis::Feet ? " ft" : " m" );
 
-  if ( mPoints.isEmpty() )
+  if ( mPoints.size() < 2 || mTotLength <= 0 )
   {
     return;
   }
@@ -263,123 +271,115 @@ void QgsMeasureHeightProfileDialog::replot()
   QgsMapLayer* layer = QgsMapLayerRegistry::instance()->mapLayer( layerid );
   if ( !layer || layer->type() != QgsMapLayer::RasterLayer )
   {
-    QgisApp::instance()->messageBar()->pushMessage( tr( "No heightmap is defined in the project." ), tr( "Right-click a raster layer in the layer tree and select it to be used as heightmap." ), QgsMessageBar::INFO, 10 );
+    // Don't repeat the notice on every update while the line is being edited
+    if ( !mNoHeightmapNotified )
+    {
+      QgisApp::instance()->messageBar()->pushMessage( tr( "No heightmap is defined in the project." ), tr( "Right-click a raster layer in the layer tree and select it to be used as heightmap." ), QgsMessageBar::INFO, 10 );
+      mNoHeightmapNotified = true;
+    }
     return;
   }
+  mNoHeightmapNotified = false;
+
+  // Keep the heightmap open across updates, so that its cached tiles are reused while the line is edited
   QString rasterFile = layer->source();
-  GDALDatasetH raster = GDALOpen( rasterFile.toLocal8Bit().data(), GA_ReadOnly );
-  if ( !raster )
+  if ( !mSampler || mSampler->rasterFile() != rasterFile )
   {
-    QMessageBox::warning( 0, tr( "Error" ), tr( "Failed to open raster file: %1" ).arg( rasterFile ) );
-    return;
+    delete mSampler;
+    mSampler = new QgsRasterSampler( rasterFile );
+    mSegmentSamples.clear();
   }
-
-  double gtrans[6] = {};
-  if ( GDALGetGeoTransform( raster, &gtrans[0] ) != CE_None )
+  if ( !mSampler->isValid() )
   {
-    QgsDebugMsg( "Failed to get raster geotransform" );
-    GDALClose( raster );
+    QMessageBox::warning( 0, tr( "Error" ), tr( "Failed to open raster file: %1" ).arg( rasterFile ) );
     return;
   }
 
-  QString proj( GDALGetProjectionRef( raster ) );
-  QgsCoordinateReferenceSystem rasterCrs( proj );
-  if ( !rasterCrs.isValid() )
+  // Get vertical unit
+  double heightConversion = QGis::fromUnitToUnitFactor( mSampler->verticalUnit(), vertDisplayUnit );
+
+  // Sample spacing, rounded down to a power of two so that it stays the same
+  // while a vertex is moved and the samples of the other segments can be reused
+  double step = qPow( 2., qFloor( log( mTotLength / mNSamples ) / log( 2. ) ) );
+
+  // Only sample the segments which changed since the last update
+  QVector<SegmentSamples> segments( mPoints.size() - 1 );
+  QVector<int> newSegments;
+  QVector<QgsPoint> positions;
+  for ( int i = 0, n = segments.size(); i < n; ++i )
   {
-    QgsDebugMsg( "Failed to get raster CRS" );
-    GDALClose( raster );
-    return;
+    SegmentSamples& segment = segments[i];
+    segment.p1 = mPoints[i];
+    segment.p2 = mPoints[i + 1];
+    segment.step = step;
+    bool cached = false;
+    for ( int j = 0, m = mSegmentSamples.size(); j < m && !cached; ++j )
+    {
+      const SegmentSamples& old = mSegmentSamples[( i + j ) % m];
+      if ( old.p1 == segment.p1 && old.p2 == segment.p2 && old.step == step )
+      {
+        segment.heights = old.heights;
+        cached = true;
+      }
+    }
+    if ( !cached )
+    {
+      newSegments.append( i );
+      for ( int k = 0, nSegmentSamples = qCeil( mSegmentLengths[i] / step ); k < nSegmentSamples; ++k )
+      {
+        positions.append( segment.p1 + ( segment.p2 - segment.p1 ) * ( k * step / mSegmentLengths[i] ) );
+      }
+    }
   }
 
-  GDALRasterBandH band = GDALGetRasterBand( raster, 1 );
-  if ( !band )
+  QVector<double> heights = mSampler->sample( positions, mPointsCrs );
+  int offset = 0;
+  foreach ( int i, newSegments )
   {
-    QgsDebugMsg( "Failed to open raster band 0" );
-    GDALClose( raster );
-    return;
+    int nSegmentSamples = qCeil( mSegmentLengths[i] / step );
+    segments[i].heights = heights.mid( offset, nSegmentSamples );
+    offset += nSegmentSamples;
   }
+  mSegmentSamples = segments;
 
-  // Get vertical unit
-  QGis::UnitType vertUnit = strcmp( GDALGetRasterUnitType( band ), "ft" ) == 0 ? QGis::Feet : QGis::Meters;
-  double heightConversion = QGis::fromUnitToUnitFactor( vertUnit, vertDisplayUnit );
-  mPlot->setAxisTitle( QwtPlot::yLeft, vertDisplayUnit == QGis::Feet ? tr( "Height [ft AMSL]" ) : tr( "Height [m AMSL]" ) );
-  mObserverHeightSpinBox->setSuffix( vertDisplayUnit == QGis::Feet ? " ft" : " m" );
-  mTargetHeightSpinBox->setSuffix( vertDisplayUnit == QGis::Feet ? " ft" : " m" );
-
+  mSampleDistances.clear();
 #if QWT_VERSION < 0x060000
   QVector<double> xSamples, ySamples;
 #else
   QVector<QPointF> samples;
 #endif
   double x = 0;
-  for ( int i = 0, n = mPoints.size() - 1; i < n; ++i )
+  for ( int i = 0, n = segments.size(); i < n; ++i )
   {
-    if ( x >= mSegmentLengths[i] )
-    {
-      continue;
-    }
-
-    QgsVector dir = QgsVector( mPoints[i + 1] - mPoints[i] ).normal();
-    while ( x < mSegmentLengths[i] )
+    const QVector<double>& segmentHeights = segments[i].heights;
+    for ( int k = 0, nSegmentSamples = segmentHeights.size(); k < nSegmentSamples; ++k )
     {
-      QgsPoint p = mPoints[i] + dir * x;
-      // Transform geo position to raster CRS
-      QgsPoint pRaster = QgsCoordinateTransform( mPointsCrs, rasterCrs ).transform( p );
-
-
-      // Transform raster geo position to pixel coordinates
-      double col = ( -gtrans[0] * gtrans[5] + gtrans[2] * gtrans[3] - gtrans[2] * pRaster.y() + gtrans[5] * pRaster.x() ) / ( gtrans[1] * gtrans[5] - gtrans[2] * gtrans[4] );
-      double row = ( -gtrans[0] * gtrans[4] + gtrans[1] * gtrans[3] - gtrans[1] * pRaster.y() + gtrans[4] * pRaster.x() ) / ( gtrans[2] * gtrans[4] - gtrans[1] * gtrans[5] );
-
-      double pixValues[4] = {};
-      if ( CE_None != GDALRasterIO( band, GF_Read,
-                                    qFloor( col ), qFloor( row ), 2, 2, &pixValues[0], 2, 2, GDT_Float64, 0, 0 ) )
-      {
-        QgsDebugMsg( "Failed to read pixel values" );
-#if QWT_VERSION < 0x060000
-        xSamples.append( xSamples.size() );
-        ySamples.append( 0 );
-#else
-        samples.append( QPointF( samples.size(), 0 ) );
-#endif
-      }
-      else
-      {
-        // Interpolate values
-        double lambdaR = row - qFloor( row );
-        double lambdaC = col - qFloor( col );
-
-        double value = ( pixValues[0] * ( 1. - lambdaC ) + pixValues[1] * lambdaC ) * ( 1. - lambdaR )
-                       + ( pixValues[2] * ( 1. - lambdaC ) + pixValues[3] * lambdaC ) * ( lambdaR );
+      mSampleDistances.append( x + k * step );
 #if QWT_VERSION < 0x060000
-        xSamples.append( xSamples.size() );
-        ySamples.append( value * heightConversion );
+      xSamples.append( mSampleDistances.back() );
+      ySamples.append( segmentHeights[k] * heightConversion );
 #else
-        samples.append( QPointF( samples.size(), value * heightConversion ) );
+      samples.append( QPointF( mSampleDistances.back(), segmentHeights[k] * heightConversion ) );
 #endif
-      }
-      x += mTotLength / mNSamples;
     }
-    x -= mSegmentLengths[i];
+    x += mSegmentLengths[i];
   }
 
 #if QWT_VERSION < 0x060000
   mPlotCurve->setData( xSamples, ySamples );
-  int nSamples = xSamples.size();
 #else
   static_cast<QwtPointSeriesData*>( mPlotCurve->data() )->setSamples( samples );
-  int nSamples = samples.size();
 #endif
   mPlotMarker->setValue( 0, 0 );
-  mPlot->setAxisScaleDraw( QwtPlot::xBottom, new ScaleDraw( mTotLength, nSamples ) );
-  double step = qPow( 10, qFloor( log10( mTotLength ) ) ) / ( mTotLength ) * nSamples;
-  while ( nSamples / step < 10 ) step /= 2.;
-  while ( nSamples / step > 10 ) step *= 2.;
-  mPlot->setAxisScale( QwtPlot::xBottom, 0, nSamples, step );
-
-  GDALClose( raster );
+  mPlot->setAxisScaleDraw( QwtPlot::xBottom, new ScaleDraw() );
+  double axisStep = qPow( 10, qFloor( log10( mTotLength ) ) );
+  while ( mTotLength / axisStep < 10 ) axisStep /= 2.;
+  while ( mTotLength / axisStep > 10 ) axisStep *= 2.;
+  mPlot->setAxisScale( QwtPlot::xBottom, 0, mTotLength, axisStep );
 
   // Node markers
+  qDeleteAll( mNodeMarkers );
+  mNodeMarkers.clear();
   x = 0;
   for ( int i = 0, n = mPoints.size() - 2; i < n; ++i )
   {
@@ -387,7 +387,7 @@ void QgsMeasureHeightProfileDialog::replot()
     QwtPlotMarker* nodeMarker = new QwtPlotMarker();
     nodeMarker->setLinePen( QPen( Qt::black, 1, Qt::DashLine ) );
     nodeMarker->setLineStyle( QwtPlotMarker::VLine );
-    int idx = qMin( int( x / mTotLength * mNSamples ), mNSamples - 1 );
+    int idx = sampleIndex( x );
 #if QWT_VERSION < 0x060000
     nodeMarker->setValue( mPlotCurve->x( idx ), mPlotCurve->y( idx ) );
 #else
@@ -401,6 +401,13 @@ void QgsMeasureHeightProfileDialog::replot()
   updateLineOfSight( );
 }
 
+int QgsMeasureHeightProfileDialog::sampleIndex( double x ) const
+{
+  // Index of the last sample at or before the specified distance
+  int idx = qUpperBound( mSampleDistances.begin(), mSampleDistances.end(), x ) - mSampleDistances.begin() - 1;
+  return qBound( 0, idx, mSampleDistances.size() - 1 );
+}
+
 void QgsMeasureHeightProfileDialog::updateLineOfSight( )
 {
   qDeleteAll( mLinesOfSight );
@@ -417,6 +424,11 @@ void QgsMeasureHeightProfileDialog::updateLineOfSight( )
   }
 
   int nSamples = mPlotCurve->dataSize();
+  if ( nSamples == 0 )
+  {
+    mPlot->replot();
+    return;
+  }
 #if QWT_VERSION < 0x060000
   QVector<QPointF> samples;
   for ( int i = 0; i < nSamples; ++i )
@@ -438,7 +450,7 @@ void QgsMeasureHeightProfileDialog::updateLineOfSight( )
   double meterToDisplayUnit = QGis::fromUnitToUnitFactor( QGis::Meters, QgsCoordinateFormat::instance()->getHeightDisplayUnit() );
   foreach ( const QPointF& p, samples )
   {
-    pX.append( p.x() / mNSamples * mTotLength );
+    pX.append( p.x() );
     double hCorr = 0.87 * pX.last() * pX.last() / ( 2 * earthRadius ) * meterToDisplayUnit;
     pY.append( p.y() - hCorr );
   }
@@ -451,26 +463,16 @@ void QgsMeasureHeightProfileDialog::updateLineOfSight( )
     losSampleSet.append( QVector<QPointF>() );
 
   QPointF p1( pX.front(), ( heightRelToGround ? pY.front() : 0 ) + mObserverHeightSpinBox->value() );
+  // A target is visible if the line of sight to it is at least as steep as
+  // the steepest line of sight to any terrain sample in between (the horizon)
+  double horizonSlope = -std::numeric_limits<double>::infinity();
   for ( int i = 1; i < nSamples; ++i )
   {
     QPointF p2( pX[i], pY[i] + targetHeight );
     if ( !heightRelToGround )
       p2.ry() -= samples[i].y();
-    // For each sample position along line [p1, p2], check if y is below terrain
-    // X = p1.x() + d * (p2.x() - p1.x())
-    // Y = p1.y() + d * (p2.y() - p1.y())
-    // => d = (X - p1.x()) / (p2.x() - p1.x())
-    // => Y = p1.y() + (X - p1.x()) / (p2.x() - p1.x()) * (p2.y() - p1.y())
-    bool visible = true;
-    for ( int j = 1; j < i; ++j )
-    {
-      double Y = p1.y() + ( pX[j] - p1.x() ) / ( p2.x() - p1.x() ) * ( p2.y() - p1.y() );
-      if ( Y < pY[j] )
-      {
-        visible = false;
-        break;
-      }
-    }
+    bool visible = ( p2.y() - p1.y() ) / ( p2.x() - p1.x() ) >= horizonSlope;
+    horizonSlope = qMax( horizonSlope, ( pY[i] - p1.y() ) / ( pX[i] - p1.x() ) );
     if (( visible && losSampleSet.size() % 2 == 0 ) || ( !visible && losSampleSet.size() % 2 == 1 ) )
     {
       losSampleSet.append( QVector<QPointF>() );
@@ -504,8 +506,8 @@ void QgsMeasureHeightProfileDialog::updateLineOfSight( )
     mLinesOfSight.append( curve );
 
     QgsRubberBand* rubberBand = new QgsRubberBand( mTool->canvas() );
-    double lambda1 = losSamples.front().x() / mNSamples;
-    double lambda2 = losSamples.back().x() / mNSamples;
+    double lambda1 = losSamples.front().x() / mTotLength;
+    double lambda2 = losSamples.back().x() / mTotLength;
     rubberBand->addPoint( mPoints[0] + ( mPoints[1] - mPoints[0] ) * lambda1 );
     rubberBand->addPoint( mPoints[0] + ( mPoints[1] - mPoints[0] ) * lambda2 );
     rubberBand->setColor( colors[iColor] );
@@ -26,6 +26,7 @@ class QDoubleSpinBox;
 class QGroupBox;
 class QgsMeasureHeightProfileTool;
 class QgsPoint;
+class QgsRasterSampler;
 class QgsRubberBand;
 class QwtPlot;
 class QwtPlotCurve;
@@ -37,6 +38,7 @@ class APP_EXPORT QgsMeasureHeightProfileDialog : public QDialog
     Q_OBJECT
   public:
     QgsMeasureHeightProfileDialog( QgsMeasureHeightProfileTool* tool, QWidget* parent = 0, Qt::WindowFlags f = 0 );
+    ~QgsMeasureHeightProfileDialog();
     void setPoints( const QList<QgsPoint> &points, const QgsCoordinateReferenceSystem& crs );
     void setMarkerPos( int segment, const QgsPoint& p );
     void clear();
@@ -51,6 +53,13 @@ class APP_EXPORT QgsMeasureHeightProfileDialog : public QDialog
   private:
     class ScaleDraw;
     enum HeightMode { HeightRelToGround, HeightRelToSeaLevel };
+    struct SegmentSamples
+    {
+      QgsPoint p1;
+      QgsPoint p2;
+      double step;
+      QVector<double> heights;
+    };
 
     QgsMeasureHeightProfileTool* mTool;
     QwtPlot* mPlot;
@@ -69,6 +78,12 @@ class APP_EXPORT QgsMeasureHeightProfileDialog : public QDialog
     QDoubleSpinBox* mObserverHeightSpinBox;
     QDoubleSpinBox* mTargetHeightSpinBox;
     QComboBox* mHeightModeCombo;
+    QgsRasterSampler* mSampler;
+    QVector<SegmentSamples> mSegmentSamples;
+    QVector<double> mSampleDistances;
+    bool mNoHeightmapNotified;
+
+    int sampleIndex( double x ) const;
 
     void keyPressEvent( QKeyEvent *ev ) override;
 };
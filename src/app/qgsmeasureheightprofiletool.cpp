@@ -48,6 +48,7 @@ QgsMeasureHeightProfileTool::QgsMeasureHeightProfileTool( QgsMapCanvas *canvas )
   mDialog = new QgsMeasureHeightProfileDialog( this, 0, Qt::WindowStaysOnTopHint );
   connect( mDrawTool, SIGNAL( finished() ), this, SLOT( drawFinished() ) );
   connect( mDrawTool, SIGNAL( cleared() ), this, SLOT( drawCleared() ) );
+  connect( mDrawTool, SIGNAL( geometryChanged() ), this, SLOT( drawChanged() ) );
 }
 
 QgsMeasureHeightProfileTool::~QgsMeasureHeightProfileTool()
@@ -172,6 +173,22 @@ void QgsMeasureHeightProfileTool::drawCleared()
   mDialog->clear();
 }
 
+void QgsMeasureHeightProfileTool::drawChanged()
+{
+  // Update the profile live while the line is being drawn, only the
+  // segment ending at the cursor changes and needs to be resampled
+  if ( mDrawTool->getStatus() != QgsMapToolDrawShape::StatusDrawing )
+  {
+    return;
+  }
+  QList<QgsPoint> points;
+  mDrawTool->getPart( 0, points );
+  if ( points.size() >= 2 )
+  {
+    mDialog->setPoints( points, mCanvas->mapSettings().destinationCrs() );
+  }
+}
+
 void QgsMeasureHeightProfileTool::drawFinished()
 {
   QList<QgsPoint> points;
@@ -53,6 +53,7 @@ class APP_EXPORT QgsMeasureHeightProfileTool : public QgsMapTool
 
   private slots:
     void drawCleared();
+    void drawChanged();
     void drawFinished();
 };
 
@@ -23,6 +23,7 @@
 #include "qgslogger.h"
 #include "qgsmaprenderer.h"
 #include "qgsmaprenderercustompainterjob.h"
+#include "qgsmaprendererparalleljob.h"
 #include "qgsmaplayerregistry.h"
 #include "qgsmaplayerstylemanager.h"
 #include "qgsmaptopixel.h"
@@ -201,13 +202,38 @@ void QgsComposerMap::draw( QPainter *painter, const QgsRectangle& extent, const
   }
 
   // render
-  QgsMapRendererCustomPainterJob job( mapSettings( extent, size, dpi ), painter );
+  QgsMapSettings jobMapSettings = mapSettings( extent, size, dpi );
+  if ( mComposition->parallelRendering() && painter->device() && painter->device()->devType() == QInternal::Image
+       && !layersUseBlendModes( jobMapSettings.layers() ) )
+  {
+    // Printing to an image: render the layers in parallel threads and draw the composed map image
+    QgsMapRendererParallelJob job( jobMapSettings );
+    job.start();
+    job.waitForFinished();
+    painter->drawImage( QPointF( 0, 0 ), job.renderedImage() );
+    return;
+  }
+
+  QgsMapRendererCustomPainterJob job( jobMapSettings, painter );
   // Render the map in this thread. This is done because of problems
   // with printing to printer on Windows (printing to PDF is fine though).
   // Raster images were not displayed - see #10599
   job.renderSynchronously();
 }
 
+bool QgsComposerMap::layersUseBlendModes( const QStringList& layerIds ) const
+{
+  foreach ( const QString& layerId, layerIds )
+  {
+    QgsMapLayer* layer = QgsMapLayerRegistry::instance()->mapLayer( layerId );
+    if ( layer && layer->blendMode() != QPainter::CompositionMode_SourceOver )
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
 QgsMapSettings QgsComposerMap::mapSettings( const QgsRectangle& extent, const QSizeF& size, int dpi ) const
 {
   const QgsMapSettings &ms = mComposition->mapSettings();
@@ -906,6 +906,9 @@ class CORE_EXPORT QgsComposerMap : public QgsComposerItem
     /**Returns a list of the layers to render for this map item*/
     QStringList layersToRender() const;
 
+    /**Returns true if one of the layers is drawn with a blend mode other than source over*/
+    bool layersUseBlendModes( const QStringList& layerIds ) const;
+
     /**Returns extent that considers mOffsetX / mOffsetY (during content move)*/
     QgsRectangle transformedExtent() const;
 
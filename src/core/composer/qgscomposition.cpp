@@ -73,6 +73,7 @@ QgsComposition::QgsComposition( const QgsMapSettings& mapSettings , const QStrin
   mSpaceBetweenPages = 10;
   mPageStyleSymbol = 0;
   mPrintAsRaster = false;
+  mParallelRendering = false;
   mGenerateWorldFile = false;
   mWorldFileMap = 0;
   mUseAdvancedEffects = true;
@@ -380,6 +380,14 @@ class CORE_EXPORT QgsComposition : public QGraphicsScene
     bool printAsRaster() const {return mPrintAsRaster;}
     void setPrintAsRaster( const bool enabled ) { mPrintAsRaster = enabled; }
 
+    /**Returns true if composer maps render their layers in parallel threads when the composition is printed to an image
+      @note added in 2.14*/
+    bool parallelRendering() const { return mParallelRendering; }
+    /**Sets whether composer maps render their layers in parallel threads when the composition is printed to an image.
+      Vector outputs (PDF, SVG, printer) are always rendered in the calling thread. False by default
+      @note added in 2.14*/
+    void setParallelRendering( const bool enabled ) { mParallelRendering = enabled; }
+
     bool generateWorldFile() const { return mGenerateWorldFile; }
     void setGenerateWorldFile( const bool enabled ) { mGenerateWorldFile = enabled; }
 
@@ -719,6 +727,9 @@ class CORE_EXPORT QgsComposition : public QGraphicsScene
     /**Flag if map should be printed as a raster (via QImage). False by default*/
     bool mPrintAsRaster;
 
+    /**Flag if composer maps are rendered in parallel threads when printing to an image. False by default*/
+    bool mParallelRendering;
+
     /**Flag if a world file should be generated on raster export */
     bool mGenerateWorldFile;
     /** Composer map to use for the world file generation */
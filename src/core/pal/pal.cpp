@@ -789,12 +789,7 @@ namespace pal
 #endif
 
     // search a solution
-    if ( searchMethod == FALP )
-      prob->init_sol_falp();
-    else if ( searchMethod == CHAIN )
-      prob->chain_search();
-    else
-      prob->popmusic();
+    prob->solve();
 
     std::cout << "PAL SEARCH (" << searchMethod << "): " << t.elapsed() / 1000.0 << " s" << std::endl;
     t.restart();
@@ -870,13 +865,7 @@ namespace pal
       return new std::list<LabelPosition*>();
 
     prob->reduce();
-
-    if ( searchMethod == FALP )
-      prob->init_sol_falp();
-    else if ( searchMethod == CHAIN )
-      prob->chain_search();
-    else
-      prob->popmusic();
+    prob->solve();
 
     return prob->getSolution( displayAll );
   }
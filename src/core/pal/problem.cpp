@@ -58,6 +58,8 @@
 #include "util.h"
 #include "priorityqueue.h"
 
+#include <QtConcurrentMap>
+
 #define UNUSED(x) (void)x;
 
 namespace pal
@@ -2949,6 +2951,214 @@ namespace pal
 //#undef _DEBUG_FULL_
 #endif
 
+  /* Clusters with less features are grouped with the following ones into one sub problem */
+  static const int sMinClusterFeatures = 64;
+
+  static int clusterRoot( int *parent, int id )
+  {
+    while ( parent[id] != id )
+    {
+      parent[id] = parent[parent[id]];
+      id = parent[id];
+    }
+    return id;
+  }
+
+  typedef struct
+  {
+    LabelPosition *lp;
+    int *parent;
+  } ClusterContext;
+
+  bool clusterCallback( LabelPosition *lp, void *ctx )
+  {
+    ClusterContext *context = ( ClusterContext* ) ctx;
+
+    if ( context->lp->isInConflict( lp ) )
+    {
+      int root1 = clusterRoot( context->parent, context->lp->getProblemFeatureId() );
+      int root2 = clusterRoot( context->parent, lp->getProblemFeatureId() );
+      // the root of a cluster is its first feature
+      if ( root1 < root2 )
+        context->parent[root2] = root1;
+      else if ( root2 < root1 )
+        context->parent[root1] = root2;
+    }
+    return true;
+  }
+
+  QList<Problem*> Problem::splitClusters( QVector< QVector<int> >& clusterFeats )
+  {
+    QList<Problem*> clusters;
+
+    if ( nbft < 2 * sMinClusterFeatures )
+      return clusters;
+
+    int i, j;
+    int *parent = new int[nbft];
+    for ( i = 0; i < nbft; i++ )
+      parent[i] = i;
+
+    ClusterContext context;
+    context.parent = parent;
+    double amin[2];
+    double amax[2];
+
+    for ( i = 0; i < nbft; i++ )
+    {
+      for ( j = 0; j < featNbLp[i]; j++ )
+      {
+        context.lp = labelpositions[featStartId[i] + j];
+        context.lp->getBoundingBox( amin, amax );
+        candidates->Search( amin, amax, clusterCallback, ( void* ) &context );
+      }
+    }
+
+    QVector<int> clusterSize( nbft, 0 );
+    for ( i = 0; i < nbft; i++ )
+      clusterSize[clusterRoot( parent, i )]++;
+
+    // group consecutive clusters, the grouping only depends on the problem
+    QVector<int> clusterGroup( nbft, -1 );
+    int nbGroups = 0;
+    int groupSize = sMinClusterFeatures;
+    for ( i = 0; i < nbft; i++ )
+    {
+      if ( clusterSize[i] == 0 )
+        continue;
+      if ( groupSize >= sMinClusterFeatures )
+      {
+        nbGroups++;
+        groupSize = 0;
+      }
+      clusterGroup[i] = nbGroups - 1;
+      groupSize += clusterSize[i];
+    }
+
+    if ( nbGroups > 1 )
+    {
+      clusterFeats.resize( nbGroups );
+      for ( i = 0; i < nbft; i++ )
+        clusterFeats[clusterGroup[clusterRoot( parent, i )]].append( i );
+
+      for ( i = 0; i < nbGroups; i++ )
+        clusters.append( clusterProblem( clusterFeats[i] ) );
+    }
+
+    delete[] parent;
+    return clusters;
+  }
+
+  Problem *Problem::clusterProblem( const QVector<int>& feats )
+  {
+    Problem *prob = new Problem();
+    prob->pal = pal;
+    prob->scale = scale;
+    prob->displayAll = displayAll;
+    for ( int i = 0; i < 4; i++ )
+      prob->bbox[i] = bbox[i];
+
+    prob->nbft = feats.size();
+    prob->featStartId = new int[prob->nbft];
+    prob->featNbLp = new int[prob->nbft];
+    prob->inactiveCost = new double[prob->nbft];
+
+    int nbLp = 0;
+    for ( int i = 0; i < prob->nbft; i++ )
+      nbLp += featNbLp[feats[i]];
+    prob->labelpositions = new LabelPosition*[nbLp];
+
+    int idlp = 0;
+    double nbOverlaps = 0;
+    for ( int i = 0; i < prob->nbft; i++ )
+    {
+      int feat = feats[i];
+      prob->featStartId[i] = idlp;
+      prob->featNbLp[i] = featNbLp[feat];
+      prob->inactiveCost[i] = inactiveCost[feat];
+
+      for ( int j = 0; j < featNbLp[feat]; j++, idlp++ )
+      {
+        LabelPosition *lp = labelpositions[featStartId[feat] + j];
+        lp->setProblemIds( i, idlp );
+        lp->insertIntoIndex( prob->candidates );
+        prob->labelpositions[idlp] = lp;
+        nbOverlaps += lp->getNumOverlaps();
+      }
+    }
+
+    prob->nblp = nbLp;
+    prob->all_nblp = nbLp;
+    prob->nbOverlap = nbOverlaps / 2;
+    return prob;
+  }
+
+  void Problem::solveCluster( Problem* &prob )
+  {
+    if ( prob->pal->searchMethod == CHAIN )
+      prob->chain_search();
+    else
+      prob->popmusic();
+  }
+
+  void Problem::mergeClusters( const QList<Problem*>& clusters, const QVector< QVector<int> >& clusterFeats )
+  {
+    init_sol_empty();
+
+    for ( int c = 0; c < clusters.size(); c++ )
+    {
+      Problem *cluster = clusters[c];
+      const QVector<int>& feats = clusterFeats[c];
+
+      for ( int i = 0; i < feats.size(); i++ )
+      {
+        int feat = feats[i];
+        for ( int j = 0; j < featNbLp[feat]; j++ )
+          labelpositions[featStartId[feat] + j]->setProblemIds( feat, featStartId[feat] + j );
+
+        int label = cluster->sol ? cluster->sol->s[i] : -1;
+        if ( label != -1 )
+        {
+          // the candidate has its id in this problem again
+          sol->s[feat] = cluster->labelpositions[label]->getId();
+          labelpositions[sol->s[feat]]->insertIntoIndex( candidates_sol );
+        }
+      }
+
+      // the candidates are owned by this problem
+      delete[] cluster->labelpositions;
+      cluster->labelpositions = NULL;
+      cluster->all_nblp = 0;
+      delete cluster;
+    }
+
+    solution_cost();
+  }
+
+  void Problem::solve()
+  {
+    if ( pal->searchMethod == FALP )
+    {
+      init_sol_falp();
+      return;
+    }
+
+    QVector< QVector<int> > clusterFeats;
+    QList<Problem*> clusters = splitClusters( clusterFeats );
+
+    if ( clusters.isEmpty() )
+    {
+      if ( pal->searchMethod == CHAIN )
+        chain_search();
+      else
+        popmusic();
+      return;
+    }
+
+    QtConcurrent::blockingMap( clusters, solveCluster );
+    mergeClusters( clusters, clusterFeats );
+  }
+
   bool Problem::compareLabelArea( pal::LabelPosition* l1, pal::LabelPosition* l2 )
   {
     return l1->getWidth() * l1->getHeight() > l2->getWidth() * l2->getHeight();
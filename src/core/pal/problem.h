@@ -35,6 +35,8 @@
 #define _PROBLEM_H
 
 #include <list>
+#include <QList>
+#include <QVector>
 #include <pal/pal.h>
 #include "rtree.hpp"
 
@@ -170,6 +172,17 @@ namespace pal
       void solution_cost();
       void check_solution();
 
+      /**
+       * \brief Splits the features into clusters whose candidates only conflict among themselves
+       * and returns one problem per group of clusters, empty if the problem does not split.
+       * The candidates are renumbered for the sub problems until mergeClusters() is called
+       * @param clusterFeats receives the features of this problem in each sub problem
+       */
+      QList<Problem*> splitClusters( QVector< QVector<int> >& clusterFeats );
+      Problem *clusterProblem( const QVector<int>& feats );
+      void mergeClusters( const QList<Problem*>& clusters, const QVector< QVector<int> >& clusterFeats );
+      static void solveCluster( Problem* &prob );
+
     public:
       Problem();
 
@@ -203,6 +216,14 @@ namespace pal
        */
       void chain_search();
 
+      /**
+       * \brief Searches a solution with the search method of pal.
+       * Clusters of features which cannot conflict with the other features are
+       * solved as separate problems in parallel threads. The clusters only depend
+       * on the problem, so the solution does not depend on the number of threads
+       */
+      void solve();
+
       std::list<LabelPosition*> * getSolution( bool returnInactive );
 
       PalStat * getStats();
@@ -18,8 +18,25 @@
 #include "qgsmaplayerregistry.h"
 #include "qgsmaplayer.h"
 
+#include <QPainter>
+
+static const int sTileSize = 256;
+
+static inline int tileIndex( int pixel, int tileSize )
+{
+  return pixel >= 0 ? pixel / tileSize : -(( -pixel - 1 ) / tileSize ) - 1;
+}
+
 QgsMapRendererCache::QgsMapRendererCache()
+    : mScale( 0 )
+    , mTileSize( 0 )
+    , mMapUnitsPerPixel( 0 )
+    , mRotation( 0 )
+    , mOutputDpi( 0 )
+    , mCrsTransformEnabled( false )
+    , mImageFormat( QImage::Format_Invalid )
 {
+  mTiles.setMaxCost( 256 * 1024 );
   clear();
 }
 
@@ -33,9 +50,16 @@ void QgsMapRendererCache::clearInternal()
 {
   mExtent.setMinimal();
   mScale = 0;
+  mTileSize = 0;
+  mOrigin = QPoint( 0, 0 );
 
   // make sure we are disconnected from all layers
-  foreach ( QString layerId, mCachedImages.keys() )
+  QSet<QString> layerIds;
+  foreach ( const TileKey& key, mTiles.keys() )
+  {
+    layerIds.insert( key.first );
+  }
+  foreach ( QString layerId, layerIds )
   {
     QgsMapLayer* layer = QgsMapLayerRegistry::instance()->mapLayer( layerId );
     if ( layer )
@@ -43,7 +67,7 @@ void QgsMapRendererCache::clearInternal()
       disconnect( layer, SIGNAL( repaintRequested() ), this, SLOT( layerRequestedRepaint() ) );
     }
   }
-  mCachedImages.clear();
+  mTiles.clear();
 }
 
 bool QgsMapRendererCache::init( QgsRectangle extent, double scale )
@@ -51,7 +75,8 @@ bool QgsMapRendererCache::init( QgsRectangle extent, double scale )
   QMutexLocker lock( &mMutex );
 
   // check whether the params are the same
-  if ( extent == mExtent &&
+  if ( mTileSize == 0 &&
+       extent == mExtent &&
        scale == mScale )
     return true;
 
@@ -64,23 +89,132 @@ bool QgsMapRendererCache::init( QgsRectangle extent, double scale )
   return false;
 }
 
+bool QgsMapRendererCache::init( const QgsMapSettings& settings )
+{
+  QMutexLocker lock( &mMutex );
+
+  // the grid stays valid if the map has been panned by whole pixels
+  const QgsMapToPixel& mtp = settings.mapToPixel();
+  QgsPoint origin = mtp.transform( mAnchor );
+  bool sameGrid = mTileSize > 0 &&
+                  settings.scale() == mScale &&
+                  mtp.mapUnitsPerPixel() == mMapUnitsPerPixel &&
+                  mtp.mapRotation() == mRotation &&
+                  settings.outputDpi() == mOutputDpi &&
+                  settings.destinationCrs() == mDestinationCrs &&
+                  settings.hasCrsTransformEnabled() == mCrsTransformEnabled &&
+                  settings.flags() == mFlags &&
+                  settings.outputImageFormat() == mImageFormat &&
+                  qAbs( origin.x() ) < 1e8 && qAbs( origin.y() ) < 1e8 &&
+                  qAbs( origin.x() - qRound( origin.x() ) ) < 0.01 &&
+                  qAbs( origin.y() - qRound( origin.y() ) ) < 0.01;
+
+  if ( sameGrid && settings.visibleExtent() == mExtent && settings.outputSize() == mOutputSize )
+    return true;
+
+  if ( !sameGrid )
+  {
+    clearInternal();
+
+    mScale = settings.scale();
+    mTileSize = sTileSize;
+    mAnchor = mtp.toMapCoordinatesF( 0, 0 );
+    origin = mtp.transform( mAnchor );
+    mMapUnitsPerPixel = mtp.mapUnitsPerPixel();
+    mRotation = mtp.mapRotation();
+    mOutputDpi = settings.outputDpi();
+    mDestinationCrs = settings.destinationCrs();
+    mCrsTransformEnabled = settings.hasCrsTransformEnabled();
+    mFlags = settings.flags();
+    mImageFormat = settings.outputImageFormat();
+  }
+
+  mExtent = settings.visibleExtent();
+  mOutputSize = settings.outputSize();
+  mOrigin = QPoint( qRound( origin.x() ), qRound( origin.y() ) );
+
+  return false;
+}
+
 void QgsMapRendererCache::setCacheImage( QString layerId, const QImage& img )
 {
   QMutexLocker lock( &mMutex );
-  mCachedImages[layerId] = img;
+
+  // split the image into the tiles of the grid, or keep it as a whole
+  QRect imageRect( -mOrigin, img.size() );
+  int tileSize = mTileSize > 0 ? mTileSize : qMax( img.width(), img.height() );
+  if ( tileSize <= 0 )
+    return;
+  for ( int tileY = tileIndex( imageRect.top(), tileSize ); tileY <= tileIndex( imageRect.bottom(), tileSize ); ++tileY )
+  {
+    for ( int tileX = tileIndex( imageRect.left(), tileSize ); tileX <= tileIndex( imageRect.right(), tileSize ); ++tileX )
+    {
+      Tile* tile = new Tile;
+      tile->rect = QRect( tileX * tileSize, tileY * tileSize, tileSize, tileSize ).intersected( imageRect );
+      tile->image = mTileSize > 0 ? img.copy( tile->rect.translated( mOrigin ) ) : img;
+      mTiles.insert( qMakePair( layerId, qMakePair( tileX, tileY ) ), tile, tile->image.byteCount() / 1024 + 1 );
+    }
+  }
 
   // connect to the layer to listen to layer's repaintRequested() signals
   QgsMapLayer* layer = QgsMapLayerRegistry::instance()->mapLayer( layerId );
   if ( layer )
   {
-    connect( layer, SIGNAL( repaintRequested() ), this, SLOT( layerRequestedRepaint() ) );
+    connect( layer, SIGNAL( repaintRequested() ), this, SLOT( layerRequestedRepaint() ), Qt::UniqueConnection );
   }
 }
 
 QImage QgsMapRendererCache::cacheImage( QString layerId )
+{
+  QRegion missing;
+  QImage image = cacheImage( layerId, missing );
+  return missing.isEmpty() ? image : QImage();
+}
+
+QImage QgsMapRendererCache::cacheImage( QString layerId, QRegion& missing )
 {
   QMutexLocker lock( &mMutex );
-  return mCachedImages.value( layerId );
+
+  if ( mTileSize == 0 )
+  {
+    // the image is stored as a whole
+    Tile* tile = mTiles.object( qMakePair( layerId, qMakePair( 0, 0 ) ) );
+    missing = tile ? QRegion() : QRegion( QRect( QPoint( 0, 0 ), mOutputSize ) );
+    return tile ? tile->image : QImage();
+  }
+
+  QRect deviceRect( QPoint( 0, 0 ), mOutputSize );
+  QRect gridRect = deviceRect.translated( -mOrigin );
+  missing = QRegion( deviceRect );
+  QImage image;
+  QPainter painter;
+  for ( int tileY = tileIndex( gridRect.top(), mTileSize ); tileY <= tileIndex( gridRect.bottom(), mTileSize ); ++tileY )
+  {
+    for ( int tileX = tileIndex( gridRect.left(), mTileSize ); tileX <= tileIndex( gridRect.right(), mTileSize ); ++tileX )
+    {
+      Tile* tile = mTiles.object( qMakePair( layerId, qMakePair( tileX, tileY ) ) );
+      if ( !tile )
+        continue;
+
+      QRect rect = tile->rect.intersected( gridRect );
+      if ( rect.isEmpty() )
+        continue;
+
+      if ( image.isNull() )
+      {
+        image = QImage( mOutputSize, tile->image.format() );
+        image.fill( 0 );
+        painter.begin( &image );
+        painter.setCompositionMode( QPainter::CompositionMode_Source );
+      }
+      painter.drawImage( rect.topLeft() + mOrigin, tile->image, rect.translated( -tile->rect.topLeft() ) );
+      missing -= QRegion( rect.translated( mOrigin ) );
+    }
+  }
+  if ( painter.isActive() )
+    painter.end();
+
+  return image;
 }
 
 void QgsMapRendererCache::layerRequestedRepaint()
@@ -94,7 +228,11 @@ void QgsMapRendererCache::clearCacheImage( QString layerId )
 {
   QMutexLocker lock( &mMutex );
 
-  mCachedImages.remove( layerId );
+  foreach ( const TileKey& key, mTiles.keys() )
+  {
+    if ( key.first == layerId )
+      mTiles.remove( key );
+  }
 
   QgsMapLayer* layer = QgsMapLayerRegistry::instance()->mapLayer( layerId );
   if ( layer )
@@ -102,3 +240,9 @@ void QgsMapRendererCache::clearCacheImage( QString layerId )
     disconnect( layer, SIGNAL( repaintRequested() ), this, SLOT( layerRequestedRepaint() ) );
   }
 }
+
+void QgsMapRendererCache::setMemoryLimit( int kiloBytes )
+{
+  QMutexLocker lock( &mMutex );
+  mTiles.setMaxCost( kiloBytes );
+}
@@ -16,10 +16,15 @@
 #ifndef QGSMAPRENDERERCACHE_H
 #define QGSMAPRENDERERCACHE_H
 
-#include <QMap>
+#include <QCache>
 #include <QImage>
 #include <QMutex>
+#include <QPair>
+#include <QRegion>
+#include <QSet>
 
+#include "qgscoordinatereferencesystem.h"
+#include "qgsmapsettings.h"
 #include "qgsrectangle.h"
 
 
@@ -30,6 +35,11 @@
  * the cache listens to repaintRequested() signals from layer. If triggered, the cache
  * removes the rendered image (and disconnects from the layer).
  *
+ * When initialized with the map settings, the images are stored in tiles of a grid which is
+ * anchored to the map. The tiles stay valid while the map is panned by whole pixels, such that
+ * only the newly exposed parts of a layer need to be rendered (see cacheImage( QString, QRegion& )).
+ * The least recently used tiles are dropped when the memory limit is exceeded.
+ *
  * The class is thread-safe (multiple classes can access the same instance safely).
  *
  * @note added in 2.4
@@ -48,15 +58,34 @@ class CORE_EXPORT QgsMapRendererCache : public QObject
     //! @return flag whether the parameters are the same as last time
     bool init( QgsRectangle extent, double scale );
 
+    //! initialize cache for rendering with the given settings. The cached tiles are kept
+    //! if the map has only been panned by whole pixels since the last time.
+    //! @return flag whether the visible extent is the same as last time
+    //! @note added in 2.14
+    bool init( const QgsMapSettings& settings );
+
     //! set cached image for the specified layer ID
     void setCacheImage( QString layerId, const QImage& img );
 
     //! get cached image for the specified layer ID. Returns null image if it is not cached.
     QImage cacheImage( QString layerId );
 
+    //! get the cached parts of the image of the specified layer ID. The areas which are not cached
+    //! are transparent and returned in missing. Returns null image if nothing is cached.
+    //! @note added in 2.14
+    QImage cacheImage( QString layerId, QRegion& missing );
+
     //! remove layer from the cache
     void clearCacheImage( QString layerId );
 
+    //! set the maximum memory used by the cached images, in kB
+    //! @note added in 2.14
+    void setMemoryLimit( int kiloBytes );
+
+    //! maximum memory used by the cached images, in kB
+    //! @note added in 2.14
+    int memoryLimit() const { return mTiles.maxCost(); }
+
   protected slots:
     //! remove layer (that emitted the signal) from the cache
     void layerRequestedRepaint();
@@ -65,11 +94,36 @@ class CORE_EXPORT QgsMapRendererCache : public QObject
     //! invalidate cache contents (without locking)
     void clearInternal();
 
+    //! part of a layer image, in pixels relative to the grid origin
+    struct Tile
+    {
+      QRect rect;
+      QImage image;
+    };
+    //! layer ID and tile column and row
+    typedef QPair<QString, QPair<int, int> > TileKey;
+
   protected:
     QMutex mMutex;
     QgsRectangle mExtent;
     double mScale;
-    QMap<QString, QImage> mCachedImages;
+
+    //! size of the tiles in pixels, 0 if the images are stored as a whole
+    int mTileSize;
+    //! map point of the grid origin
+    QgsPoint mAnchor;
+    //! device position of the grid origin
+    QPoint mOrigin;
+    QSize mOutputSize;
+    double mMapUnitsPerPixel;
+    double mRotation;
+    int mOutputDpi;
+    QgsCoordinateReferenceSystem mDestinationCrs;
+    bool mCrsTransformEnabled;
+    QgsMapSettings::Flags mFlags;
+    QImage::Format mImageFormat;
+
+    QCache<TileKey, Tile> mTiles;
 };
 
 
@@ -30,8 +30,19 @@
 #include "qgsmaplayerstylemanager.h"
 #include "qgsmaprenderercache.h"
 #include "qgspallabeling.h"
+#include "qgsvectorlayer.h"
 #include "qgsvectorlayerrenderer.h"
 
+/** Returns the map extent of the pixel rectangle, including a margin for the features whose symbols reach into it */
+static QgsRectangle partialRenderExtent( const QgsMapToPixel& mtp, const QRect& rect, int margin )
+{
+  QRect r = rect.adjusted( -margin, -margin, margin, margin );
+  QgsRectangle extent( mtp.toMapCoordinatesF( r.left(), r.top() ), mtp.toMapCoordinatesF( r.right() + 1, r.bottom() + 1 ) );
+  extent.combineExtentWith( mtp.toMapCoordinatesF( r.right() + 1, r.top() ) );
+  extent.combineExtentWith( mtp.toMapCoordinatesF( r.left(), r.bottom() + 1 ) );
+  return extent;
+}
+
 
 QgsMapRendererJob::QgsMapRendererJob( const QgsMapSettings& settings )
     : mSettings( settings )
@@ -143,11 +154,11 @@ LayerRenderJobs QgsMapRendererJob::prepareJobs( QPainter* painter, QgsPalLabelin
   QListIterator<QString> li( mSettings.layers() );
   li.toBack();
 
+  bool cacheValid = false;
   if ( mCache )
   {
-    bool cacheValid = mCache->init( mSettings.visibleExtent(), mSettings.scale() );
+    cacheValid = mCache->init( mSettings );
     QgsDebugMsg( QString( "CACHE VALID: %1" ).arg( cacheValid ) );
-    Q_UNUSED( cacheValid );
   }
 
   mGeometryCaches.clear();
@@ -180,7 +191,47 @@ LayerRenderJobs QgsMapRendererJob::prepareJobs( QPainter* painter, QgsPalLabelin
       continue;
     }
 
-    QgsRectangle r1 = mSettings.visibleExtent(), r2;
+    // Force render of layers that are being edited
+    // or if there's a labeling engine that needs the layer to register features
+    if ( mCache && ( ml->type() == QgsMapLayer::VectorLayer || ml->type() == QgsMapLayer::RedliningLayer ) )
+    {
+      QgsVectorLayer* vl = qobject_cast<QgsVectorLayer *>( ml );
+      if ( vl->isEditable() || ( labelingEngine && labelingEngine->willUseLayer( vl ) ) )
+        mCache->clearCacheImage( ml->id() );
+    }
+
+    // The cached image of a layer stays valid while the map is panned, if the layer can be rendered in parts.
+    // Then only the parts of the layer which are not cached yet get rendered.
+    QImage cachedImage;
+    QRegion missing;
+    bool partial = false;
+    int partialMargin = -1;
+    if ( mCache )
+    {
+      // the missing parts must include all the features whose symbols reach into them, so the symbol extent has to be known
+      QgsVectorLayer* vl = qobject_cast<QgsVectorLayer*>( ml );
+      if ( vl && QgsVectorLayerRenderer::rendersFeaturesIndependently( vl->rendererV2() )
+           && !mRequestedGeomCacheForLayers.contains( ml->id() ) && !mSettings.layerStyleOverrides().contains( ml->id() ) )
+      {
+        partialMargin = QgsVectorLayerRenderer::symbolMargin( vl->rendererV2(), QgsRenderContext::fromMapSettings( mSettings ) );
+      }
+      bool canRenderPartially = partialMargin >= 0;
+      if ( !cacheValid && !canRenderPartially )
+        mCache->clearCacheImage( ml->id() );
+      cachedImage = mCache->cacheImage( ml->id(), missing );
+      if ( !cachedImage.isNull() && !missing.isEmpty() )
+      {
+        partial = canRenderPartially;
+        if ( !partial )
+        {
+          // an incomplete cache image of a layer that has to be rendered in one go is a cache miss
+          mCache->clearCacheImage( ml->id() );
+          cachedImage = QImage();
+        }
+      }
+    }
+
+    QgsRectangle r1 = partial ? partialRenderExtent( mSettings.mapToPixel(), missing.boundingRect(), partialMargin ) : mSettings.visibleExtent(), r2;
     const QgsCoordinateTransform* ct = 0;
 
     if ( mSettings.hasCrsTransformEnabled() )
@@ -198,15 +249,6 @@ LayerRenderJobs QgsMapRendererJob::prepareJobs( QPainter* painter, QgsPalLabelin
       }
     }
 
-    // Force render of layers that are being edited
-    // or if there's a labeling engine that needs the layer to register features
-    if ( mCache && ( ml->type() == QgsMapLayer::VectorLayer || ml->type() == QgsMapLayer::RedliningLayer ) )
-    {
-      QgsVectorLayer* vl = qobject_cast<QgsVectorLayer *>( ml );
-      if ( vl->isEditable() || ( labelingEngine && labelingEngine->willUseLayer( vl ) ) )
-        mCache->clearCacheImage( ml->id() );
-    }
-
     layerJobs.append( LayerRenderJob() );
     LayerRenderJob& job = layerJobs.last();
     job.cached = false;
@@ -221,10 +263,10 @@ LayerRenderJobs QgsMapRendererJob::prepareJobs( QPainter* painter, QgsPalLabelin
     job.context.setExtent( r1 );
 
     // if we can use the cache, let's do it and avoid rendering!
-    if ( mCache && !mCache->cacheImage( ml->id() ).isNull() )
+    if ( !cachedImage.isNull() && !partial )
     {
       job.cached = true;
-      job.img = new QImage( mCache->cacheImage( ml->id() ) );
+      job.img = new QImage( cachedImage );
       job.renderer = 0;
       job.context.setPainter( 0 );
       continue;
@@ -252,6 +294,12 @@ LayerRenderJobs QgsMapRendererJob::prepareJobs( QPainter* painter, QgsPalLabelin
       job.img = mypFlattenedImage;
       QPainter* mypPainter = new QPainter( job.img );
       mypPainter->setRenderHint( QPainter::Antialiasing, mSettings.testFlag( QgsMapSettings::Antialiasing ) );
+      if ( partial )
+      {
+        // start from the cached parts and draw only the missing ones
+        mypPainter->drawImage( 0, 0, cachedImage );
+        mypPainter->setClipRegion( missing );
+      }
       job.context.setPainter( mypPainter );
     }
 
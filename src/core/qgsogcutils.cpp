@@ -1350,6 +1350,323 @@ QDomElement QgsOgcUtils::geometryToGML( QgsGeometry *geometry, QDomDocument &doc
   return geometryToGML( geometry, doc, "GML2", precision );
 }
 
+//appends the number like qgsDoubleToString, without the QString and QRegExp overhead
+static void _appendGMLDouble( QByteArray& out, double value, int precision )
+{
+  QByteArray number = QByteArray::number( value, 'f', precision );
+  int length = number.size();
+  if ( precision > 0 )
+  {
+    while ( length > 0 && number.at( length - 1 ) == '0' )
+    {
+      --length;
+    }
+    if ( length > 0 && number.at( length - 1 ) == '.' )
+    {
+      --length;
+    }
+  }
+  out.append( number.constData(), length );
+}
+
+//appends the start tag of an element with the srsName attribute, without closing it
+static void _appendGMLStartTag( QByteArray& out, const char* name, const QString& srsName, int indent )
+{
+  out.append( QByteArray( indent, ' ' ) ).append( '<' ).append( name );
+  if ( !srsName.isEmpty() )
+  {
+    out.append( " srsName=\"" );
+    QgsOgcUtils::appendXmlEscaped( out, srsName, true );
+    out.append( '"' );
+  }
+}
+
+//appends the coordinate element of nPoints points (gml:coordinates, gml:pos or gml:posList) like geometryToGML
+static void _appendGMLCoordinates( QByteArray& out, QgsConstWkbPtr& wkbPtr, int nPoints, bool hasZValue, bool gml3, bool pos, int precision, int indent )
+{
+  const char* endTag = gml3 ? ( pos ? "</gml:pos>\n" : "</gml:posList>\n" ) : "</gml:coordinates>\n";
+  out.append( QByteArray( indent, ' ' ) );
+  if ( gml3 )
+  {
+    out.append( pos ? "<gml:pos srsDimension=\"2\">" : "<gml:posList srsDimension=\"2\">" );
+  }
+  else
+  {
+    out.append( "<gml:coordinates cs=\",\" ts=\" \">" );
+  }
+
+  for ( int i = 0; i < nPoints; ++i )
+  {
+    if ( i != 0 )
+    {
+      out.append( ' ' );
+    }
+
+    double x, y;
+    wkbPtr >> x >> y;
+    _appendGMLDouble( out, x, precision );
+    out.append( gml3 ? ' ' : ',' );
+    _appendGMLDouble( out, y, precision );
+
+    if ( hasZValue )
+    {
+      wkbPtr += sizeof( double );
+    }
+  }
+  out.append( endTag );
+}
+
+//appends the rings of a polygon, the polygon element itself is written by the caller
+static void _appendGMLRings( QByteArray& out, QgsConstWkbPtr& wkbPtr, int numRings, bool hasZValue, bool gml3, int precision, int indent )
+{
+  QByteArray ind( indent, ' ' );
+  for ( int idx = 0; idx < numRings; ++idx )
+  {
+    const char* boundaryName = idx == 0 ? "gml:outerBoundaryIs>\n" : "gml:innerBoundaryIs>\n";
+    int nPoints;
+    wkbPtr >> nPoints;
+    out.append( ind ).append( '<' ).append( boundaryName );
+    out.append( ind ).append( " <gml:LinearRing>\n" );
+    _appendGMLCoordinates( out, wkbPtr, nPoints, hasZValue, gml3, false, precision, indent + 2 );
+    out.append( ind ).append( " </gml:LinearRing>\n" );
+    out.append( ind ).append( "</" ).append( boundaryName );
+  }
+}
+
+bool QgsOgcUtils::appendGeometryToGML( QByteArray& out, const QgsGeometry* geometry, const QString& format, int precision, const QString& srsName, int indent )
+{
+  if ( !geometry || !geometry->asWkb() )
+    return false;
+
+  bool gml3 = format == "GML3";
+  bool hasZValue = false;
+  QgsConstWkbPtr wkbPtr( geometry->asWkb() + 1 + sizeof( int ) );
+  QByteArray ind( indent, ' ' );
+
+  switch ( geometry->wkbType() )
+  {
+    case QGis::WKBPoint25D:
+    case QGis::WKBPoint:
+    {
+      _appendGMLStartTag( out, "gml:Point", srsName, indent );
+      out.append( ">\n" );
+      _appendGMLCoordinates( out, wkbPtr, 1, false, gml3, true, precision, indent + 1 );
+      out.append( ind ).append( "</gml:Point>\n" );
+      return true;
+    }
+    case QGis::WKBMultiPoint25D:
+      hasZValue = true;
+      //intentional fall-through
+    case QGis::WKBMultiPoint:
+    {
+      int nPoints;
+      wkbPtr >> nPoints;
+      _appendGMLStartTag( out, "gml:MultiPoint", srsName, indent );
+      if ( nPoints == 0 )
+      {
+        out.append( "/>\n" );
+        return true;
+      }
+      out.append( ">\n" );
+      for ( int idx = 0; idx < nPoints; ++idx )
+      {
+        wkbPtr += 1 + sizeof( int );
+        out.append( ind ).append( " <gml:pointMember>\n" );
+        out.append( ind ).append( "  <gml:Point>\n" );
+        _appendGMLCoordinates( out, wkbPtr, 1, hasZValue, gml3, true, precision, indent + 3 );
+        out.append( ind ).append( "  </gml:Point>\n" );
+        out.append( ind ).append( " </gml:pointMember>\n" );
+      }
+      out.append( ind ).append( "</gml:MultiPoint>\n" );
+      return true;
+    }
+    case QGis::WKBLineString25D:
+      hasZValue = true;
+      //intentional fall-through
+    case QGis::WKBLineString:
+    {
+      int nPoints;
+      wkbPtr >> nPoints;
+      _appendGMLStartTag( out, "gml:LineString", srsName, indent );
+      out.append( ">\n" );
+      _appendGMLCoordinates( out, wkbPtr, nPoints, hasZValue, gml3, false, precision, indent + 1 );
+      out.append( ind ).append( "</gml:LineString>\n" );
+      return true;
+    }
+    case QGis::WKBMultiLineString25D:
+      hasZValue = true;
+      //intentional fall-through
+    case QGis::WKBMultiLineString:
+    {
+      int nLines;
+      wkbPtr >> nLines;
+      _appendGMLStartTag( out, "gml:MultiLineString", srsName, indent );
+      if ( nLines == 0 )
+      {
+        out.append( "/>\n" );
+        return true;
+      }
+      out.append( ">\n" );
+      for ( int jdx = 0; jdx < nLines; ++jdx )
+      {
+        wkbPtr += 1 + sizeof( int );
+        int nPoints;
+        wkbPtr >> nPoints;
+        out.append( ind ).append( " <gml:lineStringMember>\n" );
+        out.append( ind ).append( "  <gml:LineString>\n" );
+        _appendGMLCoordinates( out, wkbPtr, nPoints, hasZValue, gml3, false, precision, indent + 3 );
+        out.append( ind ).append( "  </gml:LineString>\n" );
+        out.append( ind ).append( " </gml:lineStringMember>\n" );
+      }
+      out.append( ind ).append( "</gml:MultiLineString>\n" );
+      return true;
+    }
+    case QGis::WKBPolygon25D:
+      hasZValue = true;
+      //intentional fall-through
+    case QGis::WKBPolygon:
+    {
+      int numRings;
+      wkbPtr >> numRings;
+      if ( numRings == 0 ) // no polygon without exterior ring, like geometryToGML
+        return false;
+
+      _appendGMLStartTag( out, "gml:Polygon", srsName, indent );
+      out.append( ">\n" );
+      _appendGMLRings( out, wkbPtr, numRings, hasZValue, gml3, precision, indent + 1 );
+      out.append( ind ).append( "</gml:Polygon>\n" );
+      return true;
+    }
+    case QGis::WKBMultiPolygon25D:
+      hasZValue = true;
+      //intentional fall-through
+    case QGis::WKBMultiPolygon:
+    {
+      int numPolygons;
+      wkbPtr >> numPolygons;
+      _appendGMLStartTag( out, "gml:MultiPolygon", srsName, indent );
+      // parts without rings have no polygonMember (like in geometryToGML), so the element may stay empty
+      bool empty = true;
+      for ( int kdx = 0; kdx < numPolygons; ++kdx )
+      {
+        wkbPtr += 1 + sizeof( int );
+        int numRings;
+        wkbPtr >> numRings;
+        if ( numRings == 0 )
+        {
+          continue;
+        }
+        if ( empty )
+        {
+          out.append( ">\n" );
+          empty = false;
+        }
+        out.append( ind ).append( " <gml:polygonMember>\n" );
+        out.append( ind ).append( "  <gml:Polygon>\n" );
+        _appendGMLRings( out, wkbPtr, numRings, hasZValue, gml3, precision, indent + 3 );
+        out.append( ind ).append( "  </gml:Polygon>\n" );
+        out.append( ind ).append( " </gml:polygonMember>\n" );
+      }
+      if ( empty )
+      {
+        out.append( "/>\n" );
+      }
+      else
+      {
+        out.append( ind ).append( "</gml:MultiPolygon>\n" );
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void QgsOgcUtils::appendRectangleToGMLBox( QByteArray& out, const QgsRectangle& box, int precision, const QString& srsName, int indent )
+{
+  QByteArray ind( indent, ' ' );
+  _appendGMLStartTag( out, "gml:Box", srsName, indent );
+  out.append( ">\n" );
+  out.append( ind ).append( " <gml:coordinates cs=\",\" ts=\" \">" );
+  _appendGMLDouble( out, box.xMinimum(), precision );
+  out.append( ',' );
+  _appendGMLDouble( out, box.yMinimum(), precision );
+  out.append( ' ' );
+  _appendGMLDouble( out, box.xMaximum(), precision );
+  out.append( ',' );
+  _appendGMLDouble( out, box.yMaximum(), precision );
+  out.append( "</gml:coordinates>\n" );
+  out.append( ind ).append( "</gml:Box>\n" );
+}
+
+void QgsOgcUtils::appendRectangleToGMLEnvelope( QByteArray& out, const QgsRectangle& env, int precision, const QString& srsName, int indent )
+{
+  QByteArray ind( indent, ' ' );
+  _appendGMLStartTag( out, "gml:Envelope", srsName, indent );
+  out.append( ">\n" );
+  out.append( ind ).append( " <gml:lowerCorner>" );
+  _appendGMLDouble( out, env.xMinimum(), precision );
+  out.append( ' ' );
+  _appendGMLDouble( out, env.yMinimum(), precision );
+  out.append( "</gml:lowerCorner>\n" );
+  out.append( ind ).append( " <gml:upperCorner>" );
+  _appendGMLDouble( out, env.xMaximum(), precision );
+  out.append( ' ' );
+  _appendGMLDouble( out, env.yMaximum(), precision );
+  out.append( "</gml:upperCorner>\n" );
+  out.append( ind ).append( "</gml:Envelope>\n" );
+}
+
+void QgsOgcUtils::appendXmlEscaped( QByteArray& out, const QString& text, bool attribute )
+{
+  QByteArray utf8 = text.toUtf8();
+  const char* data = utf8.constData();
+  int start = 0;
+  for ( int i = 0; i < utf8.size(); ++i )
+  {
+    const char* entity = 0;
+    switch ( data[i] )
+    {
+      case '<':
+        entity = "&lt;";
+        break;
+      case '&':
+        entity = "&amp;";
+        break;
+      case '>':
+        // QDom only escapes the end of a CDATA section
+        if ( i >= 2 && data[i - 1] == ']' && data[i - 2] == ']' )
+          entity = "&gt;";
+        break;
+      case '"':
+        if ( attribute )
+          entity = "&quot;";
+        break;
+      case '\n':
+        if ( attribute )
+          entity = "&#xa;";
+        break;
+      case '\t':
+        if ( attribute )
+          entity = "&#x9;";
+        break;
+      case '\r':
+        entity = "&#xd;";
+        break;
+      default:
+        break;
+    }
+    if ( !entity )
+    {
+      continue;
+    }
+    out.append( data + start, i - start );
+    out.append( entity );
+    start = i + 1;
+  }
+  out.append( data + start, utf8.size() - start );
+}
+
 QDomElement QgsOgcUtils::createGMLCoordinates( const QgsPolyline &points, QDomDocument &doc )
 {
   QDomElement coordElem = doc.createElement( "gml:coordinates" );
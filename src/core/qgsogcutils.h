@@ -1,6 +1,7 @@
 #ifndef QGSOGCUTILS_H
 #define QGSOGCUTILS_H
 
+class QByteArray;
 class QColor;
 class QDomNode;
 class QDomElement;
@@ -66,6 +67,32 @@ class CORE_EXPORT QgsOgcUtils
      */
     static QDomElement rectangleToGMLEnvelope( QgsRectangle* env, QDomDocument& doc, const int &precision = 17 );
 
+    /** Writes the geometry as GML2 or GML3 to a byte array, without building a DOM. The elements and coordinates
+        are the ones of geometryToGML, the indentation the one of QDomDocument::toByteArray()
+        @param out UTF-8 output the geometry is appended to
+        @param srsName srsName attribute of the geometry element, none if empty
+        @param indent number of spaces in front of the geometry element
+        @return false (and nothing written) if geometryToGML returns a null element for the geometry
+        @note added in 2.14
+     */
+    static bool appendGeometryToGML( QByteArray& out, const QgsGeometry* geometry, const QString& format, int precision = 17, const QString& srsName = QString(), int indent = 0 );
+
+    /** Writes the rectangle as GML2 Box to a byte array, like rectangleToGMLBox
+        @note added in 2.14
+     */
+    static void appendRectangleToGMLBox( QByteArray& out, const QgsRectangle& box, int precision = 17, const QString& srsName = QString(), int indent = 0 );
+
+    /** Writes the rectangle as GML3 Envelope to a byte array, like rectangleToGMLEnvelope
+        @note added in 2.14
+     */
+    static void appendRectangleToGMLEnvelope( QByteArray& out, const QgsRectangle& env, int precision = 17, const QString& srsName = QString(), int indent = 0 );
+
+    /** Appends the text in UTF-8, escaped like QDomDocument escapes the text content of elements or, with attribute set,
+        attribute values
+        @note added in 2.14
+     */
+    static void appendXmlEscaped( QByteArray& out, const QString& text, bool attribute = false );
+
 
     /** Parse XML with OGC fill into QColor */
     static QColor colorFromOgcFill( const QDomElement& fillElement );
@@ -18,22 +18,62 @@
 //#include "qgsfeatureiterator.h"
 #include "diagram/qgsdiagram.h"
 #include "qgsdiagramrendererv2.h"
+#include "qgscategorizedsymbolrendererv2.h"
+#include "qgsellipsesymbollayerv2.h"
+#include "qgsfillsymbollayerv2.h"
 #include "qgsgeometrycache.h"
+#include "qgsgraduatedsymbolrendererv2.h"
+#include "qgslinesymbollayerv2.h"
+#include "qgsmarkersymbollayerv2.h"
 #include "qgsmessagelog.h"
 #include "qgspallabeling.h"
 #include "qgsrendererv2.h"
 #include "qgsrendercontext.h"
 #include "qgssinglesymbolrendererv2.h"
 #include "qgssymbollayerv2.h"
+#include "qgssymbollayerv2utils.h"
 #include "qgssymbolv2.h"
 #include "qgsvectorlayer.h"
 #include "qgsvectorlayerfeatureiterator.h"
 
 #include <QSettings>
+#include <QSvgRenderer>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+#include <qmath.h>
 
 // TODO:
 // - passing of cache to QgsVectorLayer
 
+//! layers with fewer features are not split for rendering
+static const long sSplitMinFeatureCount = 10000;
+//! minimum width of the strips a layer is split into
+static const int sMinChunkWidth = 256;
+//! layers whose symbols reach further than this many pixels from their features are not split
+static const int sMaxChunkMargin = 256;
+
+/** Vertical strip of the map, which is rendered into its own image in a worker thread */
+struct QgsVectorLayerRenderChunk
+{
+  QgsVectorLayerRenderChunk()
+      : painter( 0 )
+      , source( 0 )
+      , renderer( 0 )
+  {}
+
+  QRect rect;
+  //! request extent of the strip, in layer coordinates
+  QgsRectangle extent;
+  QImage image;
+  QPainter* painter;
+  QgsRenderContext context;
+  QgsFeatureRequest request;
+  QgsVectorLayerFeatureSource* source;
+  QgsVectorLayerRenderer* renderer;
+  //! features to register with the labeling engine, in the order they were rendered
+  QList<QgsFeature> labelFeatures;
+};
+
 
 QgsVectorLayerRenderer::QgsVectorLayerRenderer( QgsVectorLayer* layer, QgsRenderContext& context )
     : QgsMapLayerRenderer( layer->id() )
@@ -45,6 +85,9 @@ QgsVectorLayerRenderer::QgsVectorLayerRenderer( QgsVectorLayer* layer, QgsRender
     , mLabeling( false )
     , mDiagrams( false )
     , mLayerTransparency( 0 )
+    , mFeatureCount( -1 )
+    , mParentContext( 0 )
+    , mLabelFeatures( 0 )
 {
   mRendererV2 = layer->rendererV2() ? layer->rendererV2()->clone() : 0;
   mSelectedFeatureIds = layer->selectedFeaturesIds();
@@ -78,6 +121,10 @@ QgsVectorLayerRenderer::QgsVectorLayerRenderer( QgsVectorLayer* layer, QgsRender
 
   mVertexMarkerSize = settings.value( "/Qgis/digitizing/marker_size", 3 ).toInt();
 
+  // large layers may be rendered in strips in parallel threads
+  if ( settings.value( "/Qgis/parallel_rendering_split_layers", true ).toBool() )
+    mFeatureCount = layer->featureCount();
+
   if ( !mRendererV2 )
     return;
 
@@ -98,12 +145,191 @@ QgsVectorLayerRenderer::QgsVectorLayerRenderer( QgsVectorLayer* layer, QgsRender
 }
 
 
+QgsVectorLayerRenderer::QgsVectorLayerRenderer( const QgsVectorLayerRenderer& parent, QgsRenderContext& context )
+    : QgsMapLayerRenderer( parent.layerID() )
+    , mLayer( parent.mLayer )
+    , mContext( context )
+    , mFields( parent.mFields )
+    , mSelectedFeatureIds( parent.mSelectedFeatureIds )
+    , mRendererV2( parent.mRendererV2->clone() )
+    , mCache( 0 )
+    , mDrawVertexMarkers( parent.mDrawVertexMarkers )
+    , mVertexMarkerOnlyForSelection( parent.mVertexMarkerOnlyForSelection )
+    , mVertexMarkerStyle( parent.mVertexMarkerStyle )
+    , mVertexMarkerSize( parent.mVertexMarkerSize )
+    , mGeometryType( parent.mGeometryType )
+    , mAttrNames( parent.mAttrNames )
+    , mLabeling( parent.mLabeling )
+    , mDiagrams( parent.mDiagrams )
+    , mLayerTransparency( 0 )
+    , mFeatureBlendMode( parent.mFeatureBlendMode )
+    , mSimplifyMethod( parent.mSimplifyMethod )
+    , mSimplifyGeometry( parent.mSimplifyGeometry )
+    , mFeatureCount( parent.mFeatureCount )
+    , mParentContext( &parent.mContext )
+    , mLabelFeatures( 0 )
+{
+  if ( mDrawVertexMarkers )
+  {
+    // set editing vertex markers style
+    mRendererV2->setVertexMarkerAppearance( mVertexMarkerStyle, mVertexMarkerSize );
+  }
+}
+
+
 QgsVectorLayerRenderer::~QgsVectorLayerRenderer()
 {
   delete mRendererV2;
 }
 
 
+bool QgsVectorLayerRenderer::rendersFeaturesIndependently( const QgsFeatureRendererV2* renderer )
+{
+  if ( !renderer )
+    return false;
+
+  QString type = renderer->type();
+  return type == "singleSymbol" || type == "categorizedSymbol" || type == "graduatedSymbol" || type == "RuleRenderer";
+}
+
+
+/** Returns the factor which converts a symbol layer unit to output pixels */
+static double symbolUnitToPixels( const QgsRenderContext& context, QgsSymbolV2::OutputUnit unit, const QgsMapUnitScale& scale )
+{
+  if ( unit == QgsSymbolV2::Pixel )
+    return 1.0;
+
+  // line widths and marker sizes are scaled slightly differently, take the larger one
+  return qMax( QgsSymbolLayerV2Utils::lineWidthScaleFactor( context, unit, scale ), QgsSymbolLayerV2Utils::pixelSizeScaleFactor( context, unit, scale ) );
+}
+
+static double symbolExtent( QgsSymbolV2* symbol, const QgsRenderContext& context );
+
+/** Returns how far the symbol layer may draw from the feature geometry in pixels, or -1 if this is not known */
+static double symbolLayerExtent( QgsSymbolLayerV2* layer, const QgsRenderContext& context )
+{
+  // data defined properties may change the size of every feature, and custom layer types are unknown
+  if ( layer->hasDataDefinedProperties() || layer->outputUnit() == QgsSymbolV2::Mixed )
+    return -1;
+
+  double toPixels = symbolUnitToPixels( context, layer->outputUnit(), layer->mapUnitScale() );
+  QString type = layer->layerType();
+  if ( type == "SimpleMarker" || type == "SvgMarker" || type == "FontMarker" || type == "EllipseMarker" )
+  {
+    // the radius of the full size covers any rotation and anchor point
+    QgsMarkerSymbolLayerV2* marker = static_cast<QgsMarkerSymbolLayerV2*>( layer );
+    double size = marker->size();
+    double outline = 0;
+    if ( type == "SimpleMarker" )
+    {
+      outline = static_cast<QgsSimpleMarkerSymbolLayerV2*>( layer )->outlineWidth();
+    }
+    else if ( type == "SvgMarker" )
+    {
+      // the size is the width of the svg, its height depends on the aspect ratio
+      QgsSvgMarkerSymbolLayerV2* svgMarker = static_cast<QgsSvgMarkerSymbolLayerV2*>( layer );
+      QSvgRenderer svg( svgMarker->path() );
+      if ( !svg.isValid() || svg.defaultSize().width() <= 0 )
+        return -1;
+      size *= qMax( 1.0, double( svg.defaultSize().height() ) / svg.defaultSize().width() );
+      outline = svgMarker->outlineWidth();
+    }
+    else if ( type == "EllipseMarker" )
+    {
+      QgsEllipseSymbolLayerV2* ellipse = static_cast<QgsEllipseSymbolLayerV2*>( layer );
+      size = qMax( ellipse->symbolWidth(), ellipse->symbolHeight() );
+      outline = ellipse->outlineWidth();
+    }
+    QPointF offset = marker->offset();
+    return ( size + outline + qAbs( offset.x() ) + qAbs( offset.y() ) ) * toPixels;
+  }
+  else if ( type == "SimpleLine" )
+  {
+    // miter joins reach up to the line width from the geometry
+    QgsLineSymbolLayerV2* line = static_cast<QgsLineSymbolLayerV2*>( layer );
+    return ( line->width() + qAbs( line->offset() ) ) * toPixels;
+  }
+  else if ( type == "MarkerLine" )
+  {
+    double markerExtent = symbolExtent( layer->subSymbol(), context );
+    if ( markerExtent < 0 )
+      return -1;
+    return markerExtent + qAbs( static_cast<QgsLineSymbolLayerV2*>( layer )->offset() ) * toPixels;
+  }
+  else if ( type == "SimpleFill" )
+  {
+    QgsSimpleFillSymbolLayerV2* fill = static_cast<QgsSimpleFillSymbolLayerV2*>( layer );
+    QPointF offset = fill->offset();
+    return ( fill->borderWidth() + qAbs( offset.x() ) + qAbs( offset.y() ) ) * toPixels;
+  }
+  else if ( type == "GradientFill" || type == "ShapeburstFill" || type == "RasterFill" )
+  {
+    QPointF offset;
+    if ( type == "GradientFill" )
+      offset = static_cast<QgsGradientFillSymbolLayerV2*>( layer )->offset();
+    else if ( type == "ShapeburstFill" )
+      offset = static_cast<QgsShapeburstFillSymbolLayerV2*>( layer )->offset();
+    else
+      offset = static_cast<QgsRasterFillSymbolLayer*>( layer )->offset();
+    return ( qAbs( offset.x() ) + qAbs( offset.y() ) ) * toPixels;
+  }
+  else if ( type == "SVGFill" || type == "CentroidFill" )
+  {
+    // the svg pattern stays within the polygon, only its outline reaches out. The centroid marker may reach out of the polygon
+    return layer->subSymbol() ? symbolExtent( layer->subSymbol(), context ) : 0;
+  }
+  return -1;
+}
+
+/** Returns how far any layer of the symbol may draw from the feature geometry in pixels, or -1 if this is not known */
+static double symbolExtent( QgsSymbolV2* symbol, const QgsRenderContext& context )
+{
+  if ( !symbol )
+    return -1;
+
+  double extent = 0;
+  for ( int i = 0; i < symbol->symbolLayerCount(); ++i )
+  {
+    double layerExtent = symbolLayerExtent( symbol->symbolLayer( i ), context );
+    if ( layerExtent < 0 )
+      return -1;
+    extent = qMax( extent, layerExtent );
+  }
+  return extent;
+}
+
+int QgsVectorLayerRenderer::symbolMargin( QgsFeatureRendererV2* renderer, const QgsRenderContext& context )
+{
+  if ( !renderer )
+    return -1;
+
+  // symbols scaled by an attribute can have any size
+  QgsSingleSymbolRendererV2* singleRenderer = dynamic_cast<QgsSingleSymbolRendererV2*>( renderer );
+  QgsCategorizedSymbolRendererV2* categorizedRenderer = dynamic_cast<QgsCategorizedSymbolRendererV2*>( renderer );
+  QgsGraduatedSymbolRendererV2* graduatedRenderer = dynamic_cast<QgsGraduatedSymbolRendererV2*>( renderer );
+  if (( singleRenderer && !singleRenderer->sizeScaleField().isEmpty() ) ||
+      ( categorizedRenderer && !categorizedRenderer->sizeScaleField().isEmpty() ) ||
+      ( graduatedRenderer && !graduatedRenderer->sizeScaleField().isEmpty() ) )
+    return -1;
+
+  double extent = 0;
+  foreach ( QgsSymbolV2* symbol, renderer->symbols() )
+  {
+    double currentExtent = symbolExtent( symbol, context );
+    if ( currentExtent < 0 )
+      return -1;
+    extent = qMax( extent, currentExtent );
+  }
+  // one more pixel on each side for antialiasing
+  return qCeil( extent ) + 2;
+}
+
+bool QgsVectorLayerRenderer::labelFeatureLessThan( const QgsFeature& f1, const QgsFeature& f2 )
+{
+  return f1.id() < f2.id();
+}
+
+
 bool QgsVectorLayerRenderer::render()
 {
   if ( mGeometryType == QGis::NoGeometry || mGeometryType == QGis::UnknownGeometry )
@@ -206,13 +432,16 @@ bool QgsVectorLayerRenderer::render()
     mContext.setVectorSimplifyMethod( vectorMethod );
   }
 
-  QgsVectorLayerFeatureSource source( mLayer );
-  QgsFeatureIterator fit = source.getFeatures( featureRequest );
-
-  if (( mRendererV2->capabilities() & QgsFeatureRendererV2::SymbolLevels ) && mRendererV2->usingSymbolLevels() )
-    drawRendererV2Levels( fit );
+  if ( splitCount() > 0 && renderChunks( featureRequest ) )
+  {
+    mRendererV2->stopRender( mContext );
+  }
   else
-    drawRendererV2( fit );
+  {
+    QgsVectorLayerFeatureSource source( mLayer );
+    QgsFeatureIterator fit = source.getFeatures( featureRequest );
+    drawFeatures( fit );
+  }
 
   //apply layer transparency for vector layers
   if ( mContext.useAdvancedEffects() && mLayerTransparency != 0 )
@@ -242,6 +471,210 @@ void QgsVectorLayerRenderer::setGeometryCachePointer( QgsGeometryCache* cache )
 
 
 
+int QgsVectorLayerRenderer::splitCount() const
+{
+  if ( mFeatureCount < sSplitMinFeatureCount || mCache || !mContext.painter() || !mContext.painter()->device() )
+    return 0;
+
+  // the strips are composed pixel by pixel, so only plain image output can be split
+  if ( mContext.painter()->device()->devType() != QInternal::Image || !mContext.painter()->worldTransform().isIdentity() )
+    return 0;
+
+  // features blending with each other must be drawn on the same image
+  if ( mContext.useAdvancedEffects() && mFeatureBlendMode != QPainter::CompositionMode_SourceOver )
+    return 0;
+
+  if ( !rendersFeaturesIndependently( mRendererV2 ) )
+    return 0;
+
+  // vertex markers are not covered by the symbol extent
+  if ( mDrawVertexMarkers && mContext.drawEditingInformation() )
+    return 0;
+
+  // the strips must fetch all the features whose symbols reach into them
+  int margin = symbolMargin( mRendererV2, mContext );
+  if ( margin < 0 || margin > sMaxChunkMargin )
+    return 0;
+
+  int count = qMin( QThreadPool::globalInstance()->maxThreadCount(), mContext.mapToPixel().mapWidth() / sMinChunkWidth );
+  return count >= 2 ? count : 0;
+}
+
+
+bool QgsVectorLayerRenderer::renderChunks( const QgsFeatureRequest& featureRequest )
+{
+  int count = splitCount();
+  // include the features whose symbols reach into a strip
+  int margin = symbolMargin( mRendererV2, mContext );
+  const QgsMapToPixel& mtp = mContext.mapToPixel();
+  int width = mtp.mapWidth();
+  int height = mtp.mapHeight();
+  const QgsCoordinateTransform* ct = mContext.coordinateTransform();
+
+  QVector<QgsVectorLayerRenderChunk> chunks( count );
+  QList<QgsRectangle> extents;
+  for ( int i = 0; i < count; ++i )
+  {
+    QgsVectorLayerRenderChunk& chunk = chunks[i];
+    int left = i * width / count;
+    chunk.rect = QRect( left, 0, ( i + 1 ) * width / count - left, height );
+
+    QRect r = chunk.rect.adjusted( -margin, -margin, margin, margin );
+    QgsRectangle extent( mtp.toMapCoordinatesF( r.left(), r.top() ), mtp.toMapCoordinatesF( r.right() + 1, r.bottom() + 1 ) );
+    extent.combineExtentWith( mtp.toMapCoordinatesF( r.right() + 1, r.top() ) );
+    extent.combineExtentWith( mtp.toMapCoordinatesF( r.left(), r.bottom() + 1 ) );
+    if ( ct )
+    {
+      try
+      {
+        extent = ct->transformBoundingBox( extent, QgsCoordinateTransform::ReverseTransform );
+      }
+      catch ( QgsCsException &cse )
+      {
+        Q_UNUSED( cse );
+        return false;
+      }
+    }
+    if ( !extent.isFinite() )
+      return false;
+
+    if ( extent.intersects( featureRequest.filterRect() ) )
+      chunk.extent = extent.intersect( &featureRequest.filterRect() );
+    else
+      chunk.extent.setMinimal();
+    extents.append( chunk.extent );
+  }
+
+  for ( int i = 0; i < count; ++i )
+  {
+    QgsVectorLayerRenderChunk& chunk = chunks[i];
+    if ( chunk.extent.xMinimum() > chunk.extent.xMaximum() )
+      continue; // the strip is outside of the request extent
+
+    // each strip only gets an image of its own size, drawn through a translated painter
+    chunk.image = QImage( chunk.rect.size(), QImage::Format_ARGB32_Premultiplied );
+    if ( chunk.image.isNull() )
+    {
+      // not enough memory for the strips: clean up and let the caller render the layer in one go
+      deleteChunks( chunks );
+      return false;
+    }
+    chunk.image.fill( 0 );
+    chunk.painter = new QPainter( &chunk.image );
+    chunk.painter->setRenderHints( mContext.painter()->renderHints() );
+    chunk.painter->translate( -chunk.rect.left(), -chunk.rect.top() );
+
+    chunk.context = mContext;
+    chunk.context.setPainter( chunk.painter );
+    chunk.context.setExtent( chunk.extent );
+    chunk.request = featureRequest;
+    chunk.request.setFilterRect( chunk.extent );
+    chunk.source = new QgsVectorLayerFeatureSource( mLayer );
+    chunk.renderer = new QgsVectorLayerRenderer( *this, chunk.context );
+    chunk.renderer->mLabelFeatures = &chunk.labelFeatures;
+    chunk.renderer->mPrecedingChunkExtents = extents.mid( 0, i );
+  }
+
+  QtConcurrent::blockingMap( chunks, renderChunkStatic );
+
+  // compose the strips
+  QList<QgsFeature> labelFeatures;
+  for ( int i = 0; i < count; ++i )
+  {
+    QgsVectorLayerRenderChunk& chunk = chunks[i];
+    if ( !chunk.renderer )
+      continue;
+
+    delete chunk.painter;
+    chunk.painter = 0;
+    mContext.painter()->drawImage( chunk.rect.topLeft(), chunk.image );
+    labelFeatures.append( chunk.labelFeatures );
+  }
+
+  // register the features for labeling in the same order for any number of strips, which
+  // is the order of a serial render for providers which return the features by id
+  qStableSort( labelFeatures.begin(), labelFeatures.end(), labelFeatureLessThan );
+  for ( QList<QgsFeature>::iterator fit = labelFeatures.begin(); fit != labelFeatures.end(); ++fit )
+  {
+    registerLabelFeature( *fit );
+  }
+
+  deleteChunks( chunks );
+  return true;
+}
+
+
+void QgsVectorLayerRenderer::deleteChunks( QVector<QgsVectorLayerRenderChunk>& chunks )
+{
+  for ( int i = 0; i < chunks.size(); ++i )
+  {
+    QgsVectorLayerRenderChunk& chunk = chunks[i];
+    delete chunk.painter;
+    chunk.painter = 0;
+    delete chunk.renderer;
+    chunk.renderer = 0;
+    delete chunk.source;
+    chunk.source = 0;
+  }
+}
+
+
+void QgsVectorLayerRenderer::renderChunkStatic( QgsVectorLayerRenderChunk& chunk )
+{
+  if ( !chunk.renderer )
+    return;
+
+  chunk.renderer->mRendererV2->startRender( chunk.context, chunk.renderer->mFields );
+
+  QgsFeatureIterator fit = chunk.source->getFeatures( chunk.request );
+  chunk.renderer->drawFeatures( fit );
+}
+
+
+bool QgsVectorLayerRenderer::renderingStopped() const
+{
+  return mContext.renderingStopped() || ( mParentContext && mParentContext->renderingStopped() );
+}
+
+
+void QgsVectorLayerRenderer::registerLabelFeature( QgsFeature& fet )
+{
+  if ( !mContext.labelingEngine() || ( !mLabeling && !mDiagrams ) )
+    return;
+
+  if ( mLabelFeatures )
+  {
+    // the features of several strips are registered by the first one which gets them
+    QgsRectangle bbox = fet.geometry()->boundingBox();
+    foreach ( const QgsRectangle& extent, mPrecedingChunkExtents )
+    {
+      if ( extent.intersects( bbox ) )
+        return;
+    }
+    mLabelFeatures->append( fet );
+    return;
+  }
+
+  if ( mLabeling )
+  {
+    mContext.labelingEngine()->registerFeature( mLayerID, fet, mContext );
+  }
+  if ( mDiagrams )
+  {
+    mContext.labelingEngine()->registerDiagramFeature( mLayerID, fet, mContext );
+  }
+}
+
+
+void QgsVectorLayerRenderer::drawFeatures( QgsFeatureIterator& fit )
+{
+  if (( mRendererV2->capabilities() & QgsFeatureRendererV2::SymbolLevels ) && mRendererV2->usingSymbolLevels() )
+    drawRendererV2Levels( fit );
+  else
+    drawRendererV2( fit );
+}
+
+
 void QgsVectorLayerRenderer::drawRendererV2( QgsFeatureIterator& fit )
 {
   QgsFeature fet;
@@ -252,7 +685,7 @@ void QgsVectorLayerRenderer::drawRendererV2( QgsFeatureIterator& fit )
       if ( !fet.geometry() )
         continue; // skip features without geometry
 
-      if ( mContext.renderingStopped() )
+      if ( renderingStopped() )
       {
         QgsDebugMsg( QString( "Drawing of vector layer %1 cancelled." ).arg( layerID() ) );
         break;
@@ -271,17 +704,9 @@ void QgsVectorLayerRenderer::drawRendererV2( QgsFeatureIterator& fit )
       bool rendered = mRendererV2->renderFeature( fet, mContext, -1, sel, drawMarker );
 
       // labeling - register feature
-      Q_UNUSED( rendered );
-      if ( rendered && mContext.labelingEngine() )
+      if ( rendered )
       {
-        if ( mLabeling )
-        {
-          mContext.labelingEngine()->registerFeature( mLayerID, fet, mContext );
-        }
-        if ( mDiagrams )
-        {
-          mContext.labelingEngine()->registerDiagramFeature( mLayerID, fet, mContext );
-        }
+        registerLabelFeature( fet );
       }
     }
     catch ( const QgsCsException &cse )
@@ -315,7 +740,7 @@ void QgsVectorLayerRenderer::drawRendererV2Levels( QgsFeatureIterator& fit )
     if ( !fet.geometry() )
       continue; // skip features without geometry
 
-    if ( mContext.renderingStopped() )
+    if ( renderingStopped() )
     {
       qDebug( "rendering stop!" );
       stopRendererV2( selRenderer );
@@ -340,17 +765,7 @@ void QgsVectorLayerRenderer::drawRendererV2Levels( QgsFeatureIterator& fit )
       mCache->cacheGeometry( fet.id(), *fet.geometry() );
     }
 
-    if ( mContext.labelingEngine() )
-    {
-      if ( mLabeling )
-      {
-        mContext.labelingEngine()->registerFeature( mLayerID, fet, mContext );
-      }
-      if ( mDiagrams )
-      {
-        mContext.labelingEngine()->registerDiagramFeature( mLayerID, fet, mContext );
-      }
-    }
+    registerLabelFeature( fet );
   }
 
   // find out the order
@@ -388,7 +803,7 @@ void QgsVectorLayerRenderer::drawRendererV2Levels( QgsFeatureIterator& fit )
       QList<QgsFeature>::iterator fit;
       for ( fit = lst.begin(); fit != lst.end(); ++fit )
       {
-        if ( mContext.renderingStopped() )
+        if ( renderingStopped() )
         {
           stopRendererV2( selRenderer );
           return;
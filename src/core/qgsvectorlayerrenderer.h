@@ -27,9 +27,11 @@ class QgsDiagramLayerSettings;
 class QgsGeometryCache;
 class QgsFeatureIterator;
 class QgsSingleSymbolRendererV2;
+struct QgsVectorLayerRenderChunk;
 
 #include <QList>
 #include <QPainter>
+#include <QVector>
 
 typedef QList<int> QgsAttributeList;
 
@@ -59,8 +61,40 @@ class QgsVectorLayerRenderer : public QgsMapLayerRenderer
     //! @note The way how geometries are cached is really suboptimal - this method may be removed in future releases
     void setGeometryCachePointer( QgsGeometryCache* cache );
 
+    //! Returns true if the renderer draws each feature independently of the other features,
+    //! such that a layer may be rendered in parts
+    static bool rendersFeaturesIndependently( const QgsFeatureRendererV2* renderer );
+
+    //! Returns how many pixels the symbols of the renderer may reach beyond the feature geometries,
+    //! or -1 if this is not known, e.g. because of data defined sizes or custom symbol layer types
+    static int symbolMargin( QgsFeatureRendererV2* renderer, const QgsRenderContext& context );
+
   private:
 
+    //! Creates the renderer of a chunk of the layer. Copies the settings of the parent, but renders with its own renderer clone and context
+    QgsVectorLayerRenderer( const QgsVectorLayerRenderer& parent, QgsRenderContext& context );
+
+    //! Returns the number of vertical strips the layer should be split into for rendering in parallel threads, or 0
+    int splitCount() const;
+
+    /** Renders the layer in vertical strips in parallel threads, and draws them with the painter of the context.
+     * @return false if the strips could not be set up, e.g. because of a coordinate transform error or a failed image allocation
+     */
+    bool renderChunks( const QgsFeatureRequest& featureRequest );
+
+    //! Deletes the painters, renderers and feature sources of the strips
+    static void deleteChunks( QVector<QgsVectorLayerRenderChunk>& chunks );
+
+    static void renderChunkStatic( QgsVectorLayerRenderChunk& chunk );
+
+    //! Orders the features collected from the strips for label registration
+    static bool labelFeatureLessThan( const QgsFeature& f1, const QgsFeature& f2 );
+
+    bool renderingStopped() const;
+
+    //! Registers the feature with the labeling engine, or remembers it for later registration when rendering a chunk
+    void registerLabelFeature( QgsFeature& fet );
+
     /**Registers label and diagram layer
       @param layer diagram layer
       @param attributeNames attributes needed for labeling and diagrams will be added to the list
@@ -68,6 +102,10 @@ class QgsVectorLayerRenderer : public QgsMapLayerRenderer
     void prepareLabeling( QgsVectorLayer* layer, QStringList& attributeNames );
     void prepareDiagrams( QgsVectorLayer* layer, QStringList& attributeNames );
 
+    /** Draw the features with or without symbol levels. QgsFeatureRenderer::startRender() needs to be called before using this method
+     */
+    void drawFeatures( QgsFeatureIterator& fit );
+
     /** Draw layer with renderer V2. QgsFeatureRenderer::startRender() needs to be called before using this method
      */
     void drawRendererV2( QgsFeatureIterator& fit );
@@ -110,6 +148,16 @@ class QgsVectorLayerRenderer : public QgsMapLayerRenderer
 
     QgsVectorSimplifyMethod mSimplifyMethod;
     bool mSimplifyGeometry;
+
+    //! number of features of the layer, -1 if unknown
+    long mFeatureCount;
+
+    //! context of the parent, when rendering a chunk of the layer
+    const QgsRenderContext* mParentContext;
+    //! features which should be registered with the labeling engine after rendering a chunk
+    QList<QgsFeature>* mLabelFeatures;
+    //! request extents of the preceding chunks, whose features are registered by them
+    QList<QgsRectangle> mPrecedingChunkExtents;
 };
 
 
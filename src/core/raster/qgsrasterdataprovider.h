@@ -195,6 +195,8 @@ class CORE_EXPORT QgsRasterDataProvider : public QgsDataProvider, public QgsRast
     /** Read band offset for raster value
      * @@note added in 2.3 */
     virtual double bandOffset( int bandNo ) const { Q_UNUSED( bandNo ); return 0.0; }
+    /** Read the unit of the band values (e.g. "m" or "ft" for elevations), empty if unknown */
+    virtual QString bandUnit( int bandNo ) const { Q_UNUSED( bandNo ); return QString(); }
 
     // TODO: remove or make protected all readBlock working with void*
 
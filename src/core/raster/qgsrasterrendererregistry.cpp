@@ -21,6 +21,7 @@
 #include "qgssinglebandcolordatarenderer.h"
 #include "qgssinglebandgrayrenderer.h"
 #include "qgssinglebandpseudocolorrenderer.h"
+#include "qgsterrainrenderer.h"
 #include <QSettings>
 
 QgsRasterRendererRegistryEntry::QgsRasterRendererRegistryEntry( const QString& theName, const QString& theVisibleName,
@@ -53,6 +54,8 @@ QgsRasterRendererRegistry::QgsRasterRendererRegistry()
                                           QgsSingleBandPseudoColorRenderer::create, 0 ) );
   insert( QgsRasterRendererRegistryEntry( "singlebandcolordata", QObject::tr( "Singleband color data" ),
                                           QgsSingleBandColorDataRenderer::create, 0 ) );
+  insert( QgsRasterRendererRegistryEntry( "terrain", QObject::tr( "Terrain (hillshade, slope, aspect)" ),
+                                          QgsTerrainRenderer::create, 0 ) );
 }
 
 QgsRasterRendererRegistry::~QgsRasterRendererRegistry()
@@ -0,0 +1,197 @@
+/***************************************************************************
+ *  qgsrastersampler.cpp                                                   *
+ *  --------------------                                                   *
+ *  begin                : Mar 2016                                        *
+ *  copyright            : (C) 2016 by Sourcepole AG                       *
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgsrastersampler.h"
+#include "qgscoordinatetransform.h"
+#include "qgscrscache.h"
+#include "qgsexception.h"
+#include "qgslogger.h"
+
+#include <gdal.h>
+#include <qmath.h>
+
+QgsRasterSampler::QgsRasterSampler( const QString& rasterFile, int band )
+    : mRasterFile( rasterFile )
+    , mDataset( 0 )
+    , mBand( 0 )
+    , mWidth( 0 )
+    , mHeight( 0 )
+    , mVertUnit( QGis::Meters )
+    , mTileCache( 32 )
+    , mLastTileKey( -1 )
+    , mLastTile( 0 )
+{
+  for ( int i = 0; i < 6; ++i )
+    mGtrans[i] = 0;
+
+  mDataset = GDALOpen( rasterFile.toLocal8Bit().data(), GA_ReadOnly );
+  if ( !mDataset )
+  {
+    QgsDebugMsg( QString( "Failed to open raster file: %1" ).arg( rasterFile ) );
+    return;
+  }
+
+  if ( GDALGetGeoTransform( mDataset, &mGtrans[0] ) != CE_None )
+  {
+    QgsDebugMsg( "Failed to get raster geotransform" );
+    return;
+  }
+
+  QString proj( GDALGetProjectionRef( mDataset ) );
+  mCrs = QgsCRSCache::instance()->crsByWkt( proj );
+  if ( !mCrs.isValid() )
+  {
+    QgsDebugMsg( "Failed to get raster CRS" );
+    return;
+  }
+
+  GDALRasterBandH rasterBand = GDALGetRasterBand( mDataset, band );
+  if ( !rasterBand )
+  {
+    QgsDebugMsg( QString( "Failed to open raster band %1" ).arg( band ) );
+    return;
+  }
+
+  mVertUnit = strcmp( GDALGetRasterUnitType( rasterBand ), "ft" ) == 0 ? QGis::Feet : QGis::Meters;
+  mWidth = GDALGetRasterXSize( mDataset );
+  mHeight = GDALGetRasterYSize( mDataset );
+  mBand = rasterBand;
+}
+
+QgsRasterSampler::~QgsRasterSampler()
+{
+  mTileCache.clear();
+  if ( mDataset )
+  {
+    GDALClose( mDataset );
+  }
+}
+
+void QgsRasterSampler::clearCache()
+{
+  mTileCache.clear();
+  mLastTileKey = -1;
+  mLastTile = 0;
+}
+
+QVector<double> QgsRasterSampler::sample( const QVector<QgsPoint>& points, const QgsCoordinateReferenceSystem& crs, QVector<bool>* ok )
+{
+  int n = points.size();
+  QVector<double> values( n, 0. );
+  if ( ok )
+  {
+    ok->fill( false, n );
+  }
+  if ( !isValid() || n == 0 )
+  {
+    return values;
+  }
+
+  // Transform all positions to the raster CRS at once
+  QVector<double> x( n ), y( n ), z( n, 0. );
+  for ( int i = 0; i < n; ++i )
+  {
+    x[i] = points[i].x();
+    y[i] = points[i].y();
+  }
+  try
+  {
+    QgsCoordinateTransform( crs, mCrs ).transformInPlace( x, y, z );
+  }
+  catch ( const QgsCsException& e )
+  {
+    QgsDebugMsg( QString( "Failed to transform sample positions: %1" ).arg( e.what() ) );
+    return values;
+  }
+
+  const double* gtrans = mGtrans;
+  for ( int i = 0; i < n; ++i )
+  {
+    // Transform raster geo position to pixel coordinates
+    double col = ( -gtrans[0] * gtrans[5] + gtrans[2] * gtrans[3] - gtrans[2] * y[i] + gtrans[5] * x[i] ) / ( gtrans[1] * gtrans[5] - gtrans[2] * gtrans[4] );
+    double row = ( -gtrans[0] * gtrans[4] + gtrans[1] * gtrans[3] - gtrans[1] * y[i] + gtrans[4] * x[i] ) / ( gtrans[2] * gtrans[4] - gtrans[1] * gtrans[5] );
+    if ( !qIsFinite( col ) || !qIsFinite( row ) )
+    {
+      continue;
+    }
+    int col0 = qFloor( col );
+    int row0 = qFloor( row );
+    if ( col0 < 0 || row0 < 0 || col0 + 1 >= mWidth || row0 + 1 >= mHeight )
+    {
+      continue;
+    }
+
+    double pixValues[4];
+    if ( !pixelValue( col0, row0, pixValues[0] ) || !pixelValue( col0 + 1, row0, pixValues[1] ) ||
+         !pixelValue( col0, row0 + 1, pixValues[2] ) || !pixelValue( col0 + 1, row0 + 1, pixValues[3] ) )
+    {
+      continue;
+    }
+
+    // Interpolate values
+    double lambdaR = row - row0;
+    double lambdaC = col - col0;
+    values[i] = ( pixValues[0] * ( 1. - lambdaC ) + pixValues[1] * lambdaC ) * ( 1. - lambdaR )
+                + ( pixValues[2] * ( 1. - lambdaC ) + pixValues[3] * lambdaC ) * ( lambdaR );
+    if ( ok )
+    {
+      ( *ok )[i] = true;
+    }
+  }
+  return values;
+}
+
+double QgsRasterSampler::sample( const QgsPoint& point, const QgsCoordinateReferenceSystem& crs, bool* ok )
+{
+  QVector<bool> valid;
+  double value = sample( QVector<QgsPoint>() << point, crs, &valid ).front();
+  if ( ok )
+  {
+    *ok = valid.front();
+  }
+  return value;
+}
+
+bool QgsRasterSampler::pixelValue( int col, int row, double& value )
+{
+  int tileCol = col / sTileSize;
+  int tileRow = row / sTileSize;
+  int tileX = tileCol * sTileSize;
+  int tileY = tileRow * sTileSize;
+  int tileW = qMin( sTileSize, mWidth - tileX );
+  qint64 key = ( qint64( tileRow ) << 32 ) | tileCol;
+
+  if ( key != mLastTileKey )
+  {
+    QVector<double>* tile = mTileCache.object( key );
+    if ( !tile )
+    {
+      int tileH = qMin( sTileSize, mHeight - tileY );
+      tile = new QVector<double>( tileW * tileH );
+      if ( CE_None != GDALRasterIO( mBand, GF_Read, tileX, tileY, tileW, tileH, tile->data(), tileW, tileH, GDT_Float64, 0, 0 ) )
+      {
+        QgsDebugMsg( "Failed to read pixel values" );
+        delete tile;
+        return false;
+      }
+      mTileCache.insert( key, tile );
+    }
+    mLastTileKey = key;
+    mLastTile = tile;
+  }
+  value = mLastTile->at(( row - tileY ) * tileW + ( col - tileX ) );
+  return true;
+}
@@ -0,0 +1,80 @@
+/***************************************************************************
+ *  qgsrastersampler.h                                                     *
+ *  ------------------                                                     *
+ *  begin                : Mar 2016                                        *
+ *  copyright            : (C) 2016 by Sourcepole AG                       *
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSRASTERSAMPLER_H
+#define QGSRASTERSAMPLER_H
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgspoint.h"
+#include <QCache>
+#include <QVector>
+
+typedef void *GDALDatasetH;
+typedef void *GDALRasterBandH;
+
+/** \ingroup core
+ * Samples a band of a GDAL raster at many positions with bilinear interpolation.
+ * The dataset is kept open for the lifetime of the sampler and the tiles which
+ * are read are cached, so that repeated sampling of the same area (i.e. while
+ * interactively editing a height profile) does not hit the disk again.
+ * The sampler is not thread safe.
+ */
+class CORE_EXPORT QgsRasterSampler
+{
+  public:
+    QgsRasterSampler( const QString& rasterFile, int band = 1 );
+    ~QgsRasterSampler();
+
+    bool isValid() const { return mBand != 0; }
+    const QString& rasterFile() const { return mRasterFile; }
+    const QgsCoordinateReferenceSystem& crs() const { return mCrs; }
+    /** Unit of the sampled values, as declared by the band unit type */
+    QGis::UnitType verticalUnit() const { return mVertUnit; }
+
+    /**
+     * Samples the raster at the specified positions.
+     * @param points the positions, in the coordinate system crs
+     * @param crs the coordinate system of the points
+     * @param ok if not null, receives for each position whether it could be sampled
+     * @return the interpolated values in verticalUnit(), 0 for positions which could not be sampled
+     */
+    QVector<double> sample( const QVector<QgsPoint>& points, const QgsCoordinateReferenceSystem& crs, QVector<bool>* ok = 0 );
+    double sample( const QgsPoint& point, const QgsCoordinateReferenceSystem& crs, bool* ok = 0 );
+
+    /** Drops all cached tiles */
+    void clearCache();
+
+  private:
+    Q_DISABLE_COPY( QgsRasterSampler )
+
+    static const int sTileSize = 256;
+
+    QString mRasterFile;
+    GDALDatasetH mDataset;
+    GDALRasterBandH mBand;
+    double mGtrans[6];
+    int mWidth;
+    int mHeight;
+    QgsCoordinateReferenceSystem mCrs;
+    QGis::UnitType mVertUnit;
+    QCache<qint64, QVector<double> > mTileCache;
+    qint64 mLastTileKey;
+    const QVector<double>* mLastTile;
+
+    bool pixelValue( int col, int row, double& value );
+};
+
+#endif // QGSRASTERSAMPLER_H
@@ -0,0 +1,419 @@
+/***************************************************************************
+                         qgsterrainrenderer.cpp
+                         ----------------------
+    begin                : March 2016
+    copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgsterrainrenderer.h"
+#include "qgscolorrampshader.h"
+#include "qgslogger.h"
+#include "qgsrasterdataprovider.h"
+#include "qgsrastershader.h"
+#include "qgsrastertransparency.h"
+#include <QDomDocument>
+#include <QDomElement>
+#include <qmath.h>
+
+QgsTerrainRenderer::QgsTerrainRenderer( QgsRasterInterface* input, int band, Mode mode )
+    : QgsRasterRenderer( input, "terrain" )
+    , mBand( band )
+    , mMode( mode )
+    , mLightAzimuth( 315 )
+    , mLightAngle( 60 )
+    , mZFactor( -1 )
+    , mShader( 0 )
+    , mAutoZFactor( -1 )
+{
+  if ( input )
+  {
+    mAutoZFactor = computeAutoZFactor();
+  }
+}
+
+QgsTerrainRenderer::~QgsTerrainRenderer()
+{
+  delete mShader;
+}
+
+QgsRasterInterface * QgsTerrainRenderer::clone() const
+{
+  QgsTerrainRenderer * renderer = new QgsTerrainRenderer( 0, mBand, mMode );
+  renderer->setOpacity( mOpacity );
+  renderer->setAlphaBand( mAlphaBand );
+  renderer->setRasterTransparency( mRasterTransparency ? new QgsRasterTransparency( *mRasterTransparency ) : 0 );
+  renderer->setLightAzimuth( mLightAzimuth );
+  renderer->setLightAngle( mLightAngle );
+  renderer->setZFactor( mZFactor );
+  renderer->mAutoZFactor = mAutoZFactor;
+  renderer->setClipExtent( mClipExtent );
+
+  if ( mShader )
+  {
+    QgsRasterShader* shader = new QgsRasterShader( mShader->minimumValue(), mShader->maximumValue() );
+    const QgsColorRampShader* origColorRampShader = dynamic_cast<const QgsColorRampShader*>( mShader->rasterShaderFunction() );
+    if ( origColorRampShader )
+    {
+      QgsColorRampShader * colorRampShader = new QgsColorRampShader( mShader->minimumValue(), mShader->maximumValue() );
+      colorRampShader->setColorRampType( origColorRampShader->colorRampType() );
+      colorRampShader->setColorRampItemList( origColorRampShader->colorRampItemList() );
+      shader->setRasterShaderFunction( colorRampShader );
+    }
+    renderer->setShader( shader );
+  }
+  return renderer;
+}
+
+QgsRasterRenderer* QgsTerrainRenderer::create( const QDomElement& elem, QgsRasterInterface* input )
+{
+  if ( elem.isNull() )
+  {
+    return 0;
+  }
+
+  int band = elem.attribute( "band", "1" ).toInt();
+  QString modeName = elem.attribute( "mode" );
+  Mode mode = modeName == "slope" ? Slope : modeName == "aspect" ? Aspect : Hillshade;
+  QgsTerrainRenderer* r = new QgsTerrainRenderer( input, band, mode );
+  r->readXML( elem );
+
+  r->setLightAzimuth( elem.attribute( "lightAzimuth", "315" ).toDouble() );
+  r->setLightAngle( elem.attribute( "lightAngle", "60" ).toDouble() );
+  r->setZFactor( elem.attribute( "zFactor", "-1" ).toDouble() );
+
+  QDomElement clipElem = elem.firstChildElement( "clipExtent" );
+  if ( !clipElem.isNull() )
+  {
+    r->setClipExtent( QgsRectangle( clipElem.attribute( "xmin" ).toDouble(), clipElem.attribute( "ymin" ).toDouble(),
+                                    clipElem.attribute( "xmax" ).toDouble(), clipElem.attribute( "ymax" ).toDouble() ) );
+  }
+
+  QDomElement rasterShaderElem = elem.firstChildElement( "rastershader" );
+  if ( !rasterShaderElem.isNull() )
+  {
+    QgsRasterShader* shader = new QgsRasterShader();
+    shader->readXML( rasterShaderElem );
+    r->setShader( shader );
+  }
+  return r;
+}
+
+void QgsTerrainRenderer::setShader( QgsRasterShader* shader )
+{
+  delete mShader;
+  mShader = shader;
+}
+
+QgsRasterBlock* QgsTerrainRenderer::block( int bandNo, QgsRectangle  const & extent, int width, int height )
+{
+  return block2( bandNo, extent, width, height );
+}
+
+QgsRasterBlock* QgsTerrainRenderer::block2( int bandNo, QgsRectangle  const & extent, int width, int height, QgsRasterBlockFeedback* feedback )
+{
+  Q_UNUSED( bandNo );
+
+  QgsRasterBlock *outputBlock = new QgsRasterBlock();
+  if ( !mInput || width <= 0 || height <= 0 )
+  {
+    return outputBlock;
+  }
+
+  // Read the elevations with one extra pixel on each side, so that the border pixels have all their neighbours
+  double cellSizeX = extent.width() / width;
+  double cellSizeY = extent.height() / height;
+  QgsRectangle inputExtent( extent.xMinimum() - cellSizeX, extent.yMinimum() - cellSizeY,
+                            extent.xMaximum() + cellSizeX, extent.yMaximum() + cellSizeY );
+  int inputWidth = width + 2;
+  QgsRasterBlock *inputBlock = mInput->block2( mBand, inputExtent, inputWidth, height + 2, feedback );
+  if ( !inputBlock || inputBlock->isEmpty() )
+  {
+    QgsDebugMsg( "No raster data!" );
+    delete inputBlock;
+    return outputBlock;
+  }
+
+  QgsRasterBlock *alphaBlock = 0;
+  if ( mAlphaBand > 0 )
+  {
+    alphaBlock = mInput->block2( mAlphaBand, extent, width, height, feedback );
+    if ( !alphaBlock || alphaBlock->isEmpty() )
+    {
+      delete inputBlock;
+      delete alphaBlock;
+      return outputBlock;
+    }
+  }
+
+  if ( !outputBlock->reset( QGis::ARGB32_Premultiplied, width, height ) )
+  {
+    delete inputBlock;
+    delete alphaBlock;
+    return outputBlock;
+  }
+
+  // Copy the elevations and their validity to plain arrays for the kernel
+  int nInput = inputWidth * ( height + 2 );
+  QVector<double> z( nInput );
+  QVector<bool> valid( nInput );
+  for ( int i = 0; i < nInput; ++i )
+  {
+    valid[i] = !inputBlock->isNoData( i );
+    z[i] = valid[i] ? inputBlock->value( i ) : 0.;
+  }
+  delete inputBlock;
+
+  double zFactor = effectiveZFactor();
+  if ( zFactor <= 0 )
+  {
+    zFactor = 1.;
+  }
+  double denomX = cellSizeX * zFactor;
+  double denomY = cellSizeY * zFactor;
+  double zenithRad = mLightAngle * M_PI / 180.0;
+  double azimuthRad = mLightAzimuth * M_PI / 180.0;
+  double cosZenith = cos( zenithRad );
+  double sinZenith = sin( zenithRad );
+  bool clip = !mClipExtent.isEmpty();
+
+  QRgb defaultColor = NODATA_COLOR;
+  for ( int row = 0; row < height; ++row )
+  {
+    double y = extent.yMaximum() - ( row + 0.5 ) * cellSizeY;
+    const double* z1 = z.constData() + row * inputWidth + 1;
+    const double* z2 = z1 + inputWidth;
+    const double* z3 = z2 + inputWidth;
+    const bool* v1 = valid.constData() + row * inputWidth + 1;
+    const bool* v2 = v1 + inputWidth;
+    const bool* v3 = v2 + inputWidth;
+    for ( int col = 0; col < width; ++col )
+    {
+      qgssize idx = ( qgssize ) row * width + col;
+      double x = extent.xMinimum() + ( col + 0.5 ) * cellSizeX;
+      if ( !v2[col] || ( clip && !mClipExtent.contains( QgsPoint( x, y ) ) ) )
+      {
+        outputBlock->setColor( idx, defaultColor );
+        continue;
+      }
+
+      // Horn (1981) derivatives. At nodata neighbours (i.e. at the border of the data), only the
+      // available differences of each row and column are used, like QgsDerivativeFilter does
+      const double* zr[3] = { z1 + col, z2 + col, z3 + col };
+      const bool* vr[3] = { v1 + col, v2 + col, v3 + col };
+      double sumX = 0, sumY = 0;
+      int weightX = 0, weightY = 0;
+      for ( int k = 0; k < 3; ++k )
+      {
+        int w = k == 1 ? 2 : 1;
+        // Row k: east - west
+        if ( vr[k][1] && vr[k][-1] )
+        {
+          sumX += w * ( zr[k][1] - zr[k][-1] );
+          weightX += 2 * w;
+        }
+        else if ( vr[k][0] && vr[k][-1] )
+        {
+          sumX += w * ( zr[k][0] - zr[k][-1] );
+          weightX += w;
+        }
+        else if ( vr[k][0] && vr[k][1] )
+        {
+          sumX += w * ( zr[k][1] - zr[k][0] );
+          weightX += w;
+        }
+        // Column k - 1: north - south
+        int c = k - 1;
+        if ( vr[0][c] && vr[2][c] )
+        {
+          sumY += w * ( zr[0][c] - zr[2][c] );
+          weightY += 2 * w;
+        }
+        else if ( vr[1][c] && vr[2][c] )
+        {
+          sumY += w * ( zr[1][c] - zr[2][c] );
+          weightY += w;
+        }
+        else if ( vr[0][c] && vr[1][c] )
+        {
+          sumY += w * ( zr[0][c] - zr[1][c] );
+          weightY += w;
+        }
+      }
+      if ( weightX == 0 || weightY == 0 )
+      {
+        outputBlock->setColor( idx, defaultColor );
+        continue;
+      }
+      double derX = sumX / ( weightX * denomX );
+      double derY = sumY / ( weightY * denomY );
+
+      double value;
+      if ( mMode == Slope )
+      {
+        value = atan( sqrt( derX * derX + derY * derY ) ) * 180.0 / M_PI;
+      }
+      else if ( mMode == Aspect )
+      {
+        if ( derX == 0 && derY == 0 )
+        {
+          outputBlock->setColor( idx, defaultColor );
+          continue;
+        }
+        value = 180.0 + atan2( derX, derY ) * 180.0 / M_PI;
+      }
+      else
+      {
+        double slopeRad = atan( sqrt( derX * derX + derY * derY ) );
+        double aspectRad = ( derX == 0 && derY == 0 ) ? azimuthRad / 2.0 : M_PI + atan2( derX, derY );
+        value = qMax( 0.0, 255.0 * ( cosZenith * cos( slopeRad ) + sinZenith * sin( slopeRad ) * cos( azimuthRad - aspectRad ) ) );
+      }
+
+      int red, green, blue, alpha = 255;
+      if ( mMode != Hillshade && mShader )
+      {
+        if ( !mShader->shade( value, &red, &green, &blue, &alpha ) )
+        {
+          outputBlock->setColor( idx, defaultColor );
+          continue;
+        }
+      }
+      else
+      {
+        // Stretch slope and aspect over their full range
+        int gray = qBound( 0, qRound( mMode == Slope ? value / 90. * 255. : mMode == Aspect ? value / 360. * 255. : value ), 255 );
+        red = green = blue = gray;
+      }
+
+      double currentOpacity = mOpacity * alpha / 255.0;
+      if ( mRasterTransparency )
+      {
+        currentOpacity = mRasterTransparency->alphaValue( value, mOpacity * 255 ) / 255.0 * alpha / 255.0;
+      }
+      if ( alphaBlock )
+      {
+        currentOpacity *= alphaBlock->value( idx ) / 255.0;
+      }
+      outputBlock->setColor( idx, qRgba( currentOpacity * red, currentOpacity * green, currentOpacity * blue, currentOpacity * 255 ) );
+    }
+  }
+
+  delete alphaBlock;
+  return outputBlock;
+}
+
+bool QgsTerrainRenderer::setInput( QgsRasterInterface* input )
+{
+  if ( !QgsRasterRenderer::setInput( input ) )
+  {
+    return false;
+  }
+  // Clones of the pipe get the factor of the original renderer and don't have to look it up again
+  if ( mAutoZFactor <= 0 )
+  {
+    mAutoZFactor = computeAutoZFactor();
+  }
+  return true;
+}
+
+void QgsTerrainRenderer::setBand( int band )
+{
+  mBand = band;
+  mAutoZFactor = computeAutoZFactor();
+}
+
+double QgsTerrainRenderer::effectiveZFactor() const
+{
+  if ( mZFactor > 0 )
+  {
+    return mZFactor;
+  }
+  return mAutoZFactor > 0 ? mAutoZFactor : computeAutoZFactor();
+}
+
+double QgsTerrainRenderer::computeAutoZFactor() const
+{
+  QgsRasterDataProvider* provider = mInput ? dynamic_cast<QgsRasterDataProvider*>( mInput->srcInput() ) : 0;
+  if ( !provider )
+  {
+    return -1.;
+  }
+
+  // Elevations are in meters unless the band unit says feet
+  QGis::UnitType vertUnit = provider->bandUnit( mBand ) == "ft" ? QGis::Feet : QGis::Meters;
+
+  double horizontalToMeters = 1.;
+  switch ( provider->crs().mapUnits() )
+  {
+    case QGis::Feet:
+      horizontalToMeters = QGis::fromUnitToUnitFactor( QGis::Feet, QGis::Meters );
+      break;
+    case QGis::Degrees:
+      // Take the latitude in the middle of the layer, so that all the blocks are shaded alike
+      horizontalToMeters = 111320 * cos( provider->extent().center().y() * M_PI / 180. );
+      break;
+    default:
+      break;
+  }
+  return horizontalToMeters * QGis::fromUnitToUnitFactor( QGis::Meters, vertUnit );
+}
+
+void QgsTerrainRenderer::writeXML( QDomDocument& doc, QDomElement& parentElem ) const
+{
+  if ( parentElem.isNull() )
+  {
+    return;
+  }
+
+  QDomElement rasterRendererElem = doc.createElement( "rasterrenderer" );
+  _writeXML( doc, rasterRendererElem );
+  rasterRendererElem.setAttribute( "band", mBand );
+  rasterRendererElem.setAttribute( "mode", mMode == Slope ? "slope" : mMode == Aspect ? "aspect" : "hillshade" );
+  rasterRendererElem.setAttribute( "lightAzimuth", QString::number( mLightAzimuth ) );
+  rasterRendererElem.setAttribute( "lightAngle", QString::number( mLightAngle ) );
+  rasterRendererElem.setAttribute( "zFactor", QString::number( mZFactor ) );
+  if ( !mClipExtent.isEmpty() )
+  {
+    QDomElement clipElem = doc.createElement( "clipExtent" );
+    clipElem.setAttribute( "xmin", qgsDoubleToString( mClipExtent.xMinimum() ) );
+    clipElem.setAttribute( "ymin", qgsDoubleToString( mClipExtent.yMinimum() ) );
+    clipElem.setAttribute( "xmax", qgsDoubleToString( mClipExtent.xMaximum() ) );
+    clipElem.setAttribute( "ymax", qgsDoubleToString( mClipExtent.yMaximum() ) );
+    rasterRendererElem.appendChild( clipElem );
+  }
+  if ( mShader )
+  {
+    mShader->writeXML( doc, rasterRendererElem );
+  }
+  parentElem.appendChild( rasterRendererElem );
+}
+
+void QgsTerrainRenderer::legendSymbologyItems( QList< QPair< QString, QColor > >& symbolItems ) const
+{
+  if ( mMode != Hillshade && mShader )
+  {
+    QgsRasterShaderFunction* shaderFunction = mShader->rasterShaderFunction();
+    if ( shaderFunction )
+    {
+      shaderFunction->legendSymbologyItems( symbolItems );
+    }
+  }
+}
+
+QList<int> QgsTerrainRenderer::usesBands() const
+{
+  QList<int> bandList;
+  if ( mBand != -1 )
+  {
+    bandList << mBand;
+  }
+  return bandList;
+}
@@ -0,0 +1,100 @@
+/***************************************************************************
+                         qgsterrainrenderer.h
+                         --------------------
+    begin                : March 2016
+    copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSTERRAINRENDERER_H
+#define QGSTERRAINRENDERER_H
+
+#include "qgsrasterrenderer.h"
+#include "qgsrectangle.h"
+
+class QgsRasterShader;
+class QDomElement;
+
+/** \ingroup core
+  * Raster renderer pipe which computes hillshade, slope or aspect of an elevation band on the fly.
+  * Only the requested extent is computed, at the requested resolution, from a block of the
+  * elevation band which is read with a halo of one pixel.
+  */
+class CORE_EXPORT QgsTerrainRenderer: public QgsRasterRenderer
+{
+  public:
+    enum Mode
+    {
+      Hillshade,
+      Slope,
+      Aspect
+    };
+
+    QgsTerrainRenderer( QgsRasterInterface* input, int band, Mode mode = Hillshade );
+    ~QgsTerrainRenderer();
+    QgsRasterInterface * clone() const override;
+
+    static QgsRasterRenderer* create( const QDomElement& elem, QgsRasterInterface* input );
+
+    QgsRasterBlock* block( int bandNo, const QgsRectangle & extent, int width, int height ) override;
+    QgsRasterBlock* block2( int bandNo, const QgsRectangle & extent, int width, int height, QgsRasterBlockFeedback* feedback = nullptr ) override;
+
+    bool setInput( QgsRasterInterface* input ) override;
+
+    int band() const { return mBand; }
+    void setBand( int band );
+    Mode mode() const { return mMode; }
+    void setMode( Mode mode ) { mMode = mode; }
+
+    /** Horizontal angle of the light source in degrees, used for the hillshade */
+    double lightAzimuth() const { return mLightAzimuth; }
+    void setLightAzimuth( double azimuth ) { mLightAzimuth = azimuth; }
+    /** Vertical angle of the light source in degrees, used for the hillshade */
+    double lightAngle() const { return mLightAngle; }
+    void setLightAngle( double angle ) { mLightAngle = angle; }
+
+    /** Ratio of the horizontal to the vertical units. Set to -1 to compute it from the layer CRS and the unit of the elevation band */
+    double zFactor() const { return mZFactor; }
+    void setZFactor( double factor ) { mZFactor = factor; }
+    /** The z factor used for rendering: zFactor() if set, otherwise the one computed from the input */
+    double effectiveZFactor() const;
+
+    /** Region outside of which nothing is rendered, in layer coordinates. An empty rectangle renders the whole layer */
+    const QgsRectangle& clipExtent() const { return mClipExtent; }
+    void setClipExtent( const QgsRectangle& extent ) { mClipExtent = extent; }
+
+    /** Shader used to color slope and aspect values. If not set, the values are rendered in gray. Takes ownership of the shader */
+    void setShader( QgsRasterShader* shader );
+    QgsRasterShader* shader() { return mShader; }
+    const QgsRasterShader* shader() const { return mShader; }
+
+    void writeXML( QDomDocument& doc, QDomElement& parentElem ) const override;
+
+    void legendSymbologyItems( QList< QPair< QString, QColor > >& symbolItems ) const override;
+
+    QList<int> usesBands() const override;
+
+  private:
+    int mBand;
+    Mode mMode;
+    double mLightAzimuth;
+    double mLightAngle;
+    double mZFactor;
+    QgsRectangle mClipExtent;
+    QgsRasterShader* mShader;
+    /** Ratio computed from the layer CRS and the vertical unit of the band, used if mZFactor is -1 */
+    double mAutoZFactor;
+
+    /** Computes the ratio of the horizontal to the vertical units for the whole layer, -1 without input */
+    double computeAutoZFactor() const;
+};
+
+#endif // QGSTERRAINRENDERER_H
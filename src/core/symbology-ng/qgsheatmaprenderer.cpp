@@ -28,9 +28,152 @@
 
 #include <QDomDocument>
 #include <QDomElement>
+#include <QHash>
+#include <QMutex>
+#include <QtConcurrentMap>
+
+static const int sTileSize = 64;
+
+/** Density tiles of the last render, shared by the clones of a renderer to reuse them across pans */
+class QgsHeatmapDensityCache
+{
+  public:
+    struct Tile
+    {
+      quint64 fingerprint;
+      int pointCount;
+      QVector<double> values;
+    };
+
+    QgsHeatmapDensityCache()
+        : mapUnitsPerPixel( 0 )
+        , rotation( 0 )
+        , renderQuality( 0 )
+        , radiusPixels( -1 )
+    {}
+
+    bool hasGrid( double theMapUnitsPerPixel, double theRotation, int theRenderQuality, int theRadiusPixels, const QgsPoint& theAnchor ) const
+    {
+      return mapUnitsPerPixel == theMapUnitsPerPixel && rotation == theRotation && renderQuality == theRenderQuality
+             && radiusPixels == theRadiusPixels && anchor == theAnchor;
+    }
+
+    QMutex mutex;
+    double mapUnitsPerPixel;
+    double rotation;
+    int renderQuality;
+    int radiusPixels;
+    QgsPoint anchor;
+    QHash< QPair<int, int>, Tile > tiles;
+};
+
+/** Data shared by the tiles of one render */
+struct QgsHeatmapTileJob
+{
+  const QVector<QPoint>* cells;
+  const QVector<double>* weights;
+  QVector<double> stamp;
+  int radius;
+  const QgsVectorColorRampV2* ramp;
+  bool invertRamp;
+  double scaleMax;
+  uchar* image;
+  int bytesPerLine;
+  QPoint imageOrigin;
+};
+
+/** Square of sTileSize cells of the density grid, with the points whose kernels reach into it */
+struct QgsHeatmapTile
+{
+  const QgsHeatmapTileJob* job;
+  QPoint origin;
+  //! visible cells of the tile
+  QRect visible;
+  QVector<int> points;
+  quint64 fingerprint;
+  //! true if the values were taken from the cache
+  bool cached;
+  QVector<double> values;
+  double maxValue;
+};
+
+static inline int heatmapTileIndex( int cell )
+{
+  return cell >= 0 ? cell / sTileSize : -(( -cell - 1 ) / sTileSize ) - 1;
+}
+
+/** Hash of a point, which is summed up over the points of a tile to recognize tiles with unchanged points */
+static inline quint64 heatmapPointHash( const QPoint& cell, double weight )
+{
+  quint64 weightBits;
+  memcpy( &weightBits, &weight, sizeof( weightBits ) );
+  quint64 h = (( quint64 )( quint32 ) cell.x() << 32 | ( quint32 ) cell.y() ) ^ ( weightBits * Q_UINT64_C( 0x9e3779b97f4a7c15 ) );
+  h = ( h ^ ( h >> 30 ) ) * Q_UINT64_C( 0xbf58476d1ce4e5b9 );
+  h = ( h ^ ( h >> 27 ) ) * Q_UINT64_C( 0x94d049bb133111eb );
+  return h ^ ( h >> 31 );
+}
+
+static void accumulateHeatmapTile( QgsHeatmapTile& tile )
+{
+  const QgsHeatmapTileJob& job = *tile.job;
+  if ( !tile.cached )
+  {
+    tile.values.fill( 0, sTileSize * sTileSize );
+    int radius = job.radius;
+    int stampSize = 2 * radius + 1;
+    foreach ( int index, tile.points )
+    {
+      const QPoint& cell = job.cells->at( index );
+      double weight = job.weights->at( index );
+      int xMin = qMax( cell.x() - radius, tile.origin.x() );
+      int xMax = qMin( cell.x() + radius, tile.origin.x() + sTileSize - 1 );
+      int yMax = qMin( cell.y() + radius, tile.origin.y() + sTileSize - 1 );
+      for ( int y = qMax( cell.y() - radius, tile.origin.y() ); y <= yMax; ++y )
+      {
+        const double* stampLine = job.stamp.constData() + ( y - cell.y() + radius ) * stampSize + radius - cell.x();
+        double* line = tile.values.data() + ( y - tile.origin.y() ) * sTileSize - tile.origin.x();
+        for ( int x = xMin; x <= xMax; ++x )
+        {
+          line[x] += weight * stampLine[x];
+        }
+      }
+    }
+  }
+
+  tile.maxValue = 0;
+  for ( int y = tile.visible.top(); y <= tile.visible.bottom(); ++y )
+  {
+    const double* line = tile.values.constData() + ( y - tile.origin.y() ) * sTileSize - tile.origin.x();
+    for ( int x = tile.visible.left(); x <= tile.visible.right(); ++x )
+    {
+      tile.maxValue = qMax( tile.maxValue, line[x] );
+    }
+  }
+}
+
+static void colorHeatmapTile( QgsHeatmapTile& tile )
+{
+  const QgsHeatmapTileJob& job = *tile.job;
+  for ( int y = tile.visible.top(); y <= tile.visible.bottom(); ++y )
+  {
+    const double* line = tile.values.constData() + ( y - tile.origin.y() ) * sTileSize - tile.origin.x();
+    QRgb* scanLine = ( QRgb* )( job.image + ( y - job.imageOrigin.y() ) * job.bytesPerLine ) - job.imageOrigin.x();
+    for ( int x = tile.visible.left(); x <= tile.visible.right(); ++x )
+    {
+      //scale result to fit in the range [0, 1]
+      double pixVal = line[x] > 0 ? qMin(( line[x] / job.scaleMax ), 1.0 ) : 0;
+
+      //convert value to color from ramp
+      scanLine[x] = job.ramp->color( job.invertRamp ? 1 - pixVal : pixVal ).rgba();
+    }
+  }
+}
 
 QgsHeatmapRenderer::QgsHeatmapRenderer( )
     : QgsFeatureRendererV2( "heatmapRenderer" )
+    , mGridOriginX( 0 )
+    , mGridOriginY( 0 )
+    , mCache( new QgsHeatmapDensityCache() )
     , mCalculatedMaxValue( 0 )
     , mRadius( 10 )
     , mRadiusPixels( 0 )
@@ -54,12 +197,37 @@ QgsHeatmapRenderer::~QgsHeatmapRenderer()
 
 void QgsHeatmapRenderer::initializeValues( QgsRenderContext& context )
 {
-  mValues.resize( context.painter()->device()->width() * context.painter()->device()->height() / ( mRenderQuality * mRenderQuality ) );
-  mValues.fill( 0 );
+  mPointCells.clear();
+  mPointWeights.clear();
   mCalculatedMaxValue = 0;
   mFeaturesRendered = 0;
   mRadiusPixels = qRound( mRadius * QgsSymbolLayerV2Utils::pixelSizeScaleFactor( context, mRadiusUnit, mRadiusMapUnitScale ) / mRenderQuality );
   mRadiusSquared = mRadiusPixels * mRadiusPixels;
+
+  // keep the anchor of the grid as long as only the map extent changes, such that cached tiles can be reused
+  const QgsMapToPixel& mtp = context.mapToPixel();
+  int deviceWidth = context.painter()->device()->width();
+  int deviceHeight = context.painter()->device()->height();
+  {
+    QMutexLocker locker( &mCache->mutex );
+    QgsPoint origin = mtp.transform( mCache->anchor );
+    if ( !mCache->hasGrid( mtp.mapUnitsPerPixel(), mtp.mapRotation(), mRenderQuality, mRadiusPixels, mCache->anchor )
+         || qAbs( origin.x() ) > 1e8 || qAbs( origin.y() ) > 1e8 )
+    {
+      mCache->mapUnitsPerPixel = mtp.mapUnitsPerPixel();
+      mCache->rotation = mtp.mapRotation();
+      mCache->renderQuality = mRenderQuality;
+      mCache->radiusPixels = mRadiusPixels;
+      mCache->anchor = mtp.toMapCoordinatesF( deviceWidth / 2.0, deviceHeight / 2.0 );
+      mCache->tiles.clear();
+    }
+    mGridAnchor = mCache->anchor;
+  }
+  QgsPoint origin = mtp.transform( mGridAnchor );
+  mGridOriginX = origin.x();
+  mGridOriginY = origin.y();
+  mVisibleCells = QRect( QPoint(( int ) floor( -mGridOriginX / mRenderQuality ), ( int ) floor( -mGridOriginY / mRenderQuality ) ),
+                         QPoint(( int ) ceil(( deviceWidth - mGridOriginX ) / mRenderQuality ) - 1, ( int ) ceil(( deviceHeight - mGridOriginY ) / mRenderQuality ) - 1 ) );
 }
 
 void QgsHeatmapRenderer::startRender( QgsRenderContext& context, const QgsFields& fields )
@@ -135,9 +303,6 @@ bool QgsHeatmapRenderer::renderFeature( QgsFeature& feature, QgsRenderContext& c
     }
   }
 
-  int width = context.painter()->device()->width() / mRenderQuality;
-  int height = context.painter()->device()->height() / mRenderQuality;
-
   //transform geometry if required
   QgsGeometry* geom;
   bool createdGeom = false;
@@ -165,32 +330,15 @@ bool QgsHeatmapRenderer::renderFeature( QgsFeature& feature, QgsRenderContext& c
   for ( QgsMultiPoint::const_iterator pointIt = multiPoint.constBegin(); pointIt != multiPoint.constEnd(); ++pointIt )
   {
     QgsPoint pixel = context.mapToPixel().transform( *pointIt );
-    int pointX = pixel.x() / mRenderQuality;
-    int pointY = pixel.y() / mRenderQuality;
-    for ( int x = qMax( pointX - mRadiusPixels, 0 ); x < qMin( pointX + mRadiusPixels, width ); ++x )
+    QPoint cell(( int ) floor(( pixel.x() - mGridOriginX ) / mRenderQuality ), ( int ) floor(( pixel.y() - mGridOriginY ) / mRenderQuality ) );
+    // the kernel must reach into the visible cells
+    if ( cell.x() + mRadiusPixels < mVisibleCells.left() || cell.x() - mRadiusPixels > mVisibleCells.right()
+         || cell.y() + mRadiusPixels < mVisibleCells.top() || cell.y() - mRadiusPixels > mVisibleCells.bottom() )
     {
-      for ( int y = qMax( pointY - mRadiusPixels, 0 ); y < qMin( pointY + mRadiusPixels, height ); ++y )
-      {
-        int index = y * width + x;
-        if ( index >= mValues.count( ) )
-        {
-          continue;
-        }
-        double distanceSquared = pow( pointX - x, 2.0 ) + pow( pointY - y, 2.0 );
-        if ( distanceSquared > mRadiusSquared )
-        {
-          continue;
-        }
-
-        double score = weight * quarticKernel( sqrt( distanceSquared ), mRadiusPixels );
-        double value = mValues[ index ] + score;
-        if ( value > mCalculatedMaxValue )
-        {
-          mCalculatedMaxValue = value;
-        }
-        mValues[ index ] = value;
-      }
+      continue;
     }
+    mPointCells.append( cell );
+    mPointWeights.append( weight );
   }
 
   mFeaturesRendered++;
@@ -238,48 +386,132 @@ void QgsHeatmapRenderer::stopRender( QgsRenderContext& context )
   mWeightExpression.reset();
 }
 
+void QgsHeatmapRenderer::createStamp( QVector<double>& stamp ) const
+{
+  int stampSize = 2 * mRadiusPixels + 1;
+  stamp.fill( 0, stampSize * stampSize );
+  for ( int y = -mRadiusPixels; y <= mRadiusPixels; ++y )
+  {
+    for ( int x = -mRadiusPixels; x <= mRadiusPixels; ++x )
+    {
+      double distanceSquared = pow( x, 2.0 ) + pow( y, 2.0 );
+      if ( distanceSquared < mRadiusSquared )
+      {
+        stamp[( y + mRadiusPixels ) * stampSize + x + mRadiusPixels] = quarticKernel( sqrt( distanceSquared ), mRadiusPixels );
+      }
+    }
+  }
+}
+
 void QgsHeatmapRenderer::renderImage( QgsRenderContext& context )
 {
-  if ( !context.painter() || !mGradientRamp )
+  if ( !context.painter() || !mGradientRamp || mVisibleCells.isEmpty() )
   {
     return;
   }
 
-  QImage image( context.painter()->device()->width() / mRenderQuality,
-                context.painter()->device()->height() / mRenderQuality,
-                QImage::Format_ARGB32 );
-  image.fill( Qt::transparent );
-
-  double scaleMax = mExplicitMax > 0 ? mExplicitMax : mCalculatedMaxValue;
+  QgsHeatmapTileJob job;
+  job.cells = &mPointCells;
+  job.weights = &mPointWeights;
+  createStamp( job.stamp );
+  job.radius = mRadiusPixels;
+  job.ramp = mGradientRamp;
+  job.invertRamp = mInvertRamp;
+
+  // split the visible cells into tiles, and assign the points to the tiles their kernels reach into
+  int firstTileX = heatmapTileIndex( mVisibleCells.left() );
+  int firstTileY = heatmapTileIndex( mVisibleCells.top() );
+  int tilesX = heatmapTileIndex( mVisibleCells.right() ) - firstTileX + 1;
+  int tilesY = heatmapTileIndex( mVisibleCells.bottom() ) - firstTileY + 1;
+  QVector<QgsHeatmapTile> tiles( tilesX * tilesY );
+  for ( int i = 0; i < tiles.size(); ++i )
+  {
+    QgsHeatmapTile& tile = tiles[i];
+    tile.job = &job;
+    tile.origin = QPoint(( firstTileX + i % tilesX ) * sTileSize, ( firstTileY + i / tilesX ) * sTileSize );
+    tile.visible = QRect( tile.origin, QSize( sTileSize, sTileSize ) ).intersected( mVisibleCells );
+    tile.fingerprint = 0;
+    tile.cached = false;
+    tile.maxValue = 0;
+  }
+  for ( int i = 0, n = mPointCells.size(); i < n; ++i )
+  {
+    const QPoint& cell = mPointCells[i];
+    int tileXMin = heatmapTileIndex( qMax( cell.x() - mRadiusPixels, mVisibleCells.left() ) ) - firstTileX;
+    int tileXMax = heatmapTileIndex( qMin( cell.x() + mRadiusPixels, mVisibleCells.right() ) ) - firstTileX;
+    int tileYMin = heatmapTileIndex( qMax( cell.y() - mRadiusPixels, mVisibleCells.top() ) ) - firstTileY;
+    int tileYMax = heatmapTileIndex( qMin( cell.y() + mRadiusPixels, mVisibleCells.bottom() ) ) - firstTileY;
+    quint64 hash = heatmapPointHash( cell, mPointWeights[i] );
+    for ( int tileY = tileYMin; tileY <= tileYMax; ++tileY )
+    {
+      for ( int tileX = tileXMin; tileX <= tileXMax; ++tileX )
+      {
+        QgsHeatmapTile& tile = tiles[tileY * tilesX + tileX];
+        tile.points.append( i );
+        tile.fingerprint += hash;
+      }
+    }
+  }
 
-  int idx = 0;
-  double pixVal = 0;
-  QColor pixColor;
-  for ( int heightIndex = 0; heightIndex < image.height(); ++heightIndex )
+  // reuse the tiles of the last render which got the same points
+  double mapUnitsPerPixel = context.mapToPixel().mapUnitsPerPixel();
+  double rotation = context.mapToPixel().mapRotation();
   {
-    QRgb* scanLine = ( QRgb* )image.scanLine( heightIndex );
-    for ( int widthIndex = 0; widthIndex < image.width(); ++widthIndex )
+    QMutexLocker locker( &mCache->mutex );
+    if ( mCache->hasGrid( mapUnitsPerPixel, rotation, mRenderQuality, mRadiusPixels, mGridAnchor ) )
     {
-      //scale result to fit in the range [0, 1]
-      pixVal = mValues.at( idx ) > 0 ? qMin(( mValues.at( idx ) / scaleMax ), 1.0 ) : 0;
+      for ( int i = 0; i < tiles.size(); ++i )
+      {
+        QgsHeatmapTile& tile = tiles[i];
+        QHash< QPair<int, int>, QgsHeatmapDensityCache::Tile >::const_iterator it = mCache->tiles.constFind( qMakePair( tile.origin.x(), tile.origin.y() ) );
+        if ( it != mCache->tiles.constEnd() && it->fingerprint == tile.fingerprint && it->pointCount == tile.points.size() )
+        {
+          tile.values = it->values;
+          tile.cached = true;
+        }
+      }
+    }
+  }
 
-      //convert value to color from ramp
-      pixColor = mGradientRamp->color( mInvertRamp ? 1 - pixVal : pixVal );
+  QtConcurrent::blockingMap( tiles, accumulateHeatmapTile );
+
+  mCalculatedMaxValue = 0;
+  foreach ( const QgsHeatmapTile& tile, tiles )
+  {
+    mCalculatedMaxValue = qMax( mCalculatedMaxValue, tile.maxValue );
+  }
+  job.scaleMax = mExplicitMax > 0 ? mExplicitMax : mCalculatedMaxValue;
 
-      scanLine[widthIndex] = pixColor.rgba();
-      idx++;
+  QImage image( mVisibleCells.width(), mVisibleCells.height(), QImage::Format_ARGB32 );
+  job.image = image.bits();
+  job.bytesPerLine = image.bytesPerLine();
+  job.imageOrigin = mVisibleCells.topLeft();
+  QtConcurrent::blockingMap( tiles, colorHeatmapTile );
+
+  {
+    QMutexLocker locker( &mCache->mutex );
+    if ( mCache->hasGrid( mapUnitsPerPixel, rotation, mRenderQuality, mRadiusPixels, mGridAnchor ) )
+    {
+      mCache->tiles.clear();
+      foreach ( const QgsHeatmapTile& tile, tiles )
+      {
+        QgsHeatmapDensityCache::Tile& cachedTile = mCache->tiles[ qMakePair( tile.origin.x(), tile.origin.y() )];
+        cachedTile.fingerprint = tile.fingerprint;
+        cachedTile.pointCount = tile.points.size();
+        cachedTile.values = tile.values;
+      }
     }
   }
 
+  QPointF topLeft( mGridOriginX + mVisibleCells.left() * mRenderQuality, mGridOriginY + mVisibleCells.top() * mRenderQuality );
   if ( mRenderQuality > 1 )
   {
-    QImage resized = image.scaled( context.painter()->device()->width(),
-                                   context.painter()->device()->height() );
-    context.painter()->drawImage( 0, 0, resized );
+    QImage resized = image.scaled( image.width() * mRenderQuality, image.height() * mRenderQuality );
+    context.painter()->drawImage( topLeft, resized );
   }
   else
   {
-    context.painter()->drawImage( 0, 0, image );
+    context.painter()->drawImage( topLeft, image );
   }
 }
 
@@ -302,6 +534,7 @@ QgsFeatureRendererV2* QgsHeatmapRenderer::clone() const
   newRenderer->setMaximumValue( mExplicitMax );
   newRenderer->setRenderQuality( mRenderQuality );
   newRenderer->setWeightExpression( mWeightExpressionString );
+  newRenderer->mCache = mCache;
 
   return newRenderer;
 }
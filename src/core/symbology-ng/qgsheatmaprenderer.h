@@ -22,8 +22,12 @@
 #include "qgsfeature.h"
 #include "qgsgeometry.h"
 #include <QScopedPointer>
+#include <QSharedPointer>
+#include <QPoint>
+#include <QRect>
 
 class QgsVectorColorRampV2;
+class QgsHeatmapDensityCache;
 
 /** \ingroup core
  * \class QgsHeatmapRenderer
@@ -169,7 +173,18 @@ class CORE_EXPORT QgsHeatmapRenderer : public QgsFeatureRendererV2
     /** Private assignment operator. @see clone() */
     QgsHeatmapRenderer& operator=( const QgsHeatmapRenderer& );
 
-    QVector<double> mValues;
+    /** The density is accumulated in a grid of cells of mRenderQuality pixels. The grid is anchored to
+     * a point of the map, such that panning does not move the cells of the points */
+    QgsPoint mGridAnchor;
+    //! device position of cell (0, 0) of the grid
+    double mGridOriginX;
+    double mGridOriginY;
+    //! cells of the grid which are visible on the device
+    QRect mVisibleCells;
+    QVector<QPoint> mPointCells;
+    QVector<double> mPointWeights;
+    //! density tiles of the last render, shared with the clones of the renderer
+    QSharedPointer<QgsHeatmapDensityCache> mCache;
 
     double mCalculatedMaxValue;
 
@@ -200,6 +215,7 @@ class CORE_EXPORT QgsHeatmapRenderer : public QgsFeatureRendererV2
     QgsMultiPoint convertToMultipoint( QgsGeometry *geom );
     void initializeValues( QgsRenderContext& context );
     void renderImage( QgsRenderContext &context );
+    void createStamp( QVector<double>& stamp ) const;
 };
 
 
@@ -0,0 +1,127 @@
+/***************************************************************************
+                         qgsterrainrendererwidget.cpp
+                         ----------------------------
+    begin                : March 2016
+    copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgsterrainrendererwidget.h"
+#include "qgsterrainrenderer.h"
+#include "qgsrasterlayer.h"
+
+#include <QComboBox>
+#include <QDoubleSpinBox>
+#include <QFormLayout>
+
+QgsTerrainRendererWidget::QgsTerrainRendererWidget( QgsRasterLayer* layer, const QgsRectangle &extent )
+    : QgsRasterRendererWidget( layer, extent )
+{
+  QFormLayout* layout = new QFormLayout( this );
+
+  mBandComboBox = new QComboBox( this );
+  layout->addRow( tr( "Band" ), mBandComboBox );
+
+  mModeComboBox = new QComboBox( this );
+  mModeComboBox->addItem( tr( "Hillshade" ), QgsTerrainRenderer::Hillshade );
+  mModeComboBox->addItem( tr( "Slope" ), QgsTerrainRenderer::Slope );
+  mModeComboBox->addItem( tr( "Aspect" ), QgsTerrainRenderer::Aspect );
+  layout->addRow( tr( "Mode" ), mModeComboBox );
+
+  mAzimuthSpinBox = new QDoubleSpinBox( this );
+  mAzimuthSpinBox->setRange( 0, 359.9 );
+  mAzimuthSpinBox->setDecimals( 1 );
+  mAzimuthSpinBox->setWrapping( true );
+  mAzimuthSpinBox->setSuffix( QChar( 0x00B0 ) );
+  mAzimuthSpinBox->setValue( 315 );
+  layout->addRow( tr( "Azimuth (horizontal angle)" ), mAzimuthSpinBox );
+
+  mAngleSpinBox = new QDoubleSpinBox( this );
+  mAngleSpinBox->setRange( 0, 90. );
+  mAngleSpinBox->setDecimals( 1 );
+  mAngleSpinBox->setSuffix( QChar( 0x00B0 ) );
+  mAngleSpinBox->setValue( 60. );
+  layout->addRow( tr( "Vertical angle" ), mAngleSpinBox );
+
+  // 0 stands for an automatic z factor (-1 in the renderer)
+  mZFactorSpinBox = new QDoubleSpinBox( this );
+  mZFactorSpinBox->setRange( 0, 1000000. );
+  mZFactorSpinBox->setDecimals( 4 );
+  mZFactorSpinBox->setSpecialValueText( tr( "Auto" ) );
+  mZFactorSpinBox->setValue( 0 );
+  layout->addRow( tr( "Z factor" ), mZFactorSpinBox );
+
+  connect( mModeComboBox, SIGNAL( currentIndexChanged( int ) ), this, SLOT( modeChanged() ) );
+
+  if ( mRasterLayer && mRasterLayer->dataProvider() )
+  {
+    int nBands = mRasterLayer->dataProvider()->bandCount();
+    for ( int i = 1; i <= nBands; ++i )
+    {
+      mBandComboBox->addItem( displayBandName( i ), i );
+    }
+    setFromRenderer( mRasterLayer->renderer() );
+  }
+  modeChanged();
+}
+
+QgsRasterRenderer* QgsTerrainRendererWidget::renderer()
+{
+  if ( !mRasterLayer )
+  {
+    return 0;
+  }
+  QgsRasterDataProvider* provider = mRasterLayer->dataProvider();
+  if ( !provider )
+  {
+    return 0;
+  }
+
+  // Keep the shader and the clip extent of an existing terrain renderer
+  QgsTerrainRenderer* r = 0;
+  const QgsTerrainRenderer* current = dynamic_cast<const QgsTerrainRenderer*>( mRasterLayer->renderer() );
+  if ( current )
+  {
+    r = static_cast<QgsTerrainRenderer*>( current->clone() );
+    r->setInput( provider );
+  }
+  else
+  {
+    r = new QgsTerrainRenderer( provider, 1 );
+  }
+  r->setBand( mBandComboBox->itemData( mBandComboBox->currentIndex() ).toInt() );
+  r->setMode( static_cast<QgsTerrainRenderer::Mode>( mModeComboBox->itemData( mModeComboBox->currentIndex() ).toInt() ) );
+  r->setLightAzimuth( mAzimuthSpinBox->value() );
+  r->setLightAngle( mAngleSpinBox->value() );
+  r->setZFactor( mZFactorSpinBox->value() > 0 ? mZFactorSpinBox->value() : -1 );
+  return r;
+}
+
+void QgsTerrainRendererWidget::setFromRenderer( const QgsRasterRenderer* r )
+{
+  const QgsTerrainRenderer* terrain = dynamic_cast<const QgsTerrainRenderer*>( r );
+  if ( !terrain )
+  {
+    return;
+  }
+  mBandComboBox->setCurrentIndex( mBandComboBox->findData( terrain->band() ) );
+  mModeComboBox->setCurrentIndex( mModeComboBox->findData( terrain->mode() ) );
+  mAzimuthSpinBox->setValue( terrain->lightAzimuth() );
+  mAngleSpinBox->setValue( terrain->lightAngle() );
+  mZFactorSpinBox->setValue( terrain->zFactor() > 0 ? terrain->zFactor() : 0 );
+}
+
+void QgsTerrainRendererWidget::modeChanged()
+{
+  bool hillshade = mModeComboBox->itemData( mModeComboBox->currentIndex() ).toInt() == QgsTerrainRenderer::Hillshade;
+  mAzimuthSpinBox->setEnabled( hillshade );
+  mAngleSpinBox->setEnabled( hillshade );
+}
@@ -0,0 +1,50 @@
+/***************************************************************************
+                         qgsterrainrendererwidget.h
+                         --------------------------
+    begin                : March 2016
+    copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSTERRAINRENDERERWIDGET_H
+#define QGSTERRAINRENDERERWIDGET_H
+
+#include "qgsrasterrendererwidget.h"
+
+class QComboBox;
+class QDoubleSpinBox;
+
+class GUI_EXPORT QgsTerrainRendererWidget: public QgsRasterRendererWidget
+{
+    Q_OBJECT
+  public:
+    QgsTerrainRendererWidget( QgsRasterLayer* layer, const QgsRectangle &extent = QgsRectangle() );
+
+    static QgsRasterRendererWidget* create( QgsRasterLayer* layer, const QgsRectangle &theExtent ) { return new QgsTerrainRendererWidget( layer, theExtent ); }
+
+    QgsRasterRenderer* renderer() override;
+
+    void setFromRenderer( const QgsRasterRenderer* r );
+
+    int selectedBand( int index = 0 ) override { Q_UNUSED( index ); return mBandComboBox->currentIndex() + 1; }
+
+  private slots:
+    void modeChanged();
+
+  private:
+    QComboBox* mBandComboBox;
+    QComboBox* mModeComboBox;
+    QDoubleSpinBox* mAzimuthSpinBox;
+    QDoubleSpinBox* mAngleSpinBox;
+    QDoubleSpinBox* mZFactorSpinBox;
+};
+
+#endif // QGSTERRAINRENDERERWIDGET_H
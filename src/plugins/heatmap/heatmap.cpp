@@ -41,6 +41,8 @@
 #include <QMessageBox>
 #include <QFileInfo>
 #include <QProgressDialog>
+#include <QThread>
+#include <QtConcurrentMap>
 
 #define NO_DATA -9999
 
@@ -54,6 +56,85 @@
 #define TO8F(x) QFile::encodeName( x ).constData()
 #endif
 
+static const int sMaxBandCells = 1 << 20;
+
+/** Kernel values of the cells around a point, within its bandwidth and at most reach cells away */
+struct HeatmapKernelStamp
+{
+  int buffer;
+  int reach;
+  //! the cells of row offset r have the column offsets -halfWidth[r + reach] to halfWidth[r + reach], or none if negative
+  QVector<int> halfWidth;
+  //! their kernel values start at values[rowStart[r + reach]]
+  QVector<int> rowStart;
+  QVector<double> values;
+};
+
+struct HeatmapPoint
+{
+  int row;
+  int column;
+  double weight;
+  int stamp;
+};
+
+/** Rows of the output raster, with the indices of the points whose kernels reach into them */
+struct HeatmapBand
+{
+  int row;
+  int nRows;
+  int columns;
+  const QVector<HeatmapPoint>* allPoints;
+  const QVector<HeatmapKernelStamp>* stamps;
+  QVector<int> points;
+  QVector<float> data;
+};
+
+static void accumulateHeatmapBand( HeatmapBand& band )
+{
+  band.data.fill( NO_DATA, band.nRows * band.columns );
+  float* data = band.data.data();
+  int lastRow = band.row + band.nRows - 1;
+  foreach ( int index, band.points )
+  {
+    const HeatmapPoint& point = band.allPoints->at( index );
+    const HeatmapKernelStamp& stamp = band.stamps->at( point.stamp );
+    for ( int row = qMax( point.row - stamp.reach, band.row ), rowEnd = qMin( point.row + stamp.reach, lastRow ); row <= rowEnd; ++row )
+    {
+      int dRow = row - point.row;
+      int width = stamp.halfWidth[dRow + stamp.reach];
+      const double* values = stamp.values.constData() + stamp.rowStart[dRow + stamp.reach] + width;
+      float* line = data + ( row - band.row ) * band.columns;
+      for ( int column = qMax( point.column - width, 0 ), columnEnd = qMin( point.column + width, band.columns - 1 ); column <= columnEnd; ++column )
+      {
+        int dColumn = column - point.column;
+        double pixelValue = point.weight * values[dColumn];
+
+        // clearing anamolies along the axes: the center gets four quarters, the axes two halves
+        int count = 1;
+        if ( dRow == 0 && dColumn == 0 )
+        {
+          pixelValue /= 4;
+          count = 4;
+        }
+        else if ( dRow == 0 || dColumn == 0 )
+        {
+          pixelValue /= 2;
+          count = 2;
+        }
+        for ( ; count > 0; --count )
+        {
+          if ( line[column] == NO_DATA )
+          {
+            line[column] = 0;
+          }
+          line[column] += pixelValue;
+        }
+      }
+    }
+  }
+}
+
 static const QString sName = QObject::tr( "Heatmap" );
 static const QString sDescription = QObject::tr( "Creates a Heatmap raster for the input point vector" );
 static const QString sCategory = QObject::tr( "Raster" );
@@ -142,7 +223,6 @@ void Heatmap::run()
   // Getting the rasterdataset in place
   GDALAllRegister();
 
-  GDALDataset *emptyDataset;
   GDALDriver *myDriver;
 
   myDriver = GetGDALDriverManager()->GetDriverByName( d.outputFormat().toUtf8() );
@@ -153,40 +233,19 @@ void Heatmap::run()
   }
 
   double geoTransform[6] = { myBBox.xMinimum(), cellsize, 0, myBBox.yMinimum(), 0, cellsize };
-  emptyDataset = myDriver->Create( d.outputFilename().toUtf8(), columns, rows, 1, GDT_Float32, NULL );
-  emptyDataset->SetGeoTransform( geoTransform );
-  // Set the projection on the raster destination to match the input layer
-  emptyDataset->SetProjection( inputLayer->crs().toWkt().toLocal8Bit().data() );
-
-  GDALRasterBand *poBand;
-  poBand = emptyDataset->GetRasterBand( 1 );
-  poBand->SetNoDataValue( NO_DATA );
-
-  float* line = ( float * ) CPLMalloc( sizeof( float ) * columns );
-  for ( int i = 0; i < columns ; i++ )
-  {
-    line[i] = NO_DATA;
-  }
-  // Write the empty raster
-  for ( int i = 0; i < rows ; i++ )
-  {
-    CPLErr err = poBand->RasterIO( GF_Write, 0, i, columns, 1, line, columns, 1, GDT_Float32, int( 0 ), int( 0 ) );
-    Q_UNUSED( err );
-  }
-
-  CPLFree( line );
-  //close the dataset
-  GDALClose(( GDALDatasetH ) emptyDataset );
-
-  // open the raster in GA_Update mode
-  GDALDataset *heatmapDS;
-  heatmapDS = ( GDALDataset * ) GDALOpen( TO8F( d.outputFilename() ), GA_Update );
+  GDALDataset *heatmapDS = myDriver->Create( d.outputFilename().toUtf8(), columns, rows, 1, GDT_Float32, NULL );
   if ( !heatmapDS )
   {
-    mQGisIface->messageBar()->pushMessage( tr( "Raster update error" ), tr( "Could not open the created raster for updating. The heatmap was not generated." ), QgsMessageBar::WARNING );
+    mQGisIface->messageBar()->pushMessage( tr( "Raster creation error" ), tr( "Could not create the output raster. The heatmap was not generated." ), QgsMessageBar::WARNING );
     return;
   }
+  heatmapDS->SetGeoTransform( geoTransform );
+  // Set the projection on the raster destination to match the input layer
+  heatmapDS->SetProjection( inputLayer->crs().toWkt().toLocal8Bit().data() );
+
+  GDALRasterBand *poBand;
   poBand = heatmapDS->GetRasterBand( 1 );
+  poBand->SetNoDataValue( NO_DATA );
 
   QgsAttributeList myAttrList;
   int rField = 0;
@@ -220,27 +279,39 @@ void Heatmap::run()
     myAttrList.append( wField );
   }
 
+  // The raster is computed in bands of rows, which are accumulated in parallel and written once
+  int threadCount = qMax( QThread::idealThreadCount(), 1 );
+  int bandRows = qBound( 1, sMaxBandCells / columns, ( rows + threadCount - 1 ) / threadCount );
+  int bandCount = ( rows + bandRows - 1 ) / bandRows;
+
   // This might have attributes or mightnot have attibutes at all
   // based on the variableRadius() and weighted()
   QgsFeatureIterator fit = inputLayer->getFeatures( QgsFeatureRequest().setSubsetOfAttributes( myAttrList ) );
   int totalFeatures = inputLayer->featureCount();
   int counter = 0;
 
-  QProgressDialog p( tr( "Creating heatmap" ), tr( "Abort" ), 0, totalFeatures, mQGisIface->mainWindow() );
+  QProgressDialog p( tr( "Creating heatmap" ), tr( "Abort" ), 0, totalFeatures + bandCount, mQGisIface->mainWindow() );
   p.setWindowModality( Qt::ApplicationModal );
   p.show();
 
   QgsFeature myFeature;
+  QVector<HeatmapPoint> points;
+  QVector<HeatmapKernelStamp> stamps;
+  QHash<int, int> stampIndex;
+  bool canceled = false;
 
   while ( fit.nextFeature( myFeature ) )
   {
     counter++;
-    p.setValue( counter );
-    QApplication::processEvents();
-    if ( p.wasCanceled() )
+    if ( counter % 1000 == 0 )
     {
-      mQGisIface->messageBar()->pushMessage( tr( "Heatmap generation aborted" ), tr( "QGIS will now load the partially-computed raster" ), QgsMessageBar::INFO, mQGisIface->messageTimeout() );
-      break;
+      p.setValue( counter );
+      QApplication::processEvents();
+      if ( p.wasCanceled() )
+      {
+        canceled = true;
+        break;
+      }
     }
 
     QgsGeometry* featureGeometry = myFeature.geometry();
@@ -273,8 +344,10 @@ void Heatmap::run()
       radius = myFeature.attribute( rField ).toDouble() * radiusToMapUnits;
       myBuffer = bufferSize( radius, cellsize );
     }
-
-    int blockSize = 2 * myBuffer + 1; //Block SIDE would be more appropriate
+    if ( myBuffer < 0 )
+    {
+      continue;
+    }
 
     double weight = 1.0;
     if ( d.weighted() )
@@ -282,6 +355,14 @@ void Heatmap::run()
       weight = myFeature.attribute( wField ).toDouble();
     }
 
+    QHash<int, int>::const_iterator stampIt = stampIndex.constFind( myBuffer );
+    if ( stampIt == stampIndex.constEnd() )
+    {
+      stamps.append( HeatmapKernelStamp() );
+      createKernelStamp( stamps.last(), myBuffer, qMax( rows, columns ), kernelShape, valueType );
+      stampIt = stampIndex.insert( myBuffer, stamps.size() - 1 );
+    }
+
     //loop through all points in multipoint
     for ( QgsMultiPoint::const_iterator pointIt = multiPoints.constBegin(); pointIt != multiPoints.constEnd(); ++pointIt )
     {
@@ -293,62 +374,69 @@ void Heatmap::run()
       }
 
       // calculate the pixel position
-      unsigned int xPosition, yPosition;
-      xPosition = ((( *pointIt ).x() - myBBox.xMinimum() ) / cellsize ) - myBuffer;
-      yPosition = ((( *pointIt ).y() - myBBox.yMinimum() ) / cellsize ) - myBuffer;
-
-      // get the data
-      float *dataBuffer = ( float * ) CPLMalloc( sizeof( float ) * blockSize * blockSize );
-      CPLErr err = poBand->RasterIO( GF_Read, xPosition, yPosition, blockSize, blockSize,
-                                     dataBuffer, blockSize, blockSize, GDT_Float32, int( 0 ), int( 0 ) );
-      Q_UNUSED( err );
-
-      for ( int xp = 0; xp <= myBuffer; xp++ )
-      {
-        for ( int yp = 0; yp <= myBuffer; yp++ )
-        {
-          double distance = sqrt( pow( xp, 2.0 ) + pow( yp, 2.0 ) );
-
-          // is pixel outside search bandwidth of feature?
-          if ( distance > myBuffer )
-          {
-            continue;
-          }
+      HeatmapPoint point;
+      point.column = ( int ) floor((( *pointIt ).x() - myBBox.xMinimum() ) / cellsize - myBuffer ) + myBuffer;
+      point.row = ( int ) floor((( *pointIt ).y() - myBBox.yMinimum() ) / cellsize - myBuffer ) + myBuffer;
+      point.weight = weight;
+      point.stamp = stampIt.value();
+      points.append( point );
+    }
+  }
 
-          double pixelValue = weight * calculateKernelValue( distance, myBuffer, kernelShape, valueType );
+  // Assign the points to the bands their kernels reach into
+  QVector<HeatmapBand> bands( bandCount );
+  for ( int i = 0; i < bandCount; ++i )
+  {
+    bands[i].row = i * bandRows;
+    bands[i].nRows = qMin( bandRows, rows - bands[i].row );
+    bands[i].columns = columns;
+    bands[i].allPoints = &points;
+    bands[i].stamps = &stamps;
+  }
+  for ( int i = 0, n = points.size(); i < n; ++i )
+  {
+    const HeatmapPoint& point = points[i];
+    int reach = stamps[point.stamp].reach;
+    int firstBand = qMax( point.row - reach, 0 ) / bandRows;
+    int lastBand = qMin( point.row + reach, rows - 1 ) / bandRows;
+    for ( int band = firstBand; band <= lastBand; ++band )
+    {
+      bands[band].points.append( i );
+    }
+  }
 
-          // clearing anamolies along the axes
-          if ( xp == 0 && yp == 0 )
-          {
-            pixelValue /= 4;
-          }
-          else if ( xp == 0 || yp == 0 )
-          {
-            pixelValue /= 2;
-          }
+  for ( int first = 0; first < bandCount; first += threadCount )
+  {
+    p.setValue( totalFeatures + first );
+    QApplication::processEvents();
+    if ( p.wasCanceled() )
+    {
+      canceled = true;
+    }
 
-          int pos[4];
-          pos[0] = ( myBuffer + xp ) * blockSize + ( myBuffer + yp );
-          pos[1] = ( myBuffer + xp ) * blockSize + ( myBuffer - yp );
-          pos[2] = ( myBuffer - xp ) * blockSize + ( myBuffer + yp );
-          pos[3] = ( myBuffer - xp ) * blockSize + ( myBuffer - yp );
-          for ( int p = 0; p < 4; p++ )
-          {
-            if ( dataBuffer[ pos[p] ] == NO_DATA )
-            {
-              dataBuffer[ pos[p] ] = 0;
-            }
-            dataBuffer[ pos[p] ] += pixelValue;
-          }
-        }
+    QVector<HeatmapBand> batch = bands.mid( first, threadCount );
+    if ( canceled )
+    {
+      // the remaining bands are written without data
+      for ( int i = 0; i < batch.size(); ++i )
+      {
+        batch[i].points.clear();
       }
-      err = poBand->RasterIO( GF_Write, xPosition, yPosition, blockSize, blockSize,
-                              dataBuffer, blockSize, blockSize, GDT_Float32, int( 0 ), int( 0 ) );
+    }
+    QtConcurrent::blockingMap( batch, accumulateHeatmapBand );
+
+    foreach ( const HeatmapBand& band, batch )
+    {
+      CPLErr err = poBand->RasterIO( GF_Write, 0, band.row, columns, band.nRows, ( void* ) band.data.constData(), columns, band.nRows, GDT_Float32, 0, 0 );
       Q_UNUSED( err );
-      CPLFree( dataBuffer );
     }
   }
 
+  if ( canceled )
+  {
+    mQGisIface->messageBar()->pushMessage( tr( "Heatmap generation aborted" ), tr( "QGIS will now load the partially-computed raster" ), QgsMessageBar::INFO, mQGisIface->messageTimeout() );
+  }
+
   // Finally close the dataset
   GDALClose(( GDALDatasetH ) heatmapDS );
 
@@ -391,6 +479,31 @@ int Heatmap::bufferSize( double radius, double cellsize )
   return buffer;
 }
 
+void Heatmap::createKernelStamp( HeatmapKernelStamp& stamp, int buffer, int maxReach, const KernelShape shape, const OutputValues outputType )
+{
+  stamp.buffer = buffer;
+  stamp.reach = qMin( buffer, maxReach );
+  stamp.halfWidth.resize( 2 * stamp.reach + 1 );
+  stamp.rowStart.resize( 2 * stamp.reach + 1 );
+  stamp.values.clear();
+  for ( int dRow = -stamp.reach; dRow <= stamp.reach; ++dRow )
+  {
+    int xp = qAbs( dRow );
+    int width = -1;
+    while ( width < stamp.reach && sqrt( pow( xp, 2.0 ) + pow( width + 1, 2.0 ) ) <= buffer )
+    {
+      ++width;
+    }
+    stamp.halfWidth[dRow + stamp.reach] = width;
+    stamp.rowStart[dRow + stamp.reach] = stamp.values.size();
+    for ( int dColumn = -width; dColumn <= width; ++dColumn )
+    {
+      double distance = sqrt( pow( xp, 2.0 ) + pow( qAbs( dColumn ), 2.0 ) );
+      stamp.values.append( calculateKernelValue( distance, buffer, shape, outputType ) );
+    }
+  }
+}
+
 double Heatmap::calculateKernelValue( const double distance, const int bandwidth, const KernelShape shape, const OutputValues outputType )
 {
   switch ( shape )
@@ -48,6 +48,7 @@ class QAction;
 class QToolBar;
 
 class QgisInterface;
+struct HeatmapKernelStamp;
 
 /**
 * \class Plugin
@@ -106,6 +107,8 @@ class Heatmap: public QObject, public QgisPlugin
     double mapUnitsOf( double meters, QgsCoordinateReferenceSystem layerCrs );
     //! Worker to calculate buffer size in pixels
     int bufferSize( double radius, double cellsize );
+    //! Precompute the kernel values of the cells within buffer pixels around a point, but at most maxReach pixels away
+    void createKernelStamp( HeatmapKernelStamp& stamp, int buffer, int maxReach, const KernelShape shape, const OutputValues outputType );
     //! Calculate the value given to a point width a given distance for a specified kernel shape
     double calculateKernelValue( const double distance, const int bandwidth, const KernelShape shape, const OutputValues outputType );
     //! Uniform kernel function
@@ -29,5 +29,7 @@ QgsInterpolator* QgsIDWInterpolatorDialog::createInterpolator() const
 {
   QgsIDWInterpolator* theInterpolator = new QgsIDWInterpolator( mInputData );
   theInterpolator->setDistanceCoefficient( mPSpinBox->value() );
+  theInterpolator->setMaxNeighbours( mMaxNeighboursSpinBox->value() );
+  theInterpolator->setSearchRadius( mSearchRadiusSpinBox->value() );
   return theInterpolator;
 }
@@ -122,11 +122,11 @@ void QgsInterpolationDialog::on_buttonBox_accepted()
     return;
   }
 
-  //add .asc suffix if the user did not provider it already
+  //add .tif suffix if the user did not provider it already. Files with .asc suffix are written as ascii grid
   QString suffix = theFileInfo.suffix();
   if ( suffix.isEmpty() )
   {
-    fileName.append( ".asc" );
+    fileName.append( ".tif" );
   }
 
   int nLayers = mLayersTreeWidget->topLevelItemCount();
@@ -324,10 +324,7 @@ void QgsInterpolationDialog::on_mOutputFileButton_clicked()
 
 void QgsInterpolationDialog::on_mOutputFileLineEdit_textChanged()
 {
-  if ( mOutputFileLineEdit->text().endsWith( ".asc" ) )
-  {
-    enableOrDisableOkButton();
-  }
+  enableOrDisableOkButton();
 }
 
 void QgsInterpolationDialog::on_mConfigureInterpolationButton_clicked()
@@ -15,6 +15,9 @@
  * \brief implemetation UI for find shotest path
  */
 
+// C++ standard includes
+#include <limits>
+
 //qt includes
 #include <qcombobox.h>
 #include <qlayout.h>
@@ -43,7 +46,7 @@
 #include <qgsgraphdirector.h>
 #include <qgsgraphbuilder.h>
 #include <qgsgraph.h>
-#include <qgsgraphanalyzer.h>
+#include <qgsgraphrouter.h>
 
 // roadgraph plugin includes
 #include "roadgraphplugin.h"
@@ -311,17 +314,28 @@ QgsGraph* RgShortestPathWidget::getPath( QgsPoint& p1, QgsPoint& p2 )
     return NULL;
   }
 
-
-  QgsGraph* shortestpathTree = QgsGraphAnalyzer::shortestTree( graph, startVertexIdx, criterionNum );
-  delete graph;
-
-  if ( shortestpathTree->findVertex( p2 ) == -1 )
+  int stopVertexIdx = graph->findVertex( p2 );
+  QVector<int> arcs;
+  QgsGraphRouter router( graph, criterionNum );
+  if ( stopVertexIdx < 0 || router.shortestPath( startVertexIdx, stopVertexIdx, &arcs ) == std::numeric_limits<double>::infinity() )
   {
-    delete shortestpathTree;
+    delete graph;
     QMessageBox::critical( this, tr( "Path not found" ), tr( "Path not found" ) );
     return NULL;
   }
-  return shortestpathTree;
+
+  // return only the arcs of the path, the callers walk it back from the stop vertex
+  QgsGraph *path = new QgsGraph();
+  QVector<int> graph2path( graph->vertexCount(), -1 );
+  graph2path[ startVertexIdx ] = path->addVertex( graph->vertex( startVertexIdx ).point() );
+  foreach ( int arcIdx, arcs )
+  {
+    const QgsGraphArc& arc = graph->arc( arcIdx );
+    graph2path[ arc.inVertex()] = path->addVertex( graph->vertex( arc.inVertex() ).point() );
+    path->addArc( graph2path[ arc.outVertex()], graph2path[ arc.inVertex()], arc.properties() );
+  }
+  delete graph;
+  return path;
 }
 
 void RgShortestPathWidget::findingPath()
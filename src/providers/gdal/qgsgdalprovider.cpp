@@ -1180,6 +1180,14 @@ double QgsGdalProvider::bandOffset( int bandNo ) const
 #endif
 }
 
+QString QgsGdalProvider::bandUnit( int bandNo ) const
+{
+  GDALRasterBandH myGdalBand = mGdalDataset ? GDALGetRasterBand( mGdalDataset, bandNo ) : 0;
+  if ( !myGdalBand )
+    return QString();
+  return QString::fromUtf8( GDALGetRasterUnitType( myGdalBand ) );
+}
+
 int QgsGdalProvider::bandCount() const
 {
   if ( mGdalDataset )
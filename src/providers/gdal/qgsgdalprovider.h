@@ -182,6 +182,8 @@ class QgsGdalProvider : public QgsRasterDataProvider, QgsGdalProviderBase
     /** Read band offset for raster value
      * @@note added in 2.3 */
     double bandOffset( int bandNo ) const override;
+    /** Read the unit type of the band */
+    QString bandUnit( int bandNo ) const override;
 
     QList<QgsColorRampShader::ColorRampItem> colorTable( int bandNo )const override;
 
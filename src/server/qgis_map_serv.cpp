@@ -39,6 +39,7 @@
 #include "qgsserverlogger.h"
 #include "qgseditorwidgetregistry.h"
 #include "qgsmslayercache.h"
+#include "qgswmstilecache.h"
 
 #ifdef HAVE_SERVER_PYTHON_PLUGINS
 #include "qgsserverplugins.h"
@@ -396,6 +397,8 @@ int main( int argc, char * argv[] )
   //init layer cache here (the environment variable MAX_CACHE_LAYERS is not accessible anymore in the fcgi-loop)
   QgsMSLayerCache* cache = QgsMSLayerCache::instance();
   Q_UNUSED( cache );
+  QgsWMSTileCache* tileCache = QgsWMSTileCache::instance();
+  Q_UNUSED( tileCache );
 
 #ifdef HAVE_SERVER_PYTHON_PLUGINS
   // Create the interface
@@ -0,0 +1,296 @@
+/***************************************************************************
+                              qgspalettequantizer.cpp
+                              -----------------------
+  begin                : March 2016
+  copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgspalettequantizer.h"
+#include <QHash>
+#include <QtAlgorithms>
+#include <climits>
+
+//number of histogram bins (5 bits red, green, blue and 3 bits alpha)
+static const int sHistogramSize = 1 << 18;
+
+//above this number of occupied bins, bins are mapped to the color of their box instead of the nearest palette color
+static const int sMaxNearestColorBins = 16384;
+
+QImage QgsPaletteQuantizer::quantize( const QImage& image, int nColors )
+{
+  if ( image.isNull() )
+  {
+    return QImage();
+  }
+  nColors = qBound( 1, nColors, 256 );
+
+  QImage inputImage = image;
+  if ( inputImage.format() != QImage::Format_ARGB32 && inputImage.format() != QImage::Format_RGB32 )
+  {
+    inputImage = inputImage.convertToFormat( QImage::Format_ARGB32 );
+  }
+  int width = inputImage.width();
+  int height = inputImage.height();
+
+  //histogram: binSlots[binIndex( color )] is the position of the bin in bins or -1
+  QVector<int> binSlots( sHistogramSize, -1 );
+  int* binSlotData = binSlots.data();
+  QVector<Bin> bins;
+  //palette indices of the image colors, as long as there are not more than nColors
+  QHash<QRgb, int> exactColors;
+  bool exact = true;
+
+  QRgb previousColor = 0;
+  Bin* bin = 0;
+  for ( int i = 0; i < height; ++i )
+  {
+    const QRgb* currentScanLine = ( const QRgb* )( inputImage.constScanLine( i ) );
+    for ( int j = 0; j < width; ++j )
+    {
+      QRgb color = currentScanLine[j];
+      if ( !bin || color != previousColor )
+      {
+        int& slot = binSlotData[binIndex( color )];
+        if ( slot < 0 )
+        {
+          Bin newBin = { 0, color, 0, 0, 0, 0, 0, 0 };
+          slot = bins.size();
+          bins.append( newBin );
+        }
+        bin = bins.data() + slot;
+        if ( exact && !exactColors.contains( color ) )
+        {
+          if ( exactColors.size() < nColors )
+          {
+            exactColors.insert( color, exactColors.size() );
+          }
+          else
+          {
+            exact = false;
+            exactColors.clear();
+          }
+        }
+        previousColor = color;
+      }
+      ++bin->pixels;
+      bin->red += qRed( color );
+      bin->green += qGreen( color );
+      bin->blue += qBlue( color );
+      bin->alpha += qAlpha( color );
+    }
+  }
+
+  QVector<QRgb> colorTable;
+  if ( exact ) //all the colors in the image can be mapped to one palette color
+  {
+    colorTable.resize( exactColors.size() );
+    QHash<QRgb, int>::const_iterator colorIt = exactColors.constBegin();
+    for ( ; colorIt != exactColors.constEnd(); ++colorIt )
+    {
+      colorTable[colorIt.value()] = colorIt.key();
+    }
+  }
+  else
+  {
+    //create first box
+    Box firstBox = { 0, bins.size(), 0 };
+    for ( int i = 0; i < bins.size(); ++i )
+    {
+      Bin& currentBin = bins[i];
+      currentBin.average = qRgba( int( currentBin.red / currentBin.pixels ), int( currentBin.green / currentBin.pixels ),
+                                  int( currentBin.blue / currentBin.pixels ), int( currentBin.alpha / currentBin.pixels ) );
+      firstBox.pixels += currentBin.pixels;
+    }
+
+    QVector<Box> boxes;
+    boxes.reserve( nColors );
+    boxes.append( firstBox );
+
+    //split the box with the most pixels until number of boxes == nColors or all the boxes have one bin
+    while ( boxes.size() < nColors )
+    {
+      int splitIndex = -1;
+      quint64 maxPixels = 0;
+      for ( int i = 0; i < boxes.size(); ++i )
+      {
+        if ( boxes[i].end - boxes[i].begin > 1 && boxes[i].pixels > maxPixels )
+        {
+          splitIndex = i;
+          maxPixels = boxes[i].pixels;
+        }
+      }
+      if ( splitIndex < 0 )
+      {
+        break;
+      }
+      splitBox( bins, boxes, splitIndex );
+    }
+
+    //get representative colors for the boxes and the palette indices of the bins
+    bool searchNearest = bins.size() <= sMaxNearestColorBins;
+    colorTable.resize( boxes.size() );
+    for ( int i = 0; i < boxes.size(); ++i )
+    {
+      colorTable[i] = boxColor( bins, boxes[i] );
+    }
+    for ( int i = 0; i < boxes.size(); ++i )
+    {
+      for ( int j = boxes[i].begin; j < boxes[i].end; ++j )
+      {
+        bins[j].paletteIndex = searchNearest ? nearestColor( colorTable, bins[j].average ) : i;
+        //the bins have been sorted by splitBox
+        binSlotData[binIndex( bins[j].color )] = j;
+      }
+    }
+  }
+
+  QImage palettedImage( width, height, QImage::Format_Indexed8 );
+  palettedImage.setColorTable( colorTable );
+  palettedImage.setDotsPerMeterX( image.dotsPerMeterX() );
+  palettedImage.setDotsPerMeterY( image.dotsPerMeterY() );
+
+  const Bin* binData = bins.constData();
+  int paletteIndex = -1;
+  for ( int i = 0; i < height; ++i )
+  {
+    const QRgb* currentScanLine = ( const QRgb* )( inputImage.constScanLine( i ) );
+    uchar* palettedScanLine = palettedImage.scanLine( i );
+    for ( int j = 0; j < width; ++j )
+    {
+      QRgb color = currentScanLine[j];
+      if ( paletteIndex < 0 || color != previousColor )
+      {
+        paletteIndex = exact ? exactColors.value( color ) : binData[binSlotData[binIndex( color )]].paletteIndex;
+        previousColor = color;
+      }
+      palettedScanLine[j] = paletteIndex;
+    }
+  }
+  return palettedImage;
+}
+
+void QgsPaletteQuantizer::splitBox( QVector<Bin>& bins, QVector<Box>& boxes, int boxIndex )
+{
+  Box box = boxes[boxIndex];
+
+  //a,r,g,b ranges
+  int rMin = 255; int gMin = 255; int bMin = 255; int aMin = 255;
+  int rMax = 0; int gMax = 0; int bMax = 0; int aMax = 0;
+  for ( int i = box.begin; i < box.end; ++i )
+  {
+    QRgb color = bins[i].average;
+    rMin = qMin( rMin, qRed( color ) );
+    rMax = qMax( rMax, qRed( color ) );
+    gMin = qMin( gMin, qGreen( color ) );
+    gMax = qMax( gMax, qGreen( color ) );
+    bMin = qMin( bMin, qBlue( color ) );
+    bMax = qMax( bMax, qBlue( color ) );
+    aMin = qMin( aMin, qAlpha( color ) );
+    aMax = qMax( aMax, qAlpha( color ) );
+  }
+  int redRange = rMax - rMin;
+  int greenRange = gMax - gMin;
+  int blueRange = bMax - bMin;
+  int alphaRange = aMax - aMin;
+
+  //sort color box for a/r/g/b
+  Bin* begin = bins.data() + box.begin;
+  Bin* end = bins.data() + box.end;
+  if ( redRange >= greenRange && redRange >= blueRange && redRange >= alphaRange )
+  {
+    qSort( begin, end, redCompare );
+  }
+  else if ( greenRange >= blueRange && greenRange >= alphaRange )
+  {
+    qSort( begin, end, greenCompare );
+  }
+  else if ( blueRange >= alphaRange )
+  {
+    qSort( begin, end, blueCompare );
+  }
+  else
+  {
+    qSort( begin, end, alphaCompare );
+  }
+
+  //get median, both halves keep at least one bin
+  quint64 halfSum = box.pixels / 2;
+  quint64 currentSum = bins[box.begin].pixels;
+  int split = box.begin + 1;
+  while ( split < box.end - 1 && currentSum < halfSum )
+  {
+    currentSum += bins[split].pixels;
+    ++split;
+  }
+
+  Box newBox1 = { box.begin, split, currentSum };
+  Box newBox2 = { split, box.end, box.pixels - currentSum };
+  boxes[boxIndex] = newBox1;
+  boxes.append( newBox2 );
+}
+
+QRgb QgsPaletteQuantizer::boxColor( const QVector<Bin>& bins, const Box& box )
+{
+  quint64 red = 0;
+  quint64 green = 0;
+  quint64 blue = 0;
+  quint64 alpha = 0;
+  for ( int i = box.begin; i < box.end; ++i )
+  {
+    red += bins[i].red;
+    green += bins[i].green;
+    blue += bins[i].blue;
+    alpha += bins[i].alpha;
+  }
+  return qRgba( int( red / box.pixels ), int( green / box.pixels ), int( blue / box.pixels ), int( alpha / box.pixels ) );
+}
+
+int QgsPaletteQuantizer::nearestColor( const QVector<QRgb>& colorTable, QRgb color )
+{
+  int nearest = 0;
+  int minDistance = INT_MAX;
+  for ( int i = 0; i < colorTable.size(); ++i )
+  {
+    QRgb paletteColor = colorTable[i];
+    int dr = qRed( paletteColor ) - qRed( color );
+    int dg = qGreen( paletteColor ) - qGreen( color );
+    int db = qBlue( paletteColor ) - qBlue( color );
+    int da = qAlpha( paletteColor ) - qAlpha( color );
+    int distance = dr * dr + dg * dg + db * db + da * da;
+    if ( distance < minDistance )
+    {
+      nearest = i;
+      minDistance = distance;
+    }
+  }
+  return nearest;
+}
+
+bool QgsPaletteQuantizer::redCompare( const Bin& b1, const Bin& b2 )
+{
+  return qRed( b1.average ) < qRed( b2.average );
+}
+
+bool QgsPaletteQuantizer::greenCompare( const Bin& b1, const Bin& b2 )
+{
+  return qGreen( b1.average ) < qGreen( b2.average );
+}
+
+bool QgsPaletteQuantizer::blueCompare( const Bin& b1, const Bin& b2 )
+{
+  return qBlue( b1.average ) < qBlue( b2.average );
+}
+
+bool QgsPaletteQuantizer::alphaCompare( const Bin& b1, const Bin& b2 )
+{
+  return qAlpha( b1.average ) < qAlpha( b2.average );
+}
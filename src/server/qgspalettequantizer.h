@@ -0,0 +1,74 @@
+/***************************************************************************
+                              qgspalettequantizer.h
+                              ---------------------
+  begin                : March 2016
+  copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSPALETTEQUANTIZER_H
+#define QGSPALETTEQUANTIZER_H
+
+#include <QImage>
+#include <QVector>
+
+/**Converts images to 8-bit palette images for the PNG8 output of the server.
+The colors are counted in a fixed size histogram (5 bits per color channel, 3 bits alpha) instead of a hash of all the
+pixel colors, the palette is found by median cut on the histogram bins and each bin is mapped to its nearest palette color.
+Images with at most nColors colors are converted without loss*/
+class QgsPaletteQuantizer
+{
+  public:
+    /**Returns an image in QImage::Format_Indexed8 format with at most nColors (<= 256) palette colors*/
+    static QImage quantize( const QImage& image, int nColors = 256 );
+
+  private:
+    /**Occupied bin of the histogram*/
+    struct Bin
+    {
+      quint32 pixels;
+      //first color found in the bin
+      QRgb color;
+      //color sums of the pixels in the bin
+      quint64 red;
+      quint64 green;
+      quint64 blue;
+      quint64 alpha;
+      //average color of the pixels in the bin
+      QRgb average;
+      //palette index after the quantization
+      int paletteIndex;
+    };
+
+    /**Range of bins which is represented by one palette color*/
+    struct Box
+    {
+      int begin;
+      int end;
+      quint64 pixels;
+    };
+
+    static inline int binIndex( QRgb color )
+    {
+      return (( qAlpha( color ) >> 5 ) << 15 ) | (( qRed( color ) >> 3 ) << 10 ) | (( qGreen( color ) >> 3 ) << 5 ) | ( qBlue( color ) >> 3 );
+    }
+
+    static void splitBox( QVector<Bin>& bins, QVector<Box>& boxes, int boxIndex );
+    /**Calculates a representative color for a box (pixel weighted average)*/
+    static QRgb boxColor( const QVector<Bin>& bins, const Box& box );
+    static int nearestColor( const QVector<QRgb>& colorTable, QRgb color );
+    static bool redCompare( const Bin& b1, const Bin& b2 );
+    static bool greenCompare( const Bin& b1, const Bin& b2 );
+    static bool blueCompare( const Bin& b1, const Bin& b2 );
+    static bool alphaCompare( const Bin& b1, const Bin& b2 );
+};
+
+#endif // QGSPALETTEQUANTIZER_H
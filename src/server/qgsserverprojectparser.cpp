@@ -63,6 +63,7 @@ QgsServerProjectParser::QgsServerProjectParser( QDomDocument* xmlDoc, const QStr
 
     mRestrictedLayers = findRestrictedLayers();
     mUseLayerIDs = findUseLayerIDs();
+    mPublishedComposerElements = findPublishedComposerElements();
 
     mCustomLayerOrder.clear();
 
@@ -1219,7 +1220,7 @@ QDomElement QgsServerProjectParser::firstComposerLegendElement() const
   return compositionElem.firstChildElement( "ComposerLegend" );
 }
 
-QList<QDomElement> QgsServerProjectParser::publishedComposerElements() const
+QList<QDomElement> QgsServerProjectParser::findPublishedComposerElements() const
 {
   QList<QDomElement> composerElemList;
   if ( !mXMLDoc )
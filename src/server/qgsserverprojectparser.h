@@ -93,7 +93,7 @@ class QgsServerProjectParser
 
     QDomElement firstComposerLegendElement() const;
 
-    QList<QDomElement> publishedComposerElements() const;
+    QList<QDomElement> publishedComposerElements() const { return mPublishedComposerElements; }
 
     QList< QPair< QString, QgsLayerCoordinateTransform > > layerCoordinateTransforms() const;
 
@@ -163,6 +163,10 @@ class QgsServerProjectParser
     /**Returns a complete string set with all the restricted layer names (layers/groups that are not to be published)*/
     QSet<QString> findRestrictedLayers() const;
 
+    /**Composer elements which are published (not restricted), searched once instead of for every GetPrint request*/
+    QList<QDomElement> mPublishedComposerElements;
+    QList<QDomElement> findPublishedComposerElements() const;
+
     QStringList mCustomLayerOrder;
 
     bool findUseLayerIDs() const;
@@ -38,6 +38,7 @@
 #include "qgscomposerlegenditem.h"
 #include "qgsrequesthandler.h"
 #include "qgsogcutils.h"
+#include "qgswkbptr.h"
 
 #include <QImage>
 #include <QPainter>
@@ -65,6 +66,28 @@ static const QString GML_NAMESPACE = "http://www.opengis.net/gml";
 static const QString OGC_NAMESPACE = "http://www.opengis.net/ogc";
 static const QString QGS_NAMESPACE = "http://www.qgis.org/gml";
 
+//size of the chunks of GetFeature responses passed to the request handler
+static const int sFeatureBufferSize = 65536;
+
+//appends the number like qgsDoubleToString, without the QString and QRegExp overhead
+static void _appendDouble( QByteArray& out, double value, int prec )
+{
+  QByteArray number = QByteArray::number( value, 'f', prec );
+  int length = number.size();
+  if ( prec > 0 )
+  {
+    while ( length > 0 && number.at( length - 1 ) == '0' )
+    {
+      --length;
+    }
+    if ( length > 0 && number.at( length - 1 ) == '.' )
+    {
+      --length;
+    }
+  }
+  out.append( number.constData(), length );
+}
+
 QgsWFSServer::QgsWFSServer( const QString& configFilePath, QMap<QString, QString> &parameters, QgsWFSProjectParser* cp,
                             QgsRequestHandler* rh )
     : QgsOWSServer( configFilePath, parameters, rh )
@@ -1185,36 +1208,17 @@ void QgsWFSServer::startGetFeature( QgsRequestHandler& request, const QString& f
     result = fcString.toUtf8();
     request.startGetFeatureResponse( &result, format );
 
-    QDomDocument doc;
-    QDomElement bbElem = doc.createElement( "gml:boundedBy" );
+    QString srsName = crs.isValid() ? crs.authid() : QString();
+    mFeatureBuffer.append( "<gml:boundedBy>\n" );
     if ( format == "GML3" )
     {
-      QDomElement envElem = QgsOgcUtils::rectangleToGMLEnvelope( rect, doc, prec );
-      if ( !envElem.isNull() )
-      {
-        if ( crs.isValid() )
-        {
-          envElem.setAttribute( "srsName", crs.authid() );
-        }
-        bbElem.appendChild( envElem );
-        doc.appendChild( bbElem );
-      }
+      QgsOgcUtils::appendRectangleToGMLEnvelope( mFeatureBuffer, *rect, prec, srsName, 1 );
     }
     else
     {
-      QDomElement boxElem = QgsOgcUtils::rectangleToGMLBox( rect, doc, prec );
-      if ( !boxElem.isNull() )
-      {
-        if ( crs.isValid() )
-        {
-          boxElem.setAttribute( "srsName", crs.authid() );
-        }
-        bbElem.appendChild( boxElem );
-        doc.appendChild( bbElem );
-      }
+      QgsOgcUtils::appendRectangleToGMLBox( mFeatureBuffer, *rect, prec, srsName, 1 );
     }
-    result = doc.toByteArray();
-    request.setGetFeatureResponse( &result );
+    mFeatureBuffer.append( "</gml:boundedBy>\n" );
   }
   fcString = "";
 }
@@ -1224,62 +1228,38 @@ void QgsWFSServer::setGetFeature( QgsRequestHandler& request, const QString& for
   if ( !feat->isValid() )
     return;
 
-  QByteArray result;
   if ( format == "GeoJSON" )
   {
-    QString fcString;
-    if ( featIdx == 0 )
-      fcString += "  ";
-    else
-      fcString += " ,";
-    fcString += createFeatureGeoJSON( feat, prec, crs, attrIndexes, excludedAttributes );
-    fcString += "\n";
-
-    result = fcString.toUtf8();
-    request.setGetFeatureResponse( &result );
-    fcString = "";
+    mFeatureBuffer.append( featIdx == 0 ? "  " : " ," );
+    writeFeatureGeoJSON( mFeatureBuffer, feat, prec, attrIndexes, excludedAttributes );
+    mFeatureBuffer.append( '\n' );
   }
   else
   {
-    QDomDocument gmlDoc;
-    QDomElement featureElement;
-    if ( format == "GML3" )
-    {
-      featureElement = createFeatureGML3( feat, gmlDoc, prec, crs, attrIndexes, excludedAttributes );
-      gmlDoc.appendChild( featureElement );
-    }
-    else
-    {
-      featureElement = createFeatureGML2( feat, gmlDoc, prec, crs, attrIndexes, excludedAttributes );
-      gmlDoc.appendChild( featureElement );
-    }
+    writeFeatureGML( mFeatureBuffer, feat, format == "GML3", prec, crs, attrIndexes, excludedAttributes );
+  }
 
-    result = gmlDoc.toByteArray();
-    request.setGetFeatureResponse( &result );
-    gmlDoc.removeChild( featureElement );
+  //pass the features to the request handler in chunks instead of one by one
+  if ( mFeatureBuffer.size() >= sFeatureBufferSize )
+  {
+    request.setGetFeatureResponse( &mFeatureBuffer );
+    mFeatureBuffer.resize( 0 );
   }
 }
 
 void QgsWFSServer::endGetFeature( QgsRequestHandler& request, const QString& format )
 {
-  QByteArray result;
-  QString fcString;
   if ( format == "GeoJSON" )
   {
-    fcString += " ]\n";
-    fcString += "}";
-
-    result = fcString.toUtf8();
-    request.endGetFeatureResponse( &result );
-    fcString = "";
+    mFeatureBuffer.append( " ]\n" );
+    mFeatureBuffer.append( "}" );
   }
   else
   {
-    fcString = "</wfs:FeatureCollection>";
-    result = fcString.toUtf8();
-    request.endGetFeatureResponse( &result );
-    fcString = "";
+    mFeatureBuffer.append( "</wfs:FeatureCollection>" );
   }
+  request.endGetFeatureResponse( &mFeatureBuffer );
+  mFeatureBuffer.clear();
 }
 
 QDomDocument QgsWFSServer::transaction( const QString& requestBody )
@@ -1675,167 +1655,119 @@ QgsFeatureIds QgsWFSServer::getFeatureIdsFromFilter( QDomElement filterElem, Qgs
   return fids;
 }
 
-QString QgsWFSServer::createFeatureGeoJSON( QgsFeature* feat, int prec, QgsCoordinateReferenceSystem &, QgsAttributeList attrIndexes, QSet<QString> excludedAttributes ) /*const*/
+void QgsWFSServer::writeFeatureGeoJSON( QByteArray& out, QgsFeature* feat, int prec, const QgsAttributeList& attrIndexes, const QSet<QString>& excludedAttributes ) /*const*/
 {
-  QString fStr = "{\"type\": \"Feature\",\n";
+  out.append( "{\"type\": \"Feature\",\n" );
 
-  fStr += "   \"id\": ";
-  fStr += "\"" + mTypeName + "." + QString::number( feat->id() ) + "\"";
-  fStr += ",\n";
+  out.append( "   \"id\": \"" );
+  out.append( mTypeName.toUtf8() ).append( '.' ).append( QByteArray::number( feat->id() ) );
+  out.append( "\",\n" );
 
   QgsGeometry* geom = feat->geometry();
   if ( geom && mWithGeom )
   {
     QgsRectangle box = geom->boundingBox();
 
-    fStr += " \"bbox\": [ " + qgsDoubleToString( box.xMinimum(), prec ) + ", " + qgsDoubleToString( box.yMinimum(), prec ) + ", " + qgsDoubleToString( box.xMaximum(), prec ) + ", " + qgsDoubleToString( box.yMaximum(), prec ) + "],\n";
-
-    fStr += "  \"geometry\": ";
-    fStr += geom->exportToGeoJSON( prec );
-    fStr += ",\n";
+    out.append( " \"bbox\": [ " );
+    _appendDouble( out, box.xMinimum(), prec );
+    out.append( ", " );
+    _appendDouble( out, box.yMinimum(), prec );
+    out.append( ", " );
+    _appendDouble( out, box.xMaximum(), prec );
+    out.append( ", " );
+    _appendDouble( out, box.yMaximum(), prec );
+    out.append( "],\n" );
+
+    out.append( "  \"geometry\": " );
+    out.append( geom->exportToGeoJSON( prec ).toUtf8() );
+    out.append( ",\n" );
   }
 
   //read all attribute values from the feature
-  fStr += "   \"properties\": {\n";
-  QgsAttributes featureAttributes = feat->attributes();
+  out.append( "   \"properties\": {\n" );
+  const QgsAttributes& featureAttributes = feat->attributes();
   const QgsFields* fields = feat->fields();
   int attributeCounter = 0;
   for ( int i = 0; i < attrIndexes.count(); ++i )
   {
     int idx = attrIndexes[i];
-    QString attributeName = fields->at( idx ).name();
+    const QString& attributeName = fields->at( idx ).name();
     //skip attribute if it is excluded from WFS publication
     if ( excludedAttributes.contains( attributeName ) )
     {
       continue;
     }
-    QVariant val = featureAttributes[idx];
+    const QVariant& val = featureAttributes[idx];
 
-    if ( attributeCounter == 0 )
-      fStr += "    \"";
-    else
-      fStr += "   ,\"";
-    fStr += attributeName;
-    fStr += "\": ";
+    out.append( attributeCounter == 0 ? "    \"" : "   ,\"" );
+    out.append( attributeName.toUtf8() );
+    out.append( "\": " );
     if ( val.type() == 6 || val.type() == 2 )
     {
-      fStr +=  val.toString();
+      out.append( val.toString().toUtf8() );
     }
     else
     {
-      fStr += "\"";
-      fStr +=  val.toString().replace( QString( "\"" ), QString( "\\\"" ) );
-      fStr += "\"";
+      out.append( '"' );
+      out.append( val.toString().replace( QString( "\"" ), QString( "\\\"" ) ).toUtf8() );
+      out.append( '"' );
     }
-    fStr += "\n";
+    out.append( '\n' );
     ++attributeCounter;
   }
 
-  fStr += "   }\n";
-
-  fStr += "  }";
+  out.append( "   }\n" );
 
-  return fStr;
+  out.append( "  }" );
 }
 
-QDomElement QgsWFSServer::createFeatureGML2( QgsFeature* feat, QDomDocument& doc, int prec, QgsCoordinateReferenceSystem& crs, QgsAttributeList attrIndexes, QSet<QString> excludedAttributes ) /*const*/
+void QgsWFSServer::writeFeatureGML( QByteArray& out, QgsFeature* feat, bool gml3, int prec, const QgsCoordinateReferenceSystem& crs, const QgsAttributeList& attrIndexes, const QSet<QString>& excludedAttributes ) /*const*/
 {
+  QByteArray typeName = mTypeName.toUtf8();
+
   //gml:FeatureMember
-  QDomElement featureElement = doc.createElement( "gml:featureMember"/*wfs:FeatureMember*/ );
+  out.append( "<gml:featureMember>\n" );
 
   //qgs:%TYPENAME%
-  QDomElement typeNameElement = doc.createElement( "qgs:" + mTypeName /*qgs:%TYPENAME%*/ );
-  typeNameElement.setAttribute( "fid", mTypeName + "." + QString::number( feat->id() ) );
-  featureElement.appendChild( typeNameElement );
+  out.append( " <qgs:" ).append( typeName ).append( gml3 ? " gml:id=\"" : " fid=\"" );
+  QgsOgcUtils::appendXmlEscaped( out, mTypeName + "." + QString::number( feat->id() ), true );
+  out.append( "\">\n" );
 
   if ( mWithGeom )
   {
     //add geometry column (as gml)
     QgsGeometry* geom = feat->geometry();
-
-    QDomElement geomElem = doc.createElement( "qgs:geometry" );
-    QDomElement gmlElem = QgsOgcUtils::geometryToGML( geom, doc, prec );
-    if ( !gmlElem.isNull() )
+    if ( geom )
     {
-      QgsRectangle box = geom->boundingBox();
-      QDomElement bbElem = doc.createElement( "gml:boundedBy" );
-      QDomElement boxElem = QgsOgcUtils::rectangleToGMLBox( &box, doc, prec );
+      QString srsName = crs.isValid() ? crs.authid() : QString();
+      int start = out.size();
 
-      if ( crs.isValid() )
+      out.append( "  <gml:boundedBy>\n" );
+      if ( gml3 )
       {
-        boxElem.setAttribute( "srsName", crs.authid() );
-        gmlElem.setAttribute( "srsName", crs.authid() );
+        QgsOgcUtils::appendRectangleToGMLEnvelope( out, geom->boundingBox(), prec, srsName, 3 );
       }
-
-      bbElem.appendChild( boxElem );
-      typeNameElement.appendChild( bbElem );
-
-      geomElem.appendChild( gmlElem );
-      typeNameElement.appendChild( geomElem );
-    }
-  }
-
-  //read all attribute values from the feature
-  QgsAttributes featureAttributes = feat->attributes();
-  const QgsFields* fields = feat->fields();
-  for ( int i = 0; i < attrIndexes.count(); ++i )
-  {
-    int idx = attrIndexes[i];
-    QString attributeName = fields->at( idx ).name();
-    //skip attribute if it is excluded from WFS publication
-    if ( excludedAttributes.contains( attributeName ) )
-    {
-      continue;
-    }
-
-    QDomElement fieldElem = doc.createElement( "qgs:" + attributeName.replace( QString( " " ), QString( "_" ) ) );
-    QDomText fieldText = doc.createTextNode( featureAttributes[idx].toString() );
-    fieldElem.appendChild( fieldText );
-    typeNameElement.appendChild( fieldElem );
-  }
-
-  return featureElement;
-}
-
-QDomElement QgsWFSServer::createFeatureGML3( QgsFeature* feat, QDomDocument& doc, int prec, QgsCoordinateReferenceSystem& crs, QgsAttributeList attrIndexes, QSet<QString> excludedAttributes ) /*const*/
-{
-  //gml:FeatureMember
-  QDomElement featureElement = doc.createElement( "gml:featureMember"/*wfs:FeatureMember*/ );
-
-  //qgs:%TYPENAME%
-  QDomElement typeNameElement = doc.createElement( "qgs:" + mTypeName /*qgs:%TYPENAME%*/ );
-  typeNameElement.setAttribute( "gml:id", mTypeName + "." + QString::number( feat->id() ) );
-  featureElement.appendChild( typeNameElement );
-
-  if ( mWithGeom )
-  {
-    //add geometry column (as gml)
-    QgsGeometry* geom = feat->geometry();
-
-    QDomElement geomElem = doc.createElement( "qgs:geometry" );
-    QDomElement gmlElem = QgsOgcUtils::geometryToGML( geom, doc, "GML3", prec );
-    if ( !gmlElem.isNull() )
-    {
-      QgsRectangle box = geom->boundingBox();
-      QDomElement bbElem = doc.createElement( "gml:boundedBy" );
-      QDomElement boxElem = QgsOgcUtils::rectangleToGMLEnvelope( &box, doc, prec );
-
-      if ( crs.isValid() )
+      else
       {
-        boxElem.setAttribute( "srsName", crs.authid() );
-        gmlElem.setAttribute( "srsName", crs.authid() );
+        QgsOgcUtils::appendRectangleToGMLBox( out, geom->boundingBox(), prec, srsName, 3 );
       }
+      out.append( "  </gml:boundedBy>\n" );
 
-      bbElem.appendChild( boxElem );
-      typeNameElement.appendChild( bbElem );
-
-      geomElem.appendChild( gmlElem );
-      typeNameElement.appendChild( geomElem );
+      out.append( "  <qgs:geometry>\n" );
+      if ( QgsOgcUtils::appendGeometryToGML( out, geom, gml3 ? "GML3" : "GML2", prec, srsName, 3 ) )
+      {
+        out.append( "  </qgs:geometry>\n" );
+      }
+      else
+      {
+        //no bounding box and geometry element for geometries without GML representation
+        out.truncate( start );
+      }
     }
   }
 
   //read all attribute values from the feature
-  QgsAttributes featureAttributes = feat->attributes();
+  const QgsAttributes& featureAttributes = feat->attributes();
   const QgsFields* fields = feat->fields();
   for ( int i = 0; i < attrIndexes.count(); ++i )
   {
@@ -1847,13 +1779,14 @@ QDomElement QgsWFSServer::createFeatureGML3( QgsFeature* feat, QDomDocument& doc
       continue;
     }
 
-    QDomElement fieldElem = doc.createElement( "qgs:" + attributeName.replace( QString( " " ), QString( "_" ) ) );
-    QDomText fieldText = doc.createTextNode( featureAttributes[idx].toString() );
-    fieldElem.appendChild( fieldText );
-    typeNameElement.appendChild( fieldElem );
+    QByteArray fieldName = attributeName.replace( QString( " " ), QString( "_" ) ).toUtf8();
+    out.append( "  <qgs:" ).append( fieldName ).append( '>' );
+    QgsOgcUtils::appendXmlEscaped( out, featureAttributes[idx].toString() );
+    out.append( "</qgs:" ).append( fieldName ).append( ">\n" );
   }
 
-  return featureElement;
+  out.append( " </qgs:" ).append( typeName ).append( ">\n" );
+  out.append( "</gml:featureMember>\n" );
 }
 
 QString QgsWFSServer::serviceUrl() const
@@ -47,6 +47,8 @@
 #include "qgsfeature.h"
 #include "qgseditorwidgetregistry.h"
 #include "qgsserverlogger.h"
+#include "qgswmstilecache.h"
+#include "qgswmstilegrid.h"
 #include "qgssymbollayerv2utils.h"
 
 #include <QImage>
@@ -55,6 +57,7 @@
 #include <QTemporaryFile>
 #include <QTextStream>
 #include <QDir>
+#include <qmath.h>
 
 //for printing
 #include "qgscomposition.h"
@@ -163,7 +166,11 @@ void QgsWMSServer::executeRequest()
     QImage* result = 0;
     try
     {
-      result = getMap();
+      result = getMapTile();
+      if ( !result )
+      {
+        result = getMap();
+      }
     }
     catch ( QgsMapServiceException& ex )
     {
@@ -1430,6 +1437,8 @@ QByteArray* QgsWMSServer::getPrint( const QString& formatString )
 
   QByteArray* ba = 0;
   c->setPlotStyle( QgsComposition::Print );
+  //render the layers of the composer maps in parallel threads if the output is a raster
+  c->setParallelRendering( true );
 
   //SVG export without a running X-Server is a problem. See e.g. http://developer.qt.nokia.com/forums/viewthread/2038
   if ( formatString.compare( "svg", Qt::CaseInsensitive ) == 0 )
@@ -1580,6 +1589,106 @@ QImage* QgsWMSServer::getMap( HitTest* hitTest )
   return theImage;
 }
 
+QImage* QgsWMSServer::getMapTile()
+{
+  int metaTileSize = QgsWMSTileCache::instance()->metaTileSize();
+  if ( metaTileSize < 2 || !mConfigParser
+       || mParameters.value( "TILED" ).compare( "true", Qt::CaseInsensitive ) != 0
+       || mParameters.contains( "WATERMARK_TEXT" ) )
+  {
+    return 0;
+  }
+
+  bool widthOk, heightOk, bboxOk;
+  int width = mParameters.value( "WIDTH" ).toInt( &widthOk );
+  int height = mParameters.value( "HEIGHT" ).toInt( &heightOk );
+  QgsRectangle bbox = _parseBBOX( mParameters.value( "BBOX" ), bboxOk );
+  if ( !widthOk || !heightOk || !bboxOk || width <= 0 || height <= 0 || bbox.isEmpty() )
+  {
+    return 0;
+  }
+
+  int metaWidth = width * metaTileSize;
+  int metaHeight = height * metaTileSize;
+  if (( mConfigParser->maxWidth() != -1 && metaWidth > mConfigParser->maxWidth() )
+      || ( mConfigParser->maxHeight() != -1 && metaHeight > mConfigParser->maxHeight() ) )
+  {
+    return 0;
+  }
+
+  //the BBOX of WMS 1.3.0 is in the axis order of the CRS
+  QString crs = mParameters.value( "CRS", mParameters.value( "SRS" ) );
+  bool axisInverted = mParameters.value( "VERSION", "1.3.0" ) != "1.1.1" && !crs.isEmpty()
+                      && QgsCRSCache::instance()->crsByAuthId( crs ).axisInverted();
+  QgsWMSTileGrid grid( metaTileSize );
+  if ( !grid.setTileExtent( bbox.xMinimum(), bbox.yMinimum(), bbox.xMaximum(), bbox.yMaximum(), axisInverted ) )
+  {
+    return 0;
+  }
+  int column = grid.column();
+  int row = grid.row();
+
+  //all parameters except the tile extent influence the rendering
+  QString key = QString( "%1,%2,%3,%4,%5,%6" ).arg( width ).arg( height ).arg( grid.tileWidth(), 0, 'g', 10 ).arg( grid.tileHeight(), 0, 'g', 10 ).arg( grid.offsetX() ).arg( grid.offsetY() );
+  QMap<QString, QString>::const_iterator paramIt = mParameters.constBegin();
+  for ( ; paramIt != mParameters.constEnd(); ++paramIt )
+  {
+    if ( paramIt.key() != "BBOX" && paramIt.key() != "WIDTH" && paramIt.key() != "HEIGHT" )
+    {
+      key += "&" + paramIt.key() + "=" + paramIt.value();
+    }
+  }
+
+  QgsWMSTileCache* tileCache = QgsWMSTileCache::instance();
+  QImage tile = tileCache->searchTile( mConfigFilePath, key, column, row );
+  if ( tile.isNull() )
+  {
+    int metaColumn = grid.metaColumn();
+    int metaRow = grid.metaRow();
+    double metaXMin, metaYMin, metaXMax, metaYMax;
+    grid.metaTileExtent( metaXMin, metaYMin, metaXMax, metaYMax );
+
+    QMap<QString, QString> tileParameters = mParameters;
+    mParameters["BBOX"] = QString( "%1,%2,%3,%4" ).arg( metaXMin, 0, 'g', 17 ).arg( metaYMin, 0, 'g', 17 )
+                          .arg( metaXMax, 0, 'g', 17 ).arg( metaYMax, 0, 'g', 17 );
+    mParameters["WIDTH"] = QString::number( metaWidth );
+    mParameters["HEIGHT"] = QString::number( metaHeight );
+
+    QImage* metaTile = 0;
+    try
+    {
+      metaTile = getMap();
+    }
+    catch ( QgsMapServiceException& )
+    {
+      mParameters = tileParameters;
+      throw;
+    }
+    mParameters = tileParameters;
+
+    if ( !metaTile )
+    {
+      return 0;
+    }
+
+    for ( int i = 0; i < metaTileSize; ++i )
+    {
+      for ( int j = 0; j < metaTileSize; ++j )
+      {
+        QImage metaTilePart = metaTile->copy( grid.metaTilePart( i, j, width, height ) );
+        tileCache->insertTile( mConfigFilePath, key, metaColumn + i, metaRow + j, metaTilePart );
+        if ( metaColumn + i == column && metaRow + j == row )
+        {
+          tile = metaTilePart;
+        }
+      }
+    }
+    delete metaTile;
+  }
+
+  return new QImage( tile );
+}
+
 int QgsWMSServer::getFeatureInfo( QDomDocument& result, QString version )
 {
   if ( !mMapRenderer || !mConfigParser )
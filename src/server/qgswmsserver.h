@@ -86,6 +86,10 @@ class QgsWMSServer: public QgsOWSServer
     of the image object). If an instance to existing hit test structure is passed, instead of rendering
     it will fill the structure with symbols that would be used for rendering */
     QImage* getMap( HitTest* hitTest = 0 );
+    /**Returns the map tile of a GetMap request with TILED=true from the tile cache. On a cache miss, the metatile
+    containing the tile is rendered with getMap() and all its tiles are cached. Returns 0 if metatiling is disabled
+    or not possible for the request. The caller takes ownership of the image object*/
+    QImage* getMapTile();
     /**Returns an SLD file with the style of the requested layer. Exception is raised in case of troubles :-)*/
     QDomDocument getStyle();
     /**Returns an SLD file with the styles of the requested layers. Exception is raised in case of troubles :-)*/
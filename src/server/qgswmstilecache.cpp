@@ -0,0 +1,93 @@
+/***************************************************************************
+                              qgswmstilecache.cpp
+                              -------------------
+  begin                : March 2016
+  copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgswmstilecache.h"
+#include "qgslogger.h"
+#include <QCoreApplication>
+
+QgsWMSTileCache* QgsWMSTileCache::instance()
+{
+  static QgsWMSTileCache mInstance;
+  return &mInstance;
+}
+
+QgsWMSTileCache::QgsWMSTileCache()
+    : mMetaTileSize( 0 )
+{
+  int cacheSize = 256;
+
+  //environment variables override defaults
+  char* metaTileSizeEnv = getenv( "QGIS_SERVER_METATILE_SIZE" );
+  if ( metaTileSizeEnv )
+  {
+    mMetaTileSize = QString( metaTileSizeEnv ).toInt();
+  }
+  char* cacheSizeEnv = getenv( "QGIS_SERVER_TILE_CACHE_SIZE" );
+  if ( cacheSizeEnv )
+  {
+    bool conversionOk = false;
+    int cacheSizeInt = QString( cacheSizeEnv ).toInt( &conversionOk );
+    if ( conversionOk )
+    {
+      cacheSize = cacheSizeInt;
+    }
+  }
+  mTiles.setMaxCost( cacheSize * 1024 );
+
+  QObject::connect( &mFileSystemWatcher, SIGNAL( fileChanged( const QString& ) ), this, SLOT( removeProjectFileTiles( const QString& ) ) );
+}
+
+QgsWMSTileCache::~QgsWMSTileCache()
+{
+}
+
+QString QgsWMSTileCache::tileKey( const QString& configFilePath, const QString& key, int column, int row )
+{
+  return configFilePath + "\n" + key + "\n" + QString::number( column ) + "," + QString::number( row );
+}
+
+QImage QgsWMSTileCache::searchTile( const QString& configFilePath, const QString& key, int column, int row )
+{
+  QCoreApplication::processEvents(); //get updates from file system watcher
+
+  QImage* tile = mTiles.object( tileKey( configFilePath, key, column, row ) );
+  return tile ? *tile : QImage();
+}
+
+void QgsWMSTileCache::insertTile( const QString& configFilePath, const QString& key, int column, int row, const QImage& tile )
+{
+  if ( !mConfigFiles.contains( configFilePath ) )
+  {
+    mConfigFiles.insert( configFilePath );
+    mFileSystemWatcher.addPath( configFilePath );
+  }
+  mTiles.insert( tileKey( configFilePath, key, column, row ), new QImage( tile ), qMax( 1, tile.byteCount() / 1024 ) );
+}
+
+void QgsWMSTileCache::removeProjectFileTiles( const QString& path )
+{
+  QgsDebugMsg( "Remove tiles of changed project file " + path );
+  QString prefix = path + "\n";
+  foreach ( const QString& key, mTiles.keys() )
+  {
+    if ( key.startsWith( prefix ) )
+    {
+      mTiles.remove( key );
+    }
+  }
+  mConfigFiles.remove( path );
+  mFileSystemWatcher.removePath( path );
+}
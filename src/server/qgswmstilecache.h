@@ -0,0 +1,69 @@
+/***************************************************************************
+                              qgswmstilecache.h
+                              -----------------
+  begin                : March 2016
+  copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSWMSTILECACHE_H
+#define QGSWMSTILECACHE_H
+
+#include <QCache>
+#include <QFileSystemWatcher>
+#include <QImage>
+#include <QObject>
+#include <QSet>
+#include <QString>
+
+/**A singleton cache for the tiles of GetMap requests rendered as metatiles.
+The tiles of a project are removed when the project file changes*/
+class QgsWMSTileCache: public QObject
+{
+    Q_OBJECT
+  public:
+    static QgsWMSTileCache* instance();
+    ~QgsWMSTileCache();
+
+    /**Number of tiles per row and column of a metatile (environment variable QGIS_SERVER_METATILE_SIZE).
+      Metatiling is disabled if smaller than 2*/
+    int metaTileSize() const { return mMetaTileSize; }
+
+    /**Searches a tile
+      @param configFilePath project file of the request
+      @param key parameters of the request that influence the rendering (layers, styles, crs, tile size, ...)
+      @param column tile column in the tile grid
+      @param row tile row in the tile grid
+      @return the tile or a null image if the tile is not in the cache*/
+    QImage searchTile( const QString& configFilePath, const QString& key, int column, int row );
+    void insertTile( const QString& configFilePath, const QString& key, int column, int row, const QImage& tile );
+
+  private:
+    /**Protected singleton constructor*/
+    QgsWMSTileCache();
+
+    static QString tileKey( const QString& configFilePath, const QString& key, int column, int row );
+
+    int mMetaTileSize;
+
+    /**Tiles with the size in kB as cost. The maximum cost is read from QGIS_SERVER_TILE_CACHE_SIZE (in MB)*/
+    QCache<QString, QImage> mTiles;
+
+    /**Project files with tiles in the cache*/
+    QSet<QString> mConfigFiles;
+    QFileSystemWatcher mFileSystemWatcher;
+
+  private slots:
+    /**Removes the tiles of a changed project file*/
+    void removeProjectFileTiles( const QString& path );
+};
+
+#endif // QGSWMSTILECACHE_H
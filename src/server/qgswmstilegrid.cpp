@@ -0,0 +1,91 @@
+/***************************************************************************
+                              qgswmstilegrid.cpp
+                              ------------------
+  begin                : March 2016
+  copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgswmstilegrid.h"
+
+#include <qmath.h>
+
+QgsWMSTileGrid::QgsWMSTileGrid( int metaTileSize )
+    : mMetaTileSize( metaTileSize )
+    , mAxisInverted( false )
+    , mXMin( 0 )
+    , mYMin( 0 )
+    , mTileWidth( 0 )
+    , mTileHeight( 0 )
+    , mColumn( 0 )
+    , mRow( 0 )
+    , mOffsetX( 0 )
+    , mOffsetY( 0 )
+{
+
+}
+
+bool QgsWMSTileGrid::setTileExtent( double xMin, double yMin, double xMax, double yMax, bool axisInverted )
+{
+  mAxisInverted = axisInverted;
+  if ( axisInverted )
+  {
+    qSwap( xMin, yMin );
+    qSwap( xMax, yMax );
+  }
+
+  mXMin = xMin;
+  mYMin = yMin;
+  mTileWidth = xMax - xMin;
+  mTileHeight = yMax - yMin;
+  if ( mTileWidth <= 0 || mTileHeight <= 0 )
+  {
+    return false;
+  }
+
+  double x = xMin / mTileWidth;
+  double y = yMin / mTileHeight;
+  if ( qAbs( x ) > 1E9 || qAbs( y ) > 1E9 )
+  {
+    return false;
+  }
+
+  //tolerate rounding errors of the client in the BBOX
+  mColumn = qFloor( x + 1E-6 );
+  mRow = qFloor( y + 1E-6 );
+  mOffsetX = qMax( 0, qRound(( x - mColumn ) * 1E6 ) );
+  mOffsetY = qMax( 0, qRound(( y - mRow ) * 1E6 ) );
+  return true;
+}
+
+void QgsWMSTileGrid::metaTileExtent( double& xMin, double& yMin, double& xMax, double& yMax ) const
+{
+  xMin = mXMin - ( mColumn - metaColumn() ) * mTileWidth;
+  yMin = mYMin - ( mRow - metaRow() ) * mTileHeight;
+  xMax = xMin + mMetaTileSize * mTileWidth;
+  yMax = yMin + mMetaTileSize * mTileHeight;
+  if ( mAxisInverted )
+  {
+    qSwap( xMin, yMin );
+    qSwap( xMax, yMax );
+  }
+}
+
+QRect QgsWMSTileGrid::metaTilePart( int i, int j, int width, int height ) const
+{
+  //rows go up in the grid and down in the image
+  return QRect( i * width, ( mMetaTileSize - 1 - j ) * height, width, height );
+}
+
+int QgsWMSTileGrid::metaTileStart( int i, int metaTileSize )
+{
+  return ( i >= 0 ? i / metaTileSize : -(( -i - 1 ) / metaTileSize ) - 1 ) * metaTileSize;
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+                              qgswmstilegrid.h
+                              ----------------
+  begin                : March 2016
+  copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSWMSTILEGRID_H
+#define QGSWMSTILEGRID_H
+
+#include <QRect>
+
+/**Position of a tiled GetMap request in the grid of tiles with its size, and the metatile containing it.
+The grid has its origin at a multiple of the tile size. Grids with another origin are distinguished by the
+offset of their tiles, in millionths of the tile size. The BBOX is passed in the axis order of the request,
+which is y/x for WMS 1.3.0 with a CRS with inverted axes*/
+class QgsWMSTileGrid
+{
+  public:
+    QgsWMSTileGrid( int metaTileSize );
+
+    /**Locates the tile with the given BBOX. Returns false if the BBOX is empty or too far from the origin*/
+    bool setTileExtent( double xMin, double yMin, double xMax, double yMax, bool axisInverted );
+
+    double tileWidth() const { return mTileWidth; }
+    double tileHeight() const { return mTileHeight; }
+    int column() const { return mColumn; }
+    int row() const { return mRow; }
+    int offsetX() const { return mOffsetX; }
+    int offsetY() const { return mOffsetY; }
+
+    /**Column of the bottom left tile of the metatile*/
+    int metaColumn() const { return metaTileStart( mColumn, mMetaTileSize ); }
+    /**Row of the bottom left tile of the metatile*/
+    int metaRow() const { return metaTileStart( mRow, mMetaTileSize ); }
+
+    /**Extent of the metatile, in the axis order of the request*/
+    void metaTileExtent( double& xMin, double& yMin, double& xMax, double& yMax ) const;
+
+    /**Pixel rectangle of the tile (metaColumn() + i, metaRow() + j) in the image of the metatile, whose first row is its top*/
+    QRect metaTilePart( int i, int j, int width, int height ) const;
+
+    /**Index of the first tile of the metatile containing the tile with index i*/
+    static int metaTileStart( int i, int metaTileSize );
+
+  private:
+    int mMetaTileSize;
+    bool mAxisInverted;
+    double mXMin;
+    double mYMin;
+    double mTileWidth;
+    double mTileHeight;
+    int mColumn;
+    int mRow;
+    int mOffsetX;
+    int mOffsetY;
+};
+
+#endif // QGSWMSTILEGRID_H
@@ -34,6 +34,7 @@ class TestOpenStreetMap : public QObject
     /** Our tests proper begin here */
     void download();
     void importAndQueries();
+    void importPbf();
   private:
 
 };
@@ -187,6 +188,49 @@ void TestOpenStreetMap::importAndQueries()
   // TODO: test exported data
 }
 
+void TestOpenStreetMap::importPbf()
+{
+  QString dbFilename = "/tmp/testdata-pbf.db";
+  QString pbfFilename = TEST_DATA_DIR "/openstreetmap/testdata.osm.pbf";
+
+  QgsOSMXmlImport import( pbfFilename, dbFilename );
+  bool res = import.import();
+  if ( import.hasError() )
+    qDebug( "PBF ERR: %s", import.errorString().toAscii().data() );
+  QCOMPARE( res, true );
+
+  QgsOSMDatabase db( dbFilename );
+  QCOMPARE( db.open(), true );
+
+  QCOMPARE( db.countNodes(), 5 );
+  QCOMPARE( db.countWays(), 1 );
+
+  QgsOSMNode n = db.node( 11111 );
+  QCOMPARE( n.isValid(), true );
+  QCOMPARE( n.point().x(), 14.4277148 );
+  QCOMPARE( n.point().y(), 50.0651387 );
+
+  QgsOSMTags tags = db.tags( false, 11111 );
+  QCOMPARE( tags.count(), 7 );
+  QCOMPARE( tags.value( "addr:street" ), QString::fromUtf8( "Jarom\xc3\xadrova" ) );
+
+  QgsOSMWay w = db.way( 32137532 );
+  QCOMPARE( w.isValid(), true );
+  QCOMPARE( w.nodes().count(), 5 );
+  QCOMPARE( w.nodes()[1], ( qint64 )360769664 );
+
+  QgsOSMTags tagsW = db.tags( true, 32137532 );
+  QCOMPARE( tagsW.count(), 3 );
+  QCOMPARE( tagsW.value( "building" ), QString( "yes" ) );
+
+  // points stored by the import
+  QgsPolyline points = db.wayPoints( 32137532 );
+  QCOMPARE( points.count(), 5 );
+  QCOMPARE( points[1].x(), 14.4270254 );
+  QCOMPARE( points[1].y(), 50.0665121 );
+  QCOMPARE( points.first(), points.last() );
+}
+
 
 QTEST_MAIN( TestOpenStreetMap )
 
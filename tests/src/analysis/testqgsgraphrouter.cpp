@@ -0,0 +1,348 @@
+/***************************************************************************
+     testqgsgraphrouter.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QMultiMap>
+#include <QtTest/QtTest>
+#include <limits>
+
+#include "qgsgraph.h"
+#include "qgsgraphanalyzer.h"
+#include "qgsgraphrouter.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for the shortest path router of the network analysis library. Its dijkstra,
+ * A* and contraction hierarchy queries are compared with the dijkstra implementation of
+ * QgsGraphAnalyzer before it used the router. Graphs written to a file are read back unchanged
+ */
+class TestQgsGraphRouter : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsGraphRouter();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testDijkstra();
+    void testGraphAnalyzerDijkstra();
+    void testAStar();
+    void testHierarchy();
+    void testWriteReadFile();
+
+  private:
+    QgsGraph* mGraph;
+    //vertex without arcs
+    int mIsolatedVertex;
+
+    /**The dijkstra implementation of QgsGraphAnalyzer before the router was introduced*/
+    void referenceDijkstra( int startVertexIdx, int criterionNum, QVector<double>& resultCost ) const;
+    /**Checks that the arcs of a shortest path tree lead to the vertices with the given costs*/
+    void verifyTree( int startVertexIdx, int criterionNum, const QVector<int>& tree, const QVector<double>& cost ) const;
+    /**Checks the point to point queries of the router against the reference dijkstra for all the vertex pairs*/
+    void verifyShortestPaths( QgsGraphRouter& router, int criterionNum ) const;
+};
+
+TestQgsGraphRouter::TestQgsGraphRouter()
+    : mGraph( NULL )
+    , mIsolatedVertex( -1 )
+{
+
+}
+
+void TestQgsGraphRouter::initTestCase()
+{
+  //8 x 8 grid of vertices with arcs in both directions between neighbours, some of them one way,
+  //and a few diagonals. Criterion 0 is the length times a pseudo random factor >= 1,
+  //criterion 1 a pseudo random cost which is 0 for some arcs
+  mGraph = new QgsGraph();
+  const int size = 8;
+  for ( int row = 0; row < size; ++row )
+  {
+    for ( int col = 0; col < size; ++col )
+    {
+      mGraph->addVertex( QgsPoint( col * 100.0, row * 100.0 ) );
+    }
+  }
+  mIsolatedVertex = mGraph->addVertex( QgsPoint( 2000.0, 2000.0 ) );
+
+  unsigned int seed = 4711;
+  for ( int row = 0; row < size; ++row )
+  {
+    for ( int col = 0; col < size; ++col )
+    {
+      int v = row * size + col;
+      QList<int> neighbours;
+      if ( col + 1 < size )
+        neighbours << v + 1;
+      if ( row + 1 < size )
+        neighbours << v + size;
+      if ( col + 1 < size && row + 1 < size && ( row + col ) % 3 == 0 )
+        neighbours << v + size + 1;
+
+      foreach ( int w, neighbours )
+      {
+        QgsPoint p1 = mGraph->vertex( v ).point();
+        QgsPoint p2 = mGraph->vertex( w ).point();
+        double length = sqrt( p1.sqrDist( p2 ) );
+        for ( int direction = 0; direction < 2; ++direction )
+        {
+          seed = seed * 1103515245 + 12345;
+          //every seventh connection is one way
+          if ( direction == 1 && ( seed >> 8 ) % 7 == 0 )
+            continue;
+
+          QVector<QVariant> properties;
+          properties << length * ( 1.0 + ( seed >> 8 ) % 100 / 25.0 );
+          seed = seed * 1103515245 + 12345;
+          properties << (( seed >> 8 ) % 5 == 0 ? 0.0 : ( double )(( seed >> 8 ) % 50 ) );
+          if ( direction == 0 )
+            mGraph->addArc( v, w, properties );
+          else
+            mGraph->addArc( w, v, properties );
+        }
+      }
+    }
+  }
+}
+
+void TestQgsGraphRouter::cleanupTestCase()
+{
+  delete mGraph;
+}
+
+void TestQgsGraphRouter::referenceDijkstra( int startVertexIdx, int criterionNum, QVector<double>& resultCost ) const
+{
+  resultCost.clear();
+  resultCost.insert( resultCost.begin(), mGraph->vertexCount(), std::numeric_limits<double>::infinity() );
+  resultCost[ startVertexIdx ] = 0.0;
+
+  QMultiMap< double, int > not_begin;
+  not_begin.insert( 0.0, startVertexIdx );
+
+  while ( !not_begin.empty() )
+  {
+    QMultiMap< double, int >::iterator it = not_begin.begin();
+    double curCost = it.key();
+    int curVertex = it.value();
+    not_begin.erase( it );
+
+    QgsGraphArcIdList l = mGraph->vertex( curVertex ).outArc();
+    QgsGraphArcIdList::iterator arcIt;
+    for ( arcIt = l.begin(); arcIt != l.end(); ++arcIt )
+    {
+      const QgsGraphArc arc = mGraph->arc( *arcIt );
+      double cost = arc.property( criterionNum ).toDouble() + curCost;
+
+      if ( cost < resultCost[ arc.inVertex()] )
+      {
+        resultCost[ arc.inVertex()] = cost;
+        not_begin.insert( cost, arc.inVertex() );
+      }
+    }
+  }
+}
+
+void TestQgsGraphRouter::verifyTree( int startVertexIdx, int criterionNum, const QVector<int>& tree, const QVector<double>& cost ) const
+{
+  QCOMPARE( tree.size(), mGraph->vertexCount() );
+  QCOMPARE( tree[startVertexIdx], -1 );
+  for ( int i = 0; i < mGraph->vertexCount(); ++i )
+  {
+    if ( i == startVertexIdx )
+      continue;
+
+    if ( cost[i] == std::numeric_limits<double>::infinity() )
+    {
+      QCOMPARE( tree[i], -1 );
+      continue;
+    }
+    QVERIFY( tree[i] >= 0 );
+    const QgsGraphArc& arc = mGraph->arc( tree[i] );
+    QCOMPARE( arc.inVertex(), i );
+    QVERIFY( qgsDoubleNear( cost[arc.outVertex()] + arc.property( criterionNum ).toDouble(), cost[i], 1E-6 ) );
+  }
+}
+
+void TestQgsGraphRouter::verifyShortestPaths( QgsGraphRouter& router, int criterionNum ) const
+{
+  for ( int start = 0; start < mGraph->vertexCount(); ++start )
+  {
+    QVector<double> expectedCost;
+    referenceDijkstra( start, criterionNum, expectedCost );
+
+    for ( int stop = 0; stop < mGraph->vertexCount(); ++stop )
+    {
+      QVector<int> arcs;
+      double cost = router.shortestPath( start, stop, &arcs );
+      if ( expectedCost[stop] == std::numeric_limits<double>::infinity() )
+      {
+        QVERIFY( cost == std::numeric_limits<double>::infinity() );
+        QVERIFY( arcs.isEmpty() );
+        continue;
+      }
+      QVERIFY( qgsDoubleNear( cost, expectedCost[stop], 1E-6 ) );
+
+      //the arcs form a path from start to stop with the returned cost
+      int vertex = start;
+      double pathCost = 0;
+      foreach ( int arcIdx, arcs )
+      {
+        const QgsGraphArc& arc = mGraph->arc( arcIdx );
+        QCOMPARE( arc.outVertex(), vertex );
+        pathCost += arc.property( criterionNum ).toDouble();
+        vertex = arc.inVertex();
+      }
+      QCOMPARE( vertex, stop );
+      QVERIFY( qgsDoubleNear( pathCost, cost, 1E-6 ) );
+    }
+  }
+}
+
+void TestQgsGraphRouter::testDijkstra()
+{
+  for ( int criterion = 0; criterion < 2; ++criterion )
+  {
+    QgsGraphRouter router( mGraph, criterion );
+    QCOMPARE( router.vertexCount(), mGraph->vertexCount() );
+
+    //the router reuses its buffers, so run several searches on the same router
+    for ( int start = 0; start < mGraph->vertexCount(); start += 5 )
+    {
+      QVector<double> expectedCost;
+      referenceDijkstra( start, criterion, expectedCost );
+
+      QVector<int> tree;
+      QVector<double> cost;
+      router.dijkstra( start, &tree, &cost );
+      QCOMPARE( cost.size(), expectedCost.size() );
+      for ( int i = 0; i < cost.size(); ++i )
+      {
+        if ( expectedCost[i] == std::numeric_limits<double>::infinity() )
+          QVERIFY( cost[i] == expectedCost[i] );
+        else
+          QVERIFY( qgsDoubleNear( cost[i], expectedCost[i], 1E-6 ) );
+      }
+      QVERIFY( cost[mIsolatedVertex] == std::numeric_limits<double>::infinity() );
+      verifyTree( start, criterion, tree, cost );
+    }
+  }
+}
+
+void TestQgsGraphRouter::testGraphAnalyzerDijkstra()
+{
+  QVector<double> expectedCost;
+  referenceDijkstra( 9, 0, expectedCost );
+
+  QVector<int> tree;
+  QVector<double> cost;
+  QgsGraphAnalyzer::dijkstra( mGraph, 9, 0, &tree, &cost );
+  QCOMPARE( cost.size(), expectedCost.size() );
+  for ( int i = 0; i < cost.size(); ++i )
+  {
+    if ( expectedCost[i] == std::numeric_limits<double>::infinity() )
+      QVERIFY( cost[i] == expectedCost[i] );
+    else
+      QVERIFY( qgsDoubleNear( cost[i], expectedCost[i], 1E-6 ) );
+  }
+  verifyTree( 9, 0, tree, cost );
+
+  //the tree contains the reachable vertices (including the start vertex)
+  int reachable = 0;
+  for ( int i = 0; i < expectedCost.size(); ++i )
+  {
+    if ( expectedCost[i] != std::numeric_limits<double>::infinity() )
+      ++reachable;
+  }
+  QgsGraph* shortestTree = QgsGraphAnalyzer::shortestTree( mGraph, 9, 0 );
+  QCOMPARE( shortestTree->vertexCount(), reachable );
+  QCOMPARE( shortestTree->arcCount(), reachable - 1 );
+  delete shortestTree;
+}
+
+void TestQgsGraphRouter::testAStar()
+{
+  for ( int criterion = 0; criterion < 2; ++criterion )
+  {
+    QgsGraphRouter router( mGraph, criterion );
+    QVERIFY( !router.hasHierarchy() );
+    verifyShortestPaths( router, criterion );
+  }
+}
+
+void TestQgsGraphRouter::testHierarchy()
+{
+  for ( int criterion = 0; criterion < 2; ++criterion )
+  {
+    QgsGraphRouter router( mGraph, criterion );
+    router.buildHierarchy();
+    QVERIFY( router.hasHierarchy() );
+    verifyShortestPaths( router, criterion );
+  }
+}
+void TestQgsGraphRouter::testWriteReadFile()
+{
+  QString path = QDir::tempPath() + QDir::separator() + "qgis_test_graph.bin";
+  QFile::remove( path );
+  QVERIFY( mGraph->writeToFile( path ) );
+
+  QgsGraph* graph = QgsGraph::readFromFile( path );
+  QVERIFY( graph );
+  QCOMPARE( graph->vertexCount(), mGraph->vertexCount() );
+  QCOMPARE( graph->arcCount(), mGraph->arcCount() );
+  for ( int i = 0; i < mGraph->vertexCount(); ++i )
+  {
+    QCOMPARE( graph->vertex( i ).point(), mGraph->vertex( i ).point() );
+    QCOMPARE( graph->vertex( i ).outArc(), mGraph->vertex( i ).outArc() );
+    QCOMPARE( graph->vertex( i ).inArc(), mGraph->vertex( i ).inArc() );
+  }
+  QVERIFY( graph->vertex( mIsolatedVertex ).outArc().isEmpty() );
+  for ( int i = 0; i < mGraph->arcCount(); ++i )
+  {
+    QCOMPARE( graph->arc( i ).outVertex(), mGraph->arc( i ).outVertex() );
+    QCOMPARE( graph->arc( i ).inVertex(), mGraph->arc( i ).inVertex() );
+    QCOMPARE( graph->arc( i ).properties().size(), 2 );
+    //costs are stored exactly
+    QVERIFY( graph->arc( i ).property( 0 ).toDouble() == mGraph->arc( i ).property( 0 ).toDouble() );
+    QVERIFY( graph->arc( i ).property( 1 ).toDouble() == mGraph->arc( i ).property( 1 ).toDouble() );
+  }
+
+  //the routes are the same on the graph read back
+  QgsGraphRouter router( graph, 0 );
+  verifyShortestPaths( router, 0 );
+  delete graph;
+
+  //truncated files and files which are no graphs are not read
+  QFile file( path );
+  QVERIFY( file.open( QIODevice::ReadWrite ) );
+  QVERIFY( file.resize( file.size() / 2 ) );
+  file.close();
+  QVERIFY( !QgsGraph::readFromFile( path ) );
+
+  QVERIFY( file.open( QIODevice::WriteOnly | QIODevice::Truncate ) );
+  file.write( "no graph" );
+  file.close();
+  QVERIFY( !QgsGraph::readFromFile( path ) );
+
+  QFile::remove( path );
+  QVERIFY( !QgsGraph::readFromFile( path ) );
+}
+
+QTEST_MAIN( TestQgsGraphRouter )
+#include "testqgsgraphrouter.moc"
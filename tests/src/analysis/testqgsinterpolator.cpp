@@ -0,0 +1,327 @@
+/***************************************************************************
+     testqgsinterpolator.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QtTest/QtTest>
+#include <algorithm>
+#include <cmath>
+
+#include "qgsapplication.h"
+#include "qgsgeometry.h"
+#include "qgsgridfilewriter.h"
+#include "qgsidwinterpolator.h"
+#include "qgstininterpolator.h"
+#include "qgsvectordataprovider.h"
+#include "qgsvectorlayer.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for the IDW and TIN interpolators and the grid file writer. The IDW results are compared with
+ * an inverse distance weighting which looks at all the points for every position (the implementation before
+ * the points were indexed). The rows interpolated by the TIN at once are compared with the single cells
+ */
+class TestQgsInterpolator : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsInterpolator();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testIdwAllPoints();
+    void testIdwMaxNeighbours();
+    void testIdwSearchRadius();
+    void testTinGridRowsLinear();
+    void testTinGridRowsCloughTocher();
+    void testGridFileWriter();
+
+  private:
+    QgsVectorLayer* mPointLayer;
+    QList<QgsInterpolator::LayerData> mLayerData;
+    QVector<vertexData> mPoints;
+
+    /**Inverse distance weighting over all the points, restricted to the maxNeighbours nearest points
+      and to the points within searchRadius if they are > 0. Returns false if no point is used*/
+    bool referenceIdw( double x, double y, int maxNeighbours, double searchRadius, double& result ) const;
+    void compareIdw( QgsIDWInterpolator& interpolator, int maxNeighbours, double searchRadius ) const;
+};
+
+TestQgsInterpolator::TestQgsInterpolator()
+    : mPointLayer( NULL )
+{
+
+}
+
+void TestQgsInterpolator::initTestCase()
+{
+  QgsApplication::init();
+  QgsApplication::initQgis();
+  QgsApplication::showSettings();
+
+  mPointLayer = new QgsVectorLayer( "Point?crs=epsg:21781&field=value:double", "points", "memory" );
+  QVERIFY( mPointLayer->isValid() );
+
+  //scattered points with a fixed pseudo random sequence
+  unsigned int seed = 12345;
+  QgsFeatureList features;
+  for ( int i = 0; i < 200; ++i )
+  {
+    vertexData v;
+    seed = seed * 1103515245 + 12345;
+    v.x = 600000 + ( seed >> 8 ) % 10000 / 10.0;
+    seed = seed * 1103515245 + 12345;
+    v.y = 200000 + ( seed >> 8 ) % 8000 / 10.0;
+    seed = seed * 1103515245 + 12345;
+    v.z = ( seed >> 8 ) % 1000 / 10.0;
+    mPoints.append( v );
+
+    QgsFeature f( mPointLayer->pendingFields() );
+    f.setGeometry( QgsGeometry::fromPoint( QgsPoint( v.x, v.y ) ) );
+    f.setAttribute( 0, v.z );
+    features.append( f );
+  }
+  QVERIFY( mPointLayer->dataProvider()->addFeatures( features ) );
+
+  QgsInterpolator::LayerData ld;
+  ld.vectorLayer = mPointLayer;
+  ld.zCoordInterpolation = false;
+  ld.interpolationAttribute = 0;
+  ld.mInputType = QgsInterpolator::POINTS;
+  mLayerData.append( ld );
+}
+
+void TestQgsInterpolator::cleanupTestCase()
+{
+  delete mPointLayer;
+  QgsApplication::exitQgis();
+}
+
+bool TestQgsInterpolator::referenceIdw( double x, double y, int maxNeighbours, double searchRadius, double& result ) const
+{
+  QVector< QPair<double, int> > distances;
+  for ( int i = 0; i < mPoints.size(); ++i )
+  {
+    double distance = sqrt(( mPoints[i].x - x ) * ( mPoints[i].x - x ) + ( mPoints[i].y - y ) * ( mPoints[i].y - y ) );
+    if ( searchRadius > 0 && distance > searchRadius )
+    {
+      continue;
+    }
+    distances.append( qMakePair( distance, i ) );
+  }
+  if ( maxNeighbours > 0 && distances.size() > maxNeighbours )
+  {
+    std::sort( distances.begin(), distances.end() );
+    distances.resize( maxNeighbours );
+  }
+
+  double sumCounter = 0;
+  double sumDenominator = 0;
+  for ( int i = 0; i < distances.size(); ++i )
+  {
+    const vertexData& v = mPoints[distances[i].second];
+    if ( distances[i].first == 0 )
+    {
+      result = v.z;
+      return true;
+    }
+    double currentWeight = 1 / pow( distances[i].first, 2.0 );
+    sumCounter += currentWeight * v.z;
+    sumDenominator += currentWeight;
+  }
+  if ( sumDenominator == 0.0 )
+  {
+    return false;
+  }
+  result = sumCounter / sumDenominator;
+  return true;
+}
+
+void TestQgsInterpolator::compareIdw( QgsIDWInterpolator& interpolator, int maxNeighbours, double searchRadius ) const
+{
+  //positions inside and outside of the point extent, and on a data point
+  QList<QgsPoint> positions;
+  for ( int i = -2; i < 14; ++i )
+  {
+    for ( int j = -2; j < 12; ++j )
+    {
+      positions << QgsPoint( 600000 + i * 83.3, 200000 + j * 77.7 );
+    }
+  }
+  positions << QgsPoint( mPoints[17].x, mPoints[17].y );
+
+  foreach ( const QgsPoint& p, positions )
+  {
+    double expected = 0;
+    bool expectedOk = referenceIdw( p.x(), p.y(), maxNeighbours, searchRadius, expected );
+    double result = 0;
+    bool ok = interpolator.interpolatePoint( p.x(), p.y(), result ) == 0;
+    QCOMPARE( ok, expectedOk );
+    if ( ok )
+    {
+      QVERIFY( qgsDoubleNear( result, expected, 1E-9 * qMax( 1.0, qAbs( expected ) ) ) );
+    }
+  }
+}
+
+void TestQgsInterpolator::testIdwAllPoints()
+{
+  QgsIDWInterpolator interpolator( mLayerData );
+  compareIdw( interpolator, 0, 0 );
+
+  //the bucket index gives the same result for concurrent calls
+  QVERIFY( interpolator.prepareConcurrentInterpolation() );
+  compareIdw( interpolator, 0, 0 );
+}
+
+void TestQgsInterpolator::testIdwMaxNeighbours()
+{
+  QgsIDWInterpolator interpolator( mLayerData );
+  interpolator.setMaxNeighbours( 5 );
+  compareIdw( interpolator, 5, 0 );
+
+  interpolator.setMaxNeighbours( 1 );
+  compareIdw( interpolator, 1, 0 );
+}
+
+void TestQgsInterpolator::testIdwSearchRadius()
+{
+  QgsIDWInterpolator interpolator( mLayerData );
+  interpolator.setSearchRadius( 60 );
+  compareIdw( interpolator, 0, 60 );
+
+  interpolator.setMaxNeighbours( 3 );
+  compareIdw( interpolator, 3, 60 );
+}
+
+void TestQgsInterpolator::testTinGridRowsLinear()
+{
+  QgsTINInterpolator interpolator( mLayerData, QgsTINInterpolator::Linear );
+
+  //a grid reaching past the convex hull of the points on all sides
+  const int nCols = 37;
+  const int nRows = 31;
+  const double cellSize = 33.3;
+  const double xMin = 599900;
+  const double yMax = 200900;
+  const double noDataValue = -9999;
+  QVector<double> grid( nCols * nRows, 0 );
+  QVERIFY( interpolator.interpolateGridRows( xMin, yMax, cellSize, cellSize, nCols, nRows, grid.data(), noDataValue ) );
+
+  int inside = 0, outside = 0;
+  for ( int row = 0; row < nRows; ++row )
+  {
+    double y = yMax - ( row + 0.5 ) * cellSize;
+    for ( int col = 0; col < nCols; ++col )
+    {
+      double x = xMin + ( col + 0.5 ) * cellSize;
+      double expected = 0;
+      bool ok = interpolator.interpolatePoint( x, y, expected ) == 0;
+      double value = grid[row * nCols + col];
+      if ( ok )
+      {
+        QVERIFY( qgsDoubleNear( value, expected, 1E-6 * qMax( 1.0, qAbs( expected ) ) ) );
+        ++inside;
+      }
+      else
+      {
+        //outside of the convex hull
+        QCOMPARE( value, noDataValue );
+        ++outside;
+      }
+    }
+  }
+  QVERIFY( inside > nCols * nRows / 3 );
+  QVERIFY( outside > 2 * ( nCols + nRows ) );
+
+  //blocks of rows, as the grid file writer asks for them, give the same values
+  QVector<double> blocks( nCols * nRows, 0 );
+  for ( int blockStart = 0; blockStart < nRows; blockStart += 7 )
+  {
+    int blockRows = qMin( 7, nRows - blockStart );
+    QVERIFY( interpolator.interpolateGridRows( xMin, yMax - blockStart * cellSize, cellSize, cellSize, nCols, blockRows, blocks.data() + blockStart * nCols, noDataValue ) );
+  }
+  for ( int i = 0; i < grid.size(); ++i )
+  {
+    QVERIFY( qgsDoubleNear( blocks[i], grid[i], 1E-6 * qMax( 1.0, qAbs( grid[i] ) ) ) );
+  }
+}
+
+void TestQgsInterpolator::testTinGridRowsCloughTocher()
+{
+  QgsTINInterpolator interpolator( mLayerData, QgsTINInterpolator::CloughTocher );
+
+  //Clough-Tocher patches are not interpolated row by row, the data is left alone for the cell by cell fallback
+  QVector<double> grid( 4 * 3, 42 );
+  QVERIFY( !interpolator.interpolateGridRows( 600100, 200700, 50, 50, 4, 3, grid.data(), -9999 ) );
+  foreach ( double value, grid )
+  {
+    QCOMPARE( value, 42.0 );
+  }
+
+  //which gives nodata outside of the convex hull
+  double result = 0;
+  QVERIFY( interpolator.interpolatePoint( 600500, 200400, result ) == 0 );
+  QVERIFY( interpolator.interpolatePoint( 599000, 199000, result ) != 0 );
+  QVERIFY( interpolator.interpolatePoint( 601500, 200400, result ) != 0 );
+}
+
+void TestQgsInterpolator::testGridFileWriter()
+{
+  QgsIDWInterpolator interpolator( mLayerData );
+  QString outputPath = QDir::tempPath() + QDir::separator() + "qgis_test_idw.asc";
+  QFile::remove( outputPath );
+
+  int nCols = 25;
+  int nRows = 20;
+  double cellSize = 40;
+  QgsRectangle extent( 600000, 200000, 600000 + nCols * cellSize, 200000 + nRows * cellSize );
+  QgsGridFileWriter writer( &interpolator, outputPath, extent, nCols, nRows, cellSize, cellSize );
+  QCOMPARE( writer.writeFile( false ), 0 );
+
+  //read the values of the ascii grid after its six header lines
+  QFile outputFile( outputPath );
+  QVERIFY( outputFile.open( QIODevice::ReadOnly ) );
+  QTextStream stream( &outputFile );
+  for ( int i = 0; i < 6; ++i )
+  {
+    stream.readLine();
+  }
+  QStringList values = stream.readAll().split( QRegExp( "\\s+" ), QString::SkipEmptyParts );
+  QCOMPARE( values.size(), nCols * nRows );
+
+  for ( int i = 0; i < nRows; ++i )
+  {
+    double y = extent.yMaximum() - ( i + 0.5 ) * cellSize;
+    for ( int j = 0; j < nCols; ++j )
+    {
+      double x = extent.xMinimum() + ( j + 0.5 ) * cellSize;
+      double expected = 0;
+      QVERIFY( referenceIdw( x, y, 0, 0, expected ) );
+      //the grid is written as float64, without loss of precision
+      QVERIFY( qgsDoubleNear( values.at( i * nCols + j ).toDouble(), expected, 1E-9 * qMax( 1.0, qAbs( expected ) ) ) );
+    }
+  }
+
+  outputFile.close();
+  QFile::remove( outputPath );
+}
+
+QTEST_MAIN( TestQgsInterpolator )
+#include "testqgsinterpolator.moc"
@@ -0,0 +1,157 @@
+/***************************************************************************
+     testqgslinevectorlayerdirector.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QtTest/QtTest>
+
+#include "qgsapplication.h"
+#include "qgsgeometry.h"
+#include "qgsgraph.h"
+#include "qgsgraphbuilder.h"
+#include "qgslinevectorlayerdirector.h"
+#include "qgsvectordataprovider.h"
+#include "qgsvectorlayer.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for tying additional points to the lines of a network layer. From some
+ * points on, the closest lines are looked up in a spatial index. The points tied that way are
+ * compared with the points tied one at a time, which checks all the lines
+ */
+class TestQgsLineVectorLayerDirector : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsLineVectorLayerDirector();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testIndexedTiePoints();
+
+  private:
+    QgsVectorLayer* mLayer;
+
+    /**Builds the graph of the layer with the additional points and returns the tied points*/
+    QVector<QgsPoint> tiePoints( const QVector<QgsPoint>& additionalPoints ) const;
+};
+
+TestQgsLineVectorLayerDirector::TestQgsLineVectorLayerDirector()
+    : mLayer( NULL )
+{
+
+}
+
+void TestQgsLineVectorLayerDirector::initTestCase()
+{
+  QgsApplication::init();
+  QgsApplication::initQgis();
+  QgsApplication::showSettings();
+
+  //pseudo random lines and multi lines, and parallel lines for points with the same distance to several segments
+  mLayer = new QgsVectorLayer( "MultiLineString?crs=epsg:21781", "network", "memory" );
+  QVERIFY( mLayer->isValid() );
+  QgsFeatureList features;
+  unsigned int seed = 4711;
+  for ( int i = 0; i < 300; ++i )
+  {
+    QgsMultiPolyline lines;
+    int nParts = i % 5 == 0 ? 2 : 1;
+    for ( int part = 0; part < nParts; ++part )
+    {
+      QgsPolyline line;
+      seed = seed * 1103515245 + 12345;
+      double x = ( seed >> 8 ) % 100000 / 10.0;
+      seed = seed * 1103515245 + 12345;
+      double y = ( seed >> 8 ) % 100000 / 10.0;
+      line << QgsPoint( x, y );
+      for ( int j = 0; j < 4; ++j )
+      {
+        seed = seed * 1103515245 + 12345;
+        x += ( int )(( seed >> 8 ) % 600 ) - 300;
+        seed = seed * 1103515245 + 12345;
+        y += ( int )(( seed >> 8 ) % 600 ) - 300;
+        line << QgsPoint( x, y );
+      }
+      lines << line;
+    }
+    QgsFeature f;
+    f.setGeometry( QgsGeometry::fromMultiPolyline( lines ) );
+    features << f;
+  }
+  for ( int i = 0; i < 3; ++i )
+  {
+    QgsPolyline line;
+    line << QgsPoint( 20000, 20000 + i * 100 ) << QgsPoint( 21000, 20000 + i * 100 );
+    QgsFeature f;
+    f.setGeometry( QgsGeometry::fromMultiPolyline( QgsMultiPolyline() << line ) );
+    features << f;
+  }
+  QVERIFY( mLayer->dataProvider()->addFeatures( features ) );
+}
+
+void TestQgsLineVectorLayerDirector::cleanupTestCase()
+{
+  delete mLayer;
+  QgsApplication::exitQgis();
+}
+
+QVector<QgsPoint> TestQgsLineVectorLayerDirector::tiePoints( const QVector<QgsPoint>& additionalPoints ) const
+{
+  QgsLineVectorLayerDirector director( mLayer, -1, QString(), QString(), QString(), 3 );
+  QgsGraphBuilder builder( mLayer->crs(), false );
+  QVector<QgsPoint> tiedPoints;
+  director.makeGraph( &builder, additionalPoints, tiedPoints );
+  return tiedPoints;
+}
+
+void TestQgsLineVectorLayerDirector::testIndexedTiePoints()
+{
+  //points within and around the network, on vertices, and between the parallel lines
+  QVector<QgsPoint> points;
+  unsigned int seed = 815;
+  for ( int i = 0; i < 60; ++i )
+  {
+    seed = seed * 1103515245 + 12345;
+    double x = ( seed >> 8 ) % 140000 / 10.0 - 2000;
+    seed = seed * 1103515245 + 12345;
+    double y = ( seed >> 8 ) % 140000 / 10.0 - 2000;
+    points << QgsPoint( x, y );
+  }
+  QgsFeature f;
+  QgsFeatureIterator fit = mLayer->getFeatures();
+  for ( int i = 0; i < 5 && fit.nextFeature( f ); ++i )
+  {
+    points << f.geometry()->vertexAt( 2 );
+  }
+  points << QgsPoint( 20500, 20050 ) << QgsPoint( 20500, 20150 ) << QgsPoint( 19000, 20100 ) << QgsPoint( 30000, 30000 );
+
+  QVector<QgsPoint> indexed = tiePoints( points );
+  QCOMPARE( indexed.size(), points.size() );
+  for ( int i = 0; i < points.size(); ++i )
+  {
+    QVector<QgsPoint> scanned = tiePoints( QVector<QgsPoint>() << points[i] );
+    QCOMPARE( scanned.size(), 1 );
+    QCOMPARE( indexed[i], scanned[0] );
+  }
+
+  //equidistant lines: the first line in feature order wins
+  QCOMPARE( indexed[points.size() - 4], QgsPoint( 20500, 20000 ) );
+  QCOMPARE( indexed[points.size() - 3], QgsPoint( 20500, 20100 ) );
+}
+
+QTEST_MAIN( TestQgsLineVectorLayerDirector )
+#include "testqgslinevectorlayerdirector.moc"
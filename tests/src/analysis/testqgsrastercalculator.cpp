@@ -0,0 +1,288 @@
+/***************************************************************************
+     testqgsrastercalculator.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QtTest/QtTest>
+#include <cmath>
+#include <limits>
+
+#include <gdal.h>
+
+#include "qgsapplication.h"
+#include "qgscoordinatereferencesystem.h"
+#include "qgsrastercalcnode.h"
+#include "qgsrastercalcprogram.h"
+#include "qgsrastercalculator.h"
+#include "qgsrasterlayer.h"
+#include "qgsrastermatrix.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for the raster calculator. The compiled formula programs are compared with
+ * the evaluation of the formula tree by QgsRasterCalcNode::calculate
+ */
+class TestQgsRasterCalculator : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsRasterCalculator();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testProgram_data();
+    void testProgram();
+    void testPartialOverlap();
+
+  private:
+    QVector<float> mDataA;
+    QVector<float> mDataB;
+
+    /**Evaluates the formula tree on the cells of the two inputs. Nodata cells are set to outputNodata*/
+    static bool calculateTree( const QString& formula, const QVector<float>& a, double nodataA, const QVector<float>& b, double nodataB, float outputNodata, QVector<float>& result );
+    /**Compares two results cell by cell*/
+    static void compareResults( const QVector<float>& result, const QVector<float>& expected );
+    static QString createRaster( const QString& name, const double gtrans[6], int width, int height, const QVector<float>& data, double nodata );
+};
+
+static const double sNodataA = -9999;
+static const double sNodataB = -5555;
+
+TestQgsRasterCalculator::TestQgsRasterCalculator()
+{
+
+}
+
+void TestQgsRasterCalculator::initTestCase()
+{
+  QgsApplication::init();
+  QgsApplication::initQgis();
+  QgsApplication::showSettings();
+  GDALAllRegister();
+
+  //values around 0 (for the divisions, roots and powers), with some nodata cells.
+  //More cells than a strip of the program
+  int nCells = 3 * QgsRasterCalcProgram::sStripSize + 17;
+  for ( int i = 0; i < nCells; ++i )
+  {
+    mDataA.append( i % 37 == 0 ? sNodataA : ( i % 23 ) - 6.5f );
+    mDataB.append( i % 41 == 0 ? sNodataB : ( i % 13 ) * 0.25f - 1.0f );
+  }
+}
+
+void TestQgsRasterCalculator::cleanupTestCase()
+{
+  QgsApplication::exitQgis();
+}
+
+bool TestQgsRasterCalculator::calculateTree( const QString& formula, const QVector<float>& a, double nodataA, const QVector<float>& b, double nodataB, float outputNodata, QVector<float>& result )
+{
+  QString errorString;
+  QgsRasterCalcNode* node = QgsRasterCalcNode::parseRasterCalcString( formula, errorString );
+  if ( !node )
+  {
+    return false;
+  }
+
+  float* dataA = new float[a.size()];
+  std::copy( a.constBegin(), a.constEnd(), dataA );
+  float* dataB = new float[b.size()];
+  std::copy( b.constBegin(), b.constEnd(), dataB );
+  QgsRasterMatrix matrixA( a.size(), 1, dataA, nodataA );
+  QgsRasterMatrix matrixB( b.size(), 1, dataB, nodataB );
+  QMap<QString, QgsRasterMatrix*> rasterData;
+  rasterData.insert( "a@1", &matrixA );
+  rasterData.insert( "b@1", &matrixB );
+
+  QgsRasterMatrix resultMatrix;
+  bool ok = node->calculate( rasterData, resultMatrix );
+  delete node;
+  if ( !ok )
+  {
+    return false;
+  }
+
+  result.resize( a.size() );
+  for ( int i = 0; i < a.size(); ++i )
+  {
+    float value = resultMatrix.isNumber() ? resultMatrix.number() : resultMatrix.data()[i];
+    result[i] = value == resultMatrix.nodataValue() ? outputNodata : value;
+  }
+  return true;
+}
+
+void TestQgsRasterCalculator::compareResults( const QVector<float>& result, const QVector<float>& expected )
+{
+  QCOMPARE( result.size(), expected.size() );
+  for ( int i = 0; i < result.size(); ++i )
+  {
+    if ( qIsNaN( expected[i] ) )
+    {
+      QVERIFY( qIsNaN( result[i] ) );
+      continue;
+    }
+    QVERIFY2( qgsDoubleNear( result[i], expected[i], 1E-6 * qMax( 1.0f, qAbs( expected[i] ) ) ),
+              QString( "cell %1: %2 instead of %3" ).arg( i ).arg( result[i] ).arg( expected[i] ).toLocal8Bit().constData() );
+  }
+}
+
+QString TestQgsRasterCalculator::createRaster( const QString& name, const double gtrans[6], int width, int height, const QVector<float>& data, double nodata )
+{
+  QString path = QDir::tempPath() + QDir::separator() + name;
+  QFile::remove( path );
+  GDALDatasetH dataset = GDALCreate( GDALGetDriverByName( "GTiff" ), path.toLocal8Bit().data(), width, height, 1, GDT_Float32, NULL );
+  if ( !dataset )
+  {
+    return QString();
+  }
+  GDALSetGeoTransform( dataset, const_cast<double*>( gtrans ) );
+  GDALSetProjection( dataset, QgsCoordinateReferenceSystem( "EPSG:21781" ).toWkt().toLocal8Bit().data() );
+  GDALRasterBandH band = GDALGetRasterBand( dataset, 1 );
+  GDALSetRasterNoDataValue( band, nodata );
+  CPLErr err = GDALRasterIO( band, GF_Write, 0, 0, width, height, const_cast<float*>( data.constData() ), width, height, GDT_Float32, 0, 0 );
+  GDALClose( dataset );
+  return err == CE_None ? path : QString();
+}
+
+void TestQgsRasterCalculator::testProgram_data()
+{
+  QTest::addColumn<QString>( "formula" );
+
+  QTest::newRow( "plus" ) << "a@1 + b@1";
+  QTest::newRow( "arithmetic" ) << "a@1 - 2 * b@1 / ( b@1 - 0.5 ) + 3";
+  QTest::newRow( "division by zero" ) << "a@1 / b@1";
+  QTest::newRow( "power" ) << "a@1 ^ 0.5 + b@1 ^ 2 + 2 ^ b@1";
+  QTest::newRow( "functions" ) << "sqrt( a@1 ) * cos( b@1 ) - sin( a@1 ) + tan( b@1 )";
+  QTest::newRow( "inverse functions" ) << "asin( b@1 ) + acos( b@1 / 2 ) + atan( a@1 )";
+  QTest::newRow( "comparisons" ) << "( a@1 > b@1 ) + ( a@1 < 0 ) + ( a@1 >= b@1 ) + ( b@1 <= 0.5 ) + ( a@1 = 3.5 ) + ( a@1 != b@1 )";
+  QTest::newRow( "logical" ) << "( a@1 > 0 AND b@1 > 0 ) OR a@1 = -6.5";
+  QTest::newRow( "sign" ) << "-a@1 * -( b@1 + 1 )";
+  QTest::newRow( "constant subexpression" ) << "a@1 * ( 2 ^ 3 - sqrt( 16 ) ) + b@1 / ( 4 - 2 * 2 )";
+}
+
+void TestQgsRasterCalculator::testProgram()
+{
+  QFETCH( QString, formula );
+
+  float outputNodata = -std::numeric_limits<float>::max();
+  QVector<float> expected;
+  QVERIFY( calculateTree( formula, mDataA, sNodataA, mDataB, sNodataB, outputNodata, expected ) );
+
+  QString errorString;
+  QgsRasterCalcNode* node = QgsRasterCalcNode::parseRasterCalcString( formula, errorString );
+  QVERIFY( node );
+  QMap<QString, int> inputs;
+  inputs.insert( "a@1", 0 );
+  inputs.insert( "b@1", 1 );
+  QVector<double> inputNodata;
+  inputNodata << sNodataA << sNodataB;
+  QgsRasterCalcProgram program;
+  bool compiled = program.compile( node, inputs, inputNodata );
+  delete node;
+  QVERIFY( compiled );
+
+  //evaluate in strips, the last one shorter
+  QVector<float> result( mDataA.size() );
+  QVector<float> scratch( program.scratchSize() );
+  for ( int offset = 0; offset < mDataA.size(); offset += QgsRasterCalcProgram::sStripSize )
+  {
+    int n = qMin( QgsRasterCalcProgram::sStripSize, mDataA.size() - offset );
+    const float* stripInputs[2] = { mDataA.constData() + offset, mDataB.constData() + offset };
+    program.evaluate( stripInputs, n, scratch.data(), outputNodata, result.data() + offset );
+  }
+  compareResults( result, expected );
+}
+
+void TestQgsRasterCalculator::testPartialOverlap()
+{
+  //raster a: 30 x 20 cells of 10m. Raster b: 12 x 25 cells of 15m, covering a part of raster a and
+  //reaching over its right and lower border. No cell border of b goes through a cell center of a
+  int widthA = 30, heightA = 20;
+  double gtransA[6] = { 600000, 10, 0, 200200, 0, -10 };
+  QVector<float> dataA( widthA * heightA );
+  for ( int i = 0; i < dataA.size(); ++i )
+  {
+    dataA[i] = i % 31 == 0 ? sNodataA : i * 0.5f;
+  }
+  int widthB = 12, heightB = 25;
+  double gtransB[6] = { 600127, 15, 0, 200113, 0, -15 };
+  QVector<float> dataB( widthB * heightB );
+  for ( int i = 0; i < dataB.size(); ++i )
+  {
+    dataB[i] = i % 17 == 0 ? sNodataB : 1000 + i;
+  }
+  QString pathA = createRaster( "qgis_test_rastercalc_a.tif", gtransA, widthA, heightA, dataA, sNodataA );
+  QString pathB = createRaster( "qgis_test_rastercalc_b.tif", gtransB, widthB, heightB, dataB, sNodataB );
+  QVERIFY( !pathA.isEmpty() && !pathB.isEmpty() );
+
+  QgsRasterLayer* layerA = new QgsRasterLayer( pathA, "a", "gdal" );
+  QgsRasterLayer* layerB = new QgsRasterLayer( pathB, "b", "gdal" );
+  QVERIFY( layerA->isValid() && layerB->isValid() );
+  QVector<QgsRasterCalculatorEntry> entries;
+  QgsRasterCalculatorEntry entryA = { "a@1", layerA, 1 };
+  QgsRasterCalculatorEntry entryB = { "b@1", layerB, 1 };
+  entries << entryA << entryB;
+
+  //output in the grid of raster a
+  QString formula = "a@1 * 2 + b@1";
+  QString outputPath = QDir::tempPath() + QDir::separator() + "qgis_test_rastercalc_out.tif";
+  QFile::remove( outputPath );
+  QgsRectangle extent( gtransA[0], gtransA[3] + heightA * gtransA[5], gtransA[0] + widthA * gtransA[1], gtransA[3] );
+  QgsRasterCalculator calculator( formula, outputPath, "GTiff", extent, widthA, heightA, entries );
+  QCOMPARE( calculator.processCalculation(), 0 );
+
+  GDALDatasetH outputDataset = GDALOpen( outputPath.toLocal8Bit().data(), GA_ReadOnly );
+  QVERIFY( outputDataset );
+  GDALRasterBandH outputBand = GDALGetRasterBand( outputDataset, 1 );
+  float outputNodata = GDALGetRasterNoDataValue( outputBand, NULL );
+  QVector<float> result( widthA * heightA );
+  CPLErr err = GDALRasterIO( outputBand, GF_Read, 0, 0, widthA, heightA, result.data(), widthA, heightA, GDT_Float32, 0, 0 );
+  GDALClose( outputDataset );
+  QCOMPARE( err, CE_None );
+
+  //raster b resampled to the grid of raster a: the b cell containing the center of the a cell, nodata outside of b
+  QVector<float> resampledB( widthA * heightA );
+  int overlapping = 0;
+  for ( int row = 0; row < heightA; ++row )
+  {
+    double y = gtransA[3] + ( row + 0.5 ) * gtransA[5];
+    for ( int col = 0; col < widthA; ++col )
+    {
+      double x = gtransA[0] + ( col + 0.5 ) * gtransA[1];
+      int colB = ( int ) floor(( x - gtransB[0] ) / gtransB[1] );
+      int rowB = ( int ) floor(( y - gtransB[3] ) / gtransB[5] );
+      bool inB = colB >= 0 && colB < widthB && rowB >= 0 && rowB < heightB;
+      resampledB[row * widthA + col] = inB ? dataB[rowB * widthB + colB] : sNodataB;
+      overlapping += inB;
+    }
+  }
+  QVERIFY( overlapping > 0 && overlapping < widthA * heightA );
+
+  QVector<float> expected;
+  QVERIFY( calculateTree( formula, dataA, sNodataA, resampledB, sNodataB, outputNodata, expected ) );
+  compareResults( result, expected );
+
+  delete layerA;
+  delete layerB;
+  QFile::remove( pathA );
+  QFile::remove( pathB );
+  QFile::remove( outputPath );
+}
+
+QTEST_MAIN( TestQgsRasterCalculator )
+#include "testqgsrastercalculator.moc"
@@ -0,0 +1,462 @@
+/***************************************************************************
+     testqgsviewshed.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QPolygon>
+#include <QThreadPool>
+#include <QtTest/QtTest>
+#include <cmath>
+#include <qmath.h>
+
+#include <gdal.h>
+
+#include "qgsapplication.h"
+#include "qgscoordinatereferencesystem.h"
+#include "qgspoint.h"
+#include "qgsviewshed.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for the viewshed computation. The viewsheds of observers on both sides of a wall
+ * on flat terrain are checked cell by cell, the concurrently traced viewshed is compared with a
+ * sequential reference trace, and the viewsheds of several observers computed at once are compared
+ * with the viewsheds computed for each observer on its own
+ */
+class TestQgsViewshed : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsViewshed();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testKnownCells();
+    void testSequentialReference();
+    void testPerObserverBands();
+    void testCumulativeCount();
+
+  private:
+    QgsCoordinateReferenceSystem mCrs;
+    QString mDemPath;
+    QString mWallDemPath;
+    QVector<QgsPoint> mObservers;
+
+    /**Reads a band of a raster file, with its geotransform and size*/
+    static bool readBand( const QString& path, int band, QVector<float>& data, double gtrans[6], int& width, int& height );
+    /**Checks the viewshed of an observer 40 pixels away from the wall of the wall DEM. Within the radius, the cells on the
+     * side of the observer and the wall are visible and the cells behind the wall are not. Outside the radius, no cell is visible*/
+    static void checkWallViewshed( const QVector<float>& viewshed, const double gtrans[6], int width, int height, int observerCol, int observerRow );
+    /**Traces the viewshed of an observer on the north-up DEM ray by ray, like the sequential implementation did,
+     * without the samples outside of the heightmap. Heights are relative to the terrain, in the units of the DEM*/
+    static bool referenceViewshed( const QString& demPath, const QgsPoint& observerPos, double observerHeight, double targetHeight, double radius,
+                                   const QVector<QgsPoint>& filterRegion, int accuracyFactor, QVector<unsigned char>& viewshed, int& width, int& height );
+};
+
+TestQgsViewshed::TestQgsViewshed()
+{
+
+}
+
+void TestQgsViewshed::initTestCase()
+{
+  QgsApplication::init();
+  QgsApplication::initQgis();
+  QgsApplication::showSettings();
+  GDALAllRegister();
+
+  mCrs.createFromOgcWmsCrs( "EPSG:21781" );
+  QVERIFY( mCrs.isValid() );
+
+  //200 x 200 pixel terrain with hills and valleys, 10m pixels
+  mDemPath = QDir::tempPath() + QDir::separator() + "qgis_test_viewshed_dem.tif";
+  QFile::remove( mDemPath );
+  const int size = 200;
+  GDALDatasetH dem = GDALCreate( GDALGetDriverByName( "GTiff" ), mDemPath.toLocal8Bit().data(), size, size, 1, GDT_Float32, NULL );
+  QVERIFY( dem );
+  double gtrans[6] = { 600000, 10, 0, 202000, 0, -10 };
+  GDALSetGeoTransform( dem, gtrans );
+  GDALSetProjection( dem, mCrs.toWkt().toLocal8Bit().data() );
+  GDALRasterBandH band = GDALGetRasterBand( dem, 1 );
+  GDALSetRasterNoDataValue( band, -9999 );
+  QVector<float> heights( size * size );
+  for ( int row = 0; row < size; ++row )
+  {
+    for ( int col = 0; col < size; ++col )
+    {
+      heights[row * size + col] = 500 + 40 * sin( col / 13.0 ) * cos( row / 17.0 ) + 0.3 * col;
+    }
+  }
+  QCOMPARE( GDALRasterIO( band, GF_Write, 0, 0, size, size, heights.data(), size, size, GDT_Float32, 0, 0 ), CE_None );
+  GDALClose( dem );
+
+  //flat terrain at 500m with a wall of 50m along column 120
+  mWallDemPath = QDir::tempPath() + QDir::separator() + "qgis_test_viewshed_wall.tif";
+  QFile::remove( mWallDemPath );
+  GDALDatasetH wallDem = GDALCreate( GDALGetDriverByName( "GTiff" ), mWallDemPath.toLocal8Bit().data(), size, size, 1, GDT_Float32, NULL );
+  QVERIFY( wallDem );
+  GDALSetGeoTransform( wallDem, gtrans );
+  GDALSetProjection( wallDem, mCrs.toWkt().toLocal8Bit().data() );
+  for ( int row = 0; row < size; ++row )
+  {
+    for ( int col = 0; col < size; ++col )
+    {
+      heights[row * size + col] = col == 120 ? 550 : 500;
+    }
+  }
+  QCOMPARE( GDALRasterIO( GDALGetRasterBand( wallDem, 1 ), GF_Write, 0, 0, size, size, heights.data(), size, size, GDT_Float32, 0, 0 ), CE_None );
+  GDALClose( wallDem );
+
+  //observers with overlapping and clipped windows
+  mObservers << QgsPoint( 600705, 201295 ) << QgsPoint( 601005, 201105 ) << QgsPoint( 600205, 200305 ) << QgsPoint( 601805, 200605 );
+}
+
+void TestQgsViewshed::cleanupTestCase()
+{
+  QFile::remove( mDemPath );
+  QFile::remove( mWallDemPath );
+  QgsApplication::exitQgis();
+}
+
+bool TestQgsViewshed::readBand( const QString& path, int band, QVector<float>& data, double gtrans[6], int& width, int& height )
+{
+  GDALDatasetH dataset = GDALOpen( path.toLocal8Bit().data(), GA_ReadOnly );
+  if ( !dataset )
+  {
+    return false;
+  }
+  width = GDALGetRasterXSize( dataset );
+  height = GDALGetRasterYSize( dataset );
+  GDALGetGeoTransform( dataset, gtrans );
+  data.resize( width * height );
+  CPLErr err = GDALRasterIO( GDALGetRasterBand( dataset, band ), GF_Read, 0, 0, width, height, data.data(), width, height, GDT_Float32, 0, 0 );
+  GDALClose( dataset );
+  return err == CE_None;
+}
+
+void TestQgsViewshed::checkWallViewshed( const QVector<float>& viewshed, const double gtrans[6], int width, int height, int observerCol, int observerRow )
+{
+  //the pixels of the output are the pixels of the DEM
+  QCOMPARE( gtrans[1], 10.0 );
+  QCOMPARE( gtrans[5], -10.0 );
+  int colOffset = qRound(( gtrans[0] - 600000 ) / 10 );
+  int rowOffset = qRound(( gtrans[3] - 202000 ) / -10 );
+
+  int visible = 0;
+  int invisible = 0;
+  for ( int row = 0; row < height; ++row )
+  {
+    for ( int col = 0; col < width; ++col )
+    {
+      int demCol = colOffset + col;
+      int demRow = rowOffset + row;
+      int distSqr = ( demCol - observerCol ) * ( demCol - observerCol ) + ( demRow - observerRow ) * ( demRow - observerRow );
+      float value = viewshed[row * width + col];
+      if ( distSqr > 41 * 41 )
+      {
+        QCOMPARE( value, 0.f );
+      }
+      else if ( distSqr <= 39 * 39 )
+      {
+        bool behindWall = observerCol < 120 ? demCol > 120 : demCol < 120;
+        QCOMPARE( value, behindWall ? 0.f : 255.f );
+        visible += !behindWall;
+        invisible += behindWall;
+      }
+    }
+  }
+  QVERIFY( visible > 1000 );
+  QVERIFY( invisible > 100 );
+}
+
+bool TestQgsViewshed::referenceViewshed( const QString& demPath, const QgsPoint& observerPos, double observerHeight, double targetHeight, double radius,
+    const QVector<QgsPoint>& filterRegion, int accuracyFactor, QVector<unsigned char>& viewshed, int& width, int& height )
+{
+  GDALDatasetH dataset = GDALOpen( demPath.toLocal8Bit().data(), GA_ReadOnly );
+  if ( !dataset )
+  {
+    return false;
+  }
+  GDALRasterBandH band = GDALGetRasterBand( dataset, 1 );
+  float noDataValue = GDALGetRasterNoDataValue( band, NULL );
+  double gtrans[6];
+  GDALGetGeoTransform( dataset, gtrans );
+
+  int obs[2] = { qRound(( observerPos.x() - gtrans[0] ) / gtrans[1] ), qRound(( observerPos.y() - gtrans[3] ) / gtrans[5] ) };
+  int colStart = qMax( 0, qFloor(( observerPos.x() - radius - gtrans[0] ) / gtrans[1] ) );
+  int colEnd = qMin( GDALGetRasterXSize( dataset ) - 1, qCeil(( observerPos.x() + radius - gtrans[0] ) / gtrans[1] ) );
+  int rowStart = qMax( 0, qFloor(( observerPos.y() + radius - gtrans[3] ) / gtrans[5] ) );
+  int rowEnd = qMin( GDALGetRasterYSize( dataset ) - 1, qCeil(( observerPos.y() - radius - gtrans[3] ) / gtrans[5] ) );
+  QPolygon filterPoly;
+  foreach ( const QgsPoint& p, filterRegion )
+  {
+    filterPoly << QPoint( qRound(( p.x() - gtrans[0] ) / gtrans[1] ) / accuracyFactor, qRound(( p.y() - gtrans[3] ) / gtrans[5] ) / accuracyFactor );
+  }
+
+  //the whole window in one read
+  width = ( colEnd - colStart + 1 ) / accuracyFactor;
+  height = ( rowEnd - rowStart + 1 ) / accuracyFactor;
+  QVector<float> heightmap( width * height );
+  GDALRasterIOExtraArg rioargs;
+  INIT_RASTERIO_EXTRA_ARG( rioargs );
+  rioargs.eResampleAlg = GRIORA_Average;
+  CPLErr err = GDALRasterIOEx( band, GF_Read, colStart, rowStart, colEnd - colStart + 1, rowEnd - rowStart + 1, heightmap.data(), width, height, GDT_Float32, 0, 0, &rioargs );
+  GDALClose( dataset );
+  if ( err != CE_None )
+  {
+    return false;
+  }
+
+  gtrans[1] *= accuracyFactor;
+  gtrans[5] *= accuracyFactor;
+  colStart /= accuracyFactor;
+  colEnd /= accuracyFactor;
+  rowStart /= accuracyFactor;
+  rowEnd /= accuracyFactor;
+  obs[0] /= accuracyFactor;
+  obs[1] /= accuracyFactor;
+
+  observerHeight += heightmap[( obs[1] - rowStart ) * width + ( obs[0] - colStart )];
+  int roi = .5 * qMin( width, height );
+  viewshed.fill( 0, width * height );
+  for ( int radiusNumber = 0; radiusNumber < 8 * roi; ++radiusNumber )
+  {
+    int target[2];
+    if ( radiusNumber <= roi )
+    {
+      target[0] = obs[0] + roi;
+      target[1] = obs[1] + radiusNumber;
+    }
+    else if ( radiusNumber <= 3 * roi )
+    {
+      target[0] = obs[0] + 2 * roi - radiusNumber;
+      target[1] = obs[1] + roi;
+    }
+    else if ( radiusNumber <= 5 * roi )
+    {
+      target[0] = obs[0] - roi;
+      target[1] = obs[1] + 4 * roi - radiusNumber;
+    }
+    else if ( radiusNumber <= 7 * roi )
+    {
+      target[0] = obs[0] + radiusNumber - 6 * roi;
+      target[1] = obs[1] - roi;
+    }
+    else
+    {
+      target[0] = obs[0] + roi;
+      target[1] = obs[1] + radiusNumber - 8 * roi;
+    }
+
+    int delta[2] = { target[0] - obs[0], target[1] - obs[1] };
+    int inciny = qAbs( delta[0] ) < qAbs( delta[1] );
+    double slope = ( double ) delta[1 - inciny] / ( double ) delta[inciny];
+    int step = delta[inciny] > 0 ? 1 : -1;
+    double horizonSlope = -99999;
+    for ( int i = step; true; i += step )
+    {
+      int p[2];
+      p[inciny] = obs[inciny] + i;
+      p[1 - inciny] = obs[1 - inciny] + ( i * slope > 0 ? int( qCeil( i * slope - 0.5 ) ) : int( qFloor( i * slope + 0.5 ) ) );
+      if ( p[0] < colStart || p[0] > colEnd || p[1] < rowStart || p[1] > rowEnd )
+      {
+        break;
+      }
+      double dx = qAbs( p[0] - obs[0] ), dy = qAbs( p[1] - obs[1] );
+      if ( !( dx <= roi && dy <= roi && dx * dx + dy * dy <= double( roi ) * double( roi ) ) )
+      {
+        break;
+      }
+      if ( !filterPoly.isEmpty() && !filterPoly.containsPoint( QPoint( p[0], p[1] ), Qt::OddEvenFill ) )
+      {
+        continue;
+      }
+      int col = p[0] - colStart;
+      int row = p[1] - rowStart;
+      if ( col >= width || row >= height )
+      {
+        continue;
+      }
+      float pElev = heightmap[row * width + col];
+      if ( pElev == noDataValue )
+      {
+        continue;
+      }
+      double pGeoX = gtrans[0] + p[0] * gtrans[1];
+      double pGeoY = gtrans[3] + p[1] * gtrans[5];
+      double geoDistSqr = ( observerPos.x() - pGeoX ) * ( observerPos.x() - pGeoX ) + ( observerPos.y() - pGeoY ) * ( observerPos.y() - pGeoY );
+      pElev -= 0.87 * geoDistSqr / ( 2 * 6370000. );
+
+      double dist = qAbs( p[inciny] - obs[inciny] );
+      horizonSlope = qMax( horizonSlope, ( pElev - observerHeight ) / dist );
+      viewshed[row * width + col] = targetHeight + pElev >= observerHeight + horizonSlope * dist ? 255 : 0;
+    }
+  }
+  viewshed[( obs[1] - rowStart ) * width + ( obs[0] - colStart )] = 255;
+  return true;
+}
+
+void TestQgsViewshed::testKnownCells()
+{
+  //observers 20 pixels west and east of the wall, with a radius of 40 pixels
+  QgsPoint west( 601000, 201000 );
+  QgsPoint east( 601400, 201000 );
+
+  QString path = QDir::tempPath() + QDir::separator() + "qgis_test_viewshed.tif";
+  QFile::remove( path );
+  QVERIFY( QgsViewshed::computeViewshed( mWallDemPath, path, "GTiff", west, mCrs, 2, 1, true, 400, QGis::Meters ) );
+  QVector<float> single;
+  double gtrans[6];
+  int width, height;
+  QVERIFY( readBand( path, 1, single, gtrans, width, height ) );
+  QFile::remove( path );
+  checkWallViewshed( single, gtrans, width, height, 100, 100 );
+
+  QVERIFY( QgsViewshed::computeViewsheds( mWallDemPath, path, "GTiff", QVector<QgsPoint>() << west << east, mCrs, 2, 1, true, 400, QGis::Meters, QgsViewshed::PerObserverBands ) );
+  QVector<float> band1, band2;
+  QVERIFY( readBand( path, 1, band1, gtrans, width, height ) );
+  QVERIFY( readBand( path, 2, band2, gtrans, width, height ) );
+  QFile::remove( path );
+  checkWallViewshed( band1, gtrans, width, height, 100, 100 );
+  checkWallViewshed( band2, gtrans, width, height, 140, 100 );
+}
+
+void TestQgsViewshed::testSequentialReference()
+{
+  //the radius reaches past the east edge of the DEM and, at half the resolution, the window is one column wider than the heightmap
+  QgsPoint observer( 601912, 200993 );
+  QVector<QgsPoint> filter;
+  filter << QgsPoint( 601503, 201437 ) << QgsPoint( 602097, 201312 ) << QgsPoint( 602097, 200512 ) << QgsPoint( 601688, 200694 ) << QgsPoint( 601803, 201006 );
+
+  int maxThreadCount = QThreadPool::globalInstance()->maxThreadCount();
+  QThreadPool::globalInstance()->setMaxThreadCount( 4 );
+  for ( int accuracyFactor = 1; accuracyFactor <= 2; ++accuracyFactor )
+  {
+    for ( int filtered = 0; filtered < 2; ++filtered )
+    {
+      QVector<QgsPoint> filterRegion = filtered ? filter : QVector<QgsPoint>();
+      QString path = QDir::tempPath() + QDir::separator() + "qgis_test_viewshed.tif";
+      QFile::remove( path );
+      QVERIFY( QgsViewshed::computeViewshed( mDemPath, path, "GTiff", observer, mCrs, 2, 1, true, 500, QGis::Meters, filterRegion, true, accuracyFactor ) );
+
+      QVector<float> traced;
+      double gtrans[6];
+      int width, height;
+      QVERIFY( readBand( path, 1, traced, gtrans, width, height ) );
+      QFile::remove( path );
+
+      QVector<unsigned char> reference;
+      int referenceWidth, referenceHeight;
+      QVERIFY( referenceViewshed( mDemPath, observer, 2, 1, 500, filterRegion, accuracyFactor, reference, referenceWidth, referenceHeight ) );
+      QCOMPARE( width, referenceWidth );
+      QCOMPARE( height, referenceHeight );
+
+      int visible = 0;
+      for ( int i = 0; i < reference.size(); ++i )
+      {
+        QCOMPARE( traced[i], float( reference[i] ) );
+        visible += reference[i] == 255;
+      }
+      QVERIFY( visible > 1 );
+    }
+  }
+  QThreadPool::globalInstance()->setMaxThreadCount( maxThreadCount );
+}
+
+void TestQgsViewshed::testPerObserverBands()
+{
+  QString batchPath = QDir::tempPath() + QDir::separator() + "qgis_test_viewsheds.tif";
+  QFile::remove( batchPath );
+  QVERIFY( QgsViewshed::computeViewsheds( mDemPath, batchPath, "GTiff", mObservers, mCrs, 2, 1, true, 500, QGis::Meters, QgsViewshed::PerObserverBands ) );
+
+  for ( int i = 0; i < mObservers.size(); ++i )
+  {
+    QString singlePath = QDir::tempPath() + QDir::separator() + "qgis_test_viewshed.tif";
+    QFile::remove( singlePath );
+    QVERIFY( QgsViewshed::computeViewshed( mDemPath, singlePath, "GTiff", mObservers[i], mCrs, 2, 1, true, 500, QGis::Meters ) );
+
+    QVector<float> single, batch;
+    double singleGtrans[6], batchGtrans[6];
+    int singleWidth, singleHeight, batchWidth, batchHeight;
+    QVERIFY( readBand( singlePath, 1, single, singleGtrans, singleWidth, singleHeight ) );
+    QVERIFY( readBand( batchPath, i + 1, batch, batchGtrans, batchWidth, batchHeight ) );
+    QFile::remove( singlePath );
+
+    //the window of the single viewshed within the window of all the observers
+    int colOffset = qRound(( singleGtrans[0] - batchGtrans[0] ) / batchGtrans[1] );
+    int rowOffset = qRound(( singleGtrans[3] - batchGtrans[3] ) / batchGtrans[5] );
+    QVERIFY( colOffset >= 0 && colOffset + singleWidth <= batchWidth );
+    QVERIFY( rowOffset >= 0 && rowOffset + singleHeight <= batchHeight );
+
+    int visible = 0;
+    for ( int row = 0; row < batchHeight; ++row )
+    {
+      for ( int col = 0; col < batchWidth; ++col )
+      {
+        int singleCol = col - colOffset;
+        int singleRow = row - rowOffset;
+        bool inSingle = singleCol >= 0 && singleCol < singleWidth && singleRow >= 0 && singleRow < singleHeight;
+        float expected = inSingle ? single[singleRow * singleWidth + singleCol] : 0;
+        QCOMPARE( batch[row * batchWidth + col], expected );
+        visible += expected == 255;
+      }
+    }
+    QVERIFY( visible > 1 );
+  }
+  QFile::remove( batchPath );
+}
+
+void TestQgsViewshed::testCumulativeCount()
+{
+  QString bandsPath = QDir::tempPath() + QDir::separator() + "qgis_test_viewsheds.tif";
+  QString countPath = QDir::tempPath() + QDir::separator() + "qgis_test_viewsheds_count.tif";
+  QFile::remove( bandsPath );
+  QFile::remove( countPath );
+  QVERIFY( QgsViewshed::computeViewsheds( mDemPath, bandsPath, "GTiff", mObservers, mCrs, 2, 1, true, 500, QGis::Meters, QgsViewshed::PerObserverBands ) );
+  QVERIFY( QgsViewshed::computeViewsheds( mDemPath, countPath, "GTiff", mObservers, mCrs, 2, 1, true, 500, QGis::Meters, QgsViewshed::CumulativeCount ) );
+
+  QVector<float> count;
+  double gtrans[6];
+  int width, height;
+  QVERIFY( readBand( countPath, 1, count, gtrans, width, height ) );
+
+  QVector<float> expected( width * height, 0 );
+  for ( int i = 0; i < mObservers.size(); ++i )
+  {
+    QVector<float> band;
+    double bandGtrans[6];
+    int bandWidth, bandHeight;
+    QVERIFY( readBand( bandsPath, i + 1, band, bandGtrans, bandWidth, bandHeight ) );
+    QCOMPARE( bandWidth, width );
+    QCOMPARE( bandHeight, height );
+    for ( int j = 0; j < band.size(); ++j )
+    {
+      expected[j] += band[j] == 255;
+    }
+  }
+  for ( int j = 0; j < count.size(); ++j )
+  {
+    QCOMPARE( count[j], expected[j] );
+  }
+
+  QFile::remove( bandsPath );
+  QFile::remove( countPath );
+}
+
+QTEST_MAIN( TestQgsViewshed )
+#include "testqgsviewshed.moc"
@@ -17,6 +17,8 @@
 #include <QtTest/QtTest>
 
 #include "qgsapplication.h"
+#include "qgsgeometry.h"
+#include "qgsvectordataprovider.h"
 #include "qgsvectorlayer.h"
 #include "qgszonalstatistics.h"
 
@@ -37,6 +39,7 @@ class TestQgsZonalStatistics : public QObject
     void cleanup() {}
 
     void testStatistics();
+    void testPreciseCoverage();
 
   private:
     QgsVectorLayer* mVectorLayer;
@@ -131,5 +134,25 @@ void TestQgsZonalStatistics::testStatistics()
   QCOMPARE( f.attribute( "myqgis2_me" ).toDouble(), 0.833333333333333 );
 }
 
+void TestQgsZonalStatistics::testPreciseCoverage()
+{
+  // a rectangle which contains no pixel center, covering parts of the cells in row 1, columns 1 (value 1) and 2 (value 0)
+  QgsVectorLayer layer( "Polygon?crs=epsg:4326", "rect", "memory" );
+  QVERIFY( layer.isValid() );
+  QgsFeature feature( layer.pendingFields() );
+  feature.setGeometry( QgsGeometry::fromWkt( "POLYGON((100.379430 -0.960540, 100.379460 -0.960540, 100.379460 -0.960500, 100.379430 -0.960500, 100.379430 -0.960540))" ) );
+  QVERIFY( layer.dataProvider()->addFeatures( QgsFeatureList() << feature ) );
+
+  QgsZonalStatistics zs( &layer, mRasterPath, "", 1 );
+  QCOMPARE( zs.calculateStatistics( NULL ), 0 );
+
+  QgsFeature f;
+  QVERIFY( layer.getFeatures().nextFeature( f ) );
+  // fraction of the cells covered by the rectangle: ( 17 / 45 + 13 / 45 ) * 40 / 45
+  QVERIFY( qgsDoubleNear( f.attribute( "count" ).toDouble(), 30. / 45. * 40. / 45., 1E-6 ) );
+  QVERIFY( qgsDoubleNear( f.attribute( "sum" ).toDouble(), 17. / 45. * 40. / 45., 1E-6 ) );
+  QVERIFY( qgsDoubleNear( f.attribute( "mean" ).toDouble(), 17. / 30., 1E-6 ) );
+}
+
 QTEST_MAIN( TestQgsZonalStatistics )
 #include "testqgszonalstatistics.moc"
@@ -3,9 +3,13 @@
 #include <QObject>
 
 #include "qgsapplication.h"
+#include "qgsgeometry.h"
 #include "qgsmaplayerregistry.h"
 #include "qgsmaprenderercache.h"
 #include "qgsmaprendererjob.h"
+#include "qgssinglesymbolrendererv2.h"
+#include "qgssymbolv2.h"
+#include "qgsvectordataprovider.h"
 #include "qgsvectorlayer.h"
 
 class TestQgsMapRendererJob : public QObject
@@ -28,6 +32,7 @@ class TestQgsMapRendererJob : public QObject
     void testErrors();
 
     void testCache();
+    void testPartialCache();
 
   private:
     QStringList mLayerIds;
@@ -274,6 +279,69 @@ void TestQgsMapRendererJob::testCache()
   QgsMapLayerRegistry::instance()->removeMapLayer( l->id() );
 }
 
+void TestQgsMapRendererJob::testPartialCache()
+{
+  //points with markers reaching far beyond the newly exposed part of the map after panning
+  QgsVectorLayer* l = new QgsVectorLayer( "Point?crs=epsg:21781", "points", "memory" );
+  QVERIFY( l->isValid() );
+  unsigned int seed = 4711;
+  QgsFeatureList features;
+  for ( int i = 0; i < 300; ++i )
+  {
+    seed = seed * 1103515245 + 12345;
+    double x = 600000 + ( seed >> 8 ) % 12000 / 10.0;
+    seed = seed * 1103515245 + 12345;
+    double y = 200000 + ( seed >> 8 ) % 5000 / 10.0;
+    QgsFeature f( l->pendingFields() );
+    f.setGeometry( QgsGeometry::fromPoint( QgsPoint( x, y ) ) );
+    features.append( f );
+  }
+  QVERIFY( l->dataProvider()->addFeatures( features ) );
+  QgsStringMap markerProps;
+  markerProps["name"] = "circle";
+  markerProps["size"] = "40";
+  markerProps["color"] = "255,0,0,60";
+  l->setRendererV2( new QgsSingleSymbolRendererV2( QgsMarkerSymbolV2::createSimple( markerProps ) ) );
+  QgsMapLayerRegistry::instance()->addMapLayer( l );
+
+  QgsMapSettings settings;
+  settings.setLayers( QStringList( l->id() ) );
+  settings.setExtent( QgsRectangle( 600100, 200000, 600600, 200500 ) );
+  settings.setOutputSize( QSize( 500, 500 ) );
+  settings.setOutputDpi( 96 );
+
+  QgsMapRendererCache cache;
+  QgsMapRendererSequentialJob job( settings );
+  job.setCache( &cache );
+  job.start();
+  job.waitForFinished();
+
+  //pan by whole pixels in both directions, so that only the exposed strips are rendered from the cache
+  for ( int i = 0; i < 3; ++i )
+  {
+    double mupp = settings.mapUnitsPerPixel();
+    QgsRectangle extent = settings.extent();
+    double dx = ( i == 1 ? -70 : 110 ) * mupp;
+    double dy = ( i == 2 ? 90 : -30 ) * mupp;
+    settings.setExtent( QgsRectangle( extent.xMinimum() + dx, extent.yMinimum() + dy, extent.xMaximum() + dx, extent.yMaximum() + dy ) );
+
+    QgsMapRendererSequentialJob partialJob( settings );
+    partialJob.setCache( &cache );
+    partialJob.start();
+    partialJob.waitForFinished();
+    QImage partialImage = partialJob.renderedImage();
+
+    QgsMapRendererSequentialJob fullJob( settings );
+    fullJob.start();
+    fullJob.waitForFinished();
+    QImage fullImage = fullJob.renderedImage();
+
+    QVERIFY( partialImage == fullImage );
+  }
+
+  QgsMapLayerRegistry::instance()->removeMapLayer( l->id() );
+}
+
 
 QTEST_MAIN( TestQgsMapRendererJob )
 #include "testmaprendererjob.moc"
@@ -0,0 +1,223 @@
+/***************************************************************************
+     testqgslabelclusters.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QThreadPool>
+#include <QtTest/QtTest>
+
+#include "qgsapplication.h"
+#include "qgsgeometry.h"
+#include "qgsmaplayerregistry.h"
+#include "qgsmaprenderersequentialjob.h"
+#include "qgspallabeling.h"
+#include "qgsproject.h"
+#include "qgsvectordataprovider.h"
+#include "qgsvectorlayer.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for the labeling of independent clusters of features as separate PAL problems.
+ * The points form 12 dense clusters of 40 points, far enough apart for their candidates not to
+ * conflict, so that the labeling problem is split into several sub problems. The placed labels
+ * must not depend on the run or the number of threads, and every label must belong to its feature
+ */
+class TestQgsLabelClusters : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsLabelClusters();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testChain();
+    void testPopmusicTabu();
+
+  private:
+    QgsVectorLayer* mLayer;
+    QMap<QgsFeatureId, QgsPoint> mPoints;
+    int mMaxThreadCount;
+
+    /**Labels the layer with the given number of threads and returns the label rectangles by feature id*/
+    QMap<int, QgsRectangle> labelLayer( int threads ) const;
+    /**Checks the labels of several runs with 1, 2 and 4 threads with the given search method*/
+    void checkClusters( QgsPalLabeling::Search search );
+};
+
+TestQgsLabelClusters::TestQgsLabelClusters()
+    : mLayer( NULL )
+    , mMaxThreadCount( 1 )
+{
+
+}
+
+void TestQgsLabelClusters::initTestCase()
+{
+  QgsApplication::init();
+  QgsApplication::initQgis();
+  QgsApplication::showSettings();
+  mMaxThreadCount = QThreadPool::globalInstance()->maxThreadCount();
+
+  mLayer = new QgsVectorLayer( "Point?crs=epsg:21781&field=name:string", "points", "memory" );
+  QVERIFY( mLayer->isValid() );
+
+  //4 x 3 clusters, 3000 map units apart, of 40 points in 600 x 600 map units
+  unsigned int seed = 4711;
+  QgsFeatureList features;
+  for ( int cluster = 0; cluster < 12; ++cluster )
+  {
+    double centerX = 1500 + ( cluster % 4 ) * 3000;
+    double centerY = 1500 + ( cluster / 4 ) * 3000;
+    for ( int i = 0; i < 40; ++i )
+    {
+      seed = seed * 1103515245 + 12345;
+      double x = centerX - 300 + ( seed >> 8 ) % 6000 / 10.0;
+      seed = seed * 1103515245 + 12345;
+      double y = centerY - 300 + ( seed >> 8 ) % 6000 / 10.0;
+      QgsFeature f( mLayer->pendingFields() );
+      f.setGeometry( QgsGeometry::fromPoint( QgsPoint( x, y ) ) );
+      features << f;
+    }
+  }
+  QVERIFY( mLayer->dataProvider()->addFeatures( features ) );
+
+  //the labels are the feature ids
+  QgsFeature f;
+  QgsFeatureIterator fit = mLayer->getFeatures();
+  QgsChangedAttributesMap labels;
+  while ( fit.nextFeature( f ) )
+  {
+    mPoints.insert( f.id(), f.geometry()->asPoint() );
+    labels[f.id()].insert( 0, QString::number( f.id() ) );
+  }
+  QVERIFY( mLayer->dataProvider()->changeAttributeValues( labels ) );
+
+  //labels around the points without distance, so that the points lie on the border of their labels
+  QgsPalLayerSettings labelSettings;
+  labelSettings.enabled = true;
+  labelSettings.fieldName = "name";
+  labelSettings.placement = QgsPalLayerSettings::AroundPoint;
+  labelSettings.dist = 0;
+  labelSettings.writeToLayer( mLayer );
+
+  QgsMapLayerRegistry::instance()->addMapLayers( QList<QgsMapLayer*>() << mLayer );
+}
+
+void TestQgsLabelClusters::cleanupTestCase()
+{
+  QgsProject::instance()->removeEntry( "PAL", "/SearchMethod" );
+  QThreadPool::globalInstance()->setMaxThreadCount( mMaxThreadCount );
+  QgsApplication::exitQgis();
+}
+
+QMap<int, QgsRectangle> TestQgsLabelClusters::labelLayer( int threads ) const
+{
+  QThreadPool::globalInstance()->setMaxThreadCount( threads );
+
+  QgsMapSettings settings;
+  settings.setLayers( QStringList() << mLayer->id() );
+  settings.setExtent( QgsRectangle( 0, 0, 12000, 9000 ) );
+  settings.setOutputSize( QSize( 1200, 900 ) );
+  settings.setOutputDpi( 96 );
+  settings.setFlag( QgsMapSettings::DrawLabeling, true );
+
+  QgsMapRendererSequentialJob job( settings );
+  job.start();
+  job.waitForFinished();
+
+  QMap<int, QgsRectangle> labels;
+  QgsLabelingResults* results = job.takeLabelingResults();
+  if ( !results )
+  {
+    return labels;
+  }
+  QList<QgsLabelPosition> positions = results->labelsWithinRect( settings.extent() );
+  foreach ( const QgsLabelPosition& position, positions )
+  {
+    //a feature with several labels gets an invalid entry
+    labels.insert( position.featureId, labels.contains( position.featureId ) ? QgsRectangle() : position.labelRect );
+  }
+  delete results;
+  return labels;
+}
+
+void TestQgsLabelClusters::checkClusters( QgsPalLabeling::Search search )
+{
+  QgsProject::instance()->writeEntry( "PAL", "/SearchMethod", ( int )search );
+
+  QMap<int, QgsRectangle> reference = labelLayer( 1 );
+
+  //the clusters are dense enough for some labels to be left out, but each cluster keeps some labels
+  QVERIFY( reference.size() < mPoints.size() );
+  QVector<int> clusterLabels( 12, 0 );
+  QMap<int, QgsRectangle>::const_iterator labelIt = reference.constBegin();
+  for ( ; labelIt != reference.constEnd(); ++labelIt )
+  {
+    QVERIFY( mPoints.contains( labelIt.key() ) );
+    QgsPoint point = mPoints.value( labelIt.key() );
+    QgsRectangle rect = labelIt.value();
+    QVERIFY( !rect.isEmpty() );
+
+    //the candidate belongs to the feature: the point is on the border of the label
+    QVERIFY( rect.xMinimum() - 1E-6 <= point.x() && point.x() <= rect.xMaximum() + 1E-6 );
+    QVERIFY( rect.yMinimum() - 1E-6 <= point.y() && point.y() <= rect.yMaximum() + 1E-6 );
+    QVERIFY( qMin( qMin( qAbs( point.x() - rect.xMinimum() ), qAbs( point.x() - rect.xMaximum() ) ),
+                   qMin( qAbs( point.y() - rect.yMinimum() ), qAbs( point.y() - rect.yMaximum() ) ) ) < 1E-6 );
+
+    int cluster = qMin( 3, ( int )( point.x() / 3000 ) ) + 4 * qMin( 2, ( int )( point.y() / 3000 ) );
+    clusterLabels[cluster]++;
+
+    //the placed labels do not overlap
+    QMap<int, QgsRectangle>::const_iterator otherIt = labelIt + 1;
+    for ( ; otherIt != reference.constEnd(); ++otherIt )
+    {
+      QgsRectangle intersection = rect.intersect( &otherIt.value() );
+      QVERIFY( intersection.width() < 1E-6 || intersection.height() < 1E-6 );
+    }
+  }
+  for ( int cluster = 0; cluster < 12; ++cluster )
+  {
+    QVERIFY( clusterLabels[cluster] > 0 );
+  }
+
+  //identical labels across runs and thread counts
+  for ( int run = 0; run < 2; ++run )
+  {
+    foreach ( int threads, QList<int>() << 1 << 2 << 4 )
+    {
+      QMap<int, QgsRectangle> labels = labelLayer( threads );
+      QCOMPARE( labels.keys(), reference.keys() );
+      QMap<int, QgsRectangle>::const_iterator it = labels.constBegin();
+      for ( ; it != labels.constEnd(); ++it )
+      {
+        QVERIFY( it.value() == reference.value( it.key() ) );
+      }
+    }
+  }
+}
+
+void TestQgsLabelClusters::testChain()
+{
+  checkClusters( QgsPalLabeling::Chain );
+}
+
+void TestQgsLabelClusters::testPopmusicTabu()
+{
+  checkClusters( QgsPalLabeling::Popmusic_Tabu );
+}
+
+QTEST_MAIN( TestQgsLabelClusters )
+#include "testqgslabelclusters.moc"
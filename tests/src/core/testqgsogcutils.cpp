@@ -18,9 +18,52 @@
 #include <QSharedPointer>
 
 //qgis includes...
+#include <qgsapplication.h>
 #include <qgsgeometry.h>
 #include <qgsogcutils.h>
 
+//appends a WKB header with the byte order of the machine
+static void appendWkbHeader( QByteArray& wkb, int type )
+{
+  wkb.append( ( char ) QgsApplication::endian() );
+  wkb.append( reinterpret_cast<const char*>( &type ), sizeof( int ) );
+}
+
+static void appendWkbInt( QByteArray& wkb, int value )
+{
+  wkb.append( reinterpret_cast<const char*>( &value ), sizeof( int ) );
+}
+
+//appends nPoints coordinates with fractions, which are cut at low precisions
+static void appendWkbPoints( QByteArray& wkb, int nPoints, bool hasZValue, double offset )
+{
+  for ( int i = 0; i < nPoints; ++i )
+  {
+    double coords[3] = { 600000.123456789 + offset + i * 10.25, -200.5 - offset - i * 0.0625, 417.75 };
+    wkb.append( reinterpret_cast<const char*>( coords ), ( hasZValue ? 3 : 2 ) * sizeof( double ) );
+  }
+}
+
+//appends a polygon without header with the given number of rings
+static void appendWkbRings( QByteArray& wkb, int numRings, bool hasZValue, double offset )
+{
+  appendWkbInt( wkb, numRings );
+  for ( int i = 0; i < numRings; ++i )
+  {
+    appendWkbInt( wkb, 4 );
+    appendWkbPoints( wkb, 4, hasZValue, offset + i );
+  }
+}
+
+static QgsGeometry* geometryFromWkb( const QByteArray& wkb )
+{
+  unsigned char* data = new unsigned char[wkb.size()];
+  memcpy( data, wkb.constData(), wkb.size() );
+  QgsGeometry* geom = new QgsGeometry();
+  geom->fromWkb( data, wkb.size() );
+  return geom;
+}
+
 
 /** \ingroup UnitTests
  * This is a unit test for OGC utilities
@@ -32,6 +75,9 @@ class TestQgsOgcUtils : public QObject
 
     void testGeometryFromGML();
     void testGeometryToGML();
+    void testAppendGeometryToGML();
+    void testAppendRectangleToGML();
+    void testAppendXmlEscaped();
 
     void testExpressionFromOgcFilter();
     void testExpressionFromOgcFilter_data();
@@ -340,6 +386,181 @@ void TestQgsOgcUtils::testExpressionToOgcFilter_data()
   */
 }
 
+void TestQgsOgcUtils::testAppendGeometryToGML()
+{
+  //geometries of every type written by geometryToGML, in 2D and 2.5D, including empty parts
+  QList<QByteArray> wkbs;
+  for ( int z = 0; z < 2; ++z )
+  {
+    bool hasZValue = z == 1;
+    QByteArray wkb;
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBPoint25D : QGis::WKBPoint );
+    appendWkbPoints( wkb, 1, hasZValue, 0 );
+    wkbs << wkb;
+
+    wkb.clear();
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBLineString25D : QGis::WKBLineString );
+    appendWkbInt( wkb, 3 );
+    appendWkbPoints( wkb, 3, hasZValue, 0 );
+    wkbs << wkb;
+
+    wkb.clear();
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBPolygon25D : QGis::WKBPolygon );
+    appendWkbRings( wkb, 2, hasZValue, 0 );
+    wkbs << wkb;
+
+    //polygon without rings, which has no GML representation
+    wkb.clear();
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBPolygon25D : QGis::WKBPolygon );
+    appendWkbRings( wkb, 0, hasZValue, 0 );
+    wkbs << wkb;
+
+    for ( int nParts = 0; nParts < 3; nParts += 2 )
+    {
+      wkb.clear();
+      appendWkbHeader( wkb, hasZValue ? QGis::WKBMultiPoint25D : QGis::WKBMultiPoint );
+      appendWkbInt( wkb, nParts );
+      for ( int i = 0; i < nParts; ++i )
+      {
+        appendWkbHeader( wkb, hasZValue ? QGis::WKBPoint25D : QGis::WKBPoint );
+        appendWkbPoints( wkb, 1, hasZValue, i );
+      }
+      wkbs << wkb;
+
+      wkb.clear();
+      appendWkbHeader( wkb, hasZValue ? QGis::WKBMultiLineString25D : QGis::WKBMultiLineString );
+      appendWkbInt( wkb, nParts );
+      for ( int i = 0; i < nParts; ++i )
+      {
+        appendWkbHeader( wkb, hasZValue ? QGis::WKBLineString25D : QGis::WKBLineString );
+        appendWkbInt( wkb, 2 );
+        appendWkbPoints( wkb, 2, hasZValue, i );
+      }
+      wkbs << wkb;
+    }
+
+    //multipolygons with a part without rings in between and with no rings at all
+    wkb.clear();
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBMultiPolygon25D : QGis::WKBMultiPolygon );
+    appendWkbInt( wkb, 3 );
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBPolygon25D : QGis::WKBPolygon );
+    appendWkbRings( wkb, 2, hasZValue, 0 );
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBPolygon25D : QGis::WKBPolygon );
+    appendWkbRings( wkb, 0, hasZValue, 0 );
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBPolygon25D : QGis::WKBPolygon );
+    appendWkbRings( wkb, 1, hasZValue, 5 );
+    wkbs << wkb;
+
+    wkb.clear();
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBMultiPolygon25D : QGis::WKBMultiPolygon );
+    appendWkbInt( wkb, 1 );
+    appendWkbHeader( wkb, hasZValue ? QGis::WKBPolygon25D : QGis::WKBPolygon );
+    appendWkbRings( wkb, 0, hasZValue, 0 );
+    wkbs << wkb;
+  }
+
+  QStringList formats;
+  formats << "GML2" << "GML3";
+  QStringList srsNames;
+  srsNames << QString() << "EPSG:21781";
+  foreach ( const QByteArray& wkb, wkbs )
+  {
+    QSharedPointer<QgsGeometry> geom( geometryFromWkb( wkb ) );
+    foreach ( const QString& format, formats )
+    {
+      foreach ( const QString& srsName, srsNames )
+      {
+        for ( int precision = 3; precision <= 17; precision += 14 )
+        {
+          QDomDocument doc;
+          QDomElement elem = QgsOgcUtils::geometryToGML( geom.data(), doc, format, precision );
+
+          //the output is appended to what is already there
+          QByteArray out( "<x>" );
+          bool written = QgsOgcUtils::appendGeometryToGML( out, geom.data(), format, precision, srsName );
+          QCOMPARE( written, !elem.isNull() );
+          if ( !written )
+          {
+            QCOMPARE( out, QByteArray( "<x>" ) );
+            continue;
+          }
+          QVERIFY( out.startsWith( "<x>" ) );
+          out.remove( 0, 3 );
+
+          if ( !srsName.isEmpty() )
+          {
+            elem.setAttribute( "srsName", srsName );
+          }
+          doc.appendChild( elem );
+
+          //the attribute order of QDom depends on hashes, so the output is compared after reading it into a document
+          QDomDocument streamedDoc;
+          QVERIFY( streamedDoc.setContent( out ) );
+          QCOMPARE( streamedDoc.toString(), doc.toString() );
+
+          //GML3 has no elements with several attributes, so the indentation can be compared as well
+          if ( format == "GML3" )
+          {
+            QCOMPARE( out, doc.toByteArray() );
+          }
+        }
+      }
+    }
+  }
+
+  QByteArray out;
+  QVERIFY( !QgsOgcUtils::appendGeometryToGML( out, 0, "GML2" ) );
+  QVERIFY( out.isEmpty() );
+}
+
+void TestQgsOgcUtils::testAppendRectangleToGML()
+{
+  QgsRectangle rect( 600000.123456, 200000.5, 600100, 200200.0625 );
+  for ( int precision = 3; precision <= 17; precision += 14 )
+  {
+    QDomDocument doc;
+    QDomElement boxElem = QgsOgcUtils::rectangleToGMLBox( &rect, doc, precision );
+    boxElem.setAttribute( "srsName", "EPSG:21781" );
+    doc.appendChild( boxElem );
+    QByteArray box;
+    QgsOgcUtils::appendRectangleToGMLBox( box, rect, precision, "EPSG:21781" );
+    QDomDocument streamedBoxDoc;
+    QVERIFY( streamedBoxDoc.setContent( box ) );
+    QCOMPARE( streamedBoxDoc.toString(), doc.toString() );
+
+    doc = QDomDocument();
+    QDomElement envElem = QgsOgcUtils::rectangleToGMLEnvelope( &rect, doc, precision );
+    envElem.setAttribute( "srsName", "EPSG:21781" );
+    doc.appendChild( envElem );
+    QByteArray env;
+    QgsOgcUtils::appendRectangleToGMLEnvelope( env, rect, precision, "EPSG:21781" );
+    QCOMPARE( env, doc.toByteArray() );
+  }
+}
+
+void TestQgsOgcUtils::testAppendXmlEscaped()
+{
+  QString text = QString::fromUtf8( "a<b & \"c\" 'd' ]]> e>f\r\n\tg \xc3\xa4" );
+
+  QDomDocument doc;
+  QDomElement elem = doc.createElement( "t" );
+  elem.appendChild( doc.createTextNode( text ) );
+  doc.appendChild( elem );
+  QByteArray content( "<t>" );
+  QgsOgcUtils::appendXmlEscaped( content, text );
+  content.append( "</t>" );
+  QCOMPARE( content, doc.toByteArray( -1 ) );
+
+  doc = QDomDocument();
+  elem = doc.createElement( "t" );
+  elem.setAttribute( "a", text );
+  doc.appendChild( elem );
+  QByteArray attribute( "<t a=\"" );
+  QgsOgcUtils::appendXmlEscaped( attribute, text, true );
+  attribute.append( "\"/>" );
+  QCOMPARE( attribute, doc.toByteArray( -1 ) );
+}
+
 
 QTEST_MAIN( TestQgsOgcUtils )
 #include "testqgsogcutils.moc"
@@ -0,0 +1,221 @@
+/***************************************************************************
+     testqgsrastersampler.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QtTest/QtTest>
+#include <cmath>
+
+#include <gdal.h>
+
+#include "qgsapplication.h"
+#include "qgscoordinatereferencesystem.h"
+#include "qgscoordinatetransform.h"
+#include "qgsrastersampler.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for the raster sampler. The sampled values are compared with bilinear
+ * interpolation from a 2x2 pixel read per position, as the height profile did before the sampler,
+ * on a DEM spanning several cache tiles
+ */
+class TestQgsRasterSampler : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsRasterSampler();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testSameCrs();
+    void testTransformed();
+    void testInvalid();
+
+  private:
+    QString mDemPath;
+    QgsCoordinateReferenceSystem mDemCrs;
+    QVector<QgsPoint> mPoints;
+
+    /**Samples the DEM with a 2x2 pixel read for the position, in the DEM CRS*/
+    double referenceSample( const QgsPoint& point, bool& ok ) const;
+    /**Compares the sampler with the reference for positions in the given CRS*/
+    void compareSamples( const QVector<QgsPoint>& points, const QgsCoordinateReferenceSystem& crs, double tolerance );
+};
+
+//DEM of 600 x 520 pixels of 10 m, i.e. 3 x 3 cache tiles, with the origin at (600000, 205200)
+static const int DEM_WIDTH = 600;
+static const int DEM_HEIGHT = 520;
+static const double DEM_GTRANS[6] = { 600000, 10, 0, 205200, 0, -10 };
+
+TestQgsRasterSampler::TestQgsRasterSampler()
+{
+
+}
+
+void TestQgsRasterSampler::initTestCase()
+{
+  QgsApplication::init();
+  QgsApplication::initQgis();
+  QgsApplication::showSettings();
+  GDALAllRegister();
+
+  mDemCrs.createFromOgcWmsCrs( "EPSG:21781" );
+  mDemPath = QDir::tempPath() + QDir::separator() + "qgis_test_sampler.tif";
+  QFile::remove( mDemPath );
+  GDALDatasetH dem = GDALCreate( GDALGetDriverByName( "GTiff" ), mDemPath.toLocal8Bit().data(), DEM_WIDTH, DEM_HEIGHT, 1, GDT_Float32, NULL );
+  QVERIFY( dem );
+  double gtrans[6];
+  for ( int i = 0; i < 6; ++i )
+    gtrans[i] = DEM_GTRANS[i];
+  GDALSetGeoTransform( dem, gtrans );
+  GDALSetProjection( dem, mDemCrs.toWkt().toLocal8Bit().data() );
+  QVector<float> heights( DEM_WIDTH * DEM_HEIGHT );
+  for ( int row = 0; row < DEM_HEIGHT; ++row )
+  {
+    for ( int col = 0; col < DEM_WIDTH; ++col )
+    {
+      heights[row * DEM_WIDTH + col] = 500 + 80 * sin( col / 23.0 ) * cos( row / 17.0 ) + 0.01 * col * row;
+    }
+  }
+  CPLErr err = GDALRasterIO( GDALGetRasterBand( dem, 1 ), GF_Write, 0, 0, DEM_WIDTH, DEM_HEIGHT, heights.data(), DEM_WIDTH, DEM_HEIGHT, GDT_Float32, 0, 0 );
+  GDALClose( dem );
+  QVERIFY( err == CE_None );
+
+  //pseudo random positions in and around the DEM, and positions on the tile borders and the last pixels
+  unsigned int seed = 4711;
+  for ( int i = 0; i < 2000; ++i )
+  {
+    seed = seed * 1103515245 + 12345;
+    double x = 599900 + ( seed >> 8 ) % 620000 / 100.0;
+    seed = seed * 1103515245 + 12345;
+    double y = 199900 + ( seed >> 8 ) % 540000 / 100.0;
+    mPoints << QgsPoint( x, y );
+  }
+  mPoints << QgsPoint( 600000 + 255.5 * 10, 205200 - 100.5 * 10 ) << QgsPoint( 600000 + 256 * 10, 205200 - 256 * 10 );
+  mPoints << QgsPoint( 600000 + 511.7 * 10, 205200 - 511.2 * 10 ) << QgsPoint( 600000 + 598.9 * 10, 205200 - 518.9 * 10 );
+  mPoints << QgsPoint( 600000 + 599.5 * 10, 205200 - 10 ) << QgsPoint( 600000 + 10, 205200 - 519.5 * 10 );
+  mPoints << QgsPoint( 600000, 205200 ) << QgsPoint( 600000 - 0.1, 205200 + 0.1 );
+}
+
+void TestQgsRasterSampler::cleanupTestCase()
+{
+  QFile::remove( mDemPath );
+  QgsApplication::exitQgis();
+}
+
+double TestQgsRasterSampler::referenceSample( const QgsPoint& point, bool& ok ) const
+{
+  ok = false;
+  GDALDatasetH raster = GDALOpen( mDemPath.toLocal8Bit().data(), GA_ReadOnly );
+  if ( !raster )
+  {
+    return 0;
+  }
+  const double* gtrans = DEM_GTRANS;
+  double col = ( -gtrans[0] * gtrans[5] + gtrans[2] * gtrans[3] - gtrans[2] * point.y() + gtrans[5] * point.x() ) / ( gtrans[1] * gtrans[5] - gtrans[2] * gtrans[4] );
+  double row = ( -gtrans[0] * gtrans[4] + gtrans[1] * gtrans[3] - gtrans[1] * point.y() + gtrans[4] * point.x() ) / ( gtrans[2] * gtrans[4] - gtrans[1] * gtrans[5] );
+  double pixValues[4] = { 0, 0, 0, 0 };
+  double value = 0;
+  CPLPushErrorHandler( CPLQuietErrorHandler );
+  if ( CE_None == GDALRasterIO( GDALGetRasterBand( raster, 1 ), GF_Read, qFloor( col ), qFloor( row ), 2, 2, &pixValues[0], 2, 2, GDT_Float64, 0, 0 ) )
+  {
+    double lambdaR = row - qFloor( row );
+    double lambdaC = col - qFloor( col );
+    value = ( pixValues[0] * ( 1. - lambdaC ) + pixValues[1] * lambdaC ) * ( 1. - lambdaR )
+            + ( pixValues[2] * ( 1. - lambdaC ) + pixValues[3] * lambdaC ) * ( lambdaR );
+    ok = true;
+  }
+  CPLPopErrorHandler();
+  GDALClose( raster );
+  return value;
+}
+
+void TestQgsRasterSampler::compareSamples( const QVector<QgsPoint>& points, const QgsCoordinateReferenceSystem& crs, double tolerance )
+{
+  QgsRasterSampler sampler( mDemPath );
+  QVERIFY( sampler.isValid() );
+  QVERIFY( sampler.verticalUnit() == QGis::Meters );
+
+  QgsCoordinateTransform ct( crs, mDemCrs );
+  QVector<bool> ok;
+  QVector<double> values = sampler.sample( points, crs, &ok );
+  QCOMPARE( values.size(), points.size() );
+  QCOMPARE( ok.size(), points.size() );
+  int nSampled = 0;
+  for ( int i = 0; i < points.size(); ++i )
+  {
+    bool refOk;
+    double reference = referenceSample( ct.transform( points[i] ), refOk );
+    QCOMPARE( ok[i], refOk );
+    QVERIFY( qAbs( values[i] - reference ) <= tolerance );
+    nSampled += ok[i] ? 1 : 0;
+
+    //single positions, from the cached tiles
+    bool singleOk;
+    double single = sampler.sample( points[i], crs, &singleOk );
+    QCOMPARE( singleOk, ok[i] );
+    QCOMPARE( single, values[i] );
+  }
+  QVERIFY( nSampled > points.size() / 2 );
+  QVERIFY( nSampled < points.size() );
+
+  //the same values after dropping the cache
+  sampler.clearCache();
+  QVector<double> resampled = sampler.sample( points, crs );
+  QCOMPARE( resampled, values );
+}
+
+void TestQgsRasterSampler::testSameCrs()
+{
+  compareSamples( mPoints, mDemCrs, 1E-9 );
+}
+
+void TestQgsRasterSampler::testTransformed()
+{
+  QgsCoordinateReferenceSystem wgs84;
+  wgs84.createFromOgcWmsCrs( "EPSG:4326" );
+  QgsCoordinateTransform ct( mDemCrs, wgs84 );
+  //the positions go through another transformation than the reference, so that positions
+  //on the borders of the sampled area could fall on either side
+  QVector<QgsPoint> points;
+  foreach ( const QgsPoint& point, mPoints )
+  {
+    if ( qAbs( point.x() - 600000 ) < 0.01 || qAbs( point.x() - 605990 ) < 0.01
+         || qAbs( point.y() - 205200 ) < 0.01 || qAbs( point.y() - 200010 ) < 0.01 )
+    {
+      continue;
+    }
+    points << ct.transform( point );
+  }
+  compareSamples( points, wgs84, 1E-4 );
+}
+
+void TestQgsRasterSampler::testInvalid()
+{
+  QgsRasterSampler missing( QDir::tempPath() + QDir::separator() + "qgis_test_sampler_missing.tif" );
+  QVERIFY( !missing.isValid() );
+  bool ok = true;
+  QCOMPARE( missing.sample( QgsPoint( 601000, 204000 ), mDemCrs, &ok ), 0.0 );
+  QVERIFY( !ok );
+
+  QgsRasterSampler noBand( mDemPath, 2 );
+  QVERIFY( !noBand.isValid() );
+}
+
+QTEST_MAIN( TestQgsRasterSampler )
+#include "testqgsrastersampler.moc"
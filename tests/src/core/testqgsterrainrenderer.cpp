@@ -0,0 +1,183 @@
+/***************************************************************************
+     testqgsterrainrenderer.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QtTest/QtTest>
+#include <cmath>
+
+#include <gdal.h>
+
+#include "qgsapplication.h"
+#include "qgscoordinatereferencesystem.h"
+#include "qgsrasterblock.h"
+#include "qgsrasterdataprovider.h"
+#include "qgsrasterlayer.h"
+#include "qgsterrainrenderer.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for the automatic z factor of the terrain renderer, for elevations in meters
+ * and feet on projected and geographic rasters
+ */
+class TestQgsTerrainRenderer : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsTerrainRenderer();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testProjectedMeters();
+    void testProjectedFeet();
+    void testGeographicMeters();
+    void testGeographicFeet();
+
+  private:
+    QStringList mFiles;
+
+    /**Creates a DEM with the given CRS, geotransform and band unit and returns its path*/
+    QString createDem( const QString& name, const QString& authid, double originX, double originY, double pixelSize, const QString& unit );
+    /**Checks the automatic z factor of a terrain renderer on the DEM, of its clone and the rendered output*/
+    void checkZFactor( const QString& path, double expectedZFactor );
+};
+
+TestQgsTerrainRenderer::TestQgsTerrainRenderer()
+{
+
+}
+
+void TestQgsTerrainRenderer::initTestCase()
+{
+  QgsApplication::init();
+  QgsApplication::initQgis();
+  QgsApplication::showSettings();
+  GDALAllRegister();
+}
+
+void TestQgsTerrainRenderer::cleanupTestCase()
+{
+  foreach ( const QString& file, mFiles )
+  {
+    QFile::remove( file );
+  }
+  QgsApplication::exitQgis();
+}
+
+QString TestQgsTerrainRenderer::createDem( const QString& name, const QString& authid, double originX, double originY, double pixelSize, const QString& unit )
+{
+  QString path = QDir::tempPath() + QDir::separator() + name;
+  QFile::remove( path );
+  mFiles << path;
+
+  QgsCoordinateReferenceSystem crs;
+  crs.createFromOgcWmsCrs( authid );
+
+  const int size = 40;
+  GDALDatasetH dem = GDALCreate( GDALGetDriverByName( "GTiff" ), path.toLocal8Bit().data(), size, size, 1, GDT_Float32, NULL );
+  if ( !dem )
+  {
+    return QString();
+  }
+  double gtrans[6] = { originX, pixelSize, 0, originY, 0, -pixelSize };
+  GDALSetGeoTransform( dem, gtrans );
+  GDALSetProjection( dem, crs.toWkt().toLocal8Bit().data() );
+  GDALRasterBandH band = GDALGetRasterBand( dem, 1 );
+  if ( !unit.isEmpty() )
+  {
+    GDALSetRasterUnitType( band, unit.toLocal8Bit().data() );
+  }
+  QVector<float> heights( size * size );
+  for ( int row = 0; row < size; ++row )
+  {
+    for ( int col = 0; col < size; ++col )
+    {
+      heights[row * size + col] = 300 + 25 * sin( col / 5.0 ) * cos( row / 7.0 );
+    }
+  }
+  CPLErr err = GDALRasterIO( band, GF_Write, 0, 0, size, size, heights.data(), size, size, GDT_Float32, 0, 0 );
+  GDALClose( dem );
+  return err == CE_None ? path : QString();
+}
+
+void TestQgsTerrainRenderer::checkZFactor( const QString& path, double expectedZFactor )
+{
+  QVERIFY( !path.isEmpty() );
+  QgsRasterLayer layer( path, "dem" );
+  QVERIFY( layer.isValid() );
+
+  QgsTerrainRenderer* renderer = new QgsTerrainRenderer( layer.dataProvider(), 1, QgsTerrainRenderer::Slope );
+  layer.setRenderer( renderer );
+  QVERIFY( qgsDoubleNear( renderer->effectiveZFactor(), expectedZFactor, 1E-6 * expectedZFactor ) );
+
+  //clones keep the factor without an input
+  QgsTerrainRenderer* clone = dynamic_cast<QgsTerrainRenderer*>( renderer->clone() );
+  QVERIFY( clone );
+  QVERIFY( qgsDoubleNear( clone->effectiveZFactor(), expectedZFactor, 1E-6 * expectedZFactor ) );
+  delete clone;
+
+  //the output equals the output with the explicit factor, in every block
+  QgsTerrainRenderer explicitRenderer( layer.dataProvider(), 1, QgsTerrainRenderer::Slope );
+  explicitRenderer.setZFactor( expectedZFactor );
+  QgsRectangle extent = layer.extent();
+  QList<QgsRectangle> blocks;
+  blocks << extent;
+  blocks << QgsRectangle( extent.xMinimum(), extent.yMinimum(), extent.center().x(), extent.center().y() );
+  blocks << QgsRectangle( extent.center().x(), extent.center().y(), extent.xMaximum(), extent.yMaximum() );
+  foreach ( const QgsRectangle& blockExtent, blocks )
+  {
+    QgsRasterBlock* autoBlock = renderer->block( 1, blockExtent, 20, 20 );
+    QgsRasterBlock* explicitBlock = explicitRenderer.block( 1, blockExtent, 20, 20 );
+    QVERIFY( autoBlock && !autoBlock->isEmpty() );
+    QVERIFY( explicitBlock && !explicitBlock->isEmpty() );
+    for ( int i = 0; i < 20 * 20; ++i )
+    {
+      QCOMPARE( autoBlock->color( i ), explicitBlock->color( i ) );
+    }
+    delete autoBlock;
+    delete explicitBlock;
+  }
+}
+
+void TestQgsTerrainRenderer::testProjectedMeters()
+{
+  QString path = createDem( "qgis_test_terrain_m.tif", "EPSG:21781", 600000, 200400, 10, QString() );
+  checkZFactor( path, 1.0 );
+}
+
+void TestQgsTerrainRenderer::testProjectedFeet()
+{
+  QString path = createDem( "qgis_test_terrain_ft.tif", "EPSG:21781", 600000, 200400, 10, "ft" );
+  checkZFactor( path, 1.0 / 0.3048 );
+}
+
+void TestQgsTerrainRenderer::testGeographicMeters()
+{
+  //40 pixels of 0.001 degrees from 46.52 to 46.48 degrees north
+  QString path = createDem( "qgis_test_terrain_deg_m.tif", "EPSG:4326", 7.4, 46.52, 0.001, "m" );
+  checkZFactor( path, 111320 * cos( 46.5 * M_PI / 180. ) );
+}
+
+void TestQgsTerrainRenderer::testGeographicFeet()
+{
+  QString path = createDem( "qgis_test_terrain_deg_ft.tif", "EPSG:4326", 7.4, 46.52, 0.001, "ft" );
+  checkZFactor( path, 111320 * cos( 46.5 * M_PI / 180. ) / 0.3048 );
+}
+
+QTEST_MAIN( TestQgsTerrainRenderer )
+#include "testqgsterrainrenderer.moc"
@@ -0,0 +1,189 @@
+/***************************************************************************
+     testqgsvectorlayerrenderer.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QSettings>
+#include <QThreadPool>
+#include <QtTest/QtTest>
+
+#include "qgsapplication.h"
+#include "qgsgeometry.h"
+#include "qgsmaplayerregistry.h"
+#include "qgsmaprendererjob.h"
+#include "qgspallabeling.h"
+#include "qgssinglesymbolrendererv2.h"
+#include "qgssymbolv2.h"
+#include "qgsvectordataprovider.h"
+#include "qgsvectorlayer.h"
+
+/** \ingroup UnitTests
+ * This is a unit test for the rendering of large vector layers in parallel strips. The output of a
+ * split render, with symbols reaching far across the strip borders and labels, is compared with the
+ * output of a serial render
+ */
+class TestQgsVectorLayerRenderer : public QObject
+{
+    Q_OBJECT
+
+  public:
+    TestQgsVectorLayerRenderer();
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init() {}
+    void cleanup() {}
+
+    void testLargeMarkers();
+    void testWideLines();
+
+  private:
+    QgsVectorLayer* mPointLayer;
+    QgsVectorLayer* mLineLayer;
+    int mMaxThreadCount;
+
+    /**Renders the layer with or without splitting it into strips, using the given number of threads*/
+    QImage renderLayer( QgsVectorLayer* layer, bool split, int threads ) const;
+    /**Compares split renders of the layer with a serial render*/
+    void compareSplitRender( QgsVectorLayer* layer ) const;
+};
+
+TestQgsVectorLayerRenderer::TestQgsVectorLayerRenderer()
+    : mPointLayer( NULL )
+    , mLineLayer( NULL )
+    , mMaxThreadCount( 1 )
+{
+
+}
+
+void TestQgsVectorLayerRenderer::initTestCase()
+{
+  QgsApplication::init();
+  QgsApplication::initQgis();
+  QgsApplication::showSettings();
+  mMaxThreadCount = QThreadPool::globalInstance()->maxThreadCount();
+
+  //enough features for the layers to be split, with a fixed pseudo random sequence
+  mPointLayer = new QgsVectorLayer( "Point?crs=epsg:21781&field=name:string", "points", "memory" );
+  mLineLayer = new QgsVectorLayer( "LineString?crs=epsg:21781&field=name:string", "lines", "memory" );
+  QVERIFY( mPointLayer->isValid() );
+  QVERIFY( mLineLayer->isValid() );
+
+  unsigned int seed = 4711;
+  QgsFeatureList points;
+  QgsFeatureList lines;
+  for ( int i = 0; i < 12000; ++i )
+  {
+    seed = seed * 1103515245 + 12345;
+    double x = 600000 + ( seed >> 8 ) % 100000 / 100.0;
+    seed = seed * 1103515245 + 12345;
+    double y = 200000 + ( seed >> 8 ) % 50000 / 100.0;
+
+    QgsFeature point( mPointLayer->pendingFields() );
+    point.setGeometry( QgsGeometry::fromPoint( QgsPoint( x, y ) ) );
+    point.setAttribute( 0, QString::number( i ) );
+    points.append( point );
+
+    QgsFeature line( mLineLayer->pendingFields() );
+    QgsPolyline polyline;
+    polyline << QgsPoint( x, y ) << QgsPoint( x + 3, y + 2 );
+    line.setGeometry( QgsGeometry::fromPolyline( polyline ) );
+    line.setAttribute( 0, QString::number( i ) );
+    lines.append( line );
+  }
+  QVERIFY( mPointLayer->dataProvider()->addFeatures( points ) );
+  QVERIFY( mLineLayer->dataProvider()->addFeatures( lines ) );
+
+  //markers of 30 mm and lines of 20 mm reach much further than a few pixels across the strip borders
+  QgsStringMap markerProps;
+  markerProps["name"] = "circle";
+  markerProps["size"] = "30";
+  markerProps["color"] = "255,0,0,80";
+  mPointLayer->setRendererV2( new QgsSingleSymbolRendererV2( QgsMarkerSymbolV2::createSimple( markerProps ) ) );
+  QgsStringMap lineProps;
+  lineProps["width"] = "20";
+  lineProps["color"] = "0,0,255,80";
+  mLineLayer->setRendererV2( new QgsSingleSymbolRendererV2( QgsLineSymbolV2::createSimple( lineProps ) ) );
+
+  foreach ( QgsVectorLayer* layer, QList<QgsVectorLayer*>() << mPointLayer << mLineLayer )
+  {
+    QgsPalLayerSettings labelSettings;
+    labelSettings.enabled = true;
+    labelSettings.fieldName = "name";
+    labelSettings.writeToLayer( layer );
+  }
+
+  QgsMapLayerRegistry::instance()->addMapLayers( QList<QgsMapLayer*>() << mPointLayer << mLineLayer );
+}
+
+void TestQgsVectorLayerRenderer::cleanupTestCase()
+{
+  QSettings().remove( "/Qgis/parallel_rendering_split_layers" );
+  QThreadPool::globalInstance()->setMaxThreadCount( mMaxThreadCount );
+  QgsApplication::exitQgis();
+}
+
+QImage TestQgsVectorLayerRenderer::renderLayer( QgsVectorLayer* layer, bool split, int threads ) const
+{
+  QSettings().setValue( "/Qgis/parallel_rendering_split_layers", split );
+  QThreadPool::globalInstance()->setMaxThreadCount( threads );
+
+  QgsMapSettings settings;
+  settings.setLayers( QStringList() << layer->id() );
+  settings.setExtent( QgsRectangle( 600000, 200000, 601000, 200500 ) );
+  settings.setOutputSize( QSize( 1024, 512 ) );
+  settings.setOutputDpi( 96 );
+
+  QgsMapRendererSequentialJob job( settings );
+  job.start();
+  job.waitForFinished();
+  return job.renderedImage();
+}
+
+void TestQgsVectorLayerRenderer::compareSplitRender( QgsVectorLayer* layer ) const
+{
+  QImage serial = renderLayer( layer, false, 4 );
+  QVERIFY( !serial.isNull() );
+
+  //something has been drawn
+  bool drawn = false;
+  for ( int row = 0; row < serial.height() && !drawn; ++row )
+  {
+    for ( int col = 0; col < serial.width() && !drawn; ++col )
+    {
+      drawn = serial.pixel( col, row ) != serial.pixel( 0, 0 );
+    }
+  }
+  QVERIFY( drawn );
+
+  //2 and 4 strips of at least 256 pixels
+  QImage split2 = renderLayer( layer, true, 2 );
+  QImage split4 = renderLayer( layer, true, 4 );
+  QCOMPARE( split2.size(), serial.size() );
+  QCOMPARE( split4.size(), serial.size() );
+  QVERIFY( split2 == serial );
+  QVERIFY( split4 == serial );
+}
+
+void TestQgsVectorLayerRenderer::testLargeMarkers()
+{
+  compareSplitRender( mPointLayer );
+}
+
+void TestQgsVectorLayerRenderer::testWideLines()
+{
+  compareSplitRender( mLineLayer );
+}
+
+QTEST_MAIN( TestQgsVectorLayerRenderer )
+#include "testqgsvectorlayerrenderer.moc"
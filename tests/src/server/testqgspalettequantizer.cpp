@@ -0,0 +1,480 @@
+/***************************************************************************
+     testqgspalettequantizer.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QImage>
+#include <QtTest/QtTest>
+#include <climits>
+#include <cmath>
+
+#include "qgspalettequantizer.h"
+
+//median cut of the server before QgsPaletteQuantizer, as reference for quality and speed
+
+typedef QList< QPair<QRgb, int> > ColorBox; //Color / number of pixels
+typedef QMultiMap< int, ColorBox > ColorBoxMap; // sum of pixels / color box
+
+static void imageColors( QHash<QRgb, int>& colors, const QImage& image );
+static void splitColorBox( ColorBox& colorBox, ColorBoxMap& colorBoxMap, QMap<int, ColorBox>::iterator colorBoxMapIt );
+static bool minMaxRange( const ColorBox& colorBox, int& redRange, int& greenRange, int& blueRange, int& alphaRange );
+static bool redCompare( const QPair<QRgb, int>& c1, const QPair<QRgb, int>& c2 );
+static bool greenCompare( const QPair<QRgb, int>& c1, const QPair<QRgb, int>& c2 );
+static bool blueCompare( const QPair<QRgb, int>& c1, const QPair<QRgb, int>& c2 );
+static bool alphaCompare( const QPair<QRgb, int>& c1, const QPair<QRgb, int>& c2 );
+static QRgb boxColor( const ColorBox& box, int boxPixels );
+
+static void medianCut( QVector<QRgb>& colorTable, int nColors, const QImage& inputImage )
+{
+  QHash<QRgb, int> inputColors;
+  imageColors( inputColors, inputImage );
+
+  if ( inputColors.size() <= nColors ) //all the colors in the image can be mapped to one palette color
+  {
+    colorTable.resize( inputColors.size() );
+    int index = 0;
+    QHash<QRgb, int>::const_iterator inputColorIt = inputColors.constBegin();
+    for ( ; inputColorIt != inputColors.constEnd(); ++inputColorIt )
+    {
+      colorTable[index] = inputColorIt.key();
+      ++index;
+    }
+    return;
+  }
+
+  //create first box
+  ColorBox firstBox; //QList< QPair<QRgb, int> >
+  int firstBoxPixelSum = 0;
+  QHash<QRgb, int>::const_iterator inputColorIt = inputColors.constBegin();
+  for ( ; inputColorIt != inputColors.constEnd(); ++inputColorIt )
+  {
+    firstBox.push_back( qMakePair( inputColorIt.key(), inputColorIt.value() ) );
+    firstBoxPixelSum += inputColorIt.value();
+  }
+
+  ColorBoxMap colorBoxMap; //QMultiMap< int, ColorBox >
+  colorBoxMap.insert( firstBoxPixelSum, firstBox );
+  QMap<int, ColorBox>::iterator colorBoxMapIt = colorBoxMap.end();
+
+  //split boxes until number of boxes == nColors or all the boxes have color count 1
+  bool allColorsMapped = false;
+  while ( colorBoxMap.size() < nColors )
+  {
+    //start at the end of colorBoxMap and pick the first entry with number of colors < 1
+    colorBoxMapIt = colorBoxMap.end();
+    while ( true )
+    {
+      --colorBoxMapIt;
+      if ( colorBoxMapIt.value().size() > 1 )
+      {
+        splitColorBox( colorBoxMapIt.value(), colorBoxMap, colorBoxMapIt );
+        break;
+      }
+      if ( colorBoxMapIt == colorBoxMap.begin() )
+      {
+        allColorsMapped = true;
+        break;
+      }
+    }
+
+    if ( allColorsMapped )
+    {
+      break;
+    }
+    else
+    {
+      continue;
+    }
+  }
+
+  //get representative colors for the boxes
+  int index = 0;
+  colorTable.resize( colorBoxMap.size() );
+  ColorBoxMap::const_iterator colorBoxIt = colorBoxMap.constBegin();
+  for ( ; colorBoxIt != colorBoxMap.constEnd(); ++colorBoxIt )
+  {
+    colorTable[index] = boxColor( colorBoxIt.value(), colorBoxIt.key() );
+    ++index;
+  }
+}
+
+static void imageColors( QHash<QRgb, int>& colors, const QImage& image )
+{
+  colors.clear();
+  int width = image.width();
+  int height = image.height();
+
+  const QRgb* currentScanLine = 0;
+  QHash<QRgb, int>::iterator colorIt;
+  for ( int i = 0; i < height; ++i )
+  {
+    currentScanLine = ( const QRgb* )( image.scanLine( i ) );
+    for ( int j = 0; j < width; ++j )
+    {
+      colorIt = colors.find( currentScanLine[j] );
+      if ( colorIt == colors.end() )
+      {
+        colors.insert( currentScanLine[j], 1 );
+      }
+      else
+      {
+        colorIt.value()++;
+      }
+    }
+  }
+}
+
+static void splitColorBox( ColorBox& colorBox, ColorBoxMap& colorBoxMap,
+    QMap<int, ColorBox>::iterator colorBoxMapIt )
+{
+
+  if ( colorBox.size() < 2 )
+  {
+    return; //need at least two colors for a split
+  }
+
+  //a,r,g,b ranges
+  int redRange = 0;
+  int greenRange = 0;
+  int blueRange = 0;
+  int alphaRange = 0;
+
+  if ( !minMaxRange( colorBox, redRange, greenRange, blueRange, alphaRange ) )
+  {
+    return;
+  }
+
+  //sort color box for a/r/g/b
+  if ( redRange >= greenRange && redRange >= blueRange && redRange >= alphaRange )
+  {
+    qSort( colorBox.begin(), colorBox.end(), redCompare );
+  }
+  else if ( greenRange >= redRange && greenRange >= blueRange && greenRange >= alphaRange )
+  {
+    qSort( colorBox.begin(), colorBox.end(), greenCompare );
+  }
+  else if ( blueRange >= redRange && blueRange >= greenRange && blueRange >= alphaRange )
+  {
+    qSort( colorBox.begin(), colorBox.end(), blueCompare );
+  }
+  else
+  {
+    qSort( colorBox.begin(), colorBox.end(), alphaCompare );
+  }
+
+  //get median
+  double halfSum = colorBoxMapIt.key() / 2.0;
+  int currentSum = 0;
+  int currentListIndex = 0;
+
+  ColorBox::iterator colorBoxIt = colorBox.begin();
+  for ( ; colorBoxIt != colorBox.end(); ++colorBoxIt )
+  {
+    currentSum += colorBoxIt->second;
+    if ( currentSum >= halfSum )
+    {
+      break;
+    }
+    ++currentListIndex;
+  }
+
+  if ( currentListIndex > ( colorBox.size() - 2 ) ) //if the median is contained in the last color, split one item before that
+  {
+    --currentListIndex;
+    currentSum -= colorBoxIt->second;
+  }
+  else
+  {
+    ++colorBoxIt; //the iterator needs to point behind the last item to remove
+  }
+
+  //do split: replace old color box, insert new one
+  ColorBox newColorBox1 = colorBox.mid( 0, currentListIndex + 1 );
+  colorBoxMap.insert( currentSum, newColorBox1 );
+
+  colorBox.erase( colorBox.begin(), colorBoxIt );
+  ColorBox newColorBox2 = colorBox;
+  colorBoxMap.erase( colorBoxMapIt );
+  colorBoxMap.insert( halfSum * 2.0 - currentSum, newColorBox2 );
+}
+
+static bool minMaxRange( const ColorBox& colorBox, int& redRange, int& greenRange, int& blueRange, int& alphaRange )
+{
+  if ( colorBox.size() < 1 )
+  {
+    return false;
+  }
+
+  int rMin = INT_MAX;
+  int gMin = INT_MAX;
+  int bMin = INT_MAX;
+  int aMin = INT_MAX;
+  int rMax = INT_MIN;
+  int gMax = INT_MIN;
+  int bMax = INT_MIN;
+  int aMax = INT_MIN;
+
+  int currentRed = 0; int currentGreen = 0; int currentBlue = 0; int currentAlpha = 0;
+
+  ColorBox::const_iterator colorBoxIt = colorBox.constBegin();
+  for ( ; colorBoxIt != colorBox.constEnd(); ++colorBoxIt )
+  {
+    currentRed = qRed( colorBoxIt->first );
+    if ( currentRed > rMax )
+    {
+      rMax = currentRed;
+    }
+    if ( currentRed < rMin )
+    {
+      rMin = currentRed;
+    }
+
+    currentGreen = qGreen( colorBoxIt->first );
+    if ( currentGreen > gMax )
+    {
+      gMax = currentGreen;
+    }
+    if ( currentGreen < gMin )
+    {
+      gMin = currentGreen;
+    }
+
+    currentBlue = qBlue( colorBoxIt->first );
+    if ( currentBlue > bMax )
+    {
+      bMax = currentBlue;
+    }
+    if ( currentBlue < bMin )
+    {
+      bMin = currentBlue;
+    }
+
+    currentAlpha = qAlpha( colorBoxIt->first );
+    if ( currentAlpha > aMax )
+    {
+      aMax = currentAlpha;
+    }
+    if ( currentAlpha < aMin )
+    {
+      aMin = currentAlpha;
+    }
+  }
+
+  redRange = rMax - rMin;
+  greenRange = gMax - gMin;
+  blueRange = bMax - bMin;
+  alphaRange = aMax - aMin;
+  return true;
+}
+
+static bool redCompare( const QPair<QRgb, int>& c1, const QPair<QRgb, int>& c2 )
+{
+  return qRed( c1.first ) < qRed( c2.first );
+}
+
+static bool greenCompare( const QPair<QRgb, int>& c1, const QPair<QRgb, int>& c2 )
+{
+  return qGreen( c1.first ) < qGreen( c2.first );
+}
+
+static bool blueCompare( const QPair<QRgb, int>& c1, const QPair<QRgb, int>& c2 )
+{
+  return qBlue( c1.first ) < qBlue( c2.first );
+}
+
+static bool alphaCompare( const QPair<QRgb, int>& c1, const QPair<QRgb, int>& c2 )
+{
+  return qAlpha( c1.first ) < qAlpha( c2.first );
+}
+
+static QRgb boxColor( const ColorBox& box, int boxPixels )
+{
+  double avRed = 0;
+  double avGreen = 0;
+  double avBlue = 0;
+  double avAlpha = 0;
+  QRgb currentColor;
+  int currentPixel;
+
+  double weight;
+
+  ColorBox::const_iterator colorBoxIt = box.constBegin();
+  for ( ; colorBoxIt != box.constEnd(); ++colorBoxIt )
+  {
+    currentColor = colorBoxIt->first;
+    currentPixel = colorBoxIt->second;
+    weight = ( double )currentPixel / boxPixels;
+    avRed += ( qRed( currentColor ) * weight );
+    avGreen += ( qGreen( currentColor ) * weight );
+    avBlue += ( qBlue( currentColor ) * weight );
+    avAlpha += ( qAlpha( currentColor ) * weight );
+  }
+
+  return qRgba( avRed, avGreen, avBlue, avAlpha );
+}
+
+static QImage medianCutImage( const QImage& image )
+{
+  QVector<QRgb> colorTable;
+  medianCut( colorTable, 256, image );
+  return image.convertToFormat( QImage::Format_Indexed8, colorTable, Qt::ColorOnly | Qt::ThresholdDither |
+                                Qt::ThresholdAlphaDither | Qt::NoOpaqueDetection );
+}
+
+/** \ingroup UnitTests
+ * Checks the 8-bit palette images of the server and compares quality and speed to the former median cut
+ */
+class TestQgsPaletteQuantizer : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void initTestCase();
+
+    void exactColors();
+    void paletteSize();
+    void quality_data();
+    void quality();
+    void benchmarkQuantize_data();
+    void benchmarkQuantize();
+    void benchmarkMedianCut_data();
+    void benchmarkMedianCut();
+
+  private:
+    QMap<QString, QImage> mImages;
+
+    static double rmsError( const QImage& image, const QImage& palettedImage );
+    void addImageRows();
+};
+
+void TestQgsPaletteQuantizer::initTestCase()
+{
+  QString dataDir = QString( TEST_DATA_DIR ) + "/control_images/";
+  QImage map( dataDir + "expected_composermap_render/expected_composermap_render.png" );
+  QVERIFY( !map.isNull() );
+  mImages.insert( "map", map.convertToFormat( QImage::Format_ARGB32 ) );
+
+  QImage transparent( dataDir + "expected_inverted_polys_projection/default/expected_inverted_polys_projection.png" );
+  QVERIFY( !transparent.isNull() );
+  mImages.insert( "transparent", transparent.convertToFormat( QImage::Format_ARGB32 ) );
+
+  QImage gradient( dataDir + "expected_gradient/expected_gradient.png" );
+  QVERIFY( !gradient.isNull() );
+  mImages.insert( "gradient", gradient.convertToFormat( QImage::Format_ARGB32 ) );
+}
+
+double TestQgsPaletteQuantizer::rmsError( const QImage& image, const QImage& palettedImage )
+{
+  QImage result = palettedImage.convertToFormat( QImage::Format_ARGB32 );
+  double sum = 0;
+  for ( int i = 0; i < image.height(); ++i )
+  {
+    const QRgb* line = ( const QRgb* )image.constScanLine( i );
+    const QRgb* resultLine = ( const QRgb* )result.constScanLine( i );
+    for ( int j = 0; j < image.width(); ++j )
+    {
+      int dr = qRed( line[j] ) - qRed( resultLine[j] );
+      int dg = qGreen( line[j] ) - qGreen( resultLine[j] );
+      int db = qBlue( line[j] ) - qBlue( resultLine[j] );
+      int da = qAlpha( line[j] ) - qAlpha( resultLine[j] );
+      sum += dr * dr + dg * dg + db * db + da * da;
+    }
+  }
+  return sqrt( sum / ( 4.0 * image.width() * image.height() ) );
+}
+
+void TestQgsPaletteQuantizer::addImageRows()
+{
+  QTest::addColumn<QString>( "name" );
+  QMap<QString, QImage>::const_iterator imageIt = mImages.constBegin();
+  for ( ; imageIt != mImages.constEnd(); ++imageIt )
+  {
+    QTest::newRow( imageIt.key().toLocal8Bit().data() ) << imageIt.key();
+  }
+}
+
+void TestQgsPaletteQuantizer::exactColors()
+{
+  //200 colors, some of them in the same histogram bin, must not be changed
+  QImage image( 100, 40, QImage::Format_ARGB32 );
+  for ( int i = 0; i < image.height(); ++i )
+  {
+    for ( int j = 0; j < image.width(); ++j )
+    {
+      int c = ( i * image.width() + j ) % 200;
+      image.setPixel( j, i, qRgba( c, 255 - c, c % 3, c < 100 ? 255 : 128 ) );
+    }
+  }
+
+  QImage paletted = QgsPaletteQuantizer::quantize( image, 256 );
+  QCOMPARE( paletted.format(), QImage::Format_Indexed8 );
+  QCOMPARE( paletted.colorCount(), 200 );
+  QCOMPARE( paletted.convertToFormat( QImage::Format_ARGB32 ), image );
+}
+
+void TestQgsPaletteQuantizer::paletteSize()
+{
+  QImage paletted = QgsPaletteQuantizer::quantize( mImages["map"], 16 );
+  QCOMPARE( paletted.format(), QImage::Format_Indexed8 );
+  QCOMPARE( paletted.size(), mImages["map"].size() );
+  QVERIFY( paletted.colorCount() <= 16 );
+  QVERIFY( paletted.colorCount() > 1 );
+}
+
+void TestQgsPaletteQuantizer::quality_data()
+{
+  addImageRows();
+}
+
+void TestQgsPaletteQuantizer::quality()
+{
+  QFETCH( QString, name );
+  const QImage& image = mImages[name];
+
+  double error = rmsError( image, QgsPaletteQuantizer::quantize( image, 256 ) );
+  double medianCutError = rmsError( image, medianCutImage( image ) );
+  qDebug( "%s: rms error %.3f (median cut: %.3f)", name.toLocal8Bit().data(), error, medianCutError );
+  QVERIFY( error <= 1.5 * medianCutError + 1.0 );
+}
+
+void TestQgsPaletteQuantizer::benchmarkQuantize_data()
+{
+  addImageRows();
+}
+
+void TestQgsPaletteQuantizer::benchmarkQuantize()
+{
+  QFETCH( QString, name );
+  const QImage& image = mImages[name];
+  QBENCHMARK
+  {
+    QgsPaletteQuantizer::quantize( image, 256 );
+  }
+}
+
+void TestQgsPaletteQuantizer::benchmarkMedianCut_data()
+{
+  addImageRows();
+}
+
+void TestQgsPaletteQuantizer::benchmarkMedianCut()
+{
+  QFETCH( QString, name );
+  const QImage& image = mImages[name];
+  QBENCHMARK
+  {
+    medianCutImage( image );
+  }
+}
+
+QTEST_MAIN( TestQgsPaletteQuantizer )
+#include "testqgspalettequantizer.moc"
@@ -0,0 +1,239 @@
+/***************************************************************************
+     testqgswmstilegrid.cpp
+     --------------------------------------
+    Date                 : March 2016
+    Copyright            : (C) 2016 by Sourcepole AG
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QRegion>
+#include <QtTest/QtTest>
+
+#include "qgswmstilegrid.h"
+
+//half the extent of the EPSG:3857 tile grid
+static const double MERCATOR_ORIGIN = 20037508.342789244;
+
+static bool _near( double a, double b, double tolerance )
+{
+  return qAbs( a - b ) <= tolerance;
+}
+
+/** \ingroup UnitTests
+ * This is a unit test for the positions of tiled GetMap requests in the tile grid and their metatiles,
+ * on the EPSG:3857 grid, on EPSG:4326 with the axis order of WMS 1.3.0 and on grids with offset origins
+ */
+class TestQgsWMSTileGrid : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void initTestCase() {}
+    void cleanupTestCase() {}
+    void init() {}
+    void cleanup() {}
+
+    void testMetaTileStart();
+    void testWebMercator();
+    void testGeographicAxisInverted();
+    void testOffsetGrid();
+    void testMetaTilePart();
+    void testInvalidExtent();
+};
+
+void TestQgsWMSTileGrid::testMetaTileStart()
+{
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( 0, 4 ), 0 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( 3, 4 ), 0 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( 4, 4 ), 4 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( 9, 4 ), 8 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( -1, 4 ), -4 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( -4, 4 ), -4 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( -5, 4 ), -8 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( -2, 3 ), -3 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( -3, 3 ), -3 );
+  QCOMPARE( QgsWMSTileGrid::metaTileStart( -4, 3 ), -6 );
+
+  //every index lies in its metatile
+  for ( int i = -50; i <= 50; ++i )
+  {
+    int start = QgsWMSTileGrid::metaTileStart( i, 4 );
+    QVERIFY( start <= i && i < start + 4 );
+    QCOMPARE( start % 4, 0 );
+  }
+}
+
+void TestQgsWMSTileGrid::testWebMercator()
+{
+  //all the tiles of zoom level 3, in the order of the XYZ scheme (row 0 at the top)
+  const int zoom = 3;
+  const int nTiles = 1 << zoom;
+  double tileSize = 2 * MERCATOR_ORIGIN / nTiles;
+  for ( int tileX = 0; tileX < nTiles; ++tileX )
+  {
+    for ( int tileY = 0; tileY < nTiles; ++tileY )
+    {
+      double xMin = -MERCATOR_ORIGIN + tileX * tileSize;
+      double yMax = MERCATOR_ORIGIN - tileY * tileSize;
+
+      //the client BBOX with and without rounding errors
+      for ( int k = -1; k <= 1; ++k )
+      {
+        double error = k * 1E-9 * tileSize;
+        QgsWMSTileGrid grid( 4 );
+        QVERIFY( grid.setTileExtent( xMin + error, yMax - tileSize + error, xMin + tileSize + error, yMax + error, false ) );
+        QVERIFY( _near( grid.tileWidth(), tileSize, 1E-6 ) );
+        QVERIFY( _near( grid.tileHeight(), tileSize, 1E-6 ) );
+        QCOMPARE( grid.column(), tileX - nTiles / 2 );
+        QCOMPARE( grid.row(), nTiles / 2 - 1 - tileY );
+        QCOMPARE( grid.offsetX(), 0 );
+        QCOMPARE( grid.offsetY(), 0 );
+
+        //metatiles of 4 x 4 tiles cover the quarters of the world
+        QCOMPARE( grid.metaColumn(), tileX < 4 ? -4 : 0 );
+        QCOMPARE( grid.metaRow(), tileY < 4 ? 0 : -4 );
+        double metaXMin, metaYMin, metaXMax, metaYMax;
+        grid.metaTileExtent( metaXMin, metaYMin, metaXMax, metaYMax );
+        QVERIFY( _near( metaXMin, tileX < 4 ? -MERCATOR_ORIGIN : 0, 1E-3 ) );
+        QVERIFY( _near( metaXMax, tileX < 4 ? 0 : MERCATOR_ORIGIN, 1E-3 ) );
+        QVERIFY( _near( metaYMin, tileY < 4 ? 0 : -MERCATOR_ORIGIN, 1E-3 ) );
+        QVERIFY( _near( metaYMax, tileY < 4 ? MERCATOR_ORIGIN : 0, 1E-3 ) );
+
+        //the tile is cut from the metatile image at its XYZ position within the metatile
+        QRect part = grid.metaTilePart( grid.column() - grid.metaColumn(), grid.row() - grid.metaRow(), 256, 256 );
+        QCOMPARE( part, QRect(( tileX % 4 ) * 256, ( tileY % 4 ) * 256, 256, 256 ) );
+      }
+    }
+  }
+}
+
+void TestQgsWMSTileGrid::testGeographicAxisInverted()
+{
+  //EPSG:4326 tiles of 45 x 22.5 degrees. The WMS 1.3.0 BBOX is minLat,minLon,maxLat,maxLon
+  for ( int column = -4; column < 4; ++column )
+  {
+    for ( int row = -4; row < 4; ++row )
+    {
+      double lonMin = column * 45.0;
+      double latMin = row * 22.5;
+
+      QgsWMSTileGrid grid( 4 );
+      QVERIFY( grid.setTileExtent( latMin, lonMin, latMin + 22.5, lonMin + 45.0, true ) );
+      QCOMPARE( grid.tileWidth(), 45.0 );
+      QCOMPARE( grid.tileHeight(), 22.5 );
+      QCOMPARE( grid.column(), column );
+      QCOMPARE( grid.row(), row );
+      QCOMPARE( grid.offsetX(), 0 );
+      QCOMPARE( grid.offsetY(), 0 );
+      QCOMPARE( grid.metaColumn(), column < 0 ? -4 : 0 );
+      QCOMPARE( grid.metaRow(), row < 0 ? -4 : 0 );
+
+      //the metatile extent is returned in the axis order of the request
+      double metaXMin, metaYMin, metaXMax, metaYMax;
+      grid.metaTileExtent( metaXMin, metaYMin, metaXMax, metaYMax );
+      QCOMPARE( metaXMin, row < 0 ? -90.0 : 0.0 );
+      QCOMPARE( metaXMax, row < 0 ? 0.0 : 90.0 );
+      QCOMPARE( metaYMin, column < 0 ? -180.0 : 0.0 );
+      QCOMPARE( metaYMax, column < 0 ? 0.0 : 180.0 );
+
+      //the same tile in the x/y order of WMS 1.1.1
+      QgsWMSTileGrid grid111( 4 );
+      QVERIFY( grid111.setTileExtent( lonMin, latMin, lonMin + 45.0, latMin + 22.5, false ) );
+      QCOMPARE( grid111.column(), column );
+      QCOMPARE( grid111.row(), row );
+      grid111.metaTileExtent( metaXMin, metaYMin, metaXMax, metaYMax );
+      QCOMPARE( metaXMin, column < 0 ? -180.0 : 0.0 );
+      QCOMPARE( metaYMin, row < 0 ? -90.0 : 0.0 );
+    }
+  }
+
+  //the image rows follow the latitude, not the first BBOX axis
+  QgsWMSTileGrid grid( 4 );
+  QVERIFY( grid.setTileExtent( 67.5, -180, 90, -135, true ) );
+  QCOMPARE( grid.row(), 3 );
+  QCOMPARE( grid.metaTilePart( grid.column() - grid.metaColumn(), grid.row() - grid.metaRow(), 512, 256 ), QRect( 0, 0, 512, 256 ) );
+}
+
+void TestQgsWMSTileGrid::testOffsetGrid()
+{
+  //tiles of 1000 x 1000 with the grid origin at (250, 600)
+  for ( int k = -3; k <= 3; ++k )
+  {
+    double xMin = 250 + k * 1000;
+    double yMin = 600 + k * 1000;
+    QgsWMSTileGrid grid( 2 );
+    QVERIFY( grid.setTileExtent( xMin, yMin, xMin + 1000, yMin + 1000, false ) );
+    QCOMPARE( grid.column(), k );
+    QCOMPARE( grid.row(), k );
+    QCOMPARE( grid.offsetX(), 250000 );
+    QCOMPARE( grid.offsetY(), 600000 );
+
+    double metaXMin, metaYMin, metaXMax, metaYMax;
+    grid.metaTileExtent( metaXMin, metaYMin, metaXMax, metaYMax );
+    int metaStart = QgsWMSTileGrid::metaTileStart( k, 2 );
+    QCOMPARE( metaXMin, 250.0 + metaStart * 1000 );
+    QCOMPARE( metaYMin, 600.0 + metaStart * 1000 );
+    QCOMPARE( metaXMax, metaXMin + 2000 );
+    QCOMPARE( metaYMax, metaYMin + 2000 );
+  }
+
+  //an origin at a millionth below a tile border is the grid without offset
+  QgsWMSTileGrid grid( 2 );
+  QVERIFY( grid.setTileExtent( -1000.0000001, 1999.9999999, -0.0000001, 2999.9999999, false ) );
+  QCOMPARE( grid.column(), -1 );
+  QCOMPARE( grid.row(), 2 );
+  QCOMPARE( grid.offsetX(), 0 );
+  QCOMPARE( grid.offsetY(), 0 );
+
+  //the offset is measured in millionths of the tile size
+  QVERIFY( grid.setTileExtent( 0.5, -0.25, 10.5, 9.75, false ) );
+  QCOMPARE( grid.column(), 0 );
+  QCOMPARE( grid.row(), -1 );
+  QCOMPARE( grid.offsetX(), 50000 );
+  QCOMPARE( grid.offsetY(), 975000 );
+}
+
+void TestQgsWMSTileGrid::testMetaTilePart()
+{
+  //the parts of a metatile of 3 x 3 tiles cover its image once, with the bottom row of tiles at the bottom
+  QgsWMSTileGrid grid( 3 );
+  QCOMPARE( grid.metaTilePart( 0, 0, 256, 200 ), QRect( 0, 400, 256, 200 ) );
+  QCOMPARE( grid.metaTilePart( 1, 0, 256, 200 ), QRect( 256, 400, 256, 200 ) );
+  QCOMPARE( grid.metaTilePart( 0, 2, 256, 200 ), QRect( 0, 0, 256, 200 ) );
+  QCOMPARE( grid.metaTilePart( 2, 2, 256, 200 ), QRect( 512, 0, 256, 200 ) );
+
+  QRegion covered;
+  int area = 0;
+  for ( int i = 0; i < 3; ++i )
+  {
+    for ( int j = 0; j < 3; ++j )
+    {
+      QRect part = grid.metaTilePart( i, j, 256, 200 );
+      QVERIFY( !covered.intersects( part ) );
+      covered += part;
+      area += part.width() * part.height();
+    }
+  }
+  QCOMPARE( covered.boundingRect(), QRect( 0, 0, 3 * 256, 3 * 200 ) );
+  QCOMPARE( area, 9 * 256 * 200 );
+}
+
+void TestQgsWMSTileGrid::testInvalidExtent()
+{
+  QgsWMSTileGrid grid( 4 );
+  QVERIFY( !grid.setTileExtent( 10, 10, 10, 20, false ) );
+  QVERIFY( !grid.setTileExtent( 10, 20, 20, 10, false ) );
+  //too far from the origin for the tile size
+  QVERIFY( !grid.setTileExtent( 1E12, 0, 1E12 + 1, 1, false ) );
+  QVERIFY( grid.setTileExtent( 1E6, 0, 1E6 + 1, 1, false ) );
+  QCOMPARE( grid.column(), 1000000 );
+}
+
+QTEST_MAIN( TestQgsWMSTileGrid )
+#include "testqgswmstilegrid.moc"